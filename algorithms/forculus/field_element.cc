@@ -14,6 +14,11 @@
 
 #include "algorithms/forculus/field_element.h"
 
+#if defined(__x86_64__)
+#include <wmmintrin.h>
+#endif
+
+#include <algorithm>
 #include <cstring>
 #include <iomanip>
 #include <memory>
@@ -25,192 +30,185 @@
 namespace cobalt {
 namespace forculus {
 
-/****************************** WARNING *************************************
-*
-* This is a temporary, insecure implementation of FieldElement. It uses a
-* prime field of size less than 2^32. This is far to small to be
-* cryptographically secure. Do not release Cobalt with this implementation.
-* We are using this implementation temporarily as we develop the
-* ForculusEncrypter and ForculusDecrypter. Our intention is to replace
-* this with the field GF(2^128).
-*
-* In this temporary implementation we assume that the hardware architecture
-* is little-endian.
-*
-*****************************************************************************/
-
-// This is the largest prime number less than 2^32. It is 2^32 - 267.
-// It is defined as 64 bits so we do 64-bit arithmetic with it by default.
-static const uint64_t kLargestPrime = 4294967029;
-
 namespace {
-  // Returns the uint32_t described by the first 32 bits of |bytes|
-  // in hardware byte order.
-  uint32_t AsInt32(const std::vector<byte>& bytes) {
-    uint32_t x;
-    std::memcpy(&x, bytes.data(), sizeof(uint32_t));
-    return x;
-  }
 
-  // Populates result with all zeroes except for the first 32 bits which
-  // are taken from the uint64_t |x|, in hardware byte order.
-  void FromUInt64(const uint64_t& x, std::vector<byte>* result) {
-    result->resize(FieldElement::kDataSize, 0);
-    std::memcpy(result->data(), &x, sizeof(uint32_t));
-  }
-
-  // Returns the inverse of b mod kLargestPrime.
-  //
-  // In more detail, returns the integer t such that 1 <= t <= kLargestPrime
-  // and such that b * t mod kLargestPrime = 1.
-  uint32_t Inverse(uint32_t b) {
-    // Becuase GCD(b, kLargestPrime) = 1 there exists integers
-    // s and t such that kLargestPrime * s + b * t  = 1.
-    // The least positive such t is the inverse we are looking for.
-    //
-    // To find t we perform the extended Euclidean algorithm. See
-    // https://en.wikipedia.org/wiki/Euclidean_algorithm
-    //
-    // r_{k-2} = q_k * r_{k-1} + r_k
-    //
-    // with r_{-2} = kLargestPrime, k_{-1} = b
-    //
-    // t_k = t_{k-2} - q_k * t_{k-1}
-    //
-    // with t_{-2} = 0, t_{-1} = 1
-    //
-    // Stop when r_k = 0 and return t_{k-1}.
-
-    // Initialize r_{k-2} = r_{-2} = kLargestPrime.
-    uint64_t r_k2 = kLargestPrime;
-
-    // Initialize r_{k-1} = r_{-1} = b
-    uint64_t r_k1 = b;
-
-    // Initialze t_{k-2} = t_{-2} = 0
-    uint64_t t_k2 = 0;
-
-    // Initialze t_{k-1} = t_{-1} = 1
-    uint64_t t_k1 = 1;
-
-    while (r_k1 != 0) {
-      uint64_t q_k = r_k2 / r_k1;
-      uint64_t r_k = r_k2 % r_k1;
-      uint64_t t_k = ((t_k2 + kLargestPrime) - (q_k * t_k1) % kLargestPrime)
-          % kLargestPrime;
-
-      r_k2 = r_k1;
-      r_k1 = r_k;
-      t_k2 = t_k1;
-      t_k1 = t_k;
-    }
-    // ASSERT: rk_1=0, r_k2=1=GCD(b, kLargestPrime)
-    // kLargestPrime*s + b*t_k2 = 1, for some s we are not keeping track of.
-
-    return t_k2;
-  }
-}  // namespace
+// The low-order terms of the reduction polynomial: x^128 is congruent to
+// x^7 + x^2 + x + 1.
+const uint64_t kReductionTerms = 0x87;
+
+// Returns the low 64 bits of the carry-less product of the 128-bit
+// polynomial (high, low) = (|a|, |carry_in|) with kReductionTerms, i.e. the
+// bits of a * kReductionTerms plus those that carry into |a|'s word from
+// |carry_in| * kReductionTerms.
+inline uint64_t TimesReductionTerms(uint64_t a, uint64_t carry_in) {
+  return a ^ (a << 1) ^ (a << 2) ^ (a << 7) ^ (carry_in >> 63) ^
+         (carry_in >> 62) ^ (carry_in >> 57);
+}
 
-const size_t FieldElement::kDataSize;
+// Returns the bits of the carry-less product of |a| with kReductionTerms
+// that have degree 64 and above.
+inline uint64_t ReductionOverflow(uint64_t a) {
+  return (a >> 63) ^ (a >> 62) ^ (a >> 57);
+}
 
-FieldElement::FieldElement(std::vector<byte>&& bytes) :
-    bytes_(std::move(bytes)) {
-  // NOTE: In our temporary, insecure implementation we discard all but the
-  // first 32 bits of the input.
-  bytes_.resize(sizeof(uint32_t));
-  bytes_.resize(kDataSize, 0);
+// Reduces the polynomial |product| of degree at most 254, with the
+// coefficient of x^k in bit k % 64 of product[k / 64], modulo
+// x^128 + x^7 + x^2 + x + 1 and writes the result to |result|.
+inline void Reduce(const uint64_t product[4], uint64_t result[2]) {
+  // The high half H = product[2..3] contributes H * x^128, which is
+  // congruent to H * (x^7 + x^2 + x + 1). That has degree at most 133. The
+  // terms of degree 128 and above are reduced in the same way again, after
+  // which the degree is at most 12.
+  uint64_t overflow = ReductionOverflow(product[3]);
+  result[0] = product[0] ^ TimesReductionTerms(product[2], 0) ^
+              TimesReductionTerms(overflow, 0);
+  result[1] = product[1] ^ TimesReductionTerms(product[3], product[2]);
 }
 
-FieldElement::FieldElement(const std::string& data) : bytes_(kDataSize, 0) {
-  // NOTE: In our temporary, insecure implementation we discard all but the
-  // first 32 bits of the input.
-  for (size_t i = 0; i < sizeof(uint32_t) && i < data.size(); i++) {
-      bytes_[i] = static_cast<byte>(data[i]);
+// Sets (*high, *low) to the carry-less product of |a| and |b|.
+inline void ClMul64(uint64_t a, uint64_t b, uint64_t* low, uint64_t* high) {
+  uint64_t l = a & -(b & 1);
+  uint64_t h = 0;
+  for (int i = 1; i < 64; i++) {
+    uint64_t mask = -((b >> i) & 1);
+    l ^= (a << i) & mask;
+    h ^= (a >> (64 - i)) & mask;
   }
+  *low = l;
+  *high = h;
 }
 
-FieldElement::FieldElement(bool one) : bytes_(kDataSize, 0) {
-  if (one) {
-    // NOTE: In our temporary, insecure implementation we use the first
-    // 32 bits of |bytes_| to represent a non-negative integer in
-    // hardware architecture byte order which we are here assuming is
-    // little-endian.
-    bytes_[0] = 1;
+// Sets |product| to the carry-less product of the 128-bit polynomials |a|
+// and |b|, using three 64-bit products (Karatsuba).
+void ClMul128Portable(const uint64_t a[2], const uint64_t b[2],
+                      uint64_t product[4]) {
+  uint64_t mid[2];
+  ClMul64(a[0], b[0], &product[0], &product[1]);
+  ClMul64(a[1], b[1], &product[2], &product[3]);
+  ClMul64(a[0] ^ a[1], b[0] ^ b[1], &mid[0], &mid[1]);
+  mid[0] ^= product[0] ^ product[2];
+  mid[1] ^= product[1] ^ product[3];
+  product[1] ^= mid[0];
+  product[2] ^= mid[1];
+}
+
+#if defined(__x86_64__)
+// Equivalent to ClMul128Portable() using the PCLMULQDQ instruction.
+__attribute__((target("pclmul"))) void ClMul128Pclmul(const uint64_t a[2],
+                                                      const uint64_t b[2],
+                                                      uint64_t product[4]) {
+  __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+  __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+  __m128i low = _mm_clmulepi64_si128(x, y, 0x00);
+  __m128i high = _mm_clmulepi64_si128(x, y, 0x11);
+  __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(x, y, 0x01),
+                              _mm_clmulepi64_si128(x, y, 0x10));
+  uint64_t mid_words[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(product), low);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(product + 2), high);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(mid_words), mid);
+  product[1] ^= mid_words[0];
+  product[2] ^= mid_words[1];
+}
+
+bool HavePclmul() {
+  static const bool have_pclmul = __builtin_cpu_supports("pclmul");
+  return have_pclmul;
+}
+#endif
+
+// Sets |result| to the product of the field elements |a| and |b|. |result|
+// may alias |a| or |b|.
+void Multiply(const uint64_t a[2], const uint64_t b[2], uint64_t result[2]) {
+  uint64_t product[4];
+#if defined(__x86_64__)
+  if (HavePclmul()) {
+    ClMul128Pclmul(a, b, product);
+    Reduce(product, result);
+    return;
   }
+#endif
+  ClMul128Portable(a, b, product);
+  Reduce(product, result);
 }
 
-FieldElement FieldElement::operator+(const FieldElement& other) const {
-  // NOTE: In our temporary, insecure implementation we use the first
-  // 32 bits of |bytes_| to represent a non-negative integer in
-  // hardware architecture byte order.
-  uint64_t this_number = AsInt32(bytes_);
-  uint64_t other_number = AsInt32(other.bytes_);
-  uint64_t sum = (this_number + other_number) % kLargestPrime;
-  std::vector<byte> result;
-  FromUInt64(sum, &result);
-  return FieldElement(std::move(result));
+// Returns the 64-bit word whose bit 2k is bit k of |x| and whose odd bits
+// are zero. This is the carry-less square of |x|.
+inline uint64_t SpreadBits(uint32_t x) {
+  uint64_t y = x;
+  y = (y | (y << 16)) & 0x0000FFFF0000FFFFull;
+  y = (y | (y << 8)) & 0x00FF00FF00FF00FFull;
+  y = (y | (y << 4)) & 0x0F0F0F0F0F0F0F0Full;
+  y = (y | (y << 2)) & 0x3333333333333333ull;
+  y = (y | (y << 1)) & 0x5555555555555555ull;
+  return y;
 }
 
-void FieldElement::operator+=(const FieldElement& other) {
-  uint64_t sum =
-      (static_cast<uint64_t>(AsInt32(bytes_)) +
-      static_cast<uint64_t>(AsInt32(other.bytes_))) % kLargestPrime;
-  FromUInt64(sum, &bytes_);
+// Replaces the field element |a| with its square |num_squarings| times.
+// Squaring is linear over GF(2) so it needs no multiplication.
+void SquareTimes(uint64_t a[2], int num_squarings) {
+  uint64_t product[4];
+  for (int i = 0; i < num_squarings; i++) {
+    product[0] = SpreadBits(static_cast<uint32_t>(a[0]));
+    product[1] = SpreadBits(static_cast<uint32_t>(a[0] >> 32));
+    product[2] = SpreadBits(static_cast<uint32_t>(a[1]));
+    product[3] = SpreadBits(static_cast<uint32_t>(a[1] >> 32));
+    Reduce(product, a);
+  }
 }
 
-FieldElement FieldElement::operator-(const FieldElement& other) const {
-  uint64_t this_number = AsInt32(bytes_) + kLargestPrime;
-  uint64_t other_number = AsInt32(other.bytes_);
-  uint64_t difference = (this_number - other_number) % kLargestPrime;
-  std::vector<byte> result;
-  FromUInt64(difference, &result);
-  return FieldElement(std::move(result));
+}  // namespace
+
+const size_t FieldElement::kDataSize;
+
+FieldElement::FieldElement(std::vector<byte>&& bytes) : words_{0, 0} {
+  std::memcpy(words_, bytes.data(), std::min(bytes.size(), kDataSize));
 }
 
-void FieldElement::operator-=(const FieldElement& other) {
-  uint64_t this_number = AsInt32(bytes_) + kLargestPrime;
-  uint64_t other_number = AsInt32(other.bytes_);
-  uint64_t difference = (this_number - other_number) % kLargestPrime;
-  std::vector<byte> result;
-  FromUInt64(difference, &bytes_);
+FieldElement::FieldElement(const std::string& data) : words_{0, 0} {
+  std::memcpy(words_, data.data(), std::min(data.size(), kDataSize));
 }
 
 FieldElement FieldElement::operator*(const FieldElement& other) const {
-  uint64_t this_number = AsInt32(bytes_);
-  uint64_t other_number = AsInt32(other.bytes_);
-  uint64_t product = (this_number * other_number) % kLargestPrime;
-  std::vector<byte> result;
-  FromUInt64(product, &result);
-  return FieldElement(std::move(result));
+  FieldElement result(false);
+  Multiply(words_, other.words_, result.words_);
+  return result;
 }
 
 void FieldElement::operator*=(const FieldElement& other) {
-  uint64_t this_number = AsInt32(bytes_);
-  uint64_t other_number = AsInt32(other.bytes_);
-  uint64_t product = (this_number * other_number) % kLargestPrime;
-  std::vector<byte> result;
-  FromUInt64(product, &bytes_);
+  Multiply(words_, other.words_, words_);
 }
 
 FieldElement FieldElement::operator/(const FieldElement& other) const {
-  uint64_t this_number = AsInt32(bytes_);
-  uint64_t other_inverse = Inverse(AsInt32(other.bytes_));
-  uint64_t quotient = (this_number * other_inverse) % kLargestPrime;
-  std::vector<byte> result;
-  FromUInt64(quotient, &result);
-  return FieldElement(std::move(result));
+  return *this * other.Inverse();
 }
 
 void FieldElement::operator/=(const FieldElement& other) {
-  uint64_t this_number = AsInt32(bytes_);
-  uint64_t other_inverse = Inverse(AsInt32(other.bytes_));
-  uint64_t quotient = (this_number * other_inverse) % kLargestPrime;
-  std::vector<byte> result;
-  FromUInt64(quotient, &bytes_);
+  *this *= other.Inverse();
 }
 
-const byte* FieldElement::KeyBytes() const {
-  return bytes_.data();
+FieldElement FieldElement::Inverse() const {
+  // Itoh-Tsujii: the inverse of a is a^(2^128 - 2) = (a^(2^127 - 1))^2. Let
+  // b_k = a^(2^k - 1). Then b_2k = b_k^(2^k) * b_k and
+  // b_(k+1) = b_k^2 * a. We compute b_127 with the addition chain
+  // 1, 2, 3, 6, 7, 14, 15, 30, 31, 62, 63, 126, 127, which takes 127
+  // squarings and 12 multiplications.
+  uint64_t b[2] = {words_[0], words_[1]};
+  uint64_t b_k[2];
+  int k = 1;
+  while (k < 127) {
+    // b = b_2k.
+    b_k[0] = b[0];
+    b_k[1] = b[1];
+    SquareTimes(b, k);
+    Multiply(b, b_k, b);
+    // b = b_(2k+1).
+    SquareTimes(b, 1);
+    Multiply(b, words_, b);
+    k = 2 * k + 1;
+  }
+  SquareTimes(b, 1);
+  return FieldElement(b[0], b[1]);
 }
 
 std::ostream& operator<<(std::ostream& os, const FieldElement& el) {
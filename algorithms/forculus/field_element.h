@@ -25,6 +25,10 @@
 
 #include "util/crypto_util/types.h"
 
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "FieldElement assumes a little-endian architecture."
+#endif
+
 namespace cobalt {
 namespace forculus {
 
@@ -32,13 +36,24 @@ using crypto::byte;
 
 // A FieldElement is an element of the Forculus Field, the field over which
 // Forculs encryption takes place.
+//
+// The Forculus Field is GF(2^128), represented as the polynomials over GF(2)
+// modulo x^128 + x^7 + x^2 + x + 1. The byte representation of an element
+// has kDataSize bytes, in which bit j of byte i is the coefficient of
+// x^(8i + j). Addition and subtraction are both exclusive-or.
+// Multiplication is carry-less multiplication followed by reduction. It uses
+// the PCLMULQDQ instruction when the CPU supports it and a portable
+// implementation otherwise. Division uses the Itoh-Tsujii inversion
+// algorithm.
+//
+// A FieldElement stores its value inline and performs no heap allocation.
 class FieldElement {
  public:
   // The number of bytes of data used to represent a FieldElement. The size
   // of the Forculus Field is 2^{8 * kDataSize}.
-  static const size_t kDataSize = 256/8;
+  static const size_t kDataSize = 128/8;
 
-  // Constructs a FieldElement by moving kDataSize bytes out of |bytes|.
+  // Constructs a FieldElement from the first kDataSize bytes of |bytes|.
   // If the length of |bytes| is greater than kDataSize than the extra bytes
   // will be discarded from the end. If the length of |bytes| is less than
   // kDataSize then zero bytes will be appendeed to the end.
@@ -51,30 +66,17 @@ class FieldElement {
   explicit FieldElement(const std::string& data);
 
   // Constructs the FieldElement zero or one depending on the value of |one|.
-  explicit FieldElement(bool one);
-
-  // Move constructor.
-  FieldElement(FieldElement&& other) : bytes_(std::move(other.bytes_)) {}
-
-  // Copy constructor.
-  FieldElement(const FieldElement& other) : bytes_(other.bytes_) {}
-
-  // Copy assignment operator
-  void operator=(const FieldElement& other) {
-    bytes_ = other.bytes_;
-  }
+  explicit FieldElement(bool one) : words_{one ? 1u : 0u, 0} {}
 
-  // Move assignment operator
-  void operator=(FieldElement&& other) {
-    bytes_ = std::move(other.bytes_);
-  }
+  FieldElement(const FieldElement& other) = default;
+  FieldElement& operator=(const FieldElement& other) = default;
 
   bool operator==(const FieldElement& other) const {
-    return bytes_ == other.bytes_;
+    return words_[0] == other.words_[0] && words_[1] == other.words_[1];
   }
 
   bool operator!=(const FieldElement& other) const {
-    return bytes_ != other.bytes_;
+    return !(*this == other);
   }
 
   // FieldElements are ordered lexicographically by their byte representation.
@@ -82,36 +84,46 @@ class FieldElement {
   // some ordering is necessary in order to use FieldElements as the keys
   // of a map.
   bool operator<(const FieldElement& other) const {
-    return bytes_ < other.bytes_;
+    return std::memcmp(KeyBytes(), other.KeyBytes(), kDataSize) < 0;
   }
 
   // Convenience function that copies the underlying bytes of this element
   // into *target_string.
-  void CopyBytesToString(std::string* target_string) {
-    target_string->assign(reinterpret_cast<const char*>(
-        bytes_.data()), bytes_.size());
+  void CopyBytesToString(std::string* target_string) const {
+    target_string->assign(reinterpret_cast<const char*>(KeyBytes()),
+                          kDataSize);
   }
 
   // Returns a pointer to a buffer of bytes of length
   // crypto::SymmetricCipher::KEY_SIZE that may be used as the key to a
-  // symmetric cipher. The returned bytes are based on the underlying byte
-  // representation of the FieldElement. Each FieldElement yields a different
-  // key.
-  const byte* KeyBytes() const;
+  // symmetric cipher. The returned bytes are the byte representation of the
+  // FieldElement. Each FieldElement yields a different key.
+  const byte* KeyBytes() const {
+    return reinterpret_cast<const byte*>(words_);
+  }
 
   // Arithmetic operations below
 
   // Returns the sum of this element plus the |other| element.
-  FieldElement operator+(const FieldElement& other) const;
+  FieldElement operator+(const FieldElement& other) const {
+    return FieldElement(words_[0] ^ other.words_[0],
+                        words_[1] ^ other.words_[1]);
+  }
 
   // Sets this element to the sum of this element and the |other| element.
-  void operator+=(const FieldElement& other);
+  void operator+=(const FieldElement& other) {
+    words_[0] ^= other.words_[0];
+    words_[1] ^= other.words_[1];
+  }
 
-  // Returns the difference of this element minus the |other| element.
-  FieldElement operator-(const FieldElement& other) const;
+  // Returns the difference of this element minus the |other| element. In a
+  // field of characteristic two this is the same as the sum.
+  FieldElement operator-(const FieldElement& other) const {
+    return *this + other;
+  }
 
   // Sets this element to the difference of this element minus the |other|.
-  void operator-=(const FieldElement& other);
+  void operator-=(const FieldElement& other) { *this += other; }
 
   // Returns the product of this element times the |other| element.
   FieldElement operator*(const FieldElement& other) const;
@@ -127,8 +139,18 @@ class FieldElement {
   // The behavior is undefined if |other| is the zero element.
   void operator/=(const FieldElement& other);
 
+  // Returns the multiplicative inverse of this element. The behavior is
+  // undefined if this is the zero element.
+  FieldElement Inverse() const;
+
  private:
-  std::vector<byte> bytes_;
+  FieldElement(uint64_t low, uint64_t high) : words_{low, high} {}
+
+  // words_[0] holds the coefficients of x^0 through x^63 and words_[1] those
+  // of x^64 through x^127, with the coefficient of x^k in bit k % 64. On a
+  // little-endian machine this makes the memory of |words_| the byte
+  // representation of the element.
+  uint64_t words_[2];
 };
 
 std::ostream& operator<<(std::ostream& os, const FieldElement& el);
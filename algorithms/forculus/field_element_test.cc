@@ -14,20 +14,15 @@
 
 #include "algorithms/forculus/field_element.h"
 
+#include <random>
+#include <string>
+#include <vector>
+
 #include "third_party/googletest/googletest/include/gtest/gtest.h"
 
 namespace cobalt {
 namespace forculus {
 
-/****************************** Notice *************************************
-*
-* The tests currently in this file are based on the temporary, insecure
-* implementation of FieldElement that interprets the first 32 bits of
-* data as an integer in little-endian and discards the rest of the bytes.
-* These will be replaced by different tests when the field changes to GF(2^128).
-*
-*****************************************************************************/
-
 namespace {
 // Make the FieldElement with the given vector of bytes. This wrapper around the
 // constructor is necessary because the compiler can't tell which constructor
@@ -39,54 +34,92 @@ FieldElement FromString(const std::string& data) {
   return FieldElement(data);
 }
 
+// Returns the FieldElement whose polynomial has the binary digits of |x| as
+// its coefficients.
 FieldElement FromInt(uint32_t x) {
   std::vector<byte> bytes(sizeof(x));
   std::memcpy(bytes.data(), &x, sizeof(x));
   return FieldElement(std::move(bytes));
 }
 
+// Returns x^k.
+FieldElement PowerOfX(size_t k) {
+  std::vector<byte> bytes(FieldElement::kDataSize, 0);
+  bytes[k / 8] = 1 << (k % 8);
+  return FieldElement(std::move(bytes));
+}
+
+FieldElement RandomElement(std::mt19937* random) {
+  std::vector<byte> bytes(FieldElement::kDataSize);
+  for (byte& b : bytes) {
+    b = static_cast<byte>((*random)());
+  }
+  return FieldElement(std::move(bytes));
+}
+
+// Multiplies |a| and |b| one bit at a time: for each set bit k of |b| add
+// a * x^k, multiplying |a| by x and reducing at every step. This is slow
+// but obviously correct.
+FieldElement NaiveMultiply(const FieldElement& a, const FieldElement& b) {
+  std::string a_bytes, b_bytes;
+  a.CopyBytesToString(&a_bytes);
+  b.CopyBytesToString(&b_bytes);
+  FieldElement result(false);
+  for (size_t k = 0; k < 128; k++) {
+    if (b_bytes[k / 8] & (1 << (k % 8))) {
+      result += FromString(a_bytes);
+    }
+    // a = a * x mod x^128 + x^7 + x^2 + x + 1.
+    bool overflow = a_bytes[15] & 0x80;
+    for (int i = 15; i > 0; i--) {
+      a_bytes[i] = (a_bytes[i] << 1) | ((a_bytes[i - 1] >> 7) & 1);
+    }
+    a_bytes[0] <<= 1;
+    if (overflow) {
+      a_bytes[0] ^= 0x87;
+    }
+  }
+  return result;
+}
+
 }  // namespace
 
 TEST(FieldElementTest, TestConstructors) {
-  // Expect that the byte constructor discards all but the first 4 bytes.
-  FieldElement el = FromBytes({0, 1, 2, 3, 4, 5});
+  // Expect that the byte constructor discards all but the first 16 bytes.
+  std::vector<byte> long_bytes(20);
+  for (size_t i = 0; i < long_bytes.size(); i++) {
+    long_bytes[i] = i;
+  }
+  FieldElement el = FromBytes(std::move(long_bytes));
   const byte* bytes = el.KeyBytes();
-  EXPECT_EQ(0, bytes[0]);
-  EXPECT_EQ(1, bytes[1]);
-  EXPECT_EQ(2, bytes[2]);
-  EXPECT_EQ(3, bytes[3]);
-  EXPECT_EQ(0, bytes[4]);
-  EXPECT_EQ(0, bytes[5]);
-
-  // Expect that the string constructor discards all but the first 4 bytes.
+  for (size_t i = 0; i < FieldElement::kDataSize; i++) {
+    EXPECT_EQ(i, bytes[i]);
+  }
+  EXPECT_EQ(FromString(std::string("\0\1\2\3\4\5\6\7\10\11\12\13\14\15\16\17",
+                                   16)),
+            el);
+
+  // Expect that the string constructor appends zeroes.
   el = FromString({0, 1, 2, 3, 4, 5, 6});
   bytes = el.KeyBytes();
-  EXPECT_EQ(0, bytes[0]);
-  EXPECT_EQ(1, bytes[1]);
-  EXPECT_EQ(2, bytes[2]);
-  EXPECT_EQ(3, bytes[3]);
-  EXPECT_EQ(0, bytes[4]);
-  EXPECT_EQ(0, bytes[5]);
-
-  // Expect that 1 is represented in little-endian as 1 0 0 0 ...
+  for (size_t i = 0; i < FieldElement::kDataSize; i++) {
+    EXPECT_EQ(i < 7 ? i : 0, bytes[i]);
+  }
+
+  // Expect that 1 is represented as 1 0 0 0 ...
   el = FieldElement(true);
   bytes = el.KeyBytes();
   EXPECT_EQ(1, bytes[0]);
-  EXPECT_EQ(0, bytes[1]);
-  EXPECT_EQ(0, bytes[2]);
-  EXPECT_EQ(0, bytes[3]);
-  EXPECT_EQ(0, bytes[4]);
-  EXPECT_EQ(0, bytes[5]);
+  for (size_t i = 1; i < FieldElement::kDataSize; i++) {
+    EXPECT_EQ(0, bytes[i]);
+  }
 
   // Expect that 0 is represented as 0 0 0 ...
-  el = FieldElement(0);
+  el = FieldElement(false);
   bytes = el.KeyBytes();
-  EXPECT_EQ(0, bytes[0]);
-  EXPECT_EQ(0, bytes[1]);
-  EXPECT_EQ(0, bytes[2]);
-  EXPECT_EQ(0, bytes[3]);
-  EXPECT_EQ(0, bytes[4]);
-  EXPECT_EQ(0, bytes[5]);
+  for (size_t i = 0; i < FieldElement::kDataSize; i++) {
+    EXPECT_EQ(0, bytes[i]);
+  }
 
   // Test the copy constructor
   FieldElement x = FromBytes({0, 1, 2, 3, 4, 5});
@@ -96,16 +129,17 @@ TEST(FieldElementTest, TestConstructors) {
   // Test the move constructor
   FieldElement z(std::move(y));
   EXPECT_EQ(x, z);
-  EXPECT_NE(x, y);
 
   // Test the copy assignment operator
+  y = FieldElement(false);
+  EXPECT_NE(x, y);
   y = x;
   EXPECT_EQ(x, y);
 
   // Test the move assignment operator
+  z = FieldElement(true);
   z = std::move(y);
   EXPECT_EQ(x, z);
-  EXPECT_NE(x, y);
 }
 
 TEST(FieldElementTest, TestCopyBytesToString) {
@@ -113,117 +147,122 @@ TEST(FieldElementTest, TestCopyBytesToString) {
   std::string s;
   el.CopyBytesToString(&s);
   EXPECT_EQ(FieldElement::kDataSize, s.size());
-  std::string expected_string = std::string("\0\x1\x2\x3", 4) +
-      std::string(FieldElement::kDataSize - 4, 0);
+  std::string expected_string = std::string("\0\x1\x2\x3\x4\x5", 6) +
+      std::string(FieldElement::kDataSize - 6, 0);
   EXPECT_EQ(expected_string, s);
 }
 
+TEST(FieldElementTest, TestOrdering) {
+  // The ordering is lexicographic in the bytes.
+  EXPECT_LT(FromBytes({1, 2}), FromBytes({2, 1}));
+  EXPECT_LT(FromBytes({1}), FromBytes({1, 1}));
+  EXPECT_FALSE(FromBytes({1, 2}) < FromBytes({1, 2}));
+}
 
-TEST(FieldElementTest, TestArithmetic) {
-  // Test that 2 + 3 = 5.
-  EXPECT_EQ(FromInt(5), FromInt(2) + FromInt(3));
-
-  // Test that 2 + 3 = 5 with +=
-  FieldElement x = FromInt(2);
-  FieldElement y = FromInt(3);
-  FieldElement z = FromInt(5);
-  x+= y;
-  EXPECT_EQ(z, x);
-
-  // Test that -1 + 1 = 0.
-  // The bytes are kLargestPrime -1 in little-endian.
-  static const FieldElement kMinusOne = FromBytes({0xF4, 0xFE, 0xFF, 0xFF});
-  EXPECT_EQ(FieldElement(false), kMinusOne + FieldElement(true));
+TEST(FieldElementTest, TestAddition) {
+  // Addition is exclusive-or: (x^2 + 1) + (x^2 + x) = x + 1.
+  EXPECT_EQ(FromInt(3), FromInt(5) + FromInt(6));
 
-  // Test that -1 + 1 = 0 with +=.
-  x = kMinusOne;
-  x+= FieldElement(true);
-  EXPECT_EQ(FieldElement(false), x);
+  FieldElement x = FromInt(5);
+  x += FromInt(6);
+  EXPECT_EQ(FromInt(3), x);
 
-  // Test that 5 - 2 = 3
-  EXPECT_EQ(FromInt(3), FromInt(5) - FromInt(2));
+  // Every element is its own negative.
+  EXPECT_EQ(FieldElement(false), FromInt(5) + FromInt(5));
+  EXPECT_EQ(FromInt(5), FieldElement(false) - FromInt(5));
 
-  // Test that 5 - 2 = 3 using -=.
+  // Subtraction is the same as addition.
+  EXPECT_EQ(FromInt(3), FromInt(5) - FromInt(6));
   x = FromInt(5);
-  y = FromInt(2);
-  x-= y;
+  x -= FromInt(6);
   EXPECT_EQ(FromInt(3), x);
+}
 
-  // Test that 0 - 1 = -1
-  EXPECT_EQ(kMinusOne, FieldElement(false) - FieldElement(true));
-
-  // Test that 0 - 1 = -1 using -=.
-  x = FieldElement(false);
-  x -= FieldElement(true);
-  EXPECT_EQ(kMinusOne, x);
-
-  // Test that 1999000 - 1998999 = 1
-  EXPECT_EQ(FieldElement(true), FromInt(1999000) - FromInt(1998999));
-
-  // Test that 1999000 - 1998999 = 1 using -=
-  x = FromInt(1999000);
-  x -= FromInt(1998999);
-  EXPECT_EQ(FieldElement(true), x);
-
-  // Test that 3 * 5 = 15.
-  EXPECT_EQ(FromInt(15), FromInt(3) * FromInt(5));
-
-  // Test that 3 * 5 = 15 using *=
-  x = FromInt(3);
-  x*= FromInt(5);
-  EXPECT_EQ(FromInt(15), x);
-
-  // Test that -1 * 2 = -2.
-  static const FieldElement kMinus2 = FromBytes({0xF3, 0xFE, 0xFF, 0xFF});
-  EXPECT_EQ(kMinus2, kMinusOne * FromInt(2));
+TEST(FieldElementTest, TestMultiplication) {
+  // (x + 1) * (x + 1) = x^2 + 1.
+  EXPECT_EQ(FromInt(5), FromInt(3) * FromInt(3));
 
-  // Test that -1 * 2 = -2 using *=
-  x = kMinusOne;
-  x*= FromInt(2);
-  EXPECT_EQ(kMinus2, x);
+  // (x^2 + x + 1) * x = x^3 + x^2 + x.
+  FieldElement x = FromInt(7);
+  x *= FromInt(2);
+  EXPECT_EQ(FromInt(14), x);
+
+  // x^127 * x = x^128 = x^7 + x^2 + x + 1.
+  EXPECT_EQ(FromInt(0x87), PowerOfX(127) * PowerOfX(1));
+
+  // x^127 * x^127 = x^126 * (x^7 + x^2 + x + 1)
+  //               = x^133 + x^128 + x^127 + x^126
+  //               = x^5 * (x^7 + x^2 + x + 1) + (x^7 + x^2 + x + 1)
+  //                 + x^127 + x^126
+  //               = x^127 + x^126 + x^12 + x^6 + x^5 + x^2 + x + 1.
+  FieldElement expected = PowerOfX(127) + PowerOfX(126) + PowerOfX(12) +
+                          FromInt(0x67);
+  EXPECT_EQ(expected, PowerOfX(127) * PowerOfX(127));
+
+  // One is the identity and zero annihilates.
+  std::mt19937 random(1);
+  FieldElement a = RandomElement(&random);
+  EXPECT_EQ(a, a * FieldElement(true));
+  EXPECT_EQ(FieldElement(false), a * FieldElement(false));
+
+  // Compare against a naive implementation and check the field axioms on
+  // random elements.
+  for (int i = 0; i < 100; i++) {
+    FieldElement a = RandomElement(&random);
+    FieldElement b = RandomElement(&random);
+    FieldElement c = RandomElement(&random);
+    EXPECT_EQ(NaiveMultiply(a, b), a * b);
+    EXPECT_EQ(a * b, b * a);
+    EXPECT_EQ((a * b) * c, a * (b * c));
+    EXPECT_EQ(a * (b + c), a * b + a * c);
+  }
+}
 
+TEST(FieldElementTest, TestDivision) {
   // Check that 1/1 = 1.
-  x = FieldElement(true);
-  EXPECT_EQ(x, x/x);
+  FieldElement x = FieldElement(true);
+  EXPECT_EQ(x, x / x);
 
   // Check that 5/5 = 1
   x = FromInt(5);
-  EXPECT_EQ(FieldElement(true), x/x);
+  EXPECT_EQ(FieldElement(true), x / x);
 
-  // Check that 10/5 = 2
-  y = FromInt(10);
-  EXPECT_EQ(FromInt(2), y/x);
+  // Check that 10/5 = 2, i.e. (x^3 + x) / (x^2 + 1) = x.
+  FieldElement y = FromInt(10);
+  EXPECT_EQ(FromInt(2), y / x);
 
   // Check that 10/5 = 2 using /=
   y = FromInt(10);
-  y/=x;
+  y /= x;
   EXPECT_EQ(FromInt(2), y);
 
   // Check that 0/5 = 0
   y = FieldElement(false);
-  EXPECT_EQ(y, y/x);
-
-  // Check that 1/2 * 2 = 1.
-  x = FieldElement(true)/FromInt(2);
-  x *= FromInt(2);
-  EXPECT_EQ(FieldElement(true), x);
-
-  // Check that 2/3 * 3 = 2.
-  x = FromInt(2)/FromInt(3);
-  x *= FromInt(3);
-  EXPECT_EQ(FromInt(2), x);
-
-  // Check that 2/3 * 2/3 = 4/9
-  x = FromInt(2)/FromInt(3);
-  x*= x;
-  EXPECT_EQ(FromInt(4)/FromInt(9), x);
-
-  // Check that 1999*1000/(1000 - 999) + 2001*999/(999 - 1000) = 1.
+  EXPECT_EQ(y, y / x);
+
+  // 1/x = x^127 + x^6 + x + 1 because
+  // x * (x^127 + x^6 + x + 1) = x^128 + x^7 + x^2 + x = 1.
+  FieldElement expected = PowerOfX(127) + FromInt(0x43);
+  EXPECT_EQ(expected, PowerOfX(1).Inverse());
+
+  std::mt19937 random(2);
+  for (int i = 0; i < 100; i++) {
+    FieldElement a = RandomElement(&random);
+    FieldElement b = RandomElement(&random);
+    EXPECT_EQ(FieldElement(true), a * a.Inverse());
+    EXPECT_EQ(a, (a / b) * b);
+  }
+
+  // Check that 1999*1000/(1000 - 999) + 2001*999/(999 - 1000) is the
+  // constant term of the line through (999, 1999) and (1000, 2001).
   FieldElement x0 = FromInt(999);
   FieldElement y0 = FromInt(1999);
   FieldElement x1 = FromInt(1000);
   FieldElement y1 = FromInt(2001);
-  EXPECT_EQ(FieldElement(true), y0*x1/(x1-x0) + y1*x0/(x0 -x1));
+  FieldElement c0 = y0 * x1 / (x1 - x0) + y1 * x0 / (x0 - x1);
+  FieldElement slope = (y1 - y0) / (x1 - x0);
+  EXPECT_EQ(y0, c0 + slope * x0);
+  EXPECT_EQ(y1, c0 + slope * x1);
 }
 
 }  // namespace forculus
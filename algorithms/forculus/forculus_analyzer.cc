@@ -15,6 +15,13 @@
 #include "algorithms/forculus/forculus_analyzer.h"
 
 #include <glog/logging.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <queue>
 
 #include "algorithms/forculus/forculus_utils.h"
 #include "util/crypto_util/base64.h"
@@ -29,6 +36,23 @@ const char kAddObservationFailure[] =
     "forculus-analyzer-add-observation-failure";
 }  // namespace
 
+namespace {
+// The size of the blocks of a CiphertextArena. Larger ciphertexts get a block
+// of their own.
+const size_t kArenaBlockSize = 1 << 20;
+
+// The header of each group in a run file. It is followed by the ciphertext
+// and then by the x and y values of the points.
+struct SpillRecordHeader {
+  uint64_t fingerprint;
+  uint32_t epoch_index;
+  uint32_t ciphertext_size;
+  uint64_t num_seen;
+  uint32_t num_points;
+  uint32_t reserved;
+};
+}  // namespace
+
 namespace {
 // Produces a string used in an error message to describe the observation.
 std::string ErrorString(const ForculusObservation& obs) {
@@ -46,6 +70,115 @@ std::string ErrorString(const ForculusObservation& obs) {
 ForculusAnalyzer::ForculusAnalyzer(const cobalt::ForculusConfig& config)
     : config_(config) {}
 
+ForculusAnalyzer::~ForculusAnalyzer() {
+  for (const std::string& path : spill_runs_) {
+    std::remove(path.c_str());
+  }
+}
+
+ForculusAnalyzer::DecrypterGroupKey::DecrypterGroupKey(
+    uint32_t epoch_index, const std::string& ciphertext)
+    : DecrypterGroupKey(epoch_index, CiphertextFingerprint(ciphertext),
+                        ciphertext.data(), ciphertext.size()) {}
+
+bool ForculusAnalyzer::DecrypterGroupKey::operator==(
+    const DecrypterGroupKey& other) const {
+  return other.fingerprint == fingerprint &&
+         other.epoch_index == epoch_index &&
+         other.ciphertext_size == ciphertext_size &&
+         std::memcmp(other.ciphertext, ciphertext, ciphertext_size) == 0;
+}
+
+bool ForculusAnalyzer::DecrypterGroupKey::operator<(
+    const DecrypterGroupKey& other) const {
+  if (fingerprint != other.fingerprint) {
+    return fingerprint < other.fingerprint;
+  }
+  if (epoch_index != other.epoch_index) {
+    return epoch_index < other.epoch_index;
+  }
+  int compare = std::memcmp(ciphertext, other.ciphertext,
+                            std::min(ciphertext_size, other.ciphertext_size));
+  return compare != 0 ? compare < 0 : ciphertext_size < other.ciphertext_size;
+}
+
+const char* ForculusAnalyzer::CiphertextArena::Add(const char* data,
+                                                   size_t size) {
+  if (size > remaining_) {
+    size_t block_size = std::max(size, kArenaBlockSize);
+    blocks_.emplace_back(new char[block_size]);
+    next_ = blocks_.back().get();
+    remaining_ = block_size;
+  }
+  char* copy = next_;
+  std::memcpy(copy, data, size);
+  next_ += size;
+  remaining_ -= size;
+  return copy;
+}
+
+class ForculusAnalyzer::SpillRunReader {
+ public:
+  explicit SpillRunReader(const std::string& path)
+      : path_(path), file_(std::fopen(path.c_str(), "rb")) {
+    if (!file_) {
+      LOG(ERROR) << "Unable to open Forculus run file " << path;
+    }
+  }
+
+  ~SpillRunReader() {
+    if (file_) {
+      std::fclose(file_);
+    }
+  }
+
+  // Reads the next group into key() and result(). Returns false at the end of
+  // the file or if the file cannot be read.
+  bool Next() {
+    if (!file_) {
+      return false;
+    }
+    SpillRecordHeader header;
+    if (std::fread(&header, sizeof(header), 1, file_) != 1) {
+      if (!std::feof(file_)) {
+        LOG(ERROR) << "Unable to read Forculus run file " << path_;
+      }
+      return false;
+    }
+    ciphertext_.resize(header.ciphertext_size);
+    result_.points.clear();
+    result_.num_seen = header.num_seen;
+    bool ok = std::fread(&ciphertext_[0], 1, header.ciphertext_size, file_) ==
+              header.ciphertext_size;
+    byte point_bytes[2 * FieldElement::kDataSize];
+    for (uint32_t i = 0; ok && i < header.num_points; i++) {
+      ok = std::fread(point_bytes, sizeof(point_bytes), 1, file_) == 1;
+      result_.points.emplace_back(
+          FieldElement(std::vector<byte>(
+              point_bytes, point_bytes + FieldElement::kDataSize)),
+          FieldElement(std::vector<byte>(point_bytes + FieldElement::kDataSize,
+                                         point_bytes + sizeof(point_bytes))));
+    }
+    if (!ok) {
+      LOG(ERROR) << "Truncated Forculus run file " << path_;
+      return false;
+    }
+    key_.reset(new DecrypterGroupKey(header.epoch_index, header.fingerprint,
+                                     ciphertext_.data(), ciphertext_.size()));
+    return true;
+  }
+
+  const DecrypterGroupKey& key() const { return *key_; }
+  const DecrypterResult& result() const { return result_; }
+
+ private:
+  std::string path_;
+  FILE* file_;
+  std::string ciphertext_;
+  std::unique_ptr<DecrypterGroupKey> key_;
+  DecrypterResult result_;
+};
+
 bool ForculusAnalyzer::AddObservation(uint32_t day_index,
                                       const ForculusObservation& obs) {
   // Compute the epoch_index from the day_index.
@@ -57,98 +190,386 @@ bool ForculusAnalyzer::AddObservation(uint32_t day_index,
   auto decryption_map_iter = decryption_map_.find(group_key);
 
   if (decryption_map_iter == decryption_map_.end()) {
-    // There was no entry for this group_key in decryption_map. Create a
-    // new ForculusDecrypter and a new entry.
-    std::unique_ptr<ForculusDecrypter> decrypter(
-        new ForculusDecrypter(config_.threshold(), obs.ciphertext()));
-    decrypter->AddObservation(obs);
-    decryption_map_.emplace(group_key, DecrypterResult(std::move(decrypter)));
+    // There was no entry for this group_key in decryption_map. Intern the
+    // ciphertext and create a new entry.
+    group_key.ciphertext =
+        arena_.Add(obs.ciphertext().data(), obs.ciphertext().size());
+    decryption_map_iter =
+        decryption_map_.emplace(group_key, DecrypterResult()).first;
+    pending_memory_ += PendingMemory(group_key, decryption_map_iter->second);
+  }
+
+  DecrypterResult& decrypter_result = decryption_map_iter->second;
+  if (decrypter_result.result_info) {
+    // The ciphertext has already been decrypted. Just increment the count.
+    decrypter_result.result_info->total_count++;
+    decrypter_result.num_counted++;
+    num_observations_++;
+    return true;
+  }
+
+  // The ciphertext has not yet been decrypted. Add this additional
+  // observation and let's see if that pushes us over the threshold.
+  if (decrypter_result.inconsistent) {
+    // We have previously found the points for this ciphertext to be
+    // inconsistent.
+    LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationFailure)
+        << "Skipping decryption because of a previous error: "
+        << "day_index=" << day_index << " " << ErrorString(obs);
+    observation_errors_++;
+    return false;
+  }
+  pending_memory_ -= PendingMemory(group_key, decrypter_result);
+  if (ForculusDecrypter::InsertPoint(
+          ForculusDecrypter::Point(FieldElement(obs.point_x()),
+                                   FieldElement(obs.point_y())),
+          &decrypter_result.points) != ForculusDecrypter::kOK) {
+    // Discard the points. They are inconsistent.
+    LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationFailure)
+        << "Found inconsistent observation. Deleting points: "
+        << ErrorString(obs);
+    decrypter_result.inconsistent = true;
+    std::vector<ForculusDecrypter::Point>().swap(decrypter_result.points);
+    observation_errors_++;
+    return false;
+  }
+  decrypter_result.num_seen++;
+  if (decrypter_result.points.size() >= config_.threshold()) {
+    // We are now able to decrypt the ciphertext.
+    if (!Decrypt(group_key, &decrypter_result)) {
+      LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationFailure)
+          << "Decryption failed. Deleting points: " << ErrorString(obs);
+      observation_errors_++;
+      return false;
+    }
+    VLOG(4) << "Decryption succeeded: '" << *decrypter_result.recovered_text
+            << "' Deleted points: day_index=" << day_index << " "
+            << ErrorString(obs);
   } else {
-    // There is already an entry in encryption map.
-    DecrypterResult& decrypter_result = decryption_map_iter->second;
-    if (decrypter_result.result_info) {
-      // The ciphertext has already been decrypted. Just increment the count.
-      decrypter_result.result_info->total_count++;
-    } else {
-      // The ciphertext has not yet been decrypted. Add this additional
-      // observation and let's see if that pushes us over the threshold.
-      if (!decrypter_result.decrypter) {
-        // We have previously deleted the decrypter object because it was
-        // in an inconsistent state.
-        LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationFailure)
-            << "Skipping decryption because of a previous error: "
-            << "day_index=" << day_index << " " << ErrorString(obs);
-        observation_errors_++;
-        return false;
+    pending_memory_ += PendingMemory(group_key, decrypter_result);
+    MaybeSpill();
+  }
+  num_observations_++;
+  return true;
+}
+
+bool ForculusAnalyzer::Merge(const ForculusAnalyzer& other) {
+  if (config_.threshold() != other.config_.threshold() ||
+      config_.epoch_type() != other.config_.epoch_type()) {
+    LOG(ERROR) << "Attempt to merge ForculusAnalyzers with different configs.";
+    return false;
+  }
+  num_observations_ += other.num_observations_;
+  observation_errors_ += other.observation_errors_;
+
+  for (const auto& other_entry : other.decryption_map_) {
+    MergeGroup(other_entry.first, other_entry.second);
+  }
+  for (const std::string& path : other.spill_runs_) {
+    SpillRunReader reader(path);
+    while (reader.Next()) {
+      MergeGroup(reader.key(), reader.result());
+    }
+  }
+  return true;
+}
+
+std::map<std::string, std::unique_ptr<ForculusAnalyzer::ResultInfo>>
+ForculusAnalyzer::TakeResults() {
+  if (!spill_runs_.empty()) {
+    MergeSpillRuns();
+  }
+  return std::move(results_);
+}
+
+void ForculusAnalyzer::MergeGroup(const DecrypterGroupKey& key,
+                                  const DecrypterResult& other_result) {
+  auto decryption_map_iter = decryption_map_.find(key);
+  if (decryption_map_iter == decryption_map_.end()) {
+    // There was no entry for this group key. Copy the other entry.
+    DecrypterGroupKey group_key(
+        key.epoch_index, key.fingerprint,
+        arena_.Add(key.ciphertext, key.ciphertext_size), key.ciphertext_size);
+    DecrypterResult& decrypter_result =
+        decryption_map_.emplace(group_key, DecrypterResult()).first->second;
+    decrypter_result.inconsistent = other_result.inconsistent;
+    if (other_result.result_info) {
+      RecordDecryption(*other_result.recovered_text, other_result.num_counted,
+                       &decrypter_result);
+    } else if (!other_result.inconsistent) {
+      decrypter_result.points = other_result.points;
+      decrypter_result.num_seen = other_result.num_seen;
+      pending_memory_ += PendingMemory(group_key, decrypter_result);
+      MaybeSpill();
+    }
+    return;
+  }
+
+  DecrypterResult& decrypter_result = decryption_map_iter->second;
+  pending_memory_ -= PendingMemory(key, decrypter_result);
+  MergeResult(key, other_result, &decrypter_result);
+  pending_memory_ += PendingMemory(key, decrypter_result);
+  MaybeSpill();
+}
+
+void ForculusAnalyzer::MergeResult(const DecrypterGroupKey& key,
+                                   const DecrypterResult& other_result,
+                                   DecrypterResult* decrypter_result) {
+  // The number of observations with this key that were successfully
+  // added to |other|.
+  size_t other_num_seen =
+      other_result.result_info
+          ? other_result.num_counted
+          : (other_result.inconsistent ? 0 : other_result.num_seen);
+  if (decrypter_result->result_info) {
+    // We have already decrypted the ciphertext. Just increment the count.
+    decrypter_result->result_info->total_count += other_num_seen;
+    decrypter_result->num_counted += other_num_seen;
+    return;
+  }
+  if (decrypter_result->inconsistent) {
+    // We have previously found the points to be inconsistent.
+    return;
+  }
+  if (other_result.result_info) {
+    // |other| has decrypted the ciphertext but we have not.
+    std::vector<ForculusDecrypter::Point>().swap(decrypter_result->points);
+    RecordDecryption(*other_result.recovered_text,
+                     decrypter_result->num_seen + other_num_seen,
+                     decrypter_result);
+    return;
+  }
+  if (other_result.inconsistent) {
+    // |other| found the points to be inconsistent.
+    decrypter_result->inconsistent = true;
+    std::vector<ForculusDecrypter::Point>().swap(decrypter_result->points);
+    return;
+  }
+  for (const ForculusDecrypter::Point& point : other_result.points) {
+    if (ForculusDecrypter::InsertPoint(point, &decrypter_result->points) !=
+        ForculusDecrypter::kOK) {
+      LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationFailure)
+          << "Found inconsistent observations while merging. Deleting "
+             "points.";
+      decrypter_result->inconsistent = true;
+      std::vector<ForculusDecrypter::Point>().swap(decrypter_result->points);
+      return;
+    }
+  }
+  decrypter_result->num_seen += other_num_seen;
+  if (decrypter_result->points.size() >= config_.threshold() &&
+      !Decrypt(key, decrypter_result)) {
+    LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationFailure)
+        << "Decryption failed while merging. Deleting points.";
+    observation_errors_++;
+  }
+}
+
+bool ForculusAnalyzer::Decrypt(const DecrypterGroupKey& key,
+                               DecrypterResult* decrypter_result) {
+  std::string recovered_text;
+  ForculusDecrypter::Status status = ForculusDecrypter::DecryptWithPoints(
+      config_.threshold(), decrypter_result->points, key.ciphertext,
+      key.ciphertext_size, nullptr, &recovered_text);
+  // The points have done their job and we don't need them anymore.
+  std::vector<ForculusDecrypter::Point>().swap(decrypter_result->points);
+  if (status != ForculusDecrypter::kOK) {
+    decrypter_result->inconsistent = true;
+    return false;
+  }
+  RecordDecryption(std::move(recovered_text), decrypter_result->num_seen,
+                   decrypter_result);
+  return true;
+}
+
+void ForculusAnalyzer::RecordDecryption(std::string recovered_text,
+                                        size_t num_seen,
+                                        DecrypterResult* decrypter_result) {
+  auto results_iter = results_.find(recovered_text);
+  if (results_iter == results_.end()) {
+    // This is the first time this recovered_text has been seen. Make
+    // a new ResultInfo.
+    results_iter =
+        results_
+            .emplace(std::move(recovered_text),
+                     std::unique_ptr<ResultInfo>(new ResultInfo(num_seen)))
+            .first;
+  } else {
+    // This recovered text has been seen before. This happens when
+    // we are analyzing more than one Forculus epoch and this same
+    // recovered text was seen in a different epoch.
+    auto& result_info = results_iter->second;
+    result_info->num_epochs++;
+    result_info->total_count += num_seen;
+  }
+  // Keep a non-owned pointer to the ResultInfo in the decrypter_map so we
+  // can find it quickly the next time we get another observation with the
+  // same group_key.
+  decrypter_result->result_info = results_iter->second.get();
+  decrypter_result->recovered_text = &results_iter->first;
+  decrypter_result->num_counted = num_seen;
+}
+
+size_t ForculusAnalyzer::PendingMemory(
+    const DecrypterGroupKey& key, const DecrypterResult& decrypter_result) {
+  if (!decrypter_result.pending()) {
+    return 0;
+  }
+  // An entry of an unordered_map is a node holding the key, the value and a
+  // pointer to the next node, plus a bucket pointer.
+  return sizeof(std::pair<const DecrypterGroupKey, DecrypterResult>) +
+         2 * sizeof(void*) + key.ciphertext_size +
+         decrypter_result.points.capacity() *
+             sizeof(ForculusDecrypter::Point);
+}
+
+void ForculusAnalyzer::MaybeSpill() {
+  if (memory_budget_ > 0 && pending_memory_ > memory_budget_ && !Spill()) {
+    // Stop trying to spill. The groups stay in memory.
+    LOG(ERROR) << "Unable to spill Forculus groups to "
+               << spill_directory_ << ". Disabling the memory budget.";
+    memory_budget_ = 0;
+  }
+}
+
+bool ForculusAnalyzer::Spill() {
+  std::vector<std::pair<const DecrypterGroupKey, DecrypterResult>*> groups;
+  for (auto& entry : decryption_map_) {
+    if (entry.second.pending()) {
+      groups.push_back(&entry);
+    }
+  }
+  if (groups.empty()) {
+    return true;
+  }
+  std::sort(groups.begin(), groups.end(),
+            [](const std::pair<const DecrypterGroupKey, DecrypterResult>* a,
+               const std::pair<const DecrypterGroupKey, DecrypterResult>* b) {
+              return a->first < b->first;
+            });
+
+  std::string path = spill_directory_ + "/forculus_spill_XXXXXX";
+  int fd = mkstemp(&path[0]);
+  if (fd < 0) {
+    return false;
+  }
+  FILE* file = fdopen(fd, "wb");
+  if (!file) {
+    close(fd);
+    std::remove(path.c_str());
+    return false;
+  }
+  bool ok = true;
+  for (const auto* group : groups) {
+    const DecrypterGroupKey& key = group->first;
+    const DecrypterResult& result = group->second;
+    SpillRecordHeader header = {};
+    header.fingerprint = key.fingerprint;
+    header.epoch_index = key.epoch_index;
+    header.ciphertext_size = key.ciphertext_size;
+    header.num_seen = result.num_seen;
+    header.num_points = result.points.size();
+    ok = ok && std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+         std::fwrite(key.ciphertext, 1, key.ciphertext_size, file) ==
+             key.ciphertext_size;
+    for (const ForculusDecrypter::Point& point : result.points) {
+      ok = ok &&
+           std::fwrite(point.x.KeyBytes(), FieldElement::kDataSize, 1, file) ==
+               1 &&
+           std::fwrite(point.y.KeyBytes(), FieldElement::kDataSize, 1, file) ==
+               1;
+    }
+  }
+  ok = (std::fclose(file) == 0) && ok;
+  if (!ok) {
+    std::remove(path.c_str());
+    return false;
+  }
+  spill_runs_.push_back(path);
+
+  // Move the groups that were not spilled into a new map and a new arena.
+  // The spilled groups' ciphertexts are freed along with the old arena.
+  std::unordered_map<DecrypterGroupKey, DecrypterResult, KeyHasher>
+      decryption_map;
+  CiphertextArena arena;
+  for (auto& entry : decryption_map_) {
+    if (entry.second.pending()) {
+      continue;
+    }
+    const DecrypterGroupKey& key = entry.first;
+    decryption_map.emplace(
+        DecrypterGroupKey(key.epoch_index, key.fingerprint,
+                          arena.Add(key.ciphertext, key.ciphertext_size),
+                          key.ciphertext_size),
+        std::move(entry.second));
+  }
+  decryption_map_.swap(decryption_map);
+  arena_ = std::move(arena);
+  pending_memory_ = 0;
+  VLOG(3) << "Spilled " << groups.size() << " Forculus groups to " << path;
+  return true;
+}
+
+void ForculusAnalyzer::MergeSpillRuns() {
+  // Spill the remaining pending groups so that every pending group is in a
+  // run file and the groups left in |decryption_map_| have either been
+  // decrypted or are inconsistent. If that fails the pending groups are
+  // merged from memory instead.
+  Spill();
+
+  std::vector<std::unique_ptr<SpillRunReader>> readers;
+  // A min-heap of the indices of the readers that have a current group,
+  // ordered by the key of that group.
+  auto greater = [&readers](size_t a, size_t b) {
+    return readers[b]->key() < readers[a]->key();
+  };
+  std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(
+      greater);
+  for (const std::string& path : spill_runs_) {
+    readers.emplace_back(new SpillRunReader(path));
+    if (readers.back()->Next()) {
+      heap.push(readers.size() - 1);
+    }
+  }
+
+  while (!heap.empty()) {
+    // Gather the groups with the smallest key from all of the runs. Each run
+    // has at most one group with a given key.
+    std::vector<size_t> group_readers;
+    do {
+      group_readers.push_back(heap.top());
+      heap.pop();
+    } while (!heap.empty() &&
+             readers[heap.top()]->key() == readers[group_readers[0]]->key());
+
+    const DecrypterGroupKey& key = readers[group_readers[0]]->key();
+    auto decryption_map_iter = decryption_map_.find(key);
+    if (decryption_map_iter != decryption_map_.end()) {
+      for (size_t i : group_readers) {
+        MergeResult(key, readers[i]->result(), &decryption_map_iter->second);
       }
-      if (decrypter_result.decrypter->AddObservation(obs) !=
-          ForculusDecrypter::kOK) {
-        // Delete the Decrypter object. It is in an inconsistent state.
-        LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationFailure)
-            << "Found inconsistent observation. Deleting Decrypter: "
-            << ErrorString(obs);
-        decrypter_result.decrypter.reset();
-        observation_errors_++;
-        return false;
+    } else {
+      // Assemble the group without adding it to |decryption_map_|. If it
+      // reaches the threshold its plain text is recorded in |results_|.
+      DecrypterResult decrypter_result = readers[group_readers[0]]->result();
+      for (size_t k = 1; k < group_readers.size(); k++) {
+        MergeResult(key, readers[group_readers[k]]->result(),
+                    &decrypter_result);
       }
-      if (decrypter_result.decrypter->size() >= config_.threshold()) {
-        // We are now able to decrypt the ciphertext.
-        std::string recovered_text;
-        if (decrypter_result.decrypter->Decrypt(&recovered_text) !=
-            ForculusDecrypter::kOK) {
-          // Delete the Decrypter object. It is in an inconsistent state.
-          LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationFailure)
-              << "Decryption failed. Deleting Decrypter: " << ErrorString(obs);
-          decrypter_result.decrypter.reset();
-          observation_errors_++;
-          return false;
-        }
-        uint32_t num_seen = decrypter_result.decrypter->num_seen();
-
-        // Delete the Decrypter object. It has done its job and we don't need
-        // it anymore.
-        VLOG(4) << "Decryption succeeded: '" << recovered_text
-                << "' Deleting Decrypter: day_index=" << day_index << " "
-                << ErrorString(obs);
-        decrypter_result.decrypter.reset();
-        auto results_iter = results_.find(recovered_text);
-        if (results_iter == results_.end()) {
-          // This is the first time this recovered_text has been seen. Make
-          // a new ResultInfo.
-          std::unique_ptr<ResultInfo> result_info(new ResultInfo(num_seen));
-          // Keep a non-owned pointer to result_info in the decrypter_map
-          // so we can find it quickly the next time we get another observation
-          // with the same group_key.
-          decrypter_result.result_info = result_info.get();
-          // Keep the owned pointer in results_.
-          results_.emplace(std::move(recovered_text), std::move(result_info));
-        } else {
-          // This recovered text has been seen before. This happens when
-          // we are analyzing more than one Forculus epoch and this same
-          // recovered text was seen in a different epoch.
-          auto& result_info = results_iter->second;
-          result_info->num_epochs++;
-          result_info->total_count += num_seen;
-          // Keep a non-owned pointer to result_info in the decrypter_map
-          // so we can find it quickly the next time we get another observation
-          // with the same group_key.
-          decrypter_result.result_info = result_info.get();
-        }
+    }
+
+    for (size_t i : group_readers) {
+      if (readers[i]->Next()) {
+        heap.push(i);
       }
     }
   }
-  num_observations_++;
-  return true;
-}
 
-size_t ForculusAnalyzer::KeyHasher::operator()(
-    const DecrypterGroupKey& key) const {
-  // The probability of having the same ciphertext with two different
-  // epoch_indexes is negligably small since the epoch_index was one of
-  // the ingredients that went into the master key during encryption. For
-  // this reason we use the hash of the ciphertext alone as the hash of the
-  // pair.
-  return std::hash<std::string>()(key.ciphertext);
+  readers.clear();
+  for (const std::string& path : spill_runs_) {
+    std::remove(path.c_str());
+  }
+  spill_runs_.clear();
 }
 
 }  // namespace forculus
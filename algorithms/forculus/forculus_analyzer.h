@@ -15,11 +15,13 @@
 #ifndef COBALT_ALGORITHMS_FORCULUS_FORCULUS_ANALYZER_H_
 #define COBALT_ALGORITHMS_FORCULUS_FORCULUS_ANALYZER_H_
 
+#include <functional>
 #include <unordered_map>
 #include <map>
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "./observation.pb.h"
 #include "algorithms/forculus/forculus_decrypter.h"
@@ -52,6 +54,20 @@ namespace forculus {
 // |total_count| in each of the |ResultInfo|s in the map returned by
 // TakeResults().
 //
+// The observations are grouped by (epoch_index, ciphertext). For metrics with
+// a high cardinality most groups never reach the threshold, so the memory
+// used per group matters. Each ciphertext is stored once, in an arena, and a
+// group is keyed by a 64-bit fingerprint of its ciphertext together with a
+// pointer into the arena. The points of a group are kept in a flat sorted
+// vector that never holds more than the threshold number of points, and are
+// discarded once the ciphertext has been decrypted.
+//
+// Optionally, set_memory_budget() bounds the memory used by groups that have
+// not yet reached the threshold. When the bound is exceeded those groups are
+// written to a run file on disk, sorted by key, and removed from memory.
+// TakeResults() merges the run files back together and decrypts the groups
+// that reach the threshold once combined.
+//
 // An instance of ForculusAnalyzer is not thread-safe.
 class ForculusAnalyzer {
  public:
@@ -59,6 +75,26 @@ class ForculusAnalyzer {
   // added via AddObservation() must have been encoded using this config.
   explicit ForculusAnalyzer(const cobalt::ForculusConfig& config);
 
+  // Deletes any run files that were written to disk.
+  ~ForculusAnalyzer();
+
+  // Limits the memory used by groups of observations that have not yet
+  // reached the threshold to about |memory_budget| bytes. Whenever the limit
+  // is exceeded those groups are spilled to a new run file in
+  // |spill_directory|, which must exist. A |memory_budget| of zero, the
+  // default, means no limit. Should be invoked before any observations are
+  // added.
+  //
+  // Spilling changes the results in one way only: points of a spilled group
+  // are not checked for consistency against points of the same group added
+  // later until TakeResults(), so such inconsistencies are not counted in
+  // observation_errors().
+  void set_memory_budget(size_t memory_budget,
+                         const std::string& spill_directory) {
+    memory_budget_ = memory_budget;
+    spill_directory_ = spill_directory;
+  }
+
   // Adds an additional observation to be analyzed. All of the observations
   // added must be for the same metric part and must have been encoded using
   // the same encoding configuration. See comments at the top of this file for
@@ -75,6 +111,25 @@ class ForculusAnalyzer {
   bool AddObservation(uint32_t day_index,
                       const ForculusObservation& obs);
 
+  // Adds the observations that were added to |other| into this
+  // ForculusAnalyzer. This allows the observations for a single report to be
+  // added to several ForculusAnalyzers in parallel, one per thread, and then
+  // combined. |other| is not modified and must not be modified concurrently.
+  //
+  // The results are the same as if all of the observations added to |other|
+  // had been added to this ForculusAnalyzer, with one exception: once either
+  // analyzer has decrypted a ciphertext the other analyzer's points for that
+  // ciphertext are no longer checked for consistency but are simply counted.
+  // num_observations() and observation_errors() become the sums of their
+  // values in the two analyzers.
+  //
+  // Groups that |other| has spilled to disk are read back from its run
+  // files, which are not modified.
+  //
+  // Returns false, and does nothing, if |other| was not constructed with the
+  // same threshold and epoch type.
+  bool Merge(const ForculusAnalyzer& other);
+
   // The number of times that AddObservation() was invoked minus the value
   // observation_errors().
   size_t num_observations() {
@@ -89,6 +144,26 @@ class ForculusAnalyzer {
     return observation_errors_;
   }
 
+  // The number of run files that groups of observations have been spilled
+  // to. See set_memory_budget().
+  size_t num_spill_runs() const {
+    return spill_runs_.size();
+  }
+
+  // An estimate of the memory, in bytes, currently used by groups of
+  // observations that have not yet reached the threshold.
+  size_t pending_memory() const {
+    return pending_memory_;
+  }
+
+  // Returns the 64-bit fingerprint of |ciphertext| by which the groups of
+  // observations with that ciphertext are hashed and ordered. This allows
+  // observations to be partitioned among several ForculusAnalyzers, such that
+  // each group is in only one of them. See ShardedForculusAnalyzer.
+  static uint64_t CiphertextFingerprint(const std::string& ciphertext) {
+    return std::hash<std::string>()(ciphertext);
+  }
+
   // A ResultInfo contains info about one particular recovered plaintext.
   struct ResultInfo {
     explicit ResultInfo(size_t total_count) :
@@ -119,13 +194,14 @@ class ForculusAnalyzer {
   // successfully decrypted by the analysis. The values are pointers to
   // information about the recovered plaintext.
   //
+  // If any groups were spilled to disk they are first merged back together
+  // and decrypted if they have reached the threshold.
+  //
   // After this method is invoked this ForculusAnalyzer should be deleted.
   // This is because the contents of the returned map have been moved out
   // of the ForculusAnalyzer leaving the ForculusAnalyzer in an undefined
   // state.
-  std::map<std::string, std::unique_ptr<ResultInfo>> TakeResults() {
-    return std::move(results_);
-  }
+  std::map<std::string, std::unique_ptr<ResultInfo>> TakeResults();
 
  private:
   ForculusConfig config_;
@@ -135,51 +211,153 @@ class ForculusAnalyzer {
 
   // The type of the keys of |decryption_map_|. Represents a group of
   // observations that all come from the same epoch and have the same
-  // ciphertext.
-  struct DecrypterGroupKey{
-    DecrypterGroupKey(uint32_t epoch_index, std::string ciphertext) :
-      epoch_index(epoch_index), ciphertext(std::move(ciphertext)) {}
+  // ciphertext. The key does not own its ciphertext: for the keys in
+  // |decryption_map_| it is interned in |arena_|.
+  struct DecrypterGroupKey {
+    DecrypterGroupKey(uint32_t epoch_index, const std::string& ciphertext);
+    DecrypterGroupKey(uint32_t epoch_index, uint64_t fingerprint,
+                      const char* ciphertext, size_t ciphertext_size)
+        : fingerprint(fingerprint),
+          epoch_index(epoch_index),
+          ciphertext_size(ciphertext_size),
+          ciphertext(ciphertext) {}
 
-    bool operator==(const DecrypterGroupKey& other) const {
-      return other.epoch_index == epoch_index && other.ciphertext == ciphertext;
-    }
+    bool operator==(const DecrypterGroupKey& other) const;
+
+    // Orders keys by fingerprint, then epoch index and then ciphertext. This
+    // is the order of the groups in a run file.
+    bool operator<(const DecrypterGroupKey& other) const;
+
+    // A fingerprint of the ciphertext.
+    uint64_t fingerprint;
 
     // An eopch index. Forculus decryption operates on a set of observations
     // that are all from the same epoch.
     uint32_t epoch_index;
 
     // A ciphertext to be decrypted.
-    std::string ciphertext;
+    uint32_t ciphertext_size;
+    const char* ciphertext;
   };
 
   // The type of the values of |decryption_map_|.
   struct DecrypterResult {
-    // Constructs a new DecrypterResult with the given decrypter and a null
-    // result_info.
-    explicit DecrypterResult(std::unique_ptr<ForculusDecrypter>&& decrypter) :
-      decrypter(std::move(decrypter)),
-      result_info(nullptr) {}
+    // If the ciphertext has not yet been decrypted, the distinct points that
+    // have been added, sorted by x-value. There are fewer than the threshold
+    // number of them since the ciphertext is decrypted as soon as there are
+    // enough. Empty if the ciphertext has already been decrypted or if the
+    // group is inconsistent.
+    std::vector<ForculusDecrypter::Point> points;
 
-    // The ForculusDecrypter corresponding to the key if the ciphertext has
-    // not yet been decrypted, or NULL if the ciphertext has already been
-    // decrypted or if the ForculusDecrypter was previously corrupted.
-    std::unique_ptr<ForculusDecrypter> decrypter;
+    // The number of observations with this key that have been successfully
+    // added while the ciphertext had not yet been decrypted.
+    size_t num_seen = 0;
+
+    // True if the group was found to have inconsistent points or decryption
+    // failed. Further observations with this key are errors.
+    bool inconsistent = false;
 
     // A pointer to the ResultInfo for the recovered plain text
     // corresponding to the key if the ciphertext has already been decrypted,
     // or NULL if the ciphertext has not yet been decrypted.
-    ResultInfo* result_info;
+    ResultInfo* result_info = nullptr;
+
+    // If |result_info| is not NULL, a pointer to the recovered plain text,
+    // which is the key of |result_info| in |results_|.
+    const std::string* recovered_text = nullptr;
+
+    // If |result_info| is not NULL, the number of observations with this
+    // key that have been counted in result_info->total_count.
+    size_t num_counted = 0;
+
+    // Returns true if the ciphertext has neither been decrypted nor found to
+    // be inconsistent.
+    bool pending() const { return !result_info && !inconsistent; }
   };
 
+  // Stores ciphertexts back to back in large blocks so that each group key
+  // needs only a pointer rather than a std::string with its own allocation.
+  class CiphertextArena {
+   public:
+    // Copies the |size| bytes at |data| into the arena and returns a pointer
+    // to the copy, which is valid for the lifetime of the arena.
+    const char* Add(const char* data, size_t size);
+
+   private:
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    char* next_ = nullptr;
+    size_t remaining_ = 0;
+  };
+
+  // Reads the groups in a run file in order.
+  class SpillRunReader;
+
+  // Merges |other_result|, the result of a group with the given |key| in a
+  // different ForculusAnalyzer or in a run file, into the result for |key|,
+  // inserting a new result if there is none.
+  void MergeGroup(const DecrypterGroupKey& key,
+                  const DecrypterResult& other_result);
+
+  // Merges |other_result| into |decrypter_result|, which has the given |key|
+  // and is either in |decryption_map_| or is a temporary result that is
+  // being assembled from run files.
+  void MergeResult(const DecrypterGroupKey& key,
+                   const DecrypterResult& other_result,
+                   DecrypterResult* decrypter_result);
+
+  // Decrypts the ciphertext of |key|, whose |decrypter_result| must have at
+  // least the threshold number of points, discards the points and records
+  // the recovered plain text in |results_|. Returns false if the decryption
+  // fails, in which case the group is marked inconsistent.
+  bool Decrypt(const DecrypterGroupKey& key,
+               DecrypterResult* decrypter_result);
+
+  // Records that the ciphertext of |decrypter_result| has been decrypted to
+  // |recovered_text| and that |num_seen| observations with that ciphertext
+  // have been added.
+  void RecordDecryption(std::string recovered_text, size_t num_seen,
+                        DecrypterResult* decrypter_result);
+
+  // Returns the contribution of a group to pending_memory().
+  static size_t PendingMemory(const DecrypterGroupKey& key,
+                              const DecrypterResult& decrypter_result);
+
+  // Spills the pending groups to disk if pending_memory() exceeds the memory
+  // budget.
+  void MaybeSpill();
+
+  // Writes the pending groups to a new run file, removes them from
+  // |decryption_map_| and rebuilds |arena_| with the ciphertexts of the
+  // remaining groups. Returns false if the run file could not be written, in
+  // which case the groups are kept in memory.
+  bool Spill();
+
+  // Merges the run files and the groups in |decryption_map_|, decrypting the
+  // groups that reach the threshold, and deletes the run files.
+  void MergeSpillRuns();
+
   // Hash function for DecrypterGroupKey.
   class KeyHasher {
    public:
-    size_t operator()(const DecrypterGroupKey &key) const;
+    size_t operator()(const DecrypterGroupKey &key) const {
+      return key.fingerprint;
+    }
   };
 
   // A map from DecrypterGroupKeys to their DecrypterResults.
   std::unordered_map<DecrypterGroupKey, DecrypterResult, KeyHasher>
       decryption_map_;
+
+  // Holds the ciphertexts of the keys of |decryption_map_|.
+  CiphertextArena arena_;
+
+  // See set_memory_budget() and pending_memory().
+  size_t memory_budget_ = 0;
+  std::string spill_directory_;
+  size_t pending_memory_ = 0;
+
+  // The paths of the run files that have been written.
+  std::vector<std::string> spill_runs_;
 };
 
 }  // namespace forculus
@@ -16,6 +16,11 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
 
 #include "algorithms/forculus/forculus_encrypter.h"
 #include "encoder/client_secret.h"
@@ -211,6 +216,91 @@ TEST(ForculusAnalyzerTest, TestEpochTypes) {
   EXPECT_EQ(0u, results.size());
 }
 
+// Tests merging ForculusAnalyzers that have each been given a part of the
+// observations.
+TEST(ForculusAnalyzerTest, Merge) {
+  ForculusConfig forculus_config;
+  forculus_config.set_threshold(kThreshold);
+  ForculusAnalyzer analyzer1(forculus_config);
+  ForculusAnalyzer analyzer2(forculus_config);
+  ForculusAnalyzer analyzer3(forculus_config);
+
+  const std::string plaintext1("The woods are lovely, dark and deep,");
+  const std::string plaintext2("But I have promises to keep,");
+  const std::string plaintext3("And miles to go before I sleep,");
+  const std::string plaintext4("And miles to go before I sleep.");
+
+  // plaintext1 on day 0 is split evenly between analyzers 1 and 2 so that
+  // neither of them can decrypt it alone.
+  AddObservations(&analyzer1, 0, DAY, plaintext1, kThreshold / 2, 2);
+  AddObservations(&analyzer2, 0, DAY, plaintext1, kThreshold / 2, 3);
+
+  // plaintext2 on day 0 is decrypted by analyzer1. Analyzer2 has a few more
+  // observations of it that it cannot decrypt.
+  AddObservations(&analyzer1, 0, DAY, plaintext2, kThreshold, 1);
+  AddObservations(&analyzer2, 0, DAY, plaintext2, 3, 1);
+  // plaintext2 on day 1 is decrypted by analyzer3 alone.
+  AddObservations(&analyzer3, 1, DAY, plaintext2, kThreshold + 1, 1);
+
+  // plaintext3 is not decrypted by anyone.
+  AddObservations(&analyzer2, 0, DAY, plaintext3, kThreshold / 2, 1);
+  AddObservations(&analyzer3, 0, DAY, plaintext3, kThreshold / 2 - 1, 1);
+
+  // plaintext4 is decrypted by analyzer2 and is seen only there.
+  AddObservations(&analyzer2, 3, DAY, plaintext4, kThreshold, 2);
+
+  // Analyzers with different configs may not be merged.
+  ForculusConfig other_config;
+  other_config.set_threshold(kThreshold + 1);
+  ForculusAnalyzer other_analyzer(other_config);
+  EXPECT_FALSE(analyzer1.Merge(other_analyzer));
+
+  EXPECT_TRUE(analyzer1.Merge(analyzer2));
+  EXPECT_TRUE(analyzer1.Merge(analyzer3));
+
+  EXPECT_EQ(0u, analyzer1.observation_errors());
+  static const size_t kExpectedNumObservations =
+      (kThreshold / 2) * 2 + (kThreshold / 2) * 3 + kThreshold + 3 +
+      kThreshold + 1 + kThreshold / 2 + kThreshold / 2 - 1 + kThreshold * 2;
+  EXPECT_EQ(kExpectedNumObservations, analyzer1.num_observations());
+
+  auto results = analyzer1.TakeResults();
+  EXPECT_EQ(3u, results.size());
+
+  EXPECT_EQ((kThreshold / 2) * 2 + (kThreshold / 2) * 3,
+            results[plaintext1]->total_count);
+  EXPECT_EQ(1u, results[plaintext1]->num_epochs);
+
+  EXPECT_EQ(kThreshold + 3 + kThreshold + 1, results[plaintext2]->total_count);
+  EXPECT_EQ(2u, results[plaintext2]->num_epochs);
+
+  EXPECT_EQ(kThreshold * 2, results[plaintext4]->total_count);
+  EXPECT_EQ(1u, results[plaintext4]->num_epochs);
+
+  EXPECT_EQ(nullptr, results[plaintext3]);
+
+  // Merging did not modify the other analyzers.
+  EXPECT_EQ(kThreshold + 1 + kThreshold / 2 - 1, analyzer3.num_observations());
+  EXPECT_EQ(1u, analyzer3.TakeResults().size());
+
+  // A fake ciphertext reaches the threshold only when analyzers 4 and 5 are
+  // merged. The decryption then fails, which counts as an error.
+  ForculusAnalyzer analyzer4(forculus_config);
+  ForculusAnalyzer analyzer5(forculus_config);
+  ForculusObservation obs;
+  obs.set_ciphertext("1 ciphertext fake");
+  for (uint32_t i = 0; i < kThreshold; i++) {
+    obs.set_point_x(std::to_string(i) + " x fake");
+    obs.set_point_y(std::to_string(i) + " y fake");
+    EXPECT_TRUE((i < kThreshold / 2 ? analyzer4 : analyzer5)
+                    .AddObservation(0, obs));
+  }
+  EXPECT_TRUE(analyzer4.Merge(analyzer5));
+  EXPECT_EQ(1u, analyzer4.observation_errors());
+  EXPECT_EQ(kThreshold, analyzer4.num_observations());
+  EXPECT_EQ(0u, analyzer4.TakeResults().size());
+}
+
 // Tests the use of a ForculusAnalyzer when fed observations with errors.
 TEST(ForculusAnalyzerTest, WithErrors) {
   ForculusConfig forculus_config;
@@ -274,6 +364,123 @@ TEST(ForculusAnalyzerTest, WithErrors) {
   EXPECT_EQ(0u, results.size());
 }
 
+// Tests that a ForculusAnalyzer with a small memory budget, which must
+// spill groups to disk, gets the same results as one without a budget, both
+// directly and when merged into another ForculusAnalyzer.
+TEST(ForculusAnalyzerTest, SpillToDisk) {
+  char spill_directory[] = "/tmp/forculus_analyzer_test_XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(spill_directory));
+
+  ForculusConfig forculus_config;
+  forculus_config.set_threshold(kThreshold);
+  ForculusAnalyzer unlimited_analyzer(forculus_config);
+  ForculusAnalyzer spilling_analyzer(forculus_config);
+  spilling_analyzer.set_memory_budget(4096, spill_directory);
+
+  // Ten plaintexts with enough clients to be decrypted, on two days, and
+  // ten with too few clients. The observations are interleaved so that the
+  // groups are spilled several times before they reach the threshold.
+  std::vector<std::vector<ForculusObservation>> observations;
+  std::vector<uint32_t> day_indices;
+  for (int i = 0; i < 20; i++) {
+    int num_clients = i < 10 ? kThreshold + i : kThreshold - 1 - i % 5;
+    observations.emplace_back();
+    day_indices.push_back(i % 2);
+    for (int j = 0; j < num_clients; j++) {
+      observations.back().push_back(
+          Encrypt(i % 2, DAY, "plaintext" + std::to_string(i)));
+    }
+  }
+  for (size_t j = 0; j < kThreshold + 10; j++) {
+    for (size_t i = 0; i < observations.size(); i++) {
+      if (j < observations[i].size()) {
+        EXPECT_TRUE(
+            unlimited_analyzer.AddObservation(day_indices[i],
+                                              observations[i][j]));
+        EXPECT_TRUE(
+            spilling_analyzer.AddObservation(day_indices[i],
+                                             observations[i][j]));
+      }
+    }
+  }
+  EXPECT_EQ(0u, unlimited_analyzer.num_spill_runs());
+  EXPECT_LT(1u, spilling_analyzer.num_spill_runs());
+  EXPECT_GE(4096u, spilling_analyzer.pending_memory());
+  EXPECT_EQ(unlimited_analyzer.num_observations(),
+            spilling_analyzer.num_observations());
+  EXPECT_EQ(0u, spilling_analyzer.observation_errors());
+
+  ForculusAnalyzer merged_analyzer(forculus_config);
+  EXPECT_TRUE(merged_analyzer.Merge(spilling_analyzer));
+
+  auto expected_results = unlimited_analyzer.TakeResults();
+  EXPECT_EQ(10u, expected_results.size());
+  for (auto* analyzer : {&spilling_analyzer, &merged_analyzer}) {
+    auto results = analyzer->TakeResults();
+    ASSERT_EQ(expected_results.size(), results.size());
+    for (const auto& expected_result : expected_results) {
+      SCOPED_TRACE(expected_result.first);
+      ASSERT_NE(nullptr, results[expected_result.first]);
+      EXPECT_EQ(expected_result.second->total_count,
+                results[expected_result.first]->total_count);
+      EXPECT_EQ(expected_result.second->num_epochs,
+                results[expected_result.first]->num_epochs);
+    }
+    EXPECT_EQ(0u, analyzer->num_spill_runs());
+  }
+
+  EXPECT_EQ(0, rmdir(spill_directory));
+}
+
+// Tests that the memory budget is respected when groups reach the threshold
+// in memory as well as when they are spilled, and that decrypting a group
+// in memory releases its share of the budget.
+TEST(ForculusAnalyzerTest, SpillToDiskWithDecryptionInMemory) {
+  char spill_directory[] = "/tmp/forculus_analyzer_test_XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(spill_directory));
+
+  static const size_t kMemoryBudget = 4096;
+  ForculusConfig forculus_config;
+  forculus_config.set_threshold(kThreshold);
+  ForculusAnalyzer analyzer(forculus_config);
+  analyzer.set_memory_budget(kMemoryBudget, spill_directory);
+
+  // Ten plaintexts with enough clients to be decrypted followed by ten with
+  // too few. The observations of each plaintext are added together so that
+  // each of the first ten groups reaches the threshold without being
+  // spilled.
+  for (int i = 0; i < 20; i++) {
+    int num_clients = i < 10 ? kThreshold + 2 : kThreshold - 1;
+    for (int j = 0; j < num_clients; j++) {
+      EXPECT_TRUE(analyzer.AddObservation(
+          0, Encrypt(0, DAY, "plaintext" + std::to_string(i))));
+      EXPECT_GE(kMemoryBudget, analyzer.pending_memory());
+    }
+    if (i == 9) {
+      // Nothing needed to be spilled and nothing is pending.
+      EXPECT_EQ(0u, analyzer.num_spill_runs());
+      EXPECT_EQ(0u, analyzer.pending_memory());
+    }
+  }
+  // The ten groups that are below the threshold fit in a few runs.
+  EXPECT_LT(0u, analyzer.num_spill_runs());
+  EXPECT_GE(5u, analyzer.num_spill_runs());
+  EXPECT_EQ(0u, analyzer.observation_errors());
+  EXPECT_EQ(10u * (kThreshold + 2) + 10u * (kThreshold - 1),
+            analyzer.num_observations());
+
+  auto results = analyzer.TakeResults();
+  EXPECT_EQ(10u, results.size());
+  for (int i = 0; i < 10; i++) {
+    ASSERT_NE(nullptr, results["plaintext" + std::to_string(i)]);
+    EXPECT_EQ(kThreshold + 2,
+              results["plaintext" + std::to_string(i)]->total_count);
+  }
+  EXPECT_EQ(0u, analyzer.num_spill_runs());
+
+  EXPECT_EQ(0, rmdir(spill_directory));
+}
+
 }  // namespace forculus
 }  // namespace cobalt
 
@@ -14,6 +14,7 @@
 
 #include "algorithms/forculus/forculus_decrypter.h"
 
+#include <algorithm>
 #include <functional>
 #include <vector>
 
@@ -34,18 +35,26 @@ ForculusDecrypter::Status ForculusDecrypter::AddObservation(
   if (obs.ciphertext() != ciphertext_) {
     return kWrongCiphertext;
   }
-  // Keep a copy of y so we can check it its the same as a previously added
-  // point.
-  FieldElement y(obs.point_y());
-  auto result = points_.insert(std::make_pair(FieldElement(obs.point_x()), y));
-  auto key_value_pair = result.first;
-  auto success = result.second;
-  if (!success) {
-    if (key_value_pair->second != y) {
+  if (InsertPoint(Point(FieldElement(obs.point_x()),
+                        FieldElement(obs.point_y())),
+                  &points_) != kOK) {
+    return kInconsistentPoints;
+  }
+  num_seen_++;
+  return kOK;
+}
+
+ForculusDecrypter::Status ForculusDecrypter::Merge(
+    const ForculusDecrypter& other) {
+  if (other.ciphertext_ != ciphertext_) {
+    return kWrongCiphertext;
+  }
+  for (const Point& point : other.points_) {
+    if (InsertPoint(point, &points_) != kOK) {
       return kInconsistentPoints;
     }
   }
-  num_seen_++;
+  num_seen_ += other.num_seen_;
   return kOK;
 }
 
@@ -55,26 +64,56 @@ uint32_t ForculusDecrypter::size() {
 
 ForculusDecrypter::Status ForculusDecrypter::Decrypt(
     std::string *plain_text_out) {
-  if (size() < threshold_) {
+  return DecryptWithPoints(threshold_, points_, ciphertext_.data(),
+                           ciphertext_.size(), &lagrange_coefficients_,
+                           plain_text_out);
+}
+
+ForculusDecrypter::Status ForculusDecrypter::InsertPoint(
+    const Point& point, std::vector<Point>* points) {
+  auto iter = std::lower_bound(
+      points->begin(), points->end(), point,
+      [](const Point& a, const Point& b) { return a.x < b.x; });
+  if (iter != points->end() && iter->x == point.x) {
+    return iter->y == point.y ? kOK : kInconsistentPoints;
+  }
+  points->insert(iter, point);
+  return kOK;
+}
+
+ForculusDecrypter::Status ForculusDecrypter::DecryptWithPoints(
+    uint32_t threshold, const std::vector<Point>& points,
+    const char* ciphertext, size_t ciphertext_size,
+    std::shared_ptr<const LagrangeCoefficients>* lagrange_coefficients,
+    std::string* plain_text_out) {
+  if (points.size() < threshold) {
     return kNotEnoughPoints;
   }
 
-  // Put pointers to the first |threshold_| x and y values into vectors.
-  std::vector<const FieldElement*> x_values(threshold_);
-  std::vector<const FieldElement*> y_values(threshold_);
-  uint32_t point_index = 0;
-  for (const auto& point : points_) {
-    if (point_index >= threshold_) {
-      break;
-    }
-    x_values[point_index] = &point.first;
-    y_values[point_index++] = &point.second;
+  // Put pointers to the first |threshold| x and y values into vectors.
+  std::vector<const FieldElement*> x_values(threshold);
+  std::vector<const FieldElement*> y_values(threshold);
+  for (uint32_t i = 0; i < threshold; i++) {
+    x_values[i] = &points[i].x;
+    y_values[i] = &points[i].y;
   }
 
   // The decryption key we need is the constant term of the unique polynomial of
-  // degree (threshold_  - 1) that passes through the points given by the
-  // x_values and y_values. We can find this using interpolation.
-  FieldElement c0 = InterpolateConstant(x_values, y_values);
+  // degree (threshold  - 1) that passes through the points given by the
+  // x_values and y_values. We can find this using interpolation, which
+  // requires a single field inversion to compute the Lagrange coefficients
+  // for the x_values.
+  FieldElement c0(false);
+  if (lagrange_coefficients) {
+    if (!*lagrange_coefficients ||
+        !(*lagrange_coefficients)->Matches(x_values)) {
+      *lagrange_coefficients =
+          std::make_shared<const LagrangeCoefficients>(x_values);
+    }
+    c0 = (*lagrange_coefficients)->InterpolateConstant(y_values);
+  } else {
+    c0 = InterpolateConstant(x_values, y_values);
+  }
 
   // Now we have the key, decrypt.
   SymmetricCipher cipher;
@@ -83,9 +122,8 @@ ForculusDecrypter::Status ForculusDecrypter::Decrypt(
   // Our encryption scheme uses a zero nonce. (Note that C++11 initializes
   // the entire array to 0 with this syntax.)
   static const byte kZeroNonce[SymmetricCipher::NONCE_SIZE] = {0};
-  if (!cipher.Decrypt(kZeroNonce,
-                     reinterpret_cast<const byte*>(ciphertext_.data()),
-                     ciphertext_.size(), &recoverd_text)) {
+  if (!cipher.Decrypt(kZeroNonce, reinterpret_cast<const byte*>(ciphertext),
+                      ciphertext_size, &recoverd_text)) {
     // TODO(pseudorandom, rudominer) One reason that decryption might fail
     // is a ballot suppression attack. An adversary may intentionally flood
     // us with bad (x, y) values in order to keep us from decrypting a
@@ -15,12 +15,14 @@
 #ifndef COBALT_ALGORITHMS_FORCULUS_FORCULUS_DECRYPTER_H_
 #define COBALT_ALGORITHMS_FORCULUS_FORCULUS_DECRYPTER_H_
 
-#include <map>
+#include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "./observation.pb.h"
 #include "algorithms/forculus/field_element.h"
+#include "algorithms/forculus/polynomial_computations.h"
 #include "config/encodings.pb.h"
 
 namespace cobalt {
@@ -67,6 +69,15 @@ class ForculusDecrypter {
     kDecryptionFailed
   };
 
+  // A point (x, y) on the polynomial whose constant term is the key of a
+  // ciphertext.
+  struct Point {
+    Point(FieldElement x, FieldElement y) : x(x), y(y) {}
+
+    FieldElement x;
+    FieldElement y;
+  };
+
   ForculusDecrypter(uint32_t threshold, std::string ciphertext);
 
   // Adds an additional observation to the set of observations. If the
@@ -78,6 +89,16 @@ class ForculusDecrypter {
   // if the observation has the wrong ciphertext.
   Status AddObservation(const ForculusObservation& obs);
 
+  // Adds all of the points that were added to |other| to the set of
+  // observations, as if AddObservation() had been invoked here with each of
+  // the observations that were successfully added to |other|.
+  //
+  // Returns kWrongCiphertext if |other| has a different ciphertext. Returns
+  // kInconsistentPoints if |other| has a point with the same x-value as a
+  // point of this ForculusDecrypter but a different y-value. In that case
+  // this ForculusDecrypter can no longer be used.
+  Status Merge(const ForculusDecrypter& other);
+
   // Returns the number of distinct (x, y) values that have been successfully
   // added. The Decrypt() method may only be invoked after the size is at
   // least the |threshold| passed to the constructor.
@@ -104,14 +125,43 @@ class ForculusDecrypter {
     return ciphertext_;
   }
 
+  // Inserts |point| into |points|, which must be sorted by x-value with
+  // distinct x-values, unless |points| already has a point with the same
+  // x-value. Returns kInconsistentPoints if it has a point with the same
+  // x-value but a different y-value and kOK otherwise. This and
+  // DecryptWithPoints() allow a caller that manages its own storage, such as
+  // ForculusAnalyzer, to decrypt without a ForculusDecrypter.
+  static Status InsertPoint(const Point& point, std::vector<Point>* points);
+
+  // Decrypts the |ciphertext_size| bytes at |ciphertext| with the key found
+  // by interpolating the first |threshold| of the |points|, which must be
+  // sorted by x-value with distinct x-values, and writes the plain text to
+  // *plain_text_out. Returns kNotEnoughPoints if there are fewer than
+  // |threshold| points and kDecryptionFailed if the decryption fails.
+  //
+  // If |lagrange_coefficients| is not NULL then the Lagrange coefficients in
+  // it are used if they match the x-values, and it is set to the
+  // coefficients that were used.
+  static Status DecryptWithPoints(
+      uint32_t threshold, const std::vector<Point>& points,
+      const char* ciphertext, size_t ciphertext_size,
+      std::shared_ptr<const LagrangeCoefficients>* lagrange_coefficients,
+      std::string* plain_text_out);
+
  private:
   uint32_t threshold_;
   uint32_t num_seen_;
 
   std::string ciphertext_;
 
-  // A map from x-values to y-values.
-  std::map<FieldElement, FieldElement> points_;
+  // The distinct points, sorted by x-value.
+  std::vector<Point> points_;
+
+  // The Lagrange coefficients for the x-values used by the most recent
+  // invocation of Decrypt(). They are reused if Decrypt() is invoked again
+  // with the same x-values. They are immutable and so may be shared by
+  // copies of this ForculusDecrypter.
+  std::shared_ptr<const LagrangeCoefficients> lagrange_coefficients_;
 };
 
 }  // namespace forculus
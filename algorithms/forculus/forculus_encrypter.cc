@@ -147,6 +147,16 @@ ForculusEncrypter::Status ForculusEncrypter::EncryptValue(
   return Encrypt(serialized_value, observation_day_index, observation_out);
 }
 
+const size_t ForculusEncrypter::kDefaultMaxCacheSize;
+
+void ForculusEncrypter::set_max_cache_size(size_t max_cache_size) {
+  max_cache_size_ = max_cache_size;
+  while (cache_.size() > max_cache_size_) {
+    cache_index_.erase(cache_.back().plaintext);
+    cache_.pop_back();
+  }
+}
+
 ForculusEncrypter::Status ForculusEncrypter::Encrypt(
     const std::string& plaintext, uint32_t observation_day_index,
     ForculusObservation *observation_out) {
@@ -158,69 +168,123 @@ ForculusEncrypter::Status ForculusEncrypter::Encrypt(
   uint32_t epoch_index =
       EpochIndexFromDayIndex(observation_day_index, config_->epoch_type());
 
+  // Find or compute the master key, the coefficients of the polynomial and
+  // the ciphertext.
+  CacheEntry uncached_entry;
+  const CacheEntry* entry =
+      GetCacheEntry(plaintext, epoch_index, &uncached_entry);
+  if (!entry) {
+    return kEncryptionFailed;
+  }
+
+  // We derive a field element to be the x-value of a point on the polynomial.
+  // The derivation depends on both the master_key and the client secret.
+  // We use the master_key as the HMAC key and the client_secret as the
+  // HMAC argument.
+  std::vector<byte> element_bytes(crypto::hmac::TAG_SIZE);
+  crypto::hmac::HmacContext master_key_hmac = entry->master_key_hmac;
+  if (!master_key_hmac.Compute(client_secret_.data(),
+                               ClientSecret::kNumSecretBytes,
+                               element_bytes.data())) {
+    return kEncryptionFailed;
+  }
+  FieldElement point_x(std::move(element_bytes));
+
+  // Evaluate the polynomial at point_x to yield point_y.
+  FieldElement point_y = Evaluate(entry->coefficients, point_x);
+
+  // Build the return value.
+  point_x.CopyBytesToString(observation_out->mutable_point_x());
+  point_y.CopyBytesToString(observation_out->mutable_point_y());
+  *observation_out->mutable_ciphertext() = entry->ciphertext;
+  return kOK;
+}
+
+const ForculusEncrypter::CacheEntry* ForculusEncrypter::GetCacheEntry(
+    const std::string& plaintext, uint32_t epoch_index,
+    CacheEntry* uncached_entry) {
+  if (max_cache_size_ == 0) {
+    uncached_entry->plaintext = plaintext;
+    return ComputeCacheEntry(epoch_index, uncached_entry) ? uncached_entry
+                                                          : nullptr;
+  }
+
+  if (epoch_index != cache_epoch_index_) {
+    // The cached values are only valid within an epoch.
+    cache_.clear();
+    cache_index_.clear();
+    cache_epoch_index_ = epoch_index;
+  }
+  auto index_iter = cache_index_.find(plaintext);
+  if (index_iter != cache_index_.end()) {
+    // Move the entry to the front of the list.
+    cache_.splice(cache_.begin(), cache_, index_iter->second);
+    return &cache_.front();
+  }
+
+  CacheEntry entry;
+  entry.plaintext = plaintext;
+  if (!ComputeCacheEntry(epoch_index, &entry)) {
+    return nullptr;
+  }
+  if (cache_.size() >= max_cache_size_) {
+    cache_index_.erase(cache_.back().plaintext);
+    cache_.pop_back();
+  }
+  cache_.push_front(std::move(entry));
+  cache_index_.emplace(plaintext, cache_.begin());
+  return &cache_.front();
+}
+
+bool ForculusEncrypter::ComputeCacheEntry(uint32_t epoch_index,
+                                          CacheEntry* entry) {
   const uint32_t& threshold = config_->threshold();
 
   // We now derive the Forculus master key by invoking a random oracle on
   // all of the following data: customer_id, project_id, metric_id,
   // metric_part_name, epoch_index, threshold and plaintext.
-  std::vector<byte> master_key = DeriveMasterKey(customer_id_, project_id_,
-      metric_id_, metric_part_name_, epoch_index, threshold, plaintext);
-  if (master_key.empty()) {
-    return kEncryptionFailed;
+  entry->master_key = DeriveMasterKey(customer_id_, project_id_,
+      metric_id_, metric_part_name_, epoch_index, threshold, entry->plaintext);
+  if (entry->master_key.empty()) {
+    return false;
   }
 
   // We now derive |threshold| elements in the Forculus field to be the
   // coefficients of a polynomial of degree |threshold| - 1. We do this by
   // invoking HMAC(i) with successive values of i = 0, 1, ...
   // and using the master key as the HMAC key.
-  std::vector<FieldElement> coefficients;
+  if (!entry->master_key_hmac.SetKey(entry->master_key.data(),
+                                     entry->master_key.size())) {
+    return false;
+  }
+  entry->coefficients.clear();
+  entry->coefficients.reserve(threshold);
   for (uint32_t i = 0; i < threshold; i++) {
     std::vector<byte> coefficient_bytes(crypto::hmac::TAG_SIZE);
-    if (!HMAC(master_key.data(), master_key.size(),
-        reinterpret_cast<const byte*>(&i), sizeof(i),
-        coefficient_bytes.data())) {
-      return kEncryptionFailed;
+    if (!entry->master_key_hmac.Compute(reinterpret_cast<const byte*>(&i),
+                                        sizeof(i), coefficient_bytes.data())) {
+      return false;
     }
-    coefficients.emplace_back(std::move(coefficient_bytes));
+    entry->coefficients.emplace_back(std::move(coefficient_bytes));
   }
 
   // We use coefficients[0] as the symmetric key to perform deterministic
   // encryption of the plaintext.
   SymmetricCipher cipher;
-  cipher.set_key(coefficients[0].KeyBytes());
+  cipher.set_key(entry->coefficients[0].KeyBytes());
   // We use a zero-nonce to achieve deterministic encryption.
   static const byte kZeroNonce[SymmetricCipher::NONCE_SIZE] = {0};
   std::vector<byte> ciphertext;
   if (!cipher.Encrypt(kZeroNonce,
-      reinterpret_cast<const byte*>(plaintext.data()),
-      plaintext.size(), &ciphertext)) {
-    return kEncryptionFailed;
-  }
-
-  // We derive a field element to be the x-value of a point on the polynomial.
-  // The derivation depends on both the master_key and the client secret.
-  // We use the master_key as the HMAC key and the client_secret as the
-  // HMAC argument.
-  std::vector<byte> element_bytes(crypto::hmac::TAG_SIZE);
-  if (!HMAC(master_key.data(), master_key.size(),
-      client_secret_.data(), ClientSecret::kNumSecretBytes,
-      element_bytes.data())) {
-    return kEncryptionFailed;
+      reinterpret_cast<const byte*>(entry->plaintext.data()),
+      entry->plaintext.size(), &ciphertext)) {
+    return false;
   }
-  FieldElement point_x(std::move(element_bytes));
-
-  // Evaluate the polynomial at point_x to yield point_y.
-  FieldElement point_y = Evaluate(coefficients, point_x);
-
-  // Build the return value.
-  point_x.CopyBytesToString(observation_out->mutable_point_x());
-  point_y.CopyBytesToString(observation_out->mutable_point_y());
-  observation_out->mutable_ciphertext()->assign(
-      reinterpret_cast<const char*>(ciphertext.data()), ciphertext.size());
-  return kOK;
+  entry->ciphertext.assign(reinterpret_cast<const char*>(ciphertext.data()),
+                           ciphertext.size());
+  return true;
 }
 
 }  // namespace forculus
 
 }  // namespace cobalt
-
@@ -15,13 +15,18 @@
 #ifndef COBALT_ALGORITHMS_FORCULUS_FORCULUS_ENCRYPTER_H_
 #define COBALT_ALGORITHMS_FORCULUS_FORCULUS_ENCRYPTER_H_
 
+#include <list>
 #include <string>
 #include <memory>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "./observation.pb.h"
+#include "algorithms/forculus/field_element.h"
 #include "config/encodings.pb.h"
 #include "encoder/client_secret.h"
+#include "util/crypto_util/mac.h"
 
 namespace cobalt {
 namespace forculus {
@@ -30,6 +35,16 @@ class ForculusConfigValidator;
 
 // Encrypts a string value using Forculus threshold encryption. This API
 // is intended for use in the Cobalt Encoder.
+//
+// Most of the work of Encrypt() depends only on the plaintext and the epoch
+// and not on the client secret: deriving the master key and the |threshold|
+// coefficients of the polynomial, each with an HMAC, and encrypting the
+// plaintext. A ForculusEncrypter keeps these for the most recently encrypted
+// plaintexts of the current epoch, so that encrypting a repeated value costs
+// only the HMAC that derives the x-value and one polynomial evaluation. The
+// cache is cleared when the epoch changes. See set_max_cache_size().
+//
+// An instance of ForculusEncrypter is not thread-safe.
 class ForculusEncrypter {
  public:
   enum Status {
@@ -92,11 +107,56 @@ class ForculusEncrypter {
                       uint32_t observation_day_index,
                       ForculusObservation *observation_out);
 
+  // Sets the maximum number of plaintexts whose master key, coefficients and
+  // ciphertext are cached. The least recently used plaintext is evicted
+  // first. Each entry uses about 16 * threshold bytes plus the size of the
+  // plaintext and ciphertext. Zero disables the cache. The default is
+  // kDefaultMaxCacheSize.
+  void set_max_cache_size(size_t max_cache_size);
+
+  // The number of plaintexts that are currently cached.
+  size_t cache_size() const { return cache_index_.size(); }
+
+  static const size_t kDefaultMaxCacheSize = 64;
+
  private:
+  // The values derived from a plaintext in the current epoch that do not
+  // depend on the client secret.
+  struct CacheEntry {
+    std::string plaintext;
+    std::vector<byte> master_key;
+    // The HMAC key schedule of |master_key|, which is the key of the HMACs
+    // that derive the coefficients and the x-values.
+    crypto::hmac::HmacContext master_key_hmac;
+    std::vector<FieldElement> coefficients;
+    std::string ciphertext;
+  };
+
+  // Returns the CacheEntry for |plaintext| in the epoch |epoch_index|,
+  // computing it and, if the cache is enabled, caching it if necessary. In
+  // that case the entry is owned by the cache and is valid until the next
+  // invocation. Otherwise |*uncached_entry| is used. Returns NULL if the
+  // computation fails.
+  const CacheEntry* GetCacheEntry(const std::string& plaintext,
+                                  uint32_t epoch_index,
+                                  CacheEntry* uncached_entry);
+
+  // Computes the fields of |entry| for its plaintext in the epoch
+  // |epoch_index|. Returns false if the computation fails.
+  bool ComputeCacheEntry(uint32_t epoch_index, CacheEntry* entry);
+
   std::unique_ptr<ForculusConfigValidator> config_;
   uint32_t customer_id_, project_id_, metric_id_;
   std::string metric_part_name_;
   encoder::ClientSecret client_secret_;
+
+  // The cached entries, from the most to the least recently used, and an
+  // index of them by plaintext. All are for the epoch |cache_epoch_index_|.
+  size_t max_cache_size_ = kDefaultMaxCacheSize;
+  uint32_t cache_epoch_index_ = 0;
+  std::list<CacheEntry> cache_;
+  std::unordered_map<std::string, std::list<CacheEntry>::iterator>
+      cache_index_;
 };
 
 }  // namespace forculus
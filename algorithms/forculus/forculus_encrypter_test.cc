@@ -14,6 +14,9 @@
 
 #include "algorithms/forculus/forculus_encrypter.h"
 
+#include <algorithm>
+#include <string>
+
 #include "third_party/googletest/googletest/include/gtest/gtest.h"
 
 namespace cobalt {
@@ -267,6 +270,52 @@ TEST(ForculusEncrypterTest, EncryptValue) {
   EXPECT_NE(obs2.ciphertext(), obs3.ciphertext());
 }
 
+// Tests that the cache of master keys, coefficients and ciphertexts does not
+// change the output of Encrypt() and is bounded and cleared as documented.
+TEST(ForculusEncrypterTest, Cache) {
+  ForculusConfig config;
+  config.set_threshold(20);
+  std::string token = ClientSecret::GenerateNewSecret().GetToken();
+  ForculusEncrypter cached_encrypter(config, 1, 1, 1, "part1",
+                                     ClientSecret::FromToken(token));
+  ForculusEncrypter uncached_encrypter(config, 1, 1, 1, "part1",
+                                       ClientSecret::FromToken(token));
+  uncached_encrypter.set_max_cache_size(0);
+  EXPECT_EQ(0u, cached_encrypter.cache_size());
+
+  // Encrypting the same plaintexts repeatedly, on two days in different
+  // epochs, gives the same observations with and without the cache.
+  for (uint32_t day_index : {kDayIndex, kDayIndex + 1}) {
+    for (int i = 0; i < 3; i++) {
+      for (const std::string plaintext : {"Message 1", "Message 2"}) {
+        ForculusObservation cached_obs, uncached_obs;
+        EXPECT_EQ(ForculusEncrypter::kOK,
+                  cached_encrypter.Encrypt(plaintext, day_index, &cached_obs));
+        EXPECT_EQ(
+            ForculusEncrypter::kOK,
+            uncached_encrypter.Encrypt(plaintext, day_index, &uncached_obs));
+        EXPECT_EQ(uncached_obs.ciphertext(), cached_obs.ciphertext());
+        EXPECT_EQ(uncached_obs.point_x(), cached_obs.point_x());
+        EXPECT_EQ(uncached_obs.point_y(), cached_obs.point_y());
+      }
+    }
+    // The cache holds only the plaintexts of the current epoch.
+    EXPECT_EQ(2u, cached_encrypter.cache_size());
+    EXPECT_EQ(0u, uncached_encrypter.cache_size());
+  }
+
+  // The least recently used plaintexts are evicted.
+  cached_encrypter.set_max_cache_size(3);
+  ForculusObservation obs;
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(ForculusEncrypter::kOK,
+              cached_encrypter.Encrypt(std::to_string(i), kDayIndex, &obs));
+    EXPECT_EQ(std::min<size_t>(i + 1, 3), cached_encrypter.cache_size());
+  }
+  cached_encrypter.set_max_cache_size(1);
+  EXPECT_EQ(1u, cached_encrypter.cache_size());
+}
+
 }  // namespace forculus
 
 }  // namespace cobalt
@@ -20,9 +20,14 @@
 #include <chrono>
 #include <ctime>
 #include <fstream>
+#include <random>
 #include <streambuf>
+#include <string>
+#include <vector>
 
+#include "algorithms/forculus/field_element.h"
 #include "algorithms/forculus/forculus_encrypter.h"
+#include "algorithms/forculus/polynomial_computations.h"
 #include "encoder/client_secret.h"
 #include "third_party/googletest/googletest/include/gtest/gtest.h"
 
@@ -35,6 +40,19 @@ static const uint32_t kThreshold = 20;
 
 namespace {
 
+std::vector<FieldElement> RandomElements(size_t num_elements,
+                                         std::mt19937* random) {
+  std::vector<FieldElement> elements;
+  for (size_t i = 0; i < num_elements; i++) {
+    std::vector<byte> bytes(FieldElement::kDataSize);
+    for (byte& b : bytes) {
+      b = static_cast<byte>((*random)());
+    }
+    elements.emplace_back(std::move(bytes));
+  }
+  return elements;
+}
+
 ForculusObservation Encrypt(const std::string& plaintext, double* wall_timer,
                             double* cpu_timer) {
   // Make a config with the given threshold
@@ -149,6 +167,158 @@ TEST(ForculusPerformanceTest, OneMillionObservations) {
             << " seconds.\n";
   std::cout << "Total decryption cpu time: "
             << decryption_cpu_time / CLOCKS_PER_SEC << " seconds.\n";
+  std::cout << "Encryption throughput: "
+            << kExpectedNumObservations / encryption_wall_time
+            << " observations per second.\n";
+  std::cout << "Decryption throughput: "
+            << kExpectedNumObservations / decryption_wall_time
+            << " observations per second.\n";
+  std::cout << "\n=================================================\n";
+}
+
+// Measures the latency of the arithmetic operations of the Forculus field
+// GF(2^128).
+TEST(ForculusPerformanceTest, FieldArithmetic) {
+  static const int kNumMultiplications = 1000000;
+  static const int kNumInversions = 100000;
+  std::mt19937 random(1);
+  std::vector<FieldElement> elements = RandomElements(kThreshold, &random);
+
+  auto t_start = std::chrono::high_resolution_clock::now();
+  FieldElement product(true);
+  for (int i = 0; i < kNumMultiplications; i++) {
+    product *= elements[i % kThreshold];
+  }
+  auto t_end = std::chrono::high_resolution_clock::now();
+  double multiply_nanos =
+      std::chrono::duration<double, std::nano>(t_end - t_start).count() /
+      kNumMultiplications;
+  EXPECT_NE(FieldElement(false), product);
+
+  t_start = std::chrono::high_resolution_clock::now();
+  FieldElement sum(false);
+  for (int i = 0; i < kNumInversions; i++) {
+    sum += (elements[i % kThreshold] + product).Inverse();
+  }
+  t_end = std::chrono::high_resolution_clock::now();
+  double inverse_nanos =
+      std::chrono::duration<double, std::nano>(t_end - t_start).count() /
+      kNumInversions;
+
+  std::cout << "\n=================================================\n";
+  std::cout << "GF(2^128) multiplication: " << multiply_nanos
+            << " nanoseconds.\n";
+  std::cout << "GF(2^128) inversion: " << inverse_nanos << " nanoseconds.\n";
+  std::cout << "\n=================================================\n";
+}
+
+// Measures the latency of interpolating the constant term of a polynomial of
+// degree t - 1 from t points, which dominates the cost of
+// ForculusDecrypter::Decrypt() for large thresholds t. Compares computing
+// the Lagrange coefficients with a single batched inversion against the
+// previous method, which used one inversion per point, and against reusing
+// the Lagrange coefficients for a recurring set of x-values.
+TEST(ForculusPerformanceTest, Interpolation) {
+  std::mt19937 random(1);
+  std::cout << "\n=================================================\n";
+  for (size_t threshold : {10, 100, 1000}) {
+    std::vector<FieldElement> coefficients =
+        RandomElements(threshold, &random);
+    std::vector<FieldElement> x_values = RandomElements(threshold, &random);
+    std::vector<FieldElement> y_values;
+    for (const FieldElement& x : x_values) {
+      y_values.push_back(Evaluate(coefficients, x));
+    }
+    std::vector<const FieldElement*> x_pointers;
+    std::vector<const FieldElement*> y_pointers;
+    for (size_t i = 0; i < threshold; i++) {
+      x_pointers.push_back(&x_values[i]);
+      y_pointers.push_back(&y_values[i]);
+    }
+    const int num_iterations = 100000 / (threshold * threshold) + 1;
+
+    // The previous implementation of InterpolateConstant().
+    auto t_start = std::chrono::high_resolution_clock::now();
+    for (int n = 0; n < num_iterations; n++) {
+      FieldElement sigma(false);
+      FieldElement product_of_xi(true);
+      for (size_t i = 0; i < threshold; i++) {
+        product_of_xi *= x_values[i];
+        FieldElement prod_delta_ji(true);
+        for (size_t j = 0; j < threshold; j++) {
+          if (j != i) {
+            prod_delta_ji *= x_values[j] - x_values[i];
+          }
+        }
+        sigma += y_values[i] / (x_values[i] * prod_delta_ji);
+      }
+      EXPECT_EQ(coefficients[0], product_of_xi * sigma);
+    }
+    auto t_end = std::chrono::high_resolution_clock::now();
+    double per_point_inversion_micros =
+        std::chrono::duration<double, std::micro>(t_end - t_start).count() /
+        num_iterations;
+
+    t_start = std::chrono::high_resolution_clock::now();
+    for (int n = 0; n < num_iterations; n++) {
+      EXPECT_EQ(coefficients[0], InterpolateConstant(x_pointers, y_pointers));
+    }
+    t_end = std::chrono::high_resolution_clock::now();
+    double batched_inversion_micros =
+        std::chrono::duration<double, std::micro>(t_end - t_start).count() /
+        num_iterations;
+
+    LagrangeCoefficients lagrange_coefficients(x_pointers);
+    const int num_reuses = 100 * num_iterations;
+    t_start = std::chrono::high_resolution_clock::now();
+    for (int n = 0; n < num_reuses; n++) {
+      EXPECT_EQ(coefficients[0],
+                lagrange_coefficients.InterpolateConstant(y_pointers));
+    }
+    t_end = std::chrono::high_resolution_clock::now();
+    double reused_micros =
+        std::chrono::duration<double, std::micro>(t_end - t_start).count() /
+        num_reuses;
+
+    std::cout << "Interpolation of " << threshold << " points:\n";
+    std::cout << "  one inversion per point: " << per_point_inversion_micros
+              << " microseconds.\n";
+    std::cout << "  batched inversion: " << batched_inversion_micros
+              << " microseconds.\n";
+    std::cout << "  reused Lagrange coefficients: " << reused_micros
+              << " microseconds.\n";
+  }
+  std::cout << "\n=================================================\n";
+}
+
+// Measures the latency of encrypting a small set of repeated values, as a
+// client does for a metric with few distinct values, with and without the
+// ForculusEncrypter's cache of coefficients and ciphertexts.
+TEST(ForculusPerformanceTest, EncryptRepeatedValues) {
+  static const int kNumValues = 10;
+  static const int kNumEncryptions = 20000;
+  ForculusConfig config;
+  config.set_threshold(kThreshold);
+  config.set_epoch_type(DAY);
+  std::cout << "\n=================================================\n";
+  for (size_t max_cache_size : {0, 64}) {
+    ForculusEncrypter encrypter(config, 0, 0, 0, "",
+                                ClientSecret::GenerateNewSecret());
+    encrypter.set_max_cache_size(max_cache_size);
+    ForculusObservation obs;
+    auto t_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < kNumEncryptions; i++) {
+      EXPECT_EQ(ForculusEncrypter::kOK,
+                encrypter.Encrypt("value" + std::to_string(i % kNumValues), 0,
+                                  &obs));
+    }
+    auto t_end = std::chrono::high_resolution_clock::now();
+    double micros =
+        std::chrono::duration<double, std::micro>(t_end - t_start).count() /
+        kNumEncryptions;
+    std::cout << "Encrypt() with max_cache_size=" << max_cache_size << ": "
+              << micros << " microseconds.\n";
+  }
   std::cout << "\n=================================================\n";
 }
 
@@ -32,11 +32,9 @@ FieldElement FromInt(uint32_t x) {
 }  // namespace
 
 TEST(PolynomialComputationsTest, TestEvaluateSmallPolynomial) {
-  // NOTE: This test only makes sense with our temporary implementation of
-  // FieldElement. When we switch to the real implementation this test
-  // will have to change.
-
-  // Construct the 2nd degree polynomial 5 + 7x + 9x^2
+  // Construct the 2nd degree polynomial 5 + 7x + 9x^2 where the integer n
+  // denotes the field element whose polynomial has the binary digits of n as
+  // coefficients. So for example 7 = z^2 + z + 1.
   std::vector<FieldElement> coefficients;
   for (byte i = 5; i <=9 ; i+=2) {
     coefficients.emplace_back(FromInt(i));
@@ -53,11 +51,13 @@ TEST(PolynomialComputationsTest, TestEvaluateSmallPolynomial) {
   }
   EXPECT_EQ(sum, Evaluate(coefficients, FieldElement(true)));
 
-  // Evaluate at x = 2. Expect 5 + 14 + 36 = 55.
-  EXPECT_EQ(FromInt(55), Evaluate(coefficients, FromInt(2)));
+  // Evaluate at x = 2 = z. Multiplication by z is a left shift so we expect
+  // 5 + 14 + 36 = 0b101 ^ 0b1110 ^ 0b100100 = 0b101111 = 47.
+  EXPECT_EQ(FromInt(47), Evaluate(coefficients, FromInt(2)));
 
-  // Evaluate at x = 10. Expect 5 + 70 + 900 = 975 = ox3CF.
-  EXPECT_EQ(FromBytes({0xCF, 3}), Evaluate(coefficients, FromInt(10)));
+  // Evaluate at x = 10 = z^3 + z. Then x^2 = z^6 + z^2 = 68 and we expect
+  // 5 + 7 * 10 + 9 * 68 = 0b101 ^ 0b110110 ^ 0b1001100100 = 0x257.
+  EXPECT_EQ(FromBytes({0x57, 2}), Evaluate(coefficients, FromInt(10)));
 }
 
 TEST(PolynomialComputationsTest, TestEvaluateLargerPolynomial) {
@@ -80,10 +80,6 @@ TEST(PolynomialComputationsTest, TestEvaluateLargerPolynomial) {
 }
 
 TEST(PolynomialComputationsTest, TestInterpolateSmallPolynomial) {
-  // NOTE: This test only makes sense with our temporary implementation of
-  // FieldElement. When we switch to the real implementation this test
-  // will have to change.
-
   // Construct the 2nd degree polynomial 5 + 7x + 9x^2
   std::vector<FieldElement> coefficients;
   for (byte i = 5; i <=9 ; i+=2) {
@@ -183,6 +179,64 @@ TEST(PolynomialComputationsTest, TestInterpolate) {
   }
 }
 
+TEST(PolynomialComputationsTest, TestBatchInvert) {
+  std::vector<FieldElement> elements;
+  BatchInvert(&elements);
+  EXPECT_TRUE(elements.empty());
+
+  for (uint32_t x : {1, 2, 3, 1000, 123456789}) {
+    elements.push_back(FromInt(x));
+  }
+  std::vector<FieldElement> inverses(elements);
+  BatchInvert(&inverses);
+  ASSERT_EQ(elements.size(), inverses.size());
+  for (size_t i = 0; i < elements.size(); i++) {
+    EXPECT_EQ(elements[i].Inverse(), inverses[i]);
+    EXPECT_EQ(FieldElement(true), elements[i] * inverses[i]);
+  }
+}
+
+// Tests that one LagrangeCoefficients may be used to interpolate several
+// polynomials at the same x-values, including the x-value zero.
+TEST(PolynomialComputationsTest, TestLagrangeCoefficients) {
+  static const size_t kNumPoints = 10;
+  std::vector<FieldElement> x_values;
+  for (uint32_t x = 0; x < kNumPoints; x++) {
+    x_values.emplace_back(FromInt(x * 7919));
+  }
+  std::vector<const FieldElement*> x_value_pointers;
+  for (const FieldElement& x : x_values) {
+    x_value_pointers.push_back(&x);
+  }
+  LagrangeCoefficients lagrange_coefficients(x_value_pointers);
+  EXPECT_EQ(kNumPoints, lagrange_coefficients.size());
+  EXPECT_TRUE(lagrange_coefficients.Matches(x_value_pointers));
+
+  for (uint32_t c0 : {0, 1, 17, 1000000}) {
+    std::vector<FieldElement> coefficients;
+    for (size_t i = 0; i < kNumPoints; i++) {
+      coefficients.emplace_back(FromInt(c0 + 31 * i));
+    }
+    std::vector<FieldElement> y_values;
+    for (const FieldElement& x : x_values) {
+      y_values.push_back(Evaluate(coefficients, x));
+    }
+    std::vector<const FieldElement*> y_value_pointers;
+    for (const FieldElement& y : y_values) {
+      y_value_pointers.push_back(&y);
+    }
+    EXPECT_EQ(coefficients[0],
+              lagrange_coefficients.InterpolateConstant(y_value_pointers));
+  }
+
+  // Different x-values, or the same x-values in a different order, do not
+  // match.
+  std::swap(x_value_pointers[0], x_value_pointers[1]);
+  EXPECT_FALSE(lagrange_coefficients.Matches(x_value_pointers));
+  x_value_pointers.pop_back();
+  EXPECT_FALSE(lagrange_coefficients.Matches(x_value_pointers));
+}
+
 }  // namespace forculus
 }  // namespace cobalt
 
@@ -28,43 +28,100 @@ FieldElement Evaluate(const std::vector<FieldElement>& coefficients,
   return y;
 }
 
-FieldElement InterpolateConstant(
-    const std::vector<const FieldElement*>& x_values,
-    const std::vector<const FieldElement*>& y_values) {
+void BatchInvert(std::vector<FieldElement>* elements) {
+  size_t num_elements = elements->size();
+  if (num_elements == 0) {
+    return;
+  }
+  // prefix_products[i] is the product of elements[0], ... elements[i].
+  std::vector<FieldElement> prefix_products(*elements);
+  for (size_t i = 1; i < num_elements; i++) {
+    prefix_products[i] *= prefix_products[i - 1];
+  }
+
+  // Invert the product of all of the elements and then peel off one element
+  // at a time, from the last to the first. At the start of iteration i,
+  // inverse is the inverse of elements[0] * ... * elements[i].
+  FieldElement inverse = prefix_products[num_elements - 1].Inverse();
+  for (size_t i = num_elements - 1; i > 0; i--) {
+    FieldElement element_inverse = inverse * prefix_products[i - 1];
+    inverse *= (*elements)[i];
+    (*elements)[i] = element_inverse;
+  }
+  (*elements)[0] = inverse;
+}
+
+LagrangeCoefficients::LagrangeCoefficients(
+    const std::vector<const FieldElement*>& x_values) {
   size_t num_values = x_values.size();
-  // Our goal is to find c0, the constant term of the polynomial that passes
-  // through all of the points we were given. We use Lagrange Interpolation:
-  // https://en.wikipedia.org/wiki/Lagrange_polynomial
+  x_values_.reserve(num_values);
+  for (const FieldElement* x : x_values) {
+    x_values_.push_back(*x);
+  }
 
-  // Start by computing to the product of the x_i.
-  FieldElement product_of_xi(true);  // initialize to one
+  // Compute the numerators product_{j != i} x_j from the prefix and suffix
+  // products of the x_j. This avoids dividing by x_i, which may be zero.
+  coefficients_.assign(num_values, FieldElement(true));
+  FieldElement prefix_product(true);
   for (size_t i = 0; i < num_values; i++) {
-    product_of_xi*= *x_values[i];
+    coefficients_[i] = prefix_product;
+    prefix_product *= x_values_[i];
+  }
+  FieldElement suffix_product(true);
+  for (size_t i = num_values; i-- > 0;) {
+    coefficients_[i] *= suffix_product;
+    suffix_product *= x_values_[i];
   }
 
-  // Next compute :
-  //
-  //                              y_i
-  // sigma = Sum_i  -----------------------------------
-  //                 x_i * product_{j != i} (x_j - x_i)
-  //
-  //
-  FieldElement sigma(false);  // initialize to zero
+  // Compute the denominators product_{j != i} (x_j - x_i) and invert them
+  // all at once.
+  std::vector<FieldElement> denominators(num_values, FieldElement(true));
   for (size_t i = 0; i < num_values; i++) {
-    FieldElement prod_delta_ji(true);  // initialize to one
-    for (size_t j = 0; j < num_values; j++) {
-      if (j == i) {
-        continue;
-      }
-      prod_delta_ji *= (*x_values[j] - *x_values[i]);
+    for (size_t j = i + 1; j < num_values; j++) {
+      // In a field of characteristic 2, x_j - x_i = x_i - x_j.
+      FieldElement delta_ij = x_values_[j] - x_values_[i];
+      denominators[i] *= delta_ij;
+      denominators[j] *= delta_ij;
     }
-    sigma+= *y_values[i]/(*x_values[i] * prod_delta_ji);
   }
+  BatchInvert(&denominators);
 
-  // Finally our desired value is product_of_xi * sigma.
-  return product_of_xi * sigma;
+  for (size_t i = 0; i < num_values; i++) {
+    coefficients_[i] *= denominators[i];
+  }
+}
+
+bool LagrangeCoefficients::Matches(
+    const std::vector<const FieldElement*>& x_values) const {
+  if (x_values.size() != x_values_.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < x_values_.size(); i++) {
+    if (*x_values[i] != x_values_[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+FieldElement LagrangeCoefficients::InterpolateConstant(
+    const std::vector<const FieldElement*>& y_values) const {
+  // We use Lagrange Interpolation:
+  // https://en.wikipedia.org/wiki/Lagrange_polynomial
+  // c0 is the sum of the y_i weighted by the values at zero of the Lagrange
+  // basis polynomials, which we computed in the constructor.
+  FieldElement c0(false);  // initialize to zero
+  for (size_t i = 0; i < coefficients_.size(); i++) {
+    c0 += coefficients_[i] * *y_values[i];
+  }
+  return c0;
+}
+
+FieldElement InterpolateConstant(
+    const std::vector<const FieldElement*>& x_values,
+    const std::vector<const FieldElement*>& y_values) {
+  return LagrangeCoefficients(x_values).InterpolateConstant(y_values);
 }
 
 }  // namespace forculus
 }  // namespace cobalt
-
@@ -30,10 +30,57 @@ namespace forculus {
 FieldElement Evaluate(const std::vector<FieldElement>& coefficients,
     FieldElement x);
 
+// Replaces each of the |elements| by its inverse using Montgomery's trick,
+// which takes one field inversion and 3 * (n - 1) multiplications where
+// n = elements->size().
+// REQUIRES: None of the |elements| is zero.
+void BatchInvert(std::vector<FieldElement>* elements);
+
+// The Lagrange coefficients for the constant term of a polynomial
+// interpolated at a fixed set of distinct x-values x0, x1, ... x_d. That is,
+// the values
+//
+//   l_i = product_{j != i} x_j / (x_j - x_i)
+//
+// such that c0 = Sum_i l_i * y_i for the unique polynomial of degree d that
+// passes through the points (x0, y0), (x1, y1), ... (x_{d}, y_{d}).
+//
+// Computing the coefficients takes O(d^2) multiplications and a single field
+// inversion. Once they are computed each interpolation at the same x-values
+// takes O(d) multiplications, so an instance should be kept and reused for
+// as long as the x-values recur.
+class LagrangeCoefficients {
+ public:
+  // REQUIRES: The x_values are distinct.
+  explicit LagrangeCoefficients(
+      const std::vector<const FieldElement*>& x_values);
+
+  // Returns whether |x_values| are the x-values that were passed to the
+  // constructor, in the same order.
+  bool Matches(const std::vector<const FieldElement*>& x_values) const;
+
+  // Computes the constant term c0 of the unique polynomial of degree d that
+  // passes through the points (x_i, y_i) where the x_i are the x-values that
+  // were passed to the constructor and yi = y_values[i].
+  // REQUIRES: y_values.size() == size().
+  FieldElement InterpolateConstant(
+      const std::vector<const FieldElement*>& y_values) const;
+
+  size_t size() const { return x_values_.size(); }
+
+ private:
+  std::vector<FieldElement> x_values_;
+  std::vector<FieldElement> coefficients_;
+};
+
 // Computes the constant term c0 of the unique polynomial of degree d that
 // passes through the points (x0, y0), (x1, y1), ... (x_{d}, y_{d})
 // xi = x_values[i], yi = y_values[i] and d = x_values.size() - 1.
 // REQUIRES: x_values.size() == y_value.size() and the x_values are distinct.
+//
+// This is equivalent to LagrangeCoefficients(x_values).InterpolateConstant(
+// y_values). Use LagrangeCoefficients directly to interpolate repeatedly at
+// the same x-values.
 FieldElement InterpolateConstant(
     const std::vector<const FieldElement*>& x_values,
     const std::vector<const FieldElement*>& y_values);
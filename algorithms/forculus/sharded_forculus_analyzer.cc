@@ -0,0 +1,260 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/forculus/sharded_forculus_analyzer.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <utility>
+
+namespace cobalt {
+namespace forculus {
+
+namespace {
+
+// The capacity of the queue of each shard. Must be a power of 2.
+const size_t kQueueCapacity = 1024;
+
+// The number of times a thread that finds a queue full or empty yields before
+// it starts to sleep between attempts.
+const int kMaxYields = 100;
+
+// How long a thread sleeps between attempts once it has yielded kMaxYields
+// times.
+const std::chrono::microseconds kSleepTime(100);
+
+// Waits before the next attempt to push to a full queue or pop from an empty
+// one. |attempts| is the number of attempts so far.
+void Backoff(int* attempts) {
+  if (++*attempts <= kMaxYields) {
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(kSleepTime);
+  }
+}
+
+// A lock-free bounded queue with a single producer and a single consumer. The
+// slots are reused, so that pushing an observation copies it into a
+// ForculusObservation whose strings have usually already been allocated.
+template <typename T>
+class SingleProducerQueue {
+ public:
+  explicit SingleProducerQueue(size_t capacity)
+      : slots_(capacity), mask_(capacity - 1) {
+    CHECK_EQ(0u, capacity & mask_) << "capacity must be a power of 2";
+  }
+
+  // Returns the slot to be filled by the next push, or NULL if the queue is
+  // full. May only be invoked by the producer, which must then fill the slot
+  // and invoke Push().
+  T* Back() {
+    size_t tail = counters_.tail.load(std::memory_order_relaxed);
+    size_t head = counters_.head.load(std::memory_order_acquire);
+    if (tail - head == slots_.size()) {
+      return nullptr;
+    }
+    return &slots_[tail & mask_];
+  }
+
+  // Publishes the slot returned by Back() to the consumer.
+  void Push() {
+    counters_.tail.store(counters_.tail.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_release);
+  }
+
+  // Returns the oldest slot that has been pushed, or NULL if the queue is
+  // empty. May only be invoked by the consumer, which must then invoke Pop()
+  // once it is done with the slot.
+  T* Front() {
+    size_t head = counters_.head.load(std::memory_order_relaxed);
+    if (head == counters_.tail.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &slots_[head & mask_];
+  }
+
+  // Returns the slot returned by Front() to the producer.
+  void Pop() {
+    counters_.head.store(counters_.head.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_release);
+  }
+
+ private:
+  std::vector<T> slots_;
+  const size_t mask_;
+
+  // The number of slots that have been popped and pushed respectively. They
+  // are padded onto separate cache lines so that the producer and the
+  // consumer do not contend for one.
+  struct Counters {
+    char padding0[64];
+    std::atomic<size_t> head{0};
+    char padding1[64];
+    std::atomic<size_t> tail{0};
+  } counters_;
+};
+
+// An element of the queue of a shard.
+struct QueuedObservation {
+  uint32_t day_index = 0;
+  ForculusObservation observation;
+};
+
+}  // namespace
+
+struct ShardedForculusAnalyzer::Shard {
+  explicit Shard(const ForculusConfig& config)
+      : analyzer(config), queue(kQueueCapacity) {}
+
+  ForculusAnalyzer analyzer;
+  SingleProducerQueue<QueuedObservation> queue;
+  std::thread thread;
+
+  // Set by the producer when no more observations will be pushed.
+  std::atomic<bool> done{false};
+
+  // Set by the destructor to stop the thread without draining the queue.
+  std::atomic<bool> cancelled{false};
+};
+
+ShardedForculusAnalyzer::ShardedForculusAnalyzer(
+    const cobalt::ForculusConfig& config, size_t num_shards) {
+  num_shards = std::max<size_t>(num_shards, 1);
+  for (size_t i = 0; i < num_shards; i++) {
+    shards_.emplace_back(new Shard(config));
+  }
+}
+
+ShardedForculusAnalyzer::~ShardedForculusAnalyzer() {
+  for (auto& shard : shards_) {
+    shard->cancelled.store(true, std::memory_order_release);
+  }
+  Finish();
+}
+
+void ShardedForculusAnalyzer::set_memory_budget(
+    size_t memory_budget, const std::string& spill_directory) {
+  CHECK(!started_) << "set_memory_budget() invoked after AddObservation()";
+  for (auto& shard : shards_) {
+    shard->analyzer.set_memory_budget(memory_budget / shards_.size(),
+                                      spill_directory);
+  }
+}
+
+bool ShardedForculusAnalyzer::AddObservation(uint32_t day_index,
+                                             const ForculusObservation& obs) {
+  CHECK(!finished_) << "AddObservation() invoked after the analysis finished";
+  if (!started_) {
+    for (auto& shard : shards_) {
+      shard->thread = std::thread(Run, shard.get());
+    }
+    started_ = true;
+  }
+  // Use the high bits of the fingerprint so that the shards' hash tables,
+  // which use the same fingerprint, see well-distributed hashes.
+  uint64_t fingerprint =
+      ForculusAnalyzer::CiphertextFingerprint(obs.ciphertext());
+  Shard* shard = shards_[(fingerprint >> 32) % shards_.size()].get();
+
+  int attempts = 0;
+  QueuedObservation* slot;
+  while (!(slot = shard->queue.Back())) {
+    Backoff(&attempts);
+  }
+  slot->day_index = day_index;
+  slot->observation.CopyFrom(obs);
+  shard->queue.Push();
+  return true;
+}
+
+size_t ShardedForculusAnalyzer::num_observations() {
+  Finish();
+  size_t num_observations = 0;
+  for (auto& shard : shards_) {
+    num_observations += shard->analyzer.num_observations();
+  }
+  return num_observations;
+}
+
+size_t ShardedForculusAnalyzer::observation_errors() {
+  Finish();
+  size_t observation_errors = 0;
+  for (auto& shard : shards_) {
+    observation_errors += shard->analyzer.observation_errors();
+  }
+  return observation_errors;
+}
+
+std::map<std::string, std::unique_ptr<ForculusAnalyzer::ResultInfo>>
+ShardedForculusAnalyzer::TakeResults() {
+  Finish();
+  std::map<std::string, std::unique_ptr<ForculusAnalyzer::ResultInfo>> results;
+  for (auto& shard : shards_) {
+    for (auto& entry : shard->analyzer.TakeResults()) {
+      auto results_iter = results.find(entry.first);
+      if (results_iter == results.end()) {
+        results.emplace(entry.first, std::move(entry.second));
+      } else {
+        // The same plain text was recovered from different ciphertexts, and
+        // so from different epochs, in different shards.
+        results_iter->second->total_count += entry.second->total_count;
+        results_iter->second->num_epochs += entry.second->num_epochs;
+      }
+    }
+  }
+  return results;
+}
+
+void ShardedForculusAnalyzer::Finish() {
+  if (finished_) {
+    return;
+  }
+  finished_ = true;
+  if (!started_) {
+    return;
+  }
+  for (auto& shard : shards_) {
+    shard->done.store(true, std::memory_order_release);
+  }
+  for (auto& shard : shards_) {
+    shard->thread.join();
+  }
+}
+
+void ShardedForculusAnalyzer::Run(Shard* shard) {
+  int attempts = 0;
+  while (!shard->cancelled.load(std::memory_order_acquire)) {
+    QueuedObservation* item = shard->queue.Front();
+    if (!item) {
+      // Check |done| before looking at the queue once more, so that an
+      // observation pushed just before |done| was set is not missed.
+      if (shard->done.load(std::memory_order_acquire) &&
+          !shard->queue.Front()) {
+        return;
+      }
+      Backoff(&attempts);
+      continue;
+    }
+    attempts = 0;
+    shard->analyzer.AddObservation(item->day_index, item->observation);
+    shard->queue.Pop();
+  }
+}
+
+}  // namespace forculus
+}  // namespace cobalt
@@ -0,0 +1,107 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COBALT_ALGORITHMS_FORCULUS_SHARDED_FORCULUS_ANALYZER_H_
+#define COBALT_ALGORITHMS_FORCULUS_SHARDED_FORCULUS_ANALYZER_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "./observation.pb.h"
+#include "algorithms/forculus/forculus_analyzer.h"
+#include "config/encodings.pb.h"
+
+namespace cobalt {
+namespace forculus {
+
+// A ShardedForculusAnalyzer performs a single Forculus analysis, like a
+// ForculusAnalyzer, using several threads.
+//
+// Forculus decryption operates independently on each group of observations
+// with the same (epoch_index, ciphertext). A ShardedForculusAnalyzer
+// therefore partitions the observations among |num_shards| ForculusAnalyzers,
+// the shards, by the fingerprint of their ciphertext, so that each group is
+// analyzed by exactly one shard. Each shard runs on its own thread and
+// receives its observations through a lock-free queue with a single
+// producer, the thread that invokes AddObservation(), and a single consumer,
+// the shard's thread. Since no group is split between shards their results
+// are combined simply by adding their ResultInfos.
+//
+// Usage is as for a ForculusAnalyzer: invoke AddObservation() repeatedly and
+// then TakeResults(). Invoking num_observations(), observation_errors() or
+// TakeResults() first waits for the shards to finish analyzing all of the
+// observations that have been added, after which no more observations may be
+// added.
+//
+// AddObservation() must always be invoked from the same thread. The
+// instance is otherwise not thread-safe.
+class ShardedForculusAnalyzer {
+ public:
+  // Constructs a ShardedForculusAnalyzer for the given config with
+  // |num_shards| shards, and so |num_shards| threads.
+  ShardedForculusAnalyzer(const cobalt::ForculusConfig& config,
+                          size_t num_shards);
+
+  // Stops the threads, if they are running, without analyzing the remaining
+  // observations.
+  ~ShardedForculusAnalyzer();
+
+  // Divides |memory_budget| evenly among the shards. See
+  // ForculusAnalyzer::set_memory_budget(). Must be invoked before any
+  // observations are added.
+  void set_memory_budget(size_t memory_budget,
+                         const std::string& spill_directory);
+
+  // Queues |obs| for analysis by the shard for its ciphertext, waiting for
+  // room in the shard's queue if necessary. The threads are started by the
+  // first invocation.
+  //
+  // Unlike ForculusAnalyzer::AddObservation(), this does not know whether the
+  // observation will be added without error and always returns true. Errors
+  // are counted by observation_errors().
+  bool AddObservation(uint32_t day_index, const ForculusObservation& obs);
+
+  // The sums of the values of ForculusAnalyzer::num_observations() and
+  // ForculusAnalyzer::observation_errors() of the shards.
+  size_t num_observations();
+  size_t observation_errors();
+
+  // Returns the results of the Forculus analysis as a map. See
+  // ForculusAnalyzer::TakeResults().
+  std::map<std::string, std::unique_ptr<ForculusAnalyzer::ResultInfo>>
+  TakeResults();
+
+  size_t num_shards() const { return shards_.size(); }
+
+ private:
+  struct Shard;
+
+  // Waits for the shards to analyze all of the queued observations and
+  // stops their threads.
+  void Finish();
+
+  // The thread body of |shard|.
+  static void Run(Shard* shard);
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  bool started_ = false;
+  bool finished_ = false;
+};
+
+}  // namespace forculus
+}  // namespace cobalt
+
+#endif  // COBALT_ALGORITHMS_FORCULUS_SHARDED_FORCULUS_ANALYZER_H_
@@ -0,0 +1,131 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/forculus/sharded_forculus_analyzer.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "algorithms/forculus/forculus_encrypter.h"
+#include "encoder/client_secret.h"
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+
+namespace cobalt {
+namespace forculus {
+
+using encoder::ClientSecret;
+
+namespace {
+
+const uint32_t kThreshold = 5;
+
+// Returns |num_clients| observations of |plaintext| on |day_index|, one from
+// each of |num_clients| different clients.
+std::vector<ForculusObservation> Encrypt(uint32_t day_index,
+                                         const std::string& plaintext,
+                                         int num_clients) {
+  ForculusConfig config;
+  config.set_threshold(kThreshold);
+  std::vector<ForculusObservation> observations(num_clients);
+  for (auto& obs : observations) {
+    ForculusEncrypter encrypter(config, 0, 0, 0, "",
+                                ClientSecret::GenerateNewSecret());
+    EXPECT_EQ(ForculusEncrypter::kOK,
+              encrypter.Encrypt(plaintext, day_index, &obs));
+  }
+  return observations;
+}
+
+}  // namespace
+
+// Tests that a ShardedForculusAnalyzer gets the same results as a
+// ForculusAnalyzer for various numbers of shards.
+TEST(ShardedForculusAnalyzerTest, SameAsForculusAnalyzer) {
+  // Plaintexts that are decrypted on one day, on two days, or not at all,
+  // plus an inconsistent observation.
+  std::vector<std::pair<uint32_t, ForculusObservation>> observations;
+  for (int i = 0; i < 40; i++) {
+    std::string plaintext = "plaintext" + std::to_string(i);
+    int num_clients = i % 3 == 0 ? kThreshold - 1 : kThreshold + i % 4;
+    for (uint32_t day_index = 0; day_index <= static_cast<uint32_t>(i % 2);
+         day_index++) {
+      for (const auto& obs : Encrypt(day_index, plaintext, num_clients)) {
+        observations.emplace_back(day_index, obs);
+        // Some clients send their observation twice.
+        if (i % 5 == 0) {
+          observations.emplace_back(day_index, obs);
+        }
+      }
+    }
+  }
+  ForculusObservation inconsistent_obs = observations[0].second;
+  inconsistent_obs.set_point_y(observations[2].second.point_y());
+  observations.emplace_back(observations[0].first, inconsistent_obs);
+
+  ForculusConfig config;
+  config.set_threshold(kThreshold);
+  ForculusAnalyzer expected_analyzer(config);
+  for (const auto& entry : observations) {
+    expected_analyzer.AddObservation(entry.first, entry.second);
+  }
+  size_t expected_num_observations = expected_analyzer.num_observations();
+  size_t expected_observation_errors = expected_analyzer.observation_errors();
+  EXPECT_EQ(1u, expected_observation_errors);
+  auto expected_results = expected_analyzer.TakeResults();
+  EXPECT_EQ(26u, expected_results.size());
+
+  for (size_t num_shards : {1, 2, 3, 8}) {
+    SCOPED_TRACE(num_shards);
+    ShardedForculusAnalyzer analyzer(config, num_shards);
+    EXPECT_EQ(num_shards, analyzer.num_shards());
+    for (const auto& entry : observations) {
+      EXPECT_TRUE(analyzer.AddObservation(entry.first, entry.second));
+    }
+    EXPECT_EQ(expected_num_observations, analyzer.num_observations());
+    EXPECT_EQ(expected_observation_errors, analyzer.observation_errors());
+    auto results = analyzer.TakeResults();
+    ASSERT_EQ(expected_results.size(), results.size());
+    for (const auto& expected_result : expected_results) {
+      SCOPED_TRACE(expected_result.first);
+      ASSERT_EQ(1u, results.count(expected_result.first));
+      EXPECT_EQ(expected_result.second->total_count,
+                results[expected_result.first]->total_count);
+      EXPECT_EQ(expected_result.second->num_epochs,
+                results[expected_result.first]->num_epochs);
+    }
+  }
+}
+
+// Tests that a ShardedForculusAnalyzer may be destroyed with or without any
+// observations having been added or taken.
+TEST(ShardedForculusAnalyzerTest, Destroy) {
+  ForculusConfig config;
+  config.set_threshold(kThreshold);
+  { ShardedForculusAnalyzer analyzer(config, 4); }
+  {
+    ShardedForculusAnalyzer analyzer(config, 4);
+    EXPECT_EQ(0u, analyzer.num_observations());
+    EXPECT_TRUE(analyzer.TakeResults().empty());
+  }
+  {
+    ShardedForculusAnalyzer analyzer(config, 4);
+    for (const auto& obs : Encrypt(0, "plaintext", 100)) {
+      analyzer.AddObservation(0, obs);
+    }
+  }
+}
+
+}  // namespace forculus
+}  // namespace cobalt
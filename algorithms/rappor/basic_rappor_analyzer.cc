@@ -29,16 +29,34 @@ const char kBasicRapporAnalyzerConstructorFailure[] =
     "basic-rappor-analyzer-constructor-failure";
 const char kAddObservationFailure[] =
     "basic-rappor-analyzer-add-observation-failure";
+
+// Returns true if |a| and |b| are the same categories in the same order, so
+// that a bit index denotes the same category in both.
+bool SameCategories(const std::vector<ValuePart>& a,
+                    const std::vector<ValuePart>& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].SerializeAsString() != b[i].SerializeAsString()) {
+      return false;
+    }
+  }
+  return true;
+}
 }  // namespace
 
 BasicRapporAnalyzer::BasicRapporAnalyzer(const BasicRapporConfig& config)
-    : config_(new RapporConfigValidator(config)), num_encoding_bytes_(0) {
+    : config_(new RapporConfigValidator(config)),
+      bit_accumulator_(0),
+      num_encoding_bytes_(0) {
   if (!config_->valid()) {
     LOG_STACKDRIVER_COUNT_METRIC(ERROR, kBasicRapporAnalyzerConstructorFailure)
         << "BasicRapporConfig is invalid";
     return;
   }
   category_counts_.resize(config_->num_bits(), 0);
+  bit_accumulator_ = BitAccumulator(config_->num_bits());
   num_encoding_bytes_ = (config_->num_bits() + 7) / 8;
 }
 
@@ -59,33 +77,56 @@ bool BasicRapporAnalyzer::AddObservation(const BasicRapporObservation& obs) {
   // We have a good observation.
   num_observations_++;
 
-  // We iterate through the bits of the observation "from right to left",
-  // i.e. from the least-significant bit of the last byte to the
-  // most-significant bit of the first byte. If the ith bit is set we increment
-  // category_counts_[i].
-  //
-  // NOTE(rudominer) Possible performance optimizations: Consider using x86
-  // vector operations or the find-first-bit-set instruction or simply checking
-  // for zero bytes.
-  size_t category = 0;
-  for (int byte_index = obs.data().size() - 1; byte_index >= 0; byte_index--) {
-    uint8_t bit_mask = 1;
-    for (int bit_index = 0; bit_index < 8; bit_index++) {
-      if (category >= category_counts_.size()) {
-        return true;
-      }
-      if (bit_mask & obs.data()[byte_index]) {
-        category_counts_[category]++;
-      }
-      category++;
-      bit_mask <<= 1;
-    }
+  bit_accumulator_.Add(obs.data(), &category_counts_);
+  return true;
+}
+
+size_t BasicRapporAnalyzer::AddObservations(const uint8_t* data,
+                                            size_t num_observations,
+                                            size_t stride) {
+  if (!config_->valid()) {
+    LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationFailure)
+        << "BasicRapporConfig is invalid";
+    observation_errors_ += num_observations;
+    return 0;
+  }
+  if (stride < num_encoding_bytes_) {
+    LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationFailure)
+        << "Batch of BasicRapporObservations has a stride of " << stride
+        << " bytes which is less than the observation size of "
+        << num_encoding_bytes_;
+    observation_errors_ += num_observations;
+    return 0;
+  }
+  for (size_t i = 0; i < num_observations; i++) {
+    bit_accumulator_.Add(data + i * stride, &category_counts_);
+  }
+  num_observations_ += num_observations;
+  return num_observations;
+}
+
+bool BasicRapporAnalyzer::Merge(const BasicRapporAnalyzer& other) {
+  if (!config_->valid() || !other.config_->valid() ||
+      config_->num_bits() != other.config_->num_bits() ||
+      config_->prob_0_becomes_1() != other.config_->prob_0_becomes_1() ||
+      config_->prob_1_stays_1() != other.config_->prob_1_stays_1() ||
+      !SameCategories(config_->categories(), other.config_->categories())) {
+    LOG(ERROR) << "Attempt to merge BasicRapporAnalyzers with different "
+                  "configs.";
+    return false;
+  }
+  for (size_t i = 0; i < category_counts_.size(); i++) {
+    category_counts_[i] += other.category_counts_[i];
   }
+  other.bit_accumulator_.AddPendingCounts(&category_counts_);
+  num_observations_ += other.num_observations_;
+  observation_errors_ += other.observation_errors_;
   return true;
 }
 
 std::vector<BasicRapporAnalyzer::CategoryResult>
 BasicRapporAnalyzer::Analyze() {
+  bit_accumulator_.Flush(&category_counts_);
   double q = config_->prob_1_stays_1();
   double p = config_->prob_0_becomes_1();
   double N = num_observations_;
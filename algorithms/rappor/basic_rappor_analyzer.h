@@ -19,6 +19,7 @@
 #include <vector>
 
 #include "./observation.pb.h"
+#include "algorithms/rappor/bit_accumulator.h"
 #include "algorithms/rappor/rappor_config_validator.h"
 #include "config/encodings.pb.h"
 
@@ -42,6 +43,32 @@ class BasicRapporAnalyzer {
   // an error and so observation_errors() was incremented.
   bool AddObservation(const BasicRapporObservation& obs);
 
+  // Adds a batch of |num_observations| observations stored in columnar form,
+  // without the use of BasicRapporObservation protos. This is equivalent to
+  // invoking AddObservation() once for each of them but is faster.
+  //
+  // The data of the i-th observation is stored in the (num_categories + 7) / 8
+  // bytes beginning at |data| + i * |stride|, in the same byte order as
+  // BasicRapporObservation::data(). |stride| must therefore be at least
+  // (num_categories + 7) / 8.
+  //
+  // Returns the number of observations that were added without error. The
+  // remaining observations were discarded and counted in
+  // observation_errors().
+  size_t AddObservations(const uint8_t* data, size_t num_observations,
+                         size_t stride);
+
+  // Adds the counts accumulated by |other| into this BasicRapporAnalyzer.
+  // After this returns true, this BasicRapporAnalyzer is in the same state as
+  // if all of the observations added to |other| had also been added to it.
+  // This allows the observations for a single report to be counted by several
+  // BasicRapporAnalyzers in parallel, one per thread, and then combined.
+  //
+  // |other| is not modified. Returns false, and does nothing, if |other| was
+  // not constructed with an equivalent valid BasicRapporConfig: one with the
+  // same probabilities and the same categories in the same order.
+  bool Merge(const BasicRapporAnalyzer& other);
+
   // The number of times that AddObservation() was invoked minus the value
   // of observation_errors().
   size_t num_observations() const { return num_observations_; }
@@ -83,15 +110,20 @@ class BasicRapporAnalyzer {
 
   // Gives access to the raw counts for each category based on the observations
   // added via AddObservation(). This is mostly useful for tests.
-  const std::vector<size_t>& raw_category_counts() { return category_counts_; }
+  const std::vector<size_t>& raw_category_counts() {
+    bit_accumulator_.Flush(&category_counts_);
+    return category_counts_;
+  }
 
   std::unique_ptr<RapporConfigValidator> config_;
   size_t num_observations_ = 0;
   size_t observation_errors_ = 0;
 
   // The raw counts for each category based on the observations added
-  // via AddObservation().
+  // via AddObservation(). Some of the counts may still be pending in
+  // |bit_accumulator_|.
   std::vector<size_t> category_counts_;
+  BitAccumulator bit_accumulator_;
 
   // The number of bytes used to encode observations. This is a function
   // of the |config_|.
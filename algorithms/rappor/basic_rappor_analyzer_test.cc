@@ -417,6 +417,94 @@ TEST_F(BasicRapporAnalyzerTest, RawCountsThousandCategories) {
   }
 }
 
+// Tests that AddObservations() agrees with AddObservation() when given a
+// columnar batch of observations.
+TEST_F(BasicRapporAnalyzerTest, AddObservationsBatch) {
+  static const size_t kNumObservations = 1000;
+  // Each observation of 10 categories occupies 2 bytes. We pack them
+  // contiguously.
+  static const size_t kStride = 2;
+  SetAnalyzer(10);
+  BasicRapporAnalyzer expected_analyzer(
+      Config(10, prob_0_becomes_1_, prob_1_stays_1_));
+
+  std::vector<uint8_t> data(kNumObservations * kStride);
+  for (size_t i = 0; i < kNumObservations; i++) {
+    data[i * kStride] = i % 4;
+    data[i * kStride + 1] = i % 253;
+    BasicRapporObservation obs;
+    obs.set_data(
+        std::string(reinterpret_cast<const char*>(&data[i * kStride]), 2));
+    EXPECT_TRUE(expected_analyzer.AddObservation(obs));
+  }
+  EXPECT_EQ(kNumObservations,
+            analyzer_->AddObservations(data.data(), kNumObservations, kStride));
+  CheckState(kNumObservations, 0);
+  auto expected_results = expected_analyzer.Analyze();
+  auto results = analyzer_->Analyze();
+  ASSERT_EQ(expected_results.size(), results.size());
+  for (size_t i = 0; i < results.size(); i++) {
+    EXPECT_EQ(expected_results[i].count_estimate, results[i].count_estimate);
+    EXPECT_EQ(expected_results[i].std_error, results[i].std_error);
+  }
+
+  // A stride that is smaller than an observation is an error.
+  EXPECT_EQ(0u, analyzer_->AddObservations(data.data(), 10, 1));
+  CheckState(kNumObservations, 10);
+}
+
+// Tests that merging BasicRapporAnalyzers that have each been given part of
+// the observations gives the same results as a single BasicRapporAnalyzer
+// given all of them.
+TEST_F(BasicRapporAnalyzerTest, Merge) {
+  SetAnalyzer(10);
+  BasicRapporConfig config = Config(10, prob_0_becomes_1_, prob_1_stays_1_);
+  BasicRapporAnalyzer shard1(config);
+  BasicRapporAnalyzer shard2(config);
+  for (int i = 0; i < 1000; i++) {
+    std::string bits = BuildBitPatternString(16, i % 10, '1', '0');
+    AddObservation(bits);
+    BasicRapporObservation obs = BasicRapporObservationFromString(bits);
+    EXPECT_TRUE((i % 3 == 0 ? shard1 : shard2).AddObservation(obs));
+  }
+  // Leave counts pending in shard2 and flushed in shard1.
+  shard1.Analyze();
+
+  BasicRapporAnalyzer merged(config);
+  EXPECT_TRUE(merged.Merge(shard1));
+  EXPECT_TRUE(merged.Merge(shard2));
+  EXPECT_EQ(analyzer_->num_observations(), merged.num_observations());
+  auto expected_results = analyzer_->Analyze();
+  auto results = merged.Analyze();
+  ASSERT_EQ(expected_results.size(), results.size());
+  for (size_t i = 0; i < results.size(); i++) {
+    EXPECT_EQ(expected_results[i].count_estimate, results[i].count_estimate);
+    EXPECT_EQ(expected_results[i].std_error, results[i].std_error);
+  }
+
+  // BasicRapporAnalyzers with different configs may not be merged.
+  BasicRapporAnalyzer other(Config(11, prob_0_becomes_1_, prob_1_stays_1_));
+  EXPECT_FALSE(merged.Merge(other));
+
+  // Nor may BasicRapporAnalyzers whose configs have the same number of
+  // categories but different categories, or the same categories in a
+  // different order, since a bit would be counted for two categories.
+  BasicRapporConfig renamed_config = config;
+  renamed_config.mutable_string_categories()->set_category(9, "renamed");
+  BasicRapporAnalyzer renamed(renamed_config);
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(renamed.AddObservation(BasicRapporObservationFromString(
+        BuildBitPatternString(16, i, '1', '0'))));
+  }
+  EXPECT_FALSE(merged.Merge(renamed));
+  BasicRapporConfig reordered_config = config;
+  reordered_config.mutable_string_categories()->mutable_category()
+      ->SwapElements(0, 1);
+  BasicRapporAnalyzer reordered(reordered_config);
+  EXPECT_FALSE(merged.Merge(reordered));
+  EXPECT_EQ(analyzer_->num_observations(), merged.num_observations());
+}
+
 // Tests that AddObservation() returns false when an invalid config is
 // provided to the constructor.
 TEST_F(BasicRapporAnalyzerTest, InvalidConfig) {
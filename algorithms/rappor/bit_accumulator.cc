@@ -0,0 +1,148 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/rappor/bit_accumulator.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace cobalt {
+namespace rappor {
+
+namespace {
+
+// The 8-bit counters can absorb this many observations before they must be
+// flushed.
+const size_t kMaxPending = 255;
+
+// Returns a table that maps each byte value x to the uint64_t whose byte b
+// is bit b of x. Adding SpreadTable()[x] to a word of eight 8-bit counters
+// increments the counters of exactly the bits that are set in x.
+const uint64_t* SpreadTable() {
+  static const uint64_t* table = [] {
+    uint64_t* table = new uint64_t[256];
+    for (int x = 0; x < 256; x++) {
+      table[x] = 0;
+      for (int b = 0; b < 8; b++) {
+        table[x] |= static_cast<uint64_t>((x >> b) & 1) << (8 * b);
+      }
+    }
+    return table;
+  }();
+  return table;
+}
+
+// Adds the bits of data[start, num_bytes) to |counters| eight at a time.
+void AddBytesScalar(const uint8_t* data, size_t start, size_t num_bytes,
+                    uint64_t* counters) {
+  const uint64_t* spread_table = SpreadTable();
+  for (size_t k = start; k < num_bytes; k++) {
+    counters[k] += spread_table[data[k]];
+  }
+}
+
+#if defined(__x86_64__)
+// Adds the bits of the longest prefix of |data| whose length is a multiple
+// of 4 bytes to |counters|, which must be viewed as 8-bit counters. Each
+// iteration spreads 4 bytes of data across 32 byte lanes, one lane per bit,
+// and increments the counters of the set bits with a single subtraction.
+// Returns the length of the prefix.
+__attribute__((target("avx2"))) size_t AddBytesAvx2(const uint8_t* data,
+                                                    size_t num_bytes,
+                                                    uint8_t* counters) {
+  // _mm256_shuffle_epi8 shuffles within each 128-bit lane. The low lane
+  // receives copies of data bytes 0 and 1 and the high lane copies of bytes
+  // 2 and 3.
+  const __m256i spread = _mm256_setr_epi8(
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+      2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+  // Byte b of each 64-bit lane selects bit b.
+  const __m256i bit_masks = _mm256_set1_epi64x(0x8040201008040201ull);
+  size_t k = 0;
+  for (; k + 4 <= num_bytes; k += 4) {
+    uint32_t word;
+    std::memcpy(&word, data + k, sizeof(word));
+    __m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32(word), spread);
+    // Each lane is 0xFF, i.e. -1, if its bit is set and 0 otherwise.
+    __m256i is_set =
+        _mm256_cmpeq_epi8(_mm256_and_si256(bytes, bit_masks), bit_masks);
+    __m256i* lanes = reinterpret_cast<__m256i*>(counters + 8 * k);
+    _mm256_storeu_si256(lanes,
+                        _mm256_sub_epi8(_mm256_loadu_si256(lanes), is_set));
+  }
+  return k;
+}
+
+bool HaveAvx2() {
+  static const bool have_avx2 = __builtin_cpu_supports("avx2");
+  return have_avx2;
+}
+#endif
+
+}  // namespace
+
+BitAccumulator::BitAccumulator(size_t num_bits)
+    : num_bits_(num_bits), counters_((num_bits + 7) / 8, 0) {}
+
+void BitAccumulator::Add(const uint8_t* bytes, std::vector<size_t>* sums) {
+  if (num_pending_ == kMaxPending) {
+    Flush(sums);
+  }
+  num_pending_++;
+  size_t start = 0;
+#if defined(__x86_64__)
+  if (HaveAvx2()) {
+    start = AddBytesAvx2(bytes, counters_.size(),
+                         reinterpret_cast<uint8_t*>(counters_.data()));
+  }
+#endif
+  AddBytesScalar(bytes, start, counters_.size(), counters_.data());
+}
+
+void BitAccumulator::Flush(std::vector<size_t>* sums) {
+  if (num_pending_ == 0) {
+    return;
+  }
+  AddPendingCounts(sums);
+  std::fill(counters_.begin(), counters_.end(), 0);
+  num_pending_ = 0;
+}
+
+void BitAccumulator::AddPendingCounts(std::vector<size_t>* sums) const {
+  DCHECK_EQ(num_bits_, sums->size());
+  if (num_pending_ == 0) {
+    return;
+  }
+  // Byte k of the data holds bits [8 * (num_bytes - 1 - k), ...). The unused
+  // high-order bits of the first byte, if any, are ignored.
+  const size_t num_bytes = counters_.size();
+  for (size_t k = 0; k < num_bytes; k++) {
+    uint64_t word = counters_[k];
+    size_t first_bit = 8 * (num_bytes - 1 - k);
+    size_t last_bit = std::min(first_bit + 8, num_bits_);
+    for (size_t bit = first_bit; bit < last_bit; bit++) {
+      (*sums)[bit] += word & 0xFF;
+      word >>= 8;
+    }
+  }
+}
+
+}  // namespace rappor
+}  // namespace cobalt
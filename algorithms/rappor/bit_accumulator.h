@@ -0,0 +1,88 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COBALT_ALGORITHMS_RAPPOR_BIT_ACCUMULATOR_H_
+#define COBALT_ALGORITHMS_RAPPOR_BIT_ACCUMULATOR_H_
+
+#include <string>
+#include <vector>
+
+namespace cobalt {
+namespace rappor {
+
+// A BitAccumulator sums, for each bit position, the number of times that
+// the bit is set in a sequence of RAPPOR or Basic RAPPOR observations. It is
+// shared by BloomBitCounter and BasicRapporAnalyzer.
+//
+// The bits of an observation are numbered "from right to left". That is,
+// bit 0 is the least significant bit of the last byte of the observation
+// data. This matches the order of CohortCounts::bit_sums.
+//
+// Rather than branching on each bit, the accumulator keeps one 8-bit
+// vertical counter per bit position and adds each observation to all of them
+// at once: 32 counters per AVX2 instruction when the CPU supports it, and 8
+// counters per 64-bit addition otherwise. Every 255 observations, before
+// the 8-bit counters can overflow, they are added into the caller's size_t
+// sums and reset.
+//
+// Usage:
+//
+// BitAccumulator accumulator(num_bits);
+// std::vector<size_t> sums(num_bits, 0);
+// for (...) accumulator.Add(observation.data(), &sums);
+// accumulator.Flush(&sums);
+class BitAccumulator {
+ public:
+  // Constructs a BitAccumulator for observations with |num_bits| bits,
+  // i.e. with (num_bits + 7) / 8 bytes.
+  explicit BitAccumulator(size_t num_bits);
+
+  // Adds the bits of the num_bytes() bytes at |data| to the counters. If the
+  // counters are full they are first flushed into |sums|, which must have
+  // size num_bits().
+  void Add(const uint8_t* data, std::vector<size_t>* sums);
+
+  // Equivalent to the above. |data| must have exactly num_bytes() bytes.
+  void Add(const std::string& data, std::vector<size_t>* sums) {
+    Add(reinterpret_cast<const uint8_t*>(data.data()), sums);
+  }
+
+  // Adds all of the pending counts into |sums|, which must have size
+  // num_bits(), and resets the counters. After Flush() returns |sums|
+  // reflects every observation passed to Add().
+  void Flush(std::vector<size_t>* sums);
+
+  // Adds all of the pending counts into |sums|, which must have size
+  // num_bits(), without resetting the counters.
+  void AddPendingCounts(std::vector<size_t>* sums) const;
+
+  size_t num_bits() const { return num_bits_; }
+  size_t num_bytes() const { return counters_.size(); }
+
+ private:
+  size_t num_bits_;
+
+  // The number of observations added since the last Flush().
+  size_t num_pending_ = 0;
+
+  // counters_[k] holds eight 8-bit counters for the eight bits of byte k of
+  // the observation data. The counter for bit b of the byte is in bits
+  // [8b, 8b + 8) of counters_[k].
+  std::vector<uint64_t> counters_;
+};
+
+}  // namespace rappor
+}  // namespace cobalt
+
+#endif  // COBALT_ALGORITHMS_RAPPOR_BIT_ACCUMULATOR_H_
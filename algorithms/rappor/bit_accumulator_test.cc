@@ -0,0 +1,112 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/rappor/bit_accumulator.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "algorithms/rappor/rappor_test_utils.h"
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+
+namespace cobalt {
+namespace rappor {
+
+namespace {
+
+// Adds the bits of |data| to |sums| one bit at a time, "from right to left".
+void AddBitsNaively(const std::string& data, std::vector<size_t>* sums) {
+  size_t bit_index = 0;
+  for (int byte_index = data.size() - 1; byte_index >= 0; byte_index--) {
+    for (int bit_in_byte = 0; bit_in_byte < 8; bit_in_byte++) {
+      if (bit_index >= sums->size()) {
+        return;
+      }
+      if (data[byte_index] & (1 << bit_in_byte)) {
+        (*sums)[bit_index]++;
+      }
+      bit_index++;
+    }
+  }
+}
+
+}  // namespace
+
+// Tests BitAccumulator on a few explicit bit patterns.
+TEST(BitAccumulatorTest, SimplePatterns) {
+  BitAccumulator accumulator(16);
+  EXPECT_EQ(2u, accumulator.num_bytes());
+  std::vector<size_t> sums(16, 0);
+  accumulator.Add(BinaryStringToData("0000000000000001"), &sums);
+  accumulator.Add(BinaryStringToData("1000000000000001"), &sums);
+  accumulator.Add(BinaryStringToData("0000000110000000"), &sums);
+  accumulator.Flush(&sums);
+  std::vector<size_t> expected(16, 0);
+  expected[0] = 2;
+  expected[7] = 1;
+  expected[8] = 1;
+  expected[15] = 1;
+  EXPECT_EQ(expected, sums);
+
+  // Flushing again has no effect.
+  accumulator.Flush(&sums);
+  EXPECT_EQ(expected, sums);
+}
+
+// Tests that BitAccumulator agrees with a naive bit-by-bit count for a
+// variety of sizes, including sizes that are not multiples of 8 or 32 bits,
+// and for numbers of observations that require several flushes of the 8-bit
+// counters.
+TEST(BitAccumulatorTest, AgreesWithNaiveCount) {
+  std::mt19937 random(42);
+  for (size_t num_bits : {2u, 7u, 8u, 20u, 33u, 128u, 1000u, 1024u}) {
+    SCOPED_TRACE(std::to_string(num_bits));
+    BitAccumulator accumulator(num_bits);
+    std::vector<size_t> sums(num_bits, 0);
+    std::vector<size_t> expected_sums(num_bits, 0);
+    for (int i = 0; i < 1000; i++) {
+      std::string data(accumulator.num_bytes(), 0);
+      for (char& c : data) {
+        c = static_cast<char>(random());
+      }
+      accumulator.Add(data, &sums);
+      AddBitsNaively(data, &expected_sums);
+      // Flush at an arbitrary point that is not a multiple of 255.
+      if (i == 300) {
+        accumulator.Flush(&sums);
+        EXPECT_EQ(expected_sums, sums);
+      }
+    }
+    accumulator.Flush(&sums);
+    EXPECT_EQ(expected_sums, sums);
+  }
+}
+
+// Tests that counts do not overflow when every bit is set in many more than
+// 255 observations.
+TEST(BitAccumulatorTest, AllOnes) {
+  static const size_t kNumObservations = 10000;
+  BitAccumulator accumulator(64);
+  std::vector<size_t> sums(64, 0);
+  std::string data(8, static_cast<char>(0xFF));
+  for (size_t i = 0; i < kNumObservations; i++) {
+    accumulator.Add(data, &sums);
+  }
+  accumulator.Flush(&sums);
+  EXPECT_EQ(std::vector<size_t>(64, kNumObservations), sums);
+}
+
+}  // namespace rappor
+}  // namespace cobalt
@@ -45,6 +45,7 @@ BloomBitCounter::BloomBitCounter(const RapporConfig& config)
   for (size_t cohort = 0; cohort < config_->num_cohorts(); cohort++) {
     estimated_bloom_counts_.emplace_back(cohort, num_bits);
   }
+  bit_accumulators_.resize(config_->num_cohorts(), BitAccumulator(num_bits));
   num_bloom_bytes_ = (num_bits + 7) / 8;
 }
 
@@ -74,34 +75,93 @@ bool BloomBitCounter::AddObservation(const RapporObservation& obs) {
   num_observations_++;
   estimated_bloom_counts_[cohort].num_observations++;
 
-  // We iterate through the bits of the observation "from right to left",
-  // i.e. from the least-significant bit of the last byte to the
-  // most-significant bit of the first byte. If the ith bit is set we increment
-  // bit_sums[i] for the appropriate cohort.
-  //
-  // NOTE(rudominer) Possible performance optimizations: Consider using x86
-  // vector operations or the find-first-bit-set instruction or simply checking
-  // for zero bytes.
-  std::vector<size_t>& bit_sums = estimated_bloom_counts_[cohort].bit_sums;
-  size_t bit_index = 0;
-  for (int byte_index = num_bloom_bytes_ - 1; byte_index >= 0; byte_index--) {
-    uint8_t bit_mask = 1;
-    for (int bit_in_byte_index = 0; bit_in_byte_index < 8;
-         bit_in_byte_index++) {
-      if (bit_index >= bit_sums.size()) {
-        return true;
-      }
-      if (bit_mask & obs.data()[byte_index]) {
-        bit_sums[bit_index]++;
-      }
-      bit_index++;
-      bit_mask <<= 1;
+  bit_accumulators_[cohort].Add(obs.data(),
+                                &estimated_bloom_counts_[cohort].bit_sums);
+  return true;
+}
+
+size_t BloomBitCounter::AddObservations(const uint8_t* bloom_bytes,
+                                        const uint32_t* cohorts,
+                                        size_t num_observations,
+                                        size_t stride) {
+  if (!config_->valid()) {
+    LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationFailure)
+        << "RapporConfig is invalid";
+    observation_errors_ += num_observations;
+    return 0;
+  }
+  if (stride < num_bloom_bytes_) {
+    LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationFailure)
+        << "Batch of RAPPOR observations has a stride of " << stride
+        << " bytes which is less than the Bloom filter size of "
+        << num_bloom_bytes_;
+    observation_errors_ += num_observations;
+    return 0;
+  }
+  const uint32_t num_cohorts = config_->num_cohorts();
+  size_t num_added = 0;
+  size_t i = 0;
+  while (i < num_observations) {
+    // Process the run of observations that share the cohort of the i-th
+    // observation.
+    uint32_t cohort = cohorts[i];
+    size_t run_end = i + 1;
+    while (run_end < num_observations && cohorts[run_end] == cohort) {
+      run_end++;
+    }
+    size_t run_length = run_end - i;
+    if (cohort >= num_cohorts) {
+      LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationFailure)
+          << run_length << " RAPPOR observations have an invalid cohort index: "
+          << cohort << ". num_cohorts= " << num_cohorts;
+      observation_errors_ += run_length;
+      i = run_end;
+      continue;
     }
+    BitAccumulator& accumulator = bit_accumulators_[cohort];
+    std::vector<size_t>& bit_sums = estimated_bloom_counts_[cohort].bit_sums;
+    for (; i < run_end; i++) {
+      accumulator.Add(bloom_bytes + i * stride, &bit_sums);
+    }
+    estimated_bloom_counts_[cohort].num_observations += run_length;
+    num_added += run_length;
+  }
+  num_observations_ += num_added;
+  return num_added;
+}
+
+bool BloomBitCounter::Merge(const BloomBitCounter& other) {
+  if (!config_->valid() || !other.config_->valid() ||
+      config_->num_bits() != other.config_->num_bits() ||
+      config_->num_hashes() != other.config_->num_hashes() ||
+      config_->num_cohorts() != other.config_->num_cohorts() ||
+      config_->prob_0_becomes_1() != other.config_->prob_0_becomes_1() ||
+      config_->prob_1_stays_1() != other.config_->prob_1_stays_1()) {
+    LOG(ERROR) << "Attempt to merge BloomBitCounters with different configs.";
+    return false;
   }
+  for (size_t cohort = 0; cohort < estimated_bloom_counts_.size(); cohort++) {
+    CohortCounts& counts = estimated_bloom_counts_[cohort];
+    const CohortCounts& other_counts = other.estimated_bloom_counts_[cohort];
+    counts.num_observations += other_counts.num_observations;
+    for (size_t i = 0; i < counts.bit_sums.size(); i++) {
+      counts.bit_sums[i] += other_counts.bit_sums[i];
+    }
+    other.bit_accumulators_[cohort].AddPendingCounts(&counts.bit_sums);
+  }
+  num_observations_ += other.num_observations_;
+  observation_errors_ += other.observation_errors_;
   return true;
 }
 
+void BloomBitCounter::FlushBitSums() {
+  for (size_t cohort = 0; cohort < bit_accumulators_.size(); cohort++) {
+    bit_accumulators_[cohort].Flush(&estimated_bloom_counts_[cohort].bit_sums);
+  }
+}
+
 const std::vector<CohortCounts>& BloomBitCounter::EstimateCounts() {
+  FlushBitSums();
   double q = config_->prob_1_stays_1();
   double p = config_->prob_0_becomes_1();
   double one_minus_q_plus_p = 1.0 - (q + p);
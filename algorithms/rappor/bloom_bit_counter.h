@@ -18,6 +18,7 @@
 #include <memory>
 #include <vector>
 
+#include "algorithms/rappor/bit_accumulator.h"
 #include "algorithms/rappor/rappor_config_validator.h"
 
 namespace cobalt {
@@ -54,6 +55,33 @@ class BloomBitCounter {
   // an error and so observation_errors() was incremented.
   bool AddObservation(const RapporObservation& obs);
 
+  // Adds a batch of |num_observations| observations stored in columnar form,
+  // without the use of RapporObservation protos. This is equivalent to
+  // invoking AddObservation() once for each of them but is faster.
+  //
+  // The Bloom filter of the i-th observation is stored in the
+  // (num_bits + 7) / 8 bytes beginning at |bloom_bytes| + i * |stride|,
+  // in the same byte order as RapporObservation::data(), and its cohort is
+  // |cohorts|[i]. |stride| must therefore be at least (num_bits + 7) / 8.
+  // The observations need not be sorted by cohort but it is more efficient if
+  // they are.
+  //
+  // Returns the number of observations that were added without error. The
+  // remaining observations were discarded and counted in
+  // observation_errors().
+  size_t AddObservations(const uint8_t* bloom_bytes, const uint32_t* cohorts,
+                         size_t num_observations, size_t stride);
+
+  // Adds the counts accumulated by |other| into this BloomBitCounter. After
+  // this returns true, this BloomBitCounter is in the same state as if all of
+  // the observations added to |other| had also been added to it. This allows
+  // the observations for a single report to be counted by several
+  // BloomBitCounters in parallel, one per thread, and then combined.
+  //
+  // |other| is not modified. Returns false, and does nothing, if |other| was
+  // not constructed with an equivalent valid RapporConfig.
+  bool Merge(const BloomBitCounter& other);
+
   // The number of times that AddObservation() was invoked minus the value
   // of observation_errors().
   size_t num_observations() const { return num_observations_; }
@@ -76,6 +104,10 @@ class BloomBitCounter {
  private:
   friend class BloomBitCounterTest;
 
+  // Adds the counts pending in |bit_accumulators_| to the bit_sums in
+  // |estimated_bloom_counts_|.
+  void FlushBitSums();
+
   std::shared_ptr<RapporConfigValidator> config_;
 
   size_t num_observations_ = 0;
@@ -83,6 +115,11 @@ class BloomBitCounter {
 
   std::vector<CohortCounts> estimated_bloom_counts_;
 
+  // One per cohort. Accumulates the bit counts of the observations before
+  // they are added to the bit_sums of the cohort in
+  // |estimated_bloom_counts_|.
+  std::vector<BitAccumulator> bit_accumulators_;
+
   // The number of bytes needed to store the bloom bits in each observation.
   size_t num_bloom_bytes_;
 };
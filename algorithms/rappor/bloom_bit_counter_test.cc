@@ -108,12 +108,14 @@ class BloomBitCounterTest : public ::testing::Test {
   // Checks that bit_counter_ has the expected raw count for the given cohort
   // and bit index.
   void ExpectRawCount(uint32_t cohort, size_t index, size_t expected_count) {
+    bit_counter_->FlushBitSums();
     EXPECT_EQ(expected_count,
               bit_counter_->estimated_bloom_counts_[cohort].bit_sums[index]);
   }
 
   // Checks that bit_counter_ has the expected raw counts for the given cohort.
   void ExpectRawCounts(uint32_t cohort, std::vector<size_t> expected_counts) {
+    bit_counter_->FlushBitSums();
     EXPECT_EQ(expected_counts,
               bit_counter_->estimated_bloom_counts_[cohort].bit_sums);
   }
@@ -280,6 +282,95 @@ TEST_F(BloomBitCounterTest, RawCounts1024x100) {
   }
 }
 
+// Tests that AddObservations() agrees with AddObservation() when given a
+// columnar batch of observations, some of which are invalid.
+TEST_F(BloomBitCounterTest, AddObservationsBatch) {
+  static const size_t kNumObservations = 1000;
+  // Each 12-bit Bloom filter occupies 2 bytes but we leave 3 bytes of padding
+  // between them.
+  static const size_t kStride = 5;
+  SetBitCounter(12, 10);
+  BloomBitCounter expected_counter(
+      Config(12, 10, prob_0_becomes_1_, prob_1_stays_1_));
+
+  std::vector<uint8_t> bloom_bytes(kNumObservations * kStride, 0xAA);
+  std::vector<uint32_t> cohorts(kNumObservations);
+  for (size_t i = 0; i < kNumObservations; i++) {
+    // Runs of observations with the same cohort. Cohort 10 is invalid.
+    cohorts[i] = (i / 7) % 11;
+    bloom_bytes[i * kStride] = i % 16;
+    bloom_bytes[i * kStride + 1] = i % 251;
+    RapporObservation obs;
+    obs.set_cohort(cohorts[i]);
+    obs.set_data(std::string(
+        reinterpret_cast<const char*>(&bloom_bytes[i * kStride]), 2));
+    expected_counter.AddObservation(obs);
+  }
+  size_t num_added = bit_counter_->AddObservations(
+      bloom_bytes.data(), cohorts.data(), kNumObservations, kStride);
+  EXPECT_EQ(expected_counter.num_observations(), num_added);
+  EXPECT_EQ(expected_counter.num_observations(),
+            bit_counter_->num_observations());
+  EXPECT_EQ(expected_counter.observation_errors(),
+            bit_counter_->observation_errors());
+  EXPECT_GT(bit_counter_->observation_errors(), 0u);
+
+  const auto& expected_counts = expected_counter.EstimateCounts();
+  const auto& counts = bit_counter_->EstimateCounts();
+  ASSERT_EQ(expected_counts.size(), counts.size());
+  for (size_t cohort = 0; cohort < counts.size(); cohort++) {
+    EXPECT_EQ(expected_counts[cohort].num_observations,
+              counts[cohort].num_observations);
+    EXPECT_EQ(expected_counts[cohort].bit_sums, counts[cohort].bit_sums);
+  }
+
+  // A stride that is smaller than a Bloom filter is an error.
+  EXPECT_EQ(0u, bit_counter_->AddObservations(bloom_bytes.data(),
+                                              cohorts.data(), 10, 1));
+  EXPECT_EQ(expected_counter.observation_errors() + 10,
+            bit_counter_->observation_errors());
+}
+
+// Tests that merging BloomBitCounters that have each been given part of the
+// observations gives the same counts as a single BloomBitCounter given all
+// of them.
+TEST_F(BloomBitCounterTest, Merge) {
+  SetBitCounter(16, 3);
+  RapporConfig config = Config(16, 3, prob_0_becomes_1_, prob_1_stays_1_);
+  BloomBitCounter shard1(config);
+  BloomBitCounter shard2(config);
+  for (int i = 0; i < 1000; i++) {
+    RapporObservation obs = RapporObservationFromString(
+        i % 4, BuildBitPatternString(16, i % 16, '1', '0'));
+    // Cohort 3 is invalid.
+    bit_counter_->AddObservation(obs);
+    (i % 3 == 0 ? shard1 : shard2).AddObservation(obs);
+  }
+  // Leave counts pending in shard2 and flushed in shard1.
+  shard1.EstimateCounts();
+
+  BloomBitCounter merged(config);
+  EXPECT_TRUE(merged.Merge(shard1));
+  EXPECT_TRUE(merged.Merge(shard2));
+  EXPECT_EQ(bit_counter_->num_observations(), merged.num_observations());
+  EXPECT_EQ(bit_counter_->observation_errors(), merged.observation_errors());
+
+  const auto& expected_counts = bit_counter_->EstimateCounts();
+  const auto& counts = merged.EstimateCounts();
+  ASSERT_EQ(expected_counts.size(), counts.size());
+  for (size_t cohort = 0; cohort < counts.size(); cohort++) {
+    EXPECT_EQ(expected_counts[cohort].num_observations,
+              counts[cohort].num_observations);
+    EXPECT_EQ(expected_counts[cohort].bit_sums, counts[cohort].bit_sums);
+    EXPECT_EQ(expected_counts[cohort].count_estimates,
+              counts[cohort].count_estimates);
+  }
+
+  // BloomBitCounters with different configs may not be merged.
+  BloomBitCounter other(Config(16, 4, prob_0_becomes_1_, prob_1_stays_1_));
+  EXPECT_FALSE(merged.Merge(other));
+}
+
 // Tests that AddObservation() returns false when an invalid config is
 // provided to the constructor.
 TEST_F(BloomBitCounterTest, InvalidConfig) {
@@ -0,0 +1,220 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/rappor/candidate_hash_index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include "./logging.h"
+
+namespace cobalt {
+namespace rappor {
+
+using crypto::byte;
+
+namespace {
+
+// Identifies a file as a candidate hash index. The version must be
+// incremented whenever the file format or the way in which bit indices are
+// derived from candidates changes.
+const char kMagic[8] = {'C', 'B', 'R', 'P', 'I', 'D', 'X', '\0'};
+const uint32_t kVersion = 1;
+
+// The layout of the beginning of an index file. It is followed by the array
+// of uint16_t bit indices. All integers are in the native byte order.
+struct IndexFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_bits;
+  uint32_t num_hashes;
+  uint32_t num_cohorts;
+  uint32_t num_candidates;
+  uint32_t reserved;
+  byte config_fingerprint[crypto::hash::DIGEST_SIZE];
+  byte candidates_hash[crypto::hash::DIGEST_SIZE];
+};
+
+size_t NumBitIndices(const CandidateHashIndex::Key& key) {
+  return static_cast<size_t>(key.num_candidates) * key.num_cohorts *
+         key.num_hashes;
+}
+
+void FillHeader(const CandidateHashIndex::Key& key, IndexFileHeader* header) {
+  std::memset(header, 0, sizeof(*header));
+  std::memcpy(header->magic, kMagic, sizeof(kMagic));
+  header->version = kVersion;
+  header->num_bits = key.num_bits;
+  header->num_hashes = key.num_hashes;
+  header->num_cohorts = key.num_cohorts;
+  header->num_candidates = key.num_candidates;
+  std::memcpy(header->config_fingerprint, key.config_fingerprint,
+              crypto::hash::DIGEST_SIZE);
+  std::memcpy(header->candidates_hash, key.candidates_hash,
+              crypto::hash::DIGEST_SIZE);
+}
+
+// Appends the hex encoding of the first |num_bytes| of |bytes| to |stream|.
+void AppendHex(const byte* bytes, size_t num_bytes,
+               std::ostringstream* stream) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  for (size_t i = 0; i < num_bytes; i++) {
+    *stream << kHexDigits[bytes[i] >> 4] << kHexDigits[bytes[i] & 0xF];
+  }
+}
+
+}  // namespace
+
+CandidateHashIndex::~CandidateHashIndex() {
+  if (mapped_) {
+    munmap(mapped_, mapped_size_);
+  }
+}
+
+bool CandidateHashIndex::MakeKey(uint32_t num_bits, uint32_t num_hashes,
+                                 uint32_t num_cohorts,
+                                 const RapporCandidateList& candidates,
+                                 Key* key) {
+  key->num_bits = num_bits;
+  key->num_hashes = num_hashes;
+  key->num_cohorts = num_cohorts;
+  key->num_candidates = candidates.candidates_size();
+
+  uint32_t config_params[] = {kVersion, num_bits, num_hashes, num_cohorts};
+  if (!crypto::hash::Hash(reinterpret_cast<const byte*>(config_params),
+                          sizeof(config_params), key->config_fingerprint)) {
+    return false;
+  }
+
+  std::string serialized_candidates;
+  candidates.SerializeToString(&serialized_candidates);
+  return crypto::hash::Hash(
+      reinterpret_cast<const byte*>(serialized_candidates.data()),
+      serialized_candidates.size(), key->candidates_hash);
+}
+
+std::string CandidateHashIndex::PathForKey(const std::string& directory,
+                                           const Key& key) {
+  // Half of each digest is plenty to make file names unique. The full
+  // digests are checked by Open().
+  static const size_t kNumNameBytes = crypto::hash::DIGEST_SIZE / 2;
+  std::ostringstream stream;
+  stream << directory << "/rappor_candidates_";
+  AppendHex(key.config_fingerprint, kNumNameBytes, &stream);
+  stream << "_";
+  AppendHex(key.candidates_hash, kNumNameBytes, &stream);
+  stream << ".idx";
+  return stream.str();
+}
+
+bool CandidateHashIndex::Write(const std::string& path, const Key& key,
+                               const std::vector<uint16_t>& bit_indices) {
+  CHECK_EQ(NumBitIndices(key), bit_indices.size());
+  IndexFileHeader header;
+  FillHeader(key, &header);
+
+  std::ostringstream temp_path;
+  temp_path << path << ".tmp." << getpid();
+  FILE* file = std::fopen(temp_path.str().c_str(), "wb");
+  if (!file) {
+    LOG(WARNING) << "Unable to create RAPPOR candidate index "
+                 << temp_path.str() << ": " << std::strerror(errno);
+    return false;
+  }
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+            std::fwrite(bit_indices.data(), sizeof(uint16_t),
+                        bit_indices.size(),
+                        file) == bit_indices.size();
+  ok = (std::fclose(file) == 0) && ok;
+  if (ok) {
+    ok = std::rename(temp_path.str().c_str(), path.c_str()) == 0;
+  }
+  if (!ok) {
+    LOG(WARNING) << "Unable to write RAPPOR candidate index " << path << ": "
+                 << std::strerror(errno);
+    std::remove(temp_path.str().c_str());
+    return false;
+  }
+  VLOG(3) << "Wrote RAPPOR candidate index " << path;
+  return true;
+}
+
+bool CandidateHashIndex::Open(const std::string& path, const Key& key) {
+  CHECK(!mapped_) << "A CandidateHashIndex may only be opened once.";
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    VLOG(3) << "No RAPPOR candidate index at " << path;
+    return false;
+  }
+  size_t expected_size =
+      sizeof(IndexFileHeader) + NumBitIndices(key) * sizeof(uint16_t);
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) != expected_size) {
+    LOG(WARNING) << "Ignoring RAPPOR candidate index with unexpected size: "
+                 << path;
+    close(fd);
+    return false;
+  }
+  void* mapped = mmap(nullptr, expected_size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping remains valid after the file descriptor is closed.
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    LOG(WARNING) << "Unable to mmap RAPPOR candidate index " << path << ": "
+                 << std::strerror(errno);
+    return false;
+  }
+
+  IndexFileHeader expected_header;
+  FillHeader(key, &expected_header);
+  if (std::memcmp(mapped, &expected_header, sizeof(expected_header)) != 0) {
+    LOG(WARNING) << "Ignoring RAPPOR candidate index with unexpected header: "
+                 << path;
+    munmap(mapped, expected_size);
+    return false;
+  }
+
+  // RapporAnalyzer uses the bit indices to index arrays of size num_bits
+  // without checking them, so a corrupt file must not get past this point.
+  const uint16_t* bit_indices = reinterpret_cast<const uint16_t*>(
+      static_cast<const char*>(mapped) + sizeof(IndexFileHeader));
+  const size_t num_bit_indices = NumBitIndices(key);
+  for (size_t i = 0; i < num_bit_indices; i++) {
+    if (bit_indices[i] >= key.num_bits) {
+      LOG(WARNING) << "Ignoring RAPPOR candidate index with a bit index out "
+                      "of range: "
+                   << path;
+      munmap(mapped, expected_size);
+      return false;
+    }
+  }
+
+  mapped_ = mapped;
+  mapped_size_ = expected_size;
+  bit_indices_ = bit_indices;
+  num_cohorts_ = key.num_cohorts;
+  num_hashes_ = key.num_hashes;
+  VLOG(3) << "Opened RAPPOR candidate index " << path;
+  return true;
+}
+
+}  // namespace rappor
+}  // namespace cobalt
@@ -0,0 +1,121 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COBALT_ALGORITHMS_RAPPOR_CANDIDATE_HASH_INDEX_H_
+#define COBALT_ALGORITHMS_RAPPOR_CANDIDATE_HASH_INDEX_H_
+
+#include <string>
+#include <vector>
+
+#include "config/report_configs.pb.h"
+#include "util/crypto_util/hash.h"
+
+namespace cobalt {
+namespace rappor {
+
+// A CandidateHashIndex is a read-only, memory-mapped file containing the
+// Bloom filter bit indices of every (candidate, cohort) pair for a given
+// RapporCandidateList and for a given choice of the RAPPOR parameters that
+// determine those indices: the number of Bloom bits, the number of hashes
+// and the number of cohorts.
+//
+// Computing the bit indices requires one SHA-256 hash per (candidate, cohort)
+// pair. With large candidate lists this dominates the running time of
+// RapporAnalyzer::Analyze(). Since the same candidate list is typically
+// analyzed repeatedly, for example on each day that a report is generated,
+// RapporAnalyzer may persist the bit indices into an index file the first
+// time and memory-map it on subsequent analyses.
+//
+// An index file is identified by a Key consisting of a fingerprint of the
+// RAPPOR parameters and a hash of the candidate list. The file name is
+// derived from the Key, and the Key is also stored in the file header and
+// checked when the file is opened.
+//
+// Usage:
+//
+// CandidateHashIndex::Key key;
+// CandidateHashIndex::MakeKey(num_bits, num_hashes, num_cohorts, candidates,
+//                             &key);
+// std::string path = CandidateHashIndex::PathForKey(directory, key);
+// CandidateHashIndex index;
+// if (!index.Open(path, key)) {
+//   // Compute the bit indices into a vector and then...
+//   CandidateHashIndex::Write(path, key, bit_indices);
+// }
+class CandidateHashIndex {
+ public:
+  // Identifies the contents of an index file.
+  struct Key {
+    uint32_t num_bits = 0;
+    uint32_t num_hashes = 0;
+    uint32_t num_cohorts = 0;
+    uint32_t num_candidates = 0;
+
+    // A SHA-256 fingerprint of the above RAPPOR parameters.
+    crypto::byte config_fingerprint[crypto::hash::DIGEST_SIZE];
+
+    // A SHA-256 hash of the list of candidates.
+    crypto::byte candidates_hash[crypto::hash::DIGEST_SIZE];
+  };
+
+  CandidateHashIndex() {}
+  ~CandidateHashIndex();
+
+  CandidateHashIndex(const CandidateHashIndex&) = delete;
+  CandidateHashIndex& operator=(const CandidateHashIndex&) = delete;
+
+  // Computes the Key for the given RAPPOR parameters and |candidates|.
+  // Returns false if the hash operation fails.
+  static bool MakeKey(uint32_t num_bits, uint32_t num_hashes,
+                      uint32_t num_cohorts,
+                      const RapporCandidateList& candidates, Key* key);
+
+  // Returns the path of the index file for |key| within |directory|.
+  static std::string PathForKey(const std::string& directory, const Key& key);
+
+  // Writes a new index file at |path| for |key|. |bit_indices| must have size
+  // num_candidates * num_cohorts * num_hashes and contain the bit indices
+  // ordered first by candidate, then by cohort and then by hash index. The
+  // file is first written to a temporary file that is then renamed to |path|
+  // so that concurrent readers never observe a partially written index.
+  // Returns false on failure.
+  static bool Write(const std::string& path, const Key& key,
+                    const std::vector<uint16_t>& bit_indices);
+
+  // Memory-maps the index file at |path|. Returns false if the file does not
+  // exist, cannot be mapped, was not written for |key|, or contains a bit
+  // index that is not less than key.num_bits. An instance may only be opened
+  // once.
+  bool Open(const std::string& path, const Key& key);
+
+  // Returns a pointer to the |num_hashes| bit indices for the given candidate
+  // and cohort. Must only be invoked after Open() has returned true.
+  const uint16_t* BitIndices(uint32_t candidate_index, uint32_t cohort) const {
+    return bit_indices_ +
+           (static_cast<size_t>(candidate_index) * num_cohorts_ + cohort) *
+               num_hashes_;
+  }
+
+ private:
+  void* mapped_ = nullptr;
+  size_t mapped_size_ = 0;
+  const uint16_t* bit_indices_ = nullptr;
+  uint32_t num_cohorts_ = 0;
+  uint32_t num_hashes_ = 0;
+};
+
+}  // namespace rappor
+}  // namespace cobalt
+
+#endif  // COBALT_ALGORITHMS_RAPPOR_CANDIDATE_HASH_INDEX_H_
@@ -0,0 +1,170 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/rappor/candidate_hash_index.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+
+namespace cobalt {
+namespace rappor {
+
+namespace {
+
+RapporCandidateList MakeCandidates(int num_candidates) {
+  RapporCandidateList candidates;
+  for (int i = 0; i < num_candidates; i++) {
+    candidates.add_candidates("candidate" + std::to_string(i));
+  }
+  return candidates;
+}
+
+}  // namespace
+
+class CandidateHashIndexTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char dir_template[] = "/tmp/candidate_hash_index_test_XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(dir_template));
+    directory_ = dir_template;
+  }
+
+  void TearDown() override {
+    for (const std::string& path : paths_) {
+      std::remove(path.c_str());
+    }
+    rmdir(directory_.c_str());
+  }
+
+  // Returns the path for |key| and remembers it so that it is deleted by
+  // TearDown().
+  std::string PathForKey(const CandidateHashIndex::Key& key) {
+    paths_.push_back(CandidateHashIndex::PathForKey(directory_, key));
+    return paths_.back();
+  }
+
+  std::string directory_;
+  std::vector<std::string> paths_;
+};
+
+// Tests that keys depend on exactly the parameters that they should.
+TEST_F(CandidateHashIndexTest, MakeKey) {
+  CandidateHashIndex::Key key1, key2;
+  ASSERT_TRUE(
+      CandidateHashIndex::MakeKey(64, 2, 16, MakeCandidates(10), &key1));
+  ASSERT_TRUE(
+      CandidateHashIndex::MakeKey(64, 2, 16, MakeCandidates(10), &key2));
+  EXPECT_EQ(PathForKey(key1), PathForKey(key2));
+
+  ASSERT_TRUE(
+      CandidateHashIndex::MakeKey(64, 2, 16, MakeCandidates(11), &key2));
+  EXPECT_NE(PathForKey(key1), PathForKey(key2));
+  ASSERT_TRUE(
+      CandidateHashIndex::MakeKey(128, 2, 16, MakeCandidates(10), &key2));
+  EXPECT_NE(PathForKey(key1), PathForKey(key2));
+  ASSERT_TRUE(
+      CandidateHashIndex::MakeKey(64, 3, 16, MakeCandidates(10), &key2));
+  EXPECT_NE(PathForKey(key1), PathForKey(key2));
+  ASSERT_TRUE(
+      CandidateHashIndex::MakeKey(64, 2, 32, MakeCandidates(10), &key2));
+  EXPECT_NE(PathForKey(key1), PathForKey(key2));
+}
+
+// Tests that an index that is written can be read back.
+TEST_F(CandidateHashIndexTest, WriteAndOpen) {
+  static const uint32_t kNumCandidates = 10;
+  static const uint32_t kNumHashes = 3;
+  static const uint32_t kNumCohorts = 7;
+  CandidateHashIndex::Key key;
+  ASSERT_TRUE(CandidateHashIndex::MakeKey(
+      64, kNumHashes, kNumCohorts, MakeCandidates(kNumCandidates), &key));
+  std::string path = PathForKey(key);
+
+  // There is no index yet.
+  CandidateHashIndex missing_index;
+  EXPECT_FALSE(missing_index.Open(path, key));
+
+  std::vector<uint16_t> bit_indices(kNumCandidates * kNumCohorts * kNumHashes);
+  for (size_t i = 0; i < bit_indices.size(); i++) {
+    bit_indices[i] = i % 64;
+  }
+  ASSERT_TRUE(CandidateHashIndex::Write(path, key, bit_indices));
+
+  CandidateHashIndex index;
+  ASSERT_TRUE(index.Open(path, key));
+  size_t i = 0;
+  for (uint32_t candidate = 0; candidate < kNumCandidates; candidate++) {
+    for (uint32_t cohort = 0; cohort < kNumCohorts; cohort++) {
+      const uint16_t* indices = index.BitIndices(candidate, cohort);
+      for (uint32_t hash = 0; hash < kNumHashes; hash++) {
+        EXPECT_EQ(bit_indices[i++], indices[hash]);
+      }
+    }
+  }
+}
+
+// Tests that Open() rejects an index that was written for a different key
+// or that has been truncated.
+TEST_F(CandidateHashIndexTest, OpenRejectsMismatchedFiles) {
+  CandidateHashIndex::Key key, other_key;
+  ASSERT_TRUE(CandidateHashIndex::MakeKey(64, 2, 4, MakeCandidates(5), &key));
+  ASSERT_TRUE(
+      CandidateHashIndex::MakeKey(64, 2, 4, MakeCandidates(5), &other_key));
+  // Same sizes but a different candidate list.
+  other_key.candidates_hash[0] ^= 1;
+  std::string path = PathForKey(key);
+  ASSERT_TRUE(
+      CandidateHashIndex::Write(path, key, std::vector<uint16_t>(5 * 2 * 4)));
+
+  CandidateHashIndex index1;
+  EXPECT_FALSE(index1.Open(path, other_key));
+
+  // Truncate the file.
+  ASSERT_EQ(0, truncate(path.c_str(), 100));
+  CandidateHashIndex index2;
+  EXPECT_FALSE(index2.Open(path, key));
+}
+
+// Tests that Open() rejects an index with a valid header whose bit indices
+// are not all less than the number of Bloom bits.
+TEST_F(CandidateHashIndexTest, OpenRejectsBitIndicesOutOfRange) {
+  CandidateHashIndex::Key key;
+  ASSERT_TRUE(CandidateHashIndex::MakeKey(64, 2, 4, MakeCandidates(5), &key));
+  std::string path = PathForKey(key);
+  std::vector<uint16_t> bit_indices(5 * 2 * 4, 63);
+  ASSERT_TRUE(CandidateHashIndex::Write(path, key, bit_indices));
+  CandidateHashIndex index1;
+  EXPECT_TRUE(index1.Open(path, key));
+
+  // Overwrite the last bit index of the file in place.
+  FILE* file = std::fopen(path.c_str(), "r+b");
+  ASSERT_NE(nullptr, file);
+  ASSERT_EQ(0, std::fseek(file, -static_cast<long>(sizeof(uint16_t)),
+                          SEEK_END));
+  const uint16_t kOutOfRange = 64;
+  ASSERT_EQ(1u, std::fwrite(&kOutOfRange, sizeof(kOutOfRange), 1, file));
+  ASSERT_EQ(0, std::fclose(file));
+  CandidateHashIndex index2;
+  EXPECT_FALSE(index2.Open(path, key));
+}
+
+}  // namespace rappor
+}  // namespace cobalt
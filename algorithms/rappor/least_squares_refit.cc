@@ -0,0 +1,153 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/rappor/least_squares_refit.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "third_party/eigen/Eigen/Cholesky"
+#include "third_party/eigen/Eigen/SparseCholesky"
+
+namespace cobalt {
+namespace rappor {
+
+namespace {
+// LeastSquaresRefit() selects the candidates whose estimated count is at
+// least this large.
+const double kMinRefitCount = 0.5;
+
+// LeastSquaresRefit() considers the normal matrix to be singular if the
+// ratio of its smallest to its largest pivot is at most this.
+const double kMinRefitPivot = 1e-9;
+
+// LeastSquaresRefit() factors the normal matrix as a dense matrix if more
+// than this fraction of its entries are non-zero. Beyond that the sparse
+// factorization does more work than the dense one, because the fill-in
+// makes its factor dense anyway, and does it less efficiently.
+const double kMaxSparseRefitDensity = 0.1;
+
+// Sets |solution| to (A^T A)^-1 A^T b, given |rhs| = A^T b, and |variances|
+// to the diagonal of (A^T A)^-1 A^T D A (A^T A)^-1, given
+// |weighted_normal_matrix| = A^T D A, where |solver| is a factorization of
+// A^T A. Returns false if A^T A is singular.
+template <typename Solver>
+bool SolveNormalEquations(const Solver& solver, const Eigen::VectorXd& rhs,
+                          const Eigen::MatrixXd& weighted_normal_matrix,
+                          Eigen::VectorXd* solution,
+                          Eigen::VectorXd* variances) {
+  if (solver.info() != Eigen::Success) {
+    return false;
+  }
+  // A^T A is positive semi-definite. It is singular iff a pivot vanishes.
+  Eigen::VectorXd pivots = solver.vectorD();
+  if (pivots.minCoeff() <= kMinRefitPivot * pivots.maxCoeff()) {
+    return false;
+  }
+  *solution = solver.solve(rhs);
+  // Z = (A^T A)^-1 A^T D A. Since A^T A is symmetric the covariance
+  // Z (A^T A)^-1 is the transpose of (A^T A)^-1 Z^T.
+  Eigen::MatrixXd z = solver.solve(weighted_normal_matrix);
+  Eigen::MatrixXd covariance = solver.solve(z.transpose());
+  *variances = covariance.diagonal();
+  return true;
+}
+}  // namespace
+
+grpc::Status LeastSquaresRefit(
+    const Eigen::SparseMatrix<float, Eigen::RowMajor>& candidate_matrix,
+    const Eigen::VectorXf& est_bit_count_ratios,
+    const Eigen::VectorXf& est_std_errors, double num_observations,
+    size_t max_candidates, Eigen::VectorXf* est_candidate_weights,
+    std::vector<double>* std_errors) {
+  const int num_candidates = candidate_matrix.cols();
+  std_errors->assign(num_candidates, 0.0);
+
+  // Select the candidates whose estimated count rounds to at least one and
+  // give each of them a column of the reduced matrix.
+  std::vector<int> selected;
+  std::vector<int> reduced_column(num_candidates, -1);
+  for (int i = 0; i < num_candidates; i++) {
+    if ((*est_candidate_weights)(i) * num_observations >= kMinRefitCount) {
+      reduced_column[i] = selected.size();
+      selected.push_back(i);
+    }
+  }
+  if (selected.empty()) {
+    return grpc::Status::OK;
+  }
+  if (selected.size() > max_candidates) {
+    std::ostringstream stream;
+    stream << "The least squares refit selected " << selected.size()
+           << " candidates, more than the maximum of " << max_candidates
+           << ".";
+    return grpc::Status(grpc::RESOURCE_EXHAUSTED, stream.str());
+  }
+
+  std::vector<Eigen::Triplet<double>> triplets;
+  for (int row = 0; row < candidate_matrix.outerSize(); row++) {
+    for (Eigen::SparseMatrix<float, Eigen::RowMajor>::InnerIterator it(
+             candidate_matrix, row);
+         it; ++it) {
+      int column = reduced_column[it.col()];
+      if (column >= 0) {
+        triplets.emplace_back(row, column, it.value());
+      }
+    }
+  }
+  Eigen::SparseMatrix<double> reduced_matrix(candidate_matrix.rows(),
+                                             selected.size());
+  reduced_matrix.setFromTriplets(triplets.begin(), triplets.end());
+
+  Eigen::SparseMatrix<double> normal_matrix =
+      reduced_matrix.transpose() * reduced_matrix;
+  Eigen::SparseMatrix<double> weighted_matrix =
+      est_std_errors.cast<double>().asDiagonal() * reduced_matrix;
+  Eigen::MatrixXd weighted_normal_matrix =
+      Eigen::MatrixXd(weighted_matrix.transpose() * weighted_matrix);
+  Eigen::VectorXd rhs =
+      reduced_matrix.transpose() * est_bit_count_ratios.cast<double>();
+
+  Eigen::VectorXd solution;
+  Eigen::VectorXd variances;
+  bool solved;
+  const double size = selected.size();
+  if (normal_matrix.nonZeros() > kMaxSparseRefitDensity * size * size) {
+    Eigen::MatrixXd dense_normal_matrix(normal_matrix);
+    Eigen::LDLT<Eigen::MatrixXd> solver(dense_normal_matrix);
+    solved = SolveNormalEquations(solver, rhs, weighted_normal_matrix,
+                                  &solution, &variances);
+  } else {
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> solver(normal_matrix);
+    solved = SolveNormalEquations(solver, rhs, weighted_normal_matrix,
+                                  &solution, &variances);
+  }
+  if (!solved) {
+    return grpc::Status(grpc::FAILED_PRECONDITION,
+                        "The least squares refit is singular.");
+  }
+
+  est_candidate_weights->setZero();
+  for (size_t j = 0; j < selected.size(); j++) {
+    (*est_candidate_weights)(selected[j]) = solution(j);
+    // Rounding may make a vanishing variance slightly negative.
+    (*std_errors)[selected[j]] =
+        std::sqrt(std::max(variances(j), 0.0)) * num_observations;
+  }
+  return grpc::Status::OK;
+}
+
+}  // namespace rappor
+}  // namespace cobalt
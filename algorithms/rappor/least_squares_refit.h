@@ -0,0 +1,61 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COBALT_ALGORITHMS_RAPPOR_LEAST_SQUARES_REFIT_H_
+#define COBALT_ALGORITHMS_RAPPOR_LEAST_SQUARES_REFIT_H_
+
+#include <vector>
+
+#include "grpc++/grpc++.h"
+#include "third_party/eigen/Eigen/Core"
+#include "third_party/eigen/Eigen/SparseCore"
+
+namespace cobalt {
+namespace rappor {
+
+// Performs the second stage of a string RAPPOR analysis, described at
+// RapporSolverOptions::least_squares_refit. |candidate_matrix| is the
+// candidate matrix A of the analysis, |est_bit_count_ratios| is b and
+// |est_std_errors| are the std errors of b. |est_candidate_weights| is the
+// solution found by the minimizer. The candidates whose estimated count
+// |est_candidate_weights|(i) * |num_observations| is at least one half are
+// selected and |est_candidate_weights| is replaced by the least squares
+// solution x = (A^T A)^-1 A^T b, where A is restricted to the selected
+// columns, in which the other candidates have weight zero. |std_errors| is
+// set to the standard errors of the resulting count estimates.
+//
+// The covariance of x is (A^T A)^-1 A^T D A (A^T A)^-1 with D the diagonal
+// matrix of the variances of b. Its diagonal is computed from
+// Z = (A^T A)^-1 A^T D A, which takes one solve with k right-hand sides
+// for k selected candidates, as the diagonal of Z (A^T A)^-1, which takes
+// another. A^T A is factored by a sparse Cholesky decomposition unless it
+// is so dense that a dense one is faster. Either way the refit uses
+// O(k^2) memory and O(k^3) time.
+//
+// Returns RESOURCE_EXHAUSTED if more than |max_candidates| candidates are
+// selected and FAILED_PRECONDITION if A^T A is singular, for example
+// because two selected candidates have identical Bloom filters in every
+// cohort. In both cases |est_candidate_weights| is unchanged and
+// |std_errors| is zero.
+grpc::Status LeastSquaresRefit(
+    const Eigen::SparseMatrix<float, Eigen::RowMajor>& candidate_matrix,
+    const Eigen::VectorXf& est_bit_count_ratios,
+    const Eigen::VectorXf& est_std_errors, double num_observations,
+    size_t max_candidates, Eigen::VectorXf* est_candidate_weights,
+    std::vector<double>* std_errors);
+
+}  // namespace rappor
+}  // namespace cobalt
+
+#endif  // COBALT_ALGORITHMS_RAPPOR_LEAST_SQUARES_REFIT_H_
@@ -0,0 +1,175 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/rappor/least_squares_refit.h"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "third_party/eigen/Eigen/LU"
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+
+namespace cobalt {
+namespace rappor {
+
+namespace {
+
+const double kNumObservations = 1000;
+
+// Returns a random binary matrix with |num_blocks| blocks of |block_rows|
+// rows and |num_columns| columns in which each column has |ones_per_block|
+// ones, which need not be distinct, in each block. This is the shape of a
+// RAPPOR candidate matrix.
+Eigen::SparseMatrix<float, Eigen::RowMajor> RandomCandidateMatrix(
+    int num_blocks, int block_rows, int num_columns, int ones_per_block) {
+  std::mt19937 random(7);
+  std::vector<Eigen::Triplet<float>> triplets;
+  for (int column = 0; column < num_columns; column++) {
+    for (int block = 0; block < num_blocks; block++) {
+      for (int i = 0; i < ones_per_block; i++) {
+        triplets.emplace_back(block * block_rows + random() % block_rows,
+                              column, 1.0f);
+      }
+    }
+  }
+  Eigen::SparseMatrix<float, Eigen::RowMajor> matrix(num_blocks * block_rows,
+                                                     num_columns);
+  // Duplicate entries are summed but a candidate matrix is binary.
+  matrix.setFromTriplets(
+      triplets.begin(), triplets.end(),
+      [](const float&, const float& b) { return b; });
+  return matrix;
+}
+
+// Weights under which every even candidate is selected by the refit and
+// every odd candidate is not.
+Eigen::VectorXf AlternatingWeights(int num_columns) {
+  Eigen::VectorXf weights(num_columns);
+  for (int i = 0; i < num_columns; i++) {
+    weights(i) = (i % 2 == 0) ? 10.0f / kNumObservations : 0.0f;
+  }
+  return weights;
+}
+
+}  // namespace
+
+// Tests that the refit agrees with a computation using the explicit inverse
+// of A^T A, both for a sparse normal matrix, which is factored as a sparse
+// matrix, and for a dense one, which is factored as a dense matrix.
+TEST(LeastSquaresRefitTest, AgreesWithInverse) {
+  static const int kNumBlocks = 8;
+  static const int kNumColumns = 60;
+  for (int block_rows : {16, 1024}) {
+    SCOPED_TRACE(block_rows);
+    Eigen::SparseMatrix<float, Eigen::RowMajor> matrix =
+        RandomCandidateMatrix(kNumBlocks, block_rows, kNumColumns, 1);
+    Eigen::VectorXf labels = Eigen::VectorXf::Random(matrix.rows());
+    Eigen::VectorXf label_std_errors =
+        Eigen::VectorXf::Random(matrix.rows()).cwiseAbs();
+
+    // The columns of the even candidates.
+    Eigen::MatrixXd reduced(matrix.rows(), kNumColumns / 2);
+    Eigen::MatrixXd dense = Eigen::MatrixXf(matrix).cast<double>();
+    for (int j = 0; j < kNumColumns / 2; j++) {
+      reduced.col(j) = dense.col(2 * j);
+    }
+    Eigen::MatrixXd normal_matrix = reduced.transpose() * reduced;
+    // Check that both factorizations are exercised.
+    double density = (normal_matrix.array() != 0.0).cast<double>().mean();
+    if (block_rows == 16) {
+      EXPECT_GT(density, 0.2);
+    } else {
+      EXPECT_LT(density, 0.05);
+    }
+    Eigen::MatrixXd inverse = normal_matrix.inverse();
+    Eigen::VectorXd expected_solution =
+        inverse * reduced.transpose() * labels.cast<double>();
+    Eigen::VectorXd variances =
+        label_std_errors.cast<double>().array().square();
+    Eigen::MatrixXd covariance = inverse * reduced.transpose() *
+                                 variances.asDiagonal() * reduced * inverse;
+
+    Eigen::VectorXf weights = AlternatingWeights(kNumColumns);
+    std::vector<double> std_errors;
+    ASSERT_TRUE(LeastSquaresRefit(matrix, labels, label_std_errors,
+                                  kNumObservations, kNumColumns, &weights,
+                                  &std_errors)
+                    .ok());
+    ASSERT_EQ(kNumColumns, std_errors.size());
+    for (int i = 0; i < kNumColumns; i++) {
+      if (i % 2 == 1) {
+        EXPECT_EQ(0.0f, weights(i));
+        EXPECT_EQ(0.0, std_errors[i]);
+        continue;
+      }
+      EXPECT_NEAR(expected_solution(i / 2), weights(i), 1e-4);
+      EXPECT_NEAR(std::sqrt(covariance(i / 2, i / 2)) * kNumObservations,
+                  std_errors[i], 1e-6 * kNumObservations);
+    }
+  }
+}
+
+// Tests that the refit is skipped if it would select more than the maximum
+// number of candidates.
+TEST(LeastSquaresRefitTest, TooManyCandidates) {
+  static const int kNumColumns = 20;
+  Eigen::SparseMatrix<float, Eigen::RowMajor> matrix =
+      RandomCandidateMatrix(4, 64, kNumColumns, 2);
+  Eigen::VectorXf labels = Eigen::VectorXf::Random(matrix.rows());
+  Eigen::VectorXf label_std_errors = Eigen::VectorXf::Ones(matrix.rows());
+
+  Eigen::VectorXf weights = AlternatingWeights(kNumColumns);
+  std::vector<double> std_errors;
+  EXPECT_EQ(grpc::RESOURCE_EXHAUSTED,
+            LeastSquaresRefit(matrix, labels, label_std_errors,
+                              kNumObservations, kNumColumns / 2 - 1, &weights,
+                              &std_errors)
+                .error_code());
+  EXPECT_EQ(AlternatingWeights(kNumColumns), weights);
+  EXPECT_EQ(std::vector<double>(kNumColumns, 0.0), std_errors);
+
+  EXPECT_TRUE(LeastSquaresRefit(matrix, labels, label_std_errors,
+                                kNumObservations, kNumColumns / 2, &weights,
+                                &std_errors)
+                  .ok());
+}
+
+// Tests that a singular refit fails and leaves the weights unchanged.
+TEST(LeastSquaresRefitTest, Singular) {
+  static const int kNumColumns = 4;
+  // Candidates 0 and 2 have the same column.
+  Eigen::SparseMatrix<float, Eigen::RowMajor> matrix(8, kNumColumns);
+  matrix.insert(0, 0) = 1.0f;
+  matrix.insert(5, 0) = 1.0f;
+  matrix.insert(1, 1) = 1.0f;
+  matrix.insert(0, 2) = 1.0f;
+  matrix.insert(5, 2) = 1.0f;
+  matrix.insert(6, 3) = 1.0f;
+  Eigen::VectorXf labels = Eigen::VectorXf::Ones(8);
+  Eigen::VectorXf label_std_errors = Eigen::VectorXf::Ones(8);
+
+  Eigen::VectorXf weights = AlternatingWeights(kNumColumns);
+  std::vector<double> std_errors;
+  EXPECT_EQ(grpc::FAILED_PRECONDITION,
+            LeastSquaresRefit(matrix, labels, label_std_errors,
+                              kNumObservations, kNumColumns, &weights,
+                              &std_errors)
+                .error_code());
+  EXPECT_EQ(AlternatingWeights(kNumColumns), weights);
+  EXPECT_EQ(std::vector<double>(kNumColumns, 0.0), std_errors);
+}
+
+}  // namespace rappor
+}  // namespace cobalt
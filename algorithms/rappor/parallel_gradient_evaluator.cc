@@ -0,0 +1,224 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/rappor/parallel_gradient_evaluator.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cobalt {
+namespace rappor {
+
+namespace {
+
+// Returns the start of part |part| when [0, size) is divided into
+// |num_parts| nearly equal parts.
+size_t PartStart(size_t size, int num_parts, int part) {
+  return size * part / num_parts;
+}
+
+// Returns the largest absolute outer (i.e. row, for a row-major matrix) sum
+// of |matrix|.
+float MaxOuterSum(const Eigen::SparseMatrix<float, Eigen::RowMajor>& matrix) {
+  float max_sum = 0;
+  for (int outer = 0; outer < matrix.outerSize(); outer++) {
+    float sum = 0;
+    for (Eigen::SparseMatrix<float, Eigen::RowMajor>::InnerIterator it(matrix,
+                                                                       outer);
+         it; ++it) {
+      sum += std::abs(it.value());
+    }
+    max_sum = std::max(max_sum, sum);
+  }
+  return max_sum;
+}
+
+}  // namespace
+
+// A WorkerPool computes the parts of one product at a time on a fixed set of
+// worker threads and the calling thread, which claim the parts one by one.
+class ParallelGradientEvaluator::WorkerPool {
+ public:
+  // Starts |num_workers| worker threads.
+  explicit WorkerPool(int num_workers);
+
+  // Stops the worker threads.
+  ~WorkerPool();
+
+  // Invokes part_fn(part) for each part in [0, num_parts) and waits for them
+  // to finish. Concurrent invocations are serialized.
+  void Run(int num_parts, const std::function<void(int)>& part_fn);
+
+ private:
+  // The main function of each worker thread.
+  void WorkerLoop();
+
+  std::vector<std::thread> workers_;
+
+  // Held for the duration of Run() so that only one product is computed at a
+  // time.
+  std::mutex run_mutex_;
+
+  // Protects the fields below.
+  std::mutex mutex_;
+
+  // Notifies the sleeping workers when a product has been started or
+  // shut_down_ has been set true. Uses mutex_.
+  std::condition_variable worker_notifier_;
+
+  // Notifies Run() when the last part has been completed. Uses mutex_.
+  std::condition_variable done_notifier_;
+
+  // The part function of the current product, or NULL between products.
+  const std::function<void(int)>* part_fn_ = nullptr;
+  int num_parts_ = 0;
+  int num_claimed_ = 0;
+  int num_completed_ = 0;
+  bool shut_down_ = false;
+};
+
+ParallelGradientEvaluator::WorkerPool::WorkerPool(int num_workers) {
+  for (int i = 0; i < num_workers; i++) {
+    workers_.emplace_back([this] { this->WorkerLoop(); });
+  }
+}
+
+ParallelGradientEvaluator::WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shut_down_ = true;
+    worker_notifier_.notify_all();
+  }
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ParallelGradientEvaluator::WorkerPool::Run(
+    int num_parts, const std::function<void(int)>& part_fn) {
+  std::lock_guard<std::mutex> run_lock(run_mutex_);
+  std::unique_lock<std::mutex> lock(mutex_);
+  part_fn_ = &part_fn;
+  num_parts_ = num_parts;
+  num_claimed_ = 0;
+  num_completed_ = 0;
+  if (num_parts > 1) {
+    worker_notifier_.notify_all();
+  }
+  while (num_claimed_ < num_parts_) {
+    int part = num_claimed_++;
+    lock.unlock();
+    part_fn(part);
+    lock.lock();
+    num_completed_++;
+  }
+  done_notifier_.wait(lock, [this] { return num_completed_ == num_parts_; });
+  part_fn_ = nullptr;
+}
+
+void ParallelGradientEvaluator::WorkerPool::WorkerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    worker_notifier_.wait(lock, [this] {
+      return shut_down_ || (part_fn_ && num_claimed_ < num_parts_);
+    });
+    if (shut_down_) {
+      return;
+    }
+    // Run() does not return, and so *part_fn_ remains valid, until every
+    // claimed part has been completed.
+    const std::function<void(int)>& part_fn = *part_fn_;
+    int part = num_claimed_++;
+    lock.unlock();
+    part_fn(part);
+    lock.lock();
+    if (++num_completed_ == num_parts_) {
+      done_notifier_.notify_all();
+    }
+  }
+}
+
+ParallelGradientEvaluator::ParallelGradientEvaluator(
+    const Eigen::SparseMatrix<float, Eigen::RowMajor>& matrix,
+    size_t rows_per_block, const Eigen::VectorXf& labels, int num_threads)
+    : matrix_(matrix),
+      transpose_(matrix.transpose()),
+      labels_(labels),
+      rows_per_block_(std::max<size_t>(rows_per_block, 1)) {
+  CHECK_EQ(matrix_.rows(), labels_.size());
+  CHECK_EQ(0, matrix_.rows() % rows_per_block_);
+  num_threads = std::max(num_threads, 1);
+  num_row_parts_ = std::max<int>(
+      std::min<size_t>(num_threads, matrix_.rows() / rows_per_block_), 1);
+  num_column_parts_ =
+      std::max<int>(std::min<size_t>(num_threads, matrix_.cols()), 1);
+  pool_.reset(
+      new WorkerPool(std::max(num_row_parts_, num_column_parts_) - 1));
+}
+
+ParallelGradientEvaluator::~ParallelGradientEvaluator() {}
+
+float ParallelGradientEvaluator::Loss(const Eigen::VectorXf& weights) const {
+  Eigen::VectorXf residual;
+  return Residual(weights, &residual);
+}
+
+float ParallelGradientEvaluator::Gradient(const Eigen::VectorXf& weights,
+                                          Eigen::VectorXf* gradient) const {
+  Eigen::VectorXf residual;
+  float loss = Residual(weights, &residual);
+  gradient->resize(matrix_.cols());
+  pool_->Run(num_column_parts_, [this, &residual, gradient](int part) {
+    size_t begin = PartStart(matrix_.cols(), num_column_parts_, part);
+    size_t end = PartStart(matrix_.cols(), num_column_parts_, part + 1);
+    gradient->segment(begin, end - begin) =
+        transpose_.middleRows(begin, end - begin) * residual;
+  });
+  return loss;
+}
+
+float ParallelGradientEvaluator::LipschitzBound() const {
+  return MaxOuterSum(matrix_) * MaxOuterSum(transpose_);
+}
+
+float ParallelGradientEvaluator::Residual(const Eigen::VectorXf& weights,
+                                          Eigen::VectorXf* residual) const {
+  const size_t num_blocks = matrix_.rows() / rows_per_block_;
+  residual->resize(matrix_.rows());
+  std::vector<float> part_losses(num_row_parts_);
+  pool_->Run(num_row_parts_, [&](int part) {
+    size_t begin =
+        PartStart(num_blocks, num_row_parts_, part) * rows_per_block_;
+    size_t end =
+        PartStart(num_blocks, num_row_parts_, part + 1) * rows_per_block_;
+    auto residual_part = residual->segment(begin, end - begin);
+    residual_part = matrix_.middleRows(begin, end - begin) * weights -
+                    labels_.segment(begin, end - begin);
+    part_losses[part] = 0.5f * residual_part.squaredNorm();
+  });
+  float loss = 0;
+  for (float part_loss : part_losses) {
+    loss += part_loss;
+  }
+  return loss;
+}
+
+}  // namespace rappor
+}  // namespace cobalt
@@ -0,0 +1,97 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COBALT_ALGORITHMS_RAPPOR_PARALLEL_GRADIENT_EVALUATOR_H_
+#define COBALT_ALGORITHMS_RAPPOR_PARALLEL_GRADIENT_EVALUATOR_H_
+
+#include <functional>
+#include <memory>
+
+#include "third_party/eigen/Eigen/Core"
+#include "third_party/eigen/Eigen/SparseCore"
+
+namespace cobalt {
+namespace rappor {
+
+// A ParallelGradientEvaluator evaluates the least squares loss
+//
+//   L(w) = 1/2 ||A w - b||^2
+//
+// and its gradient A^T (A w - b) using several threads, where A is the
+// candidate matrix of a string RAPPOR analysis and b is the vector of
+// estimated bit count ratios. See RapporAnalyzer.
+//
+// A consists of one block of rows for each cohort. The product A w is
+// computed by partitioning the cohort blocks among the threads. The product
+// A^T r is computed from a copy of A in column-major order, i.e. a row-major
+// copy of A^T, by partitioning the candidates among the threads. The copy
+// doubles the memory used for A but means that every thread writes to its
+// own slice of the gradient so that no synchronization is needed.
+//
+// The worker threads are started by the constructor and are reused by every
+// product, so that a minimizer that evaluates the gradient once per epoch
+// does not pay for creating threads in each epoch. The calling thread also
+// computes a part of each product. Loss() and Gradient() may be invoked
+// concurrently, in which case the products are computed one at a time.
+class ParallelGradientEvaluator {
+ public:
+  // |matrix| is A and |labels| is b. A must have a multiple of
+  // |rows_per_block| rows. At most |num_threads| threads are used. |matrix|
+  // and |labels| must outlive this object.
+  ParallelGradientEvaluator(
+      const Eigen::SparseMatrix<float, Eigen::RowMajor>& matrix,
+      size_t rows_per_block, const Eigen::VectorXf& labels, int num_threads);
+
+  // Stops the worker threads.
+  ~ParallelGradientEvaluator();
+
+  // Returns L(weights).
+  float Loss(const Eigen::VectorXf& weights) const;
+
+  // Sets |gradient| to the gradient of L at |weights| and returns
+  // L(weights).
+  float Gradient(const Eigen::VectorXf& weights,
+                 Eigen::VectorXf* gradient) const;
+
+  // Returns an upper bound on the largest eigenvalue of A^T A, i.e. on the
+  // Lipschitz constant of the gradient. The bound is the product of the
+  // largest absolute row sum and the largest absolute column sum of A,
+  // which is tight when, as for a candidate matrix, those sums are nearly
+  // constant.
+  float LipschitzBound() const;
+
+ private:
+  // Sets |residual| to A weights - b and returns 1/2 its squared norm.
+  float Residual(const Eigen::VectorXf& weights,
+                 Eigen::VectorXf* residual) const;
+
+  class WorkerPool;
+
+  const Eigen::SparseMatrix<float, Eigen::RowMajor>& matrix_;
+  const Eigen::SparseMatrix<float, Eigen::RowMajor> transpose_;
+  const Eigen::VectorXf& labels_;
+  size_t rows_per_block_;
+
+  // The number of threads used for A w and for A^T r respectively.
+  int num_row_parts_;
+  int num_column_parts_;
+
+  // Invokes the part functions of the products.
+  std::unique_ptr<WorkerPool> pool_;
+};
+
+}  // namespace rappor
+}  // namespace cobalt
+
+#endif  // COBALT_ALGORITHMS_RAPPOR_PARALLEL_GRADIENT_EVALUATOR_H_
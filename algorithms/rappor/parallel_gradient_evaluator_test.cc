@@ -0,0 +1,141 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/rappor/parallel_gradient_evaluator.h"
+
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "third_party/eigen/Eigen/Eigenvalues"
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+
+namespace cobalt {
+namespace rappor {
+
+namespace {
+
+// Returns a random binary matrix with |num_blocks| blocks of |block_rows|
+// rows and |num_columns| columns in which each column has |ones_per_block|
+// ones, which need not be distinct, in each block. This is the shape of a
+// RAPPOR candidate matrix.
+Eigen::SparseMatrix<float, Eigen::RowMajor> RandomCandidateMatrix(
+    int num_blocks, int block_rows, int num_columns, int ones_per_block) {
+  std::mt19937 random(7);
+  std::vector<Eigen::Triplet<float>> triplets;
+  for (int column = 0; column < num_columns; column++) {
+    for (int block = 0; block < num_blocks; block++) {
+      for (int i = 0; i < ones_per_block; i++) {
+        triplets.emplace_back(block * block_rows + random() % block_rows,
+                              column, 1.0f);
+      }
+    }
+  }
+  Eigen::SparseMatrix<float, Eigen::RowMajor> matrix(num_blocks * block_rows,
+                                                     num_columns);
+  // Duplicate entries are summed but a candidate matrix is binary.
+  matrix.setFromTriplets(
+      triplets.begin(), triplets.end(),
+      [](const float&, const float& b) { return b; });
+  return matrix;
+}
+
+}  // namespace
+
+// Tests that the loss and gradient agree with a dense computation for a
+// variety of thread counts, including more threads than blocks or columns.
+TEST(ParallelGradientEvaluatorTest, AgreesWithDense) {
+  static const int kNumBlocks = 5;
+  static const int kBlockRows = 16;
+  static const int kNumColumns = 30;
+  Eigen::SparseMatrix<float, Eigen::RowMajor> matrix =
+      RandomCandidateMatrix(kNumBlocks, kBlockRows, kNumColumns, 2);
+  Eigen::MatrixXf dense = matrix;
+  Eigen::VectorXf labels = Eigen::VectorXf::Random(kNumBlocks * kBlockRows);
+  Eigen::VectorXf weights = Eigen::VectorXf::Random(kNumColumns);
+
+  Eigen::VectorXf residual = dense * weights - labels;
+  float expected_loss = 0.5f * residual.squaredNorm();
+  Eigen::VectorXf expected_gradient = dense.transpose() * residual;
+
+  for (int num_threads : {1, 2, 3, 5, 8, 100}) {
+    SCOPED_TRACE(num_threads);
+    ParallelGradientEvaluator evaluator(matrix, kBlockRows, labels,
+                                        num_threads);
+    EXPECT_NEAR(expected_loss, evaluator.Loss(weights), 1e-4);
+    Eigen::VectorXf gradient;
+    EXPECT_NEAR(expected_loss, evaluator.Gradient(weights, &gradient), 1e-4);
+    ASSERT_EQ(kNumColumns, gradient.size());
+    EXPECT_LT((expected_gradient - gradient).lpNorm<Eigen::Infinity>(), 1e-4);
+  }
+}
+
+// Tests that the worker threads of one evaluator compute many successive
+// products correctly, including products requested by concurrent callers.
+TEST(ParallelGradientEvaluatorTest, ReusesWorkers) {
+  static const int kNumBlocks = 8;
+  static const int kBlockRows = 16;
+  static const int kNumColumns = 40;
+  static const int kNumCallers = 4;
+  static const int kNumProducts = 200;
+  Eigen::SparseMatrix<float, Eigen::RowMajor> matrix =
+      RandomCandidateMatrix(kNumBlocks, kBlockRows, kNumColumns, 2);
+  Eigen::MatrixXf dense = matrix;
+  Eigen::VectorXf labels = Eigen::VectorXf::Random(kNumBlocks * kBlockRows);
+  ParallelGradientEvaluator evaluator(matrix, kBlockRows, labels, 4);
+
+  std::vector<Eigen::VectorXf> weights;
+  std::vector<Eigen::VectorXf> expected_gradients;
+  for (int caller = 0; caller < kNumCallers; caller++) {
+    weights.push_back(Eigen::VectorXf::Random(kNumColumns));
+    expected_gradients.push_back(dense.transpose() *
+                                 (dense * weights.back() - labels));
+  }
+  std::vector<int> num_mismatches(kNumCallers, 0);
+  std::vector<std::thread> callers;
+  for (int caller = 0; caller < kNumCallers; caller++) {
+    callers.emplace_back([&, caller] {
+      Eigen::VectorXf gradient;
+      for (int i = 0; i < kNumProducts; i++) {
+        evaluator.Gradient(weights[caller], &gradient);
+        if ((expected_gradients[caller] - gradient)
+                .lpNorm<Eigen::Infinity>() >= 1e-4) {
+          num_mismatches[caller]++;
+        }
+      }
+    });
+  }
+  for (auto& caller : callers) {
+    caller.join();
+  }
+  for (int caller = 0; caller < kNumCallers; caller++) {
+    EXPECT_EQ(0, num_mismatches[caller]);
+  }
+}
+
+// Tests that LipschitzBound() bounds the largest eigenvalue of A^T A.
+TEST(ParallelGradientEvaluatorTest, LipschitzBound) {
+  Eigen::SparseMatrix<float, Eigen::RowMajor> matrix =
+      RandomCandidateMatrix(4, 8, 20, 2);
+  Eigen::MatrixXf dense = matrix;
+  Eigen::VectorXf labels = Eigen::VectorXf::Zero(32);
+  ParallelGradientEvaluator evaluator(matrix, 8, labels, 2);
+  Eigen::SelfAdjointEigenSolver<Eigen::MatrixXf> eigen_solver(
+      dense.transpose() * dense);
+  EXPECT_GE(evaluator.LipschitzBound() * 1.0001f,
+            eigen_solver.eigenvalues().maxCoeff());
+}
+
+}  // namespace rappor
+}  // namespace cobalt
@@ -16,6 +16,15 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "algorithms/rappor/candidate_hash_index.h"
+#include "algorithms/rappor/least_squares_refit.h"
+#include "algorithms/rappor/parallel_gradient_evaluator.h"
 #include "algorithms/rappor/rappor_encoder.h"
 #include "third_party/lossmin/lossmin/losses/inner-product-loss-function.h"
 #include "third_party/lossmin/lossmin/minimizers/gradient-evaluator.h"
@@ -26,9 +35,13 @@
 namespace cobalt {
 namespace rappor {
 
-// Stackdriver metric contants
 namespace {
+// Stackdriver metric contants
 const char kAnalyzeFailure[] = "rappor-analyzer-analyze-failure";
+
+// The convergence threshold of MinimizeWithProximalGradient() if none is
+// specified.
+const float kDefaultConvergenceThreshold = 1e-6f;
 }  // namespace
 
 using crypto::byte;
@@ -46,6 +59,20 @@ bool RapporAnalyzer::AddObservation(const RapporObservation& obs) {
   return bit_counter_.AddObservation(obs);
 }
 
+size_t RapporAnalyzer::AddObservations(const uint8_t* bloom_bytes,
+                                       const uint32_t* cohorts,
+                                       size_t num_observations,
+                                       size_t stride) {
+  VLOG(5) << "RapporAnalyzer::AddObservations() num_observations="
+          << num_observations;
+  return bit_counter_.AddObservations(bloom_bytes, cohorts, num_observations,
+                                      stride);
+}
+
+bool RapporAnalyzer::Merge(const RapporAnalyzer& other) {
+  return bit_counter_.Merge(other.bit_counter_);
+}
+
 grpc::Status RapporAnalyzer::Analyze(
     std::vector<CandidateResult>* results_out) {
   CHECK(results_out);
@@ -65,11 +92,101 @@ grpc::Status RapporAnalyzer::Analyze(
   // we are estimating. See comments on the declaration of
   // ExtractEstimatedBitCountRatios() for a description of this vector.
   Eigen::VectorXf est_bit_count_ratios;
-  status = ExtractEstimatedBitCountRatios(&est_bit_count_ratios);
+  Eigen::VectorXf est_std_errors;
+  status = ExtractEstimatedBitCountRatios(
+      &est_bit_count_ratios,
+      solver_options_.least_squares_refit ? &est_std_errors : nullptr);
   if (!status.ok()) {
     return status;
   }
 
+  // Each column of candidate_matrix_ corresponds to a candidate that was
+  // not pruned. The weights are indexed by column.
+  const size_t num_candidates =
+      candidate_map_.candidate_list->candidates_size();
+  const int num_columns = candidate_matrix_.cols();
+  Eigen::VectorXf est_candidate_weights(num_columns);
+  if (initial_weights_.size() == num_candidates) {
+    // Warm-start from the given weight vector.
+    for (int column = 0; column < num_columns; column++) {
+      est_candidate_weights(column) =
+          initial_weights_[column_candidates_[column]];
+    }
+  } else {
+    if (!initial_weights_.empty()) {
+      LOG(WARNING) << "Ignoring initial weights of size "
+                   << initial_weights_.size() << ". Expecting "
+                   << num_candidates;
+    }
+    // Initialize the weight vector to the constant 1/n vector.
+    est_candidate_weights.setConstant(1.0 / num_columns);
+  }
+  const Eigen::VectorXf initial_candidate_weights = est_candidate_weights;
+
+  bool initial_weights_better = false;
+  if (num_columns == 0) {
+    // Every candidate was pruned.
+    converged_ = true;
+  } else if (solver_options_.minimizer ==
+             RapporSolverOptions::kProximalGradient) {
+    converged_ = MinimizeWithProximalGradient(est_bit_count_ratios,
+                                              &est_candidate_weights,
+                                              &initial_weights_better);
+  } else {
+    if (solver_options_.num_threads > 1) {
+      LOG(WARNING) << "The boosting minimizer runs on a single thread. "
+                      "Ignoring num_threads="
+                   << solver_options_.num_threads << ".";
+    }
+    converged_ = MinimizeWithBoosting(est_bit_count_ratios,
+                                      &est_candidate_weights,
+                                      &initial_weights_better);
+  }
+  if (!converged_) {
+    std::ostringstream message;
+    message << "The minimizer did not converge after "
+            << solver_options_.max_epochs << " epochs.";
+    if (!solver_options_.accept_unconverged) {
+      LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAnalyzeFailure) << message.str();
+      return grpc::Status(grpc::INTERNAL, message.str());
+    }
+    // Return the best solution found so far. The minimizers do not
+    // guarantee that the loss decreases monotonically so we fall back to
+    // the initial weights if they are better.
+    if (initial_weights_better) {
+      est_candidate_weights = initial_candidate_weights;
+    }
+    LOG(WARNING) << message.str() << " Using the best solution found.";
+  }
+
+  std::vector<double> std_errors(num_columns, 0.0);
+  if (solver_options_.least_squares_refit) {
+    grpc::Status status = LeastSquaresRefit(
+        candidate_matrix_, est_bit_count_ratios, est_std_errors,
+        bit_counter_.num_observations(),
+        solver_options_.max_refit_candidates, &est_candidate_weights,
+        &std_errors);
+    if (!status.ok()) {
+      LOG(WARNING) << status.error_message() << " Using the estimates of the "
+                   << "minimizer without standard errors.";
+    }
+  }
+
+  // Pruned candidates have an estimated count of zero.
+  results_out->assign(num_candidates, CandidateResult());
+  for (int column = 0; column < num_columns; column++) {
+    CandidateResult& result = results_out->at(column_candidates_[column]);
+    result.count_estimate =
+        est_candidate_weights(column) * bit_counter_.num_observations();
+    result.std_error = std_errors[column];
+  }
+
+  return grpc::Status::OK;
+}
+
+bool RapporAnalyzer::MinimizeWithBoosting(
+    const Eigen::VectorXf& est_bit_count_ratios,
+    Eigen::VectorXf* est_candidate_weights, bool* initial_weights_better) {
   ///////////////////////////////////////////////////////////////////////////
   // Note(rudominer) The code below is a temporary proof-of-concept.
   // It is not intended to be used for Cobalt production. The goal is to
@@ -111,37 +228,89 @@ grpc::Status RapporAnalyzer::Analyze(
   lossmin::LinearRegressionLossFunction loss_function;
   lossmin::GradientEvaluator grad_eval(candidate_matrix_, as_label_set,
                                        &loss_function);
-  // Note(rudominer) The two "0.0" parameters below are l1 and l2 the weights
-  // given to the l1 and l2 norms of w in the loss function. In order to
-  // have behvior similar to the LASSO implementation we want to set l1 > 0.
-  // However I have found that when I set l1 > 0 then the algorithm does
-  // not converge. I don't know why.
-  lossmin::ParallelBoostingWithMomentum minimizer(0.0, 0.0, grad_eval);
+  // The two parameters below are l1 and l2, the weights given to the l1 and
+  // l2 norms of w in the loss function. With solver_options_.l1 > 0 this is
+  // a Lasso regression. See RapporSolverOptions::l1.
+  lossmin::ParallelBoostingWithMomentum minimizer(solver_options_.l1, 0.0,
+                                                  grad_eval);
   minimizer.Setup();
 
-  const int num_candidates = candidate_matrix_.cols();
-  // Initialize the weight vector to the constant 1/n vector.
-  lossmin::Weights est_candidate_weights =
-      lossmin::Weights::Constant(num_candidates, 1.0 / num_candidates);
-  std::vector<float> loss_not_used;
-  if (!minimizer.Run(10000, &est_candidate_weights, &loss_not_used)) {
-    std::string message =
-        "ParallelBoostingWithMomentum did not converge after 10,000 epochs.";
-    LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAnalyzeFailure) << message;
-    return grpc::Status(grpc::INTERNAL, message);
+  if (solver_options_.convergence_threshold > 0) {
+    minimizer.set_convergence_threshold(solver_options_.convergence_threshold);
   }
 
-  results_out->resize(num_candidates);
-  for (auto i = 0; i < num_candidates; i++) {
-    results_out->at(i).count_estimate =
-        est_candidate_weights(i) * bit_counter_.num_observations();
+  const lossmin::Weights initial_candidate_weights = *est_candidate_weights;
+  const int max_epochs = solver_options_.max_epochs;
+  const int convergence_epochs =
+      std::max(solver_options_.convergence_epochs, 1);
+  std::vector<float> loss_not_used;
+  if (minimizer.Run(max_epochs, max_epochs, convergence_epochs,
+                    est_candidate_weights, &loss_not_used)) {
+    return true;
   }
+  *initial_weights_better = minimizer.Loss(initial_candidate_weights) <
+                            minimizer.Loss(*est_candidate_weights);
+  return false;
+}
 
-  return grpc::Status::OK;
+bool RapporAnalyzer::MinimizeWithProximalGradient(
+    const Eigen::VectorXf& est_bit_count_ratios,
+    Eigen::VectorXf* est_candidate_weights, bool* initial_weights_better) {
+  ParallelGradientEvaluator evaluator(candidate_matrix_, config_->num_bits(),
+                                      est_bit_count_ratios,
+                                      solver_options_.num_threads);
+  const float lipschitz_bound = evaluator.LipschitzBound();
+  if (lipschitz_bound <= 0) {
+    // The matrix is zero so every vector of weights is a minimizer.
+    return true;
+  }
+  const float step = 1.0f / lipschitz_bound;
+  const float l1_step = solver_options_.l1 * step;
+  const float threshold = solver_options_.convergence_threshold > 0
+                              ? solver_options_.convergence_threshold
+                              : kDefaultConvergenceThreshold;
+  const int convergence_epochs =
+      std::max(solver_options_.convergence_epochs, 1);
+
+  const Eigen::VectorXf initial_candidate_weights = *est_candidate_weights;
+  Eigen::VectorXf& weights = *est_candidate_weights;
+  // The point at which the gradient is evaluated, which is extrapolated
+  // from the last two iterates.
+  Eigen::VectorXf momentum_point = weights;
+  Eigen::VectorXf gradient;
+  Eigen::VectorXf next_weights;
+  float momentum = 1.0f;
+  for (int epoch = 1; epoch <= solver_options_.max_epochs; epoch++) {
+    evaluator.Gradient(momentum_point, &gradient);
+    next_weights = momentum_point - step * gradient;
+    if (l1_step > 0) {
+      // The proximal operator of the l1 norm: soft thresholding.
+      next_weights = next_weights.array().sign() *
+                     (next_weights.array().abs() - l1_step).max(0.0f);
+    }
+    // Restart the momentum if it points in a direction in which the loss
+    // increases.
+    if ((momentum_point - next_weights).dot(next_weights - weights) > 0) {
+      momentum = 1.0f;
+    }
+    float next_momentum =
+        (1.0f + std::sqrt(1.0f + 4.0f * momentum * momentum)) / 2.0f;
+    momentum_point = next_weights + ((momentum - 1.0f) / next_momentum) *
+                                        (next_weights - weights);
+    momentum = next_momentum;
+    float max_change = (next_weights - weights).lpNorm<Eigen::Infinity>();
+    weights.swap(next_weights);
+    if (epoch % convergence_epochs == 0 && max_change <= threshold) {
+      return true;
+    }
+  }
+  *initial_weights_better = evaluator.Loss(initial_candidate_weights) <
+                            evaluator.Loss(weights);
+  return false;
 }
 
 grpc::Status RapporAnalyzer::ExtractEstimatedBitCountRatios(
-    Eigen::VectorXf* est_bit_count_ratios) {
+    Eigen::VectorXf* est_bit_count_ratios, Eigen::VectorXf* est_std_errors) {
   VLOG(5) << "RapporAnalyzer::ExtractEstimatedBitCountRatios()";
   CHECK(est_bit_count_ratios);
 
@@ -161,6 +330,9 @@ grpc::Status RapporAnalyzer::ExtractEstimatedBitCountRatios(
   const uint32_t num_cohorts = config_->num_cohorts();
 
   est_bit_count_ratios->resize(num_cohorts * num_bits);
+  if (est_std_errors) {
+    est_std_errors->resize(num_cohorts * num_bits);
+  }
 
   const std::vector<CohortCounts>& estimated_counts =
       bit_counter_.EstimateCounts();
@@ -175,6 +347,11 @@ grpc::Status RapporAnalyzer::ExtractEstimatedBitCountRatios(
       (*est_bit_count_ratios)(cohort_block_base + bloom_index) =
           cohort_data.count_estimates[bit_index] /
           static_cast<double>(cohort_data.num_observations);
+      if (est_std_errors) {
+        (*est_std_errors)(cohort_block_base + bloom_index) =
+            cohort_data.std_errors[bit_index] /
+            static_cast<double>(cohort_data.num_observations);
+      }
     }
     cohort_block_base += num_bits;
   }
@@ -196,9 +373,6 @@ grpc::Status RapporAnalyzer::BuildCandidateMap() {
                         "list was specified.");
   }
 
-  // TODO(rudominer) We should cache candidate_matrix_ rather than recomputing
-  // candidate_map_ and candidate_matrix_ each time.
-
   const uint32_t num_bits = config_->num_bits();
   const uint32_t num_cohorts = config_->num_cohorts();
   const uint32_t num_hashes = config_->num_hashes();
@@ -216,51 +390,81 @@ grpc::Status RapporAnalyzer::BuildCandidateMap() {
             << " candidates.";
   }
 
-  candidate_matrix_.resize(num_cohorts * num_bits, num_candidates);
+  // Obtain the bit indices for all (candidate, cohort) pairs. If we have
+  // been given a directory for persistent indices then we first try to
+  // memory-map a previously written index so that we do not have to perform
+  // num_candidates * num_cohorts hash operations.
+  CandidateHashIndex index;
+  CandidateHashIndex::Key index_key;
+  std::string index_path;
+  if (!candidate_index_directory_.empty()) {
+    if (CandidateHashIndex::MakeKey(num_bits, num_hashes, num_cohorts,
+                                    *candidate_map_.candidate_list,
+                                    &index_key)) {
+      index_path =
+          CandidateHashIndex::PathForKey(candidate_index_directory_, index_key);
+    }
+  }
+  std::vector<uint16_t> computed_bit_indices;
+  bool use_index = !index_path.empty() && index.Open(index_path, index_key);
+  if (!use_index) {
+    auto status = ComputeBitIndices(&computed_bit_indices);
+    if (!status.ok()) {
+      return status;
+    }
+    if (!index_path.empty()) {
+      CandidateHashIndex::Write(index_path, index_key, computed_bit_indices);
+    }
+  }
+
   std::vector<Eigen::Triplet<float>> sparse_matrix_triplets;
   sparse_matrix_triplets.reserve(num_candidates * num_cohorts * num_hashes);
-
-  int column = 0;
-  for (const std::string& candidate :
-       candidate_map_.candidate_list->candidates()) {
-    // In rappor_encoder.cc it is not std::strings that are encoded but rather
-    // |ValuePart|s. So here we want to take the candidate as a string and
-    // convert it into a serialized |ValuePart|.
-    ValuePart candidate_as_value_part;
-    candidate_as_value_part.set_string_value(candidate);
-    std::string serialized_candidate;
-    candidate_as_value_part.SerializeToString(&serialized_candidate);
-
+  candidate_map_.candidate_cohort_maps.clear();
+  candidate_map_.candidate_cohort_maps.reserve(num_candidates);
+  column_candidates_.clear();
+  column_candidates_.reserve(num_candidates);
+
+  // bloom_filter is indexed "from the left". That is bloom_filter[0]
+  // corresponds to the most significant bit of the first byte of the
+  // Bloom filter.
+  std::vector<bool> bloom_filter(num_bits, false);
+
+  // The estimated bit counts used for pruning candidates, if enabled.
+  const std::vector<CohortCounts>* estimated_counts =
+      solver_options_.prune_candidates ? &bit_counter_.EstimateCounts()
+                                       : nullptr;
+
+  for (uint32_t candidate = 0; candidate < num_candidates; candidate++) {
     // Append a CohortMap for this candidate.
     candidate_map_.candidate_cohort_maps.emplace_back();
     CohortMap& cohort_map = candidate_map_.candidate_cohort_maps.back();
-
-    // Iterate through the cohorts.
-    int row_block_base = 0;
+    cohort_map.cohort_hashes.resize(num_cohorts);
     for (size_t cohort = 0; cohort < num_cohorts; cohort++) {
-      // Append an instance of |Hashes| for this cohort.
-      cohort_map.cohort_hashes.emplace_back();
-      Hashes& hashes = cohort_map.cohort_hashes.back();
-
-      // Form one big hashed value of the serialized_candidate. This will be
-      // used to obtain multiple bit indices.
-      byte hashed_value[crypto::hash::DIGEST_SIZE];
-      if (!RapporEncoder::HashValueAndCohort(serialized_candidate, cohort,
-                                             num_hashes, hashed_value)) {
-        return grpc::Status(grpc::INTERNAL,
-                            "Hash operation failed unexpectedly.");
+      const uint16_t* bit_indices;
+      if (use_index) {
+        bit_indices = index.BitIndices(candidate, cohort);
+      } else {
+        size_t offset =
+            (static_cast<size_t>(candidate) * num_cohorts + cohort) *
+            num_hashes;
+        bit_indices = &computed_bit_indices[offset];
       }
+      cohort_map.cohort_hashes[cohort].bit_indices.assign(
+          bit_indices, bit_indices + num_hashes);
+    }
 
-      // bloom_filter is indexed "from the left". That is bloom_filter[0]
-      // corresponds to the most significant bit of the first byte of the
-      // Bloom filter.
-      std::vector<bool> bloom_filter(num_bits, false);
+    if (estimated_counts &&
+        !IsCandidateSupported(cohort_map, *estimated_counts)) {
+      continue;
+    }
+    const uint32_t column = column_candidates_.size();
+    column_candidates_.push_back(candidate);
 
-      // Extract one bit index for each of the hashes in the Bloom filter.
-      for (size_t hash_index = 0; hash_index < num_hashes; hash_index++) {
-        uint32_t bit_index =
-            RapporEncoder::ExtractBitIndex(hashed_value, hash_index, num_bits);
-        hashes.bit_indices.push_back(bit_index);
+    // Iterate through the cohorts.
+    int row_block_base = 0;
+    for (size_t cohort = 0; cohort < num_cohorts; cohort++) {
+      std::fill(bloom_filter.begin(), bloom_filter.end(), false);
+      for (uint16_t bit_index : cohort_map.cohort_hashes[cohort].bit_indices) {
         // |bit_index| is an index "from the right".
         bloom_filter[num_bits - 1 - bit_index] = true;
       }
@@ -279,17 +483,87 @@ grpc::Status RapporAnalyzer::BuildCandidateMap() {
       // of |num_bits| rows.
       row_block_base += num_bits;
     }
-    // In our sparse matrix representation a column corresponds to a candidate.
-    column++;
-    row_block_base = 0;
   }
 
+  if (solver_options_.prune_candidates) {
+    LOG(INFO) << "RapporAnalyzer: pruned " << num_pruned_candidates()
+              << " of " << num_candidates << " candidates.";
+  }
+  candidate_matrix_.resize(num_cohorts * num_bits, column_candidates_.size());
   candidate_matrix_.setFromTriplets(sparse_matrix_triplets.begin(),
                                     sparse_matrix_triplets.end());
 
   return grpc::Status::OK;
 }
 
+bool RapporAnalyzer::IsCandidateSupported(
+    const CohortMap& cohort_map,
+    const std::vector<CohortCounts>& estimated_counts) {
+  size_t num_observed_cohorts = 0;
+  size_t num_supporting_cohorts = 0;
+  for (size_t cohort = 0; cohort < estimated_counts.size(); cohort++) {
+    const CohortCounts& counts = estimated_counts[cohort];
+    if (counts.num_observations == 0) {
+      continue;
+    }
+    num_observed_cohorts++;
+    bool all_bits_set = true;
+    // Both |bit_index| and the CohortCounts index bits "from the right".
+    for (uint16_t bit_index : cohort_map.cohort_hashes[cohort].bit_indices) {
+      if (counts.count_estimates[bit_index] <=
+          solver_options_.prune_z_score * counts.std_errors[bit_index]) {
+        all_bits_set = false;
+        break;
+      }
+    }
+    if (all_bits_set) {
+      num_supporting_cohorts++;
+    }
+  }
+  return num_supporting_cohorts >=
+         solver_options_.prune_min_cohort_fraction * num_observed_cohorts;
+}
+
+grpc::Status RapporAnalyzer::ComputeBitIndices(
+    std::vector<uint16_t>* bit_indices) {
+  const uint32_t num_bits = config_->num_bits();
+  const uint32_t num_cohorts = config_->num_cohorts();
+  const uint32_t num_hashes = config_->num_hashes();
+  const size_t num_candidates =
+      candidate_map_.candidate_list->candidates_size();
+  bit_indices->clear();
+  bit_indices->reserve(num_candidates * num_cohorts * num_hashes);
+
+  for (const std::string& candidate :
+       candidate_map_.candidate_list->candidates()) {
+    // In rappor_encoder.cc it is not std::strings that are encoded but rather
+    // |ValuePart|s. So here we want to take the candidate as a string and
+    // convert it into a serialized |ValuePart|.
+    ValuePart candidate_as_value_part;
+    candidate_as_value_part.set_string_value(candidate);
+    std::string serialized_candidate;
+    candidate_as_value_part.SerializeToString(&serialized_candidate);
+
+    for (size_t cohort = 0; cohort < num_cohorts; cohort++) {
+      // Form one big hashed value of the serialized_candidate. This will be
+      // used to obtain multiple bit indices.
+      byte hashed_value[crypto::hash::DIGEST_SIZE];
+      if (!RapporEncoder::HashValueAndCohort(serialized_candidate, cohort,
+                                             num_hashes, hashed_value)) {
+        return grpc::Status(grpc::INTERNAL,
+                            "Hash operation failed unexpectedly.");
+      }
+
+      // Extract one bit index for each of the hashes in the Bloom filter.
+      for (size_t hash_index = 0; hash_index < num_hashes; hash_index++) {
+        bit_indices->push_back(
+            RapporEncoder::ExtractBitIndex(hashed_value, hash_index, num_bits));
+      }
+    }
+  }
+  return grpc::Status::OK;
+}
+
 }  // namespace rappor
 }  // namespace cobalt
 
@@ -17,6 +17,7 @@
 
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "./observation.pb.h"
@@ -39,6 +40,71 @@ struct CandidateResult {
   double std_error;
 };
 
+// Options that control the minimizer used by RapporAnalyzer::Analyze().
+struct RapporSolverOptions {
+  // The maximum number of epochs that the minimizer may run.
+  int max_epochs = 10000;
+
+  // The number of epochs between successive checks for convergence.
+  int convergence_epochs = 1;
+
+  // If positive, overrides the minimizer's default convergence threshold.
+  // Larger values allow the minimizer to stop sooner with a less exact
+  // solution.
+  float convergence_threshold = 0.0f;
+
+  // If true and the minimizer has not converged after |max_epochs| epochs
+  // then Analyze() returns the best solution found so far, rather than
+  // returning an error. RapporAnalyzer::converged() may be used to
+  // distinguish the two cases.
+  bool accept_unconverged = false;
+
+  // The weight given to the l1 norm of the solution in the loss function.
+  // With l1 > 0 the minimizer performs a Lasso regression that favors
+  // solutions in which few candidates have a non-zero estimate.
+  float l1 = 0.0f;
+
+  // If true then Analyze() performs a second stage after the minimizer: it
+  // refits the candidates whose estimated count is at least one half using
+  // ordinary least squares restricted to their columns of the candidate
+  // matrix and computes the std_error of each CandidateResult from the
+  // std errors of the estimated bit counts. Otherwise std_error is zero.
+  bool least_squares_refit = false;
+
+  // The refit takes memory quadratic and time cubic in the number of
+  // candidates it selects. If it would select more than this many then
+  // Analyze() logs a warning and skips it, so std_error is zero. See
+  // LeastSquaresRefit().
+  size_t max_refit_candidates = 2000;
+
+  // The algorithms with which Analyze() may minimize the loss.
+  enum Minimizer {
+    // lossmin's ParallelBoostingWithMomentum, on the calling thread.
+    kBoosting,
+    // Accelerated proximal gradient descent (FISTA with adaptive restart)
+    // whose matrix products are computed by |num_threads| threads. See
+    // ParallelGradientEvaluator.
+    kProximalGradient,
+  };
+  Minimizer minimizer = kBoosting;
+
+  // The number of threads used by the kProximalGradient minimizer. The
+  // kBoosting minimizer always runs on a single thread.
+  int num_threads = 1;
+
+  // If true then, before the minimizer runs, Analyze() drops the candidates
+  // that the observations show to be almost certainly absent, which shrinks
+  // the candidate matrix and speeds up the minimizer. In a given cohort a
+  // candidate is supported if the estimated count of each of its Bloom
+  // filter bits exceeds |prune_z_score| times its std error. A candidate is
+  // dropped if it is supported in fewer than |prune_min_cohort_fraction| of
+  // the cohorts that have observations. Dropped candidates have an
+  // estimated count of zero.
+  bool prune_candidates = false;
+  double prune_z_score = 2.0;
+  double prune_min_cohort_fraction = 0.5;
+};
+
 // A RapporAnalyzer is constructed for the purpose of performing a single
 // string RAPPOR analysis.
 //
@@ -56,6 +122,10 @@ struct CandidateResult {
 //
 // (4) Optionally examine the underlying BloomBitCounter via the bit_counter()
 //     accessor.
+//
+// Before step (3) the minimizer may be tuned via set_solver_options() and
+// warm-started via set_initial_weights(), for example with the estimates from
+// a previous analysis of the same report.
 class RapporAnalyzer {
  public:
   // Constructs a RapporAnalyzer for the given config and candidates. All of the
@@ -77,6 +147,18 @@ class RapporAnalyzer {
   // Returns true to indicate the observation was added without error.
   bool AddObservation(const RapporObservation& obs);
 
+  // Adds a batch of observations stored in columnar form. See
+  // BloomBitCounter::AddObservations() for the format. Returns the number of
+  // observations that were added without error.
+  size_t AddObservations(const uint8_t* bloom_bytes, const uint32_t* cohorts,
+                         size_t num_observations, size_t stride);
+
+  // Adds the observations that were added to |other| into this
+  // RapporAnalyzer. See BloomBitCounter::Merge(). Returns false if |other|
+  // was not constructed with an equivalent valid RapporConfig. The
+  // candidates of |other| are ignored.
+  bool Merge(const RapporAnalyzer& other);
+
   // Performs the string RAPPOR analysis and writes the results to
   // |results_out|. Return OK for success or an error status.
   //
@@ -90,6 +172,47 @@ class RapporAnalyzer {
   // Gives access to the underlying BloomBitCounter.
   const BloomBitCounter& bit_counter() { return bit_counter_; }
 
+  // Enables the use of a persistent CandidateHashIndex stored in |directory|.
+  // If |directory| is not empty then Analyze() will memory-map the index
+  // file for the config and candidates passed to the constructor if one
+  // exists in |directory|. Otherwise it will hash the candidates as usual and
+  // then write a new index file into |directory| for use by later analyses
+  // of the same candidates. Failure to read or write an index file is not an
+  // error.
+  void set_candidate_index_directory(const std::string& directory) {
+    candidate_index_directory_ = directory;
+  }
+
+  // Sets the options for the minimizer used by Analyze().
+  void set_solver_options(const RapporSolverOptions& options) {
+    solver_options_ = options;
+  }
+
+  // Sets the vector from which the minimizer used by Analyze() starts. By
+  // default it starts from the constant vector in which each candidate has
+  // weight 1/num_candidates. |weights| must have one entry per candidate and
+  // each entry is the estimated fraction of all observations that are for
+  // that candidate. For example, the estimates from a previous analysis of
+  // the same report may be used: weights[i] = results[i].count_estimate /
+  // num_observations. A good initial vector can reduce the number of epochs
+  // the minimizer needs to converge by a large factor. If |weights| has the
+  // wrong size then Analyze() logs a warning and ignores it.
+  void set_initial_weights(std::vector<float> weights) {
+    initial_weights_ = std::move(weights);
+  }
+
+  // Returns whether the minimizer converged during the most recent
+  // successful invocation of Analyze(). This can only be false if
+  // RapporSolverOptions::accept_unconverged was set.
+  bool converged() const { return converged_; }
+
+  // Returns the number of candidates that were dropped by the most recent
+  // invocation of Analyze(). See RapporSolverOptions::prune_candidates.
+  size_t num_pruned_candidates() const {
+    return candidate_map_.candidate_cohort_maps.size() -
+           column_candidates_.size();
+  }
+
  private:
   friend class RapporAnalyzerTest;
 
@@ -97,6 +220,11 @@ class RapporAnalyzer {
   // the data passed to the constructor.
   grpc::Status BuildCandidateMap();
 
+  // Computes the Bloom filter bit indices of every (candidate, cohort) pair
+  // by hashing, and writes them to |bit_indices| ordered first by candidate,
+  // then by cohort and then by hash index.
+  grpc::Status ComputeBitIndices(std::vector<uint16_t>* bit_indices);
+
   // An instance of Hashes is implicitly associated with a given
   // (candidate, cohort) pair and gives the list of hash values for that pair
   // under each of several hash functions. Each of the hash values is a
@@ -136,6 +264,13 @@ class RapporAnalyzer {
     std::vector<CohortMap> candidate_cohort_maps;
   };
 
+  // Returns whether the candidate with the given |cohort_map| should be kept
+  // in the candidate matrix given the |estimated_counts| returned by
+  // BloomBitCounter::EstimateCounts(). See
+  // RapporSolverOptions::prune_candidates.
+  bool IsCandidateSupported(const CohortMap& cohort_map,
+                            const std::vector<CohortCounts>& estimated_counts);
+
   // Computes the column vector est_bit_count_ratios. This method should be
   // invoked after all Observations have been added via AddObservation().
   //
@@ -153,8 +288,32 @@ class RapporAnalyzer {
   //
   // See the note at the bottom of rappor_anlayzer.cc for a justification of
   // this formula.
+  //
+  // If |est_std_errors| is not null it is set to a vector parallel to
+  // |est_bit_count_ratios| that contains the standard errors of its entries.
   grpc::Status ExtractEstimatedBitCountRatios(
-      Eigen::VectorXf* est_bit_count_ratios);
+      Eigen::VectorXf* est_bit_count_ratios,
+      Eigen::VectorXf* est_std_errors = nullptr);
+
+  // Minimizes the least squares loss of A w = b plus l1 times the l1 norm of
+  // w, where A is candidate_matrix_ and b is |est_bit_count_ratios|, with
+  // lossmin's ParallelBoostingWithMomentum, starting from
+  // |est_candidate_weights|.
+  // Returns whether the minimizer converged. If it did not then
+  // |initial_weights_better| is set to whether the starting weights have a
+  // lower loss than the final weights.
+  bool MinimizeWithBoosting(const Eigen::VectorXf& est_bit_count_ratios,
+                            Eigen::VectorXf* est_candidate_weights,
+                            bool* initial_weights_better);
+
+  // Minimizes 1/2 ||A w - b||^2 + l1 ||w||_1, with the same contract as
+  // MinimizeWithBoosting(), using accelerated proximal gradient descent
+  // (FISTA with adaptive restart) and a ParallelGradientEvaluator with
+  // solver_options_.num_threads threads. Convergence means that no weight
+  // changed by more than the convergence threshold in an epoch.
+  bool MinimizeWithProximalGradient(
+      const Eigen::VectorXf& est_bit_count_ratios,
+      Eigen::VectorXf* est_candidate_weights, bool* initial_weights_better);
 
   BloomBitCounter bit_counter_;
 
@@ -162,15 +321,32 @@ class RapporAnalyzer {
 
   CandidateMap candidate_map_;
 
+  // See set_candidate_index_directory().
+  std::string candidate_index_directory_;
+
+  // See set_solver_options().
+  RapporSolverOptions solver_options_;
+
+  // See set_initial_weights().
+  std::vector<float> initial_weights_;
+
+  // See converged().
+  bool converged_ = false;
+
+  // The index of the candidate that corresponds to each column of
+  // candidate_matrix_. This is the identity unless candidates were pruned.
+  std::vector<uint32_t> column_candidates_;
+
   // candidate_matrix_ is a representation of candidate_map_ as a sparse matrix.
   // It is an (m * k) X s sparse binary matrix, where
   // m = # of cohorts
   // k = # of Bloom filter bits per cohort
-  // s = # of candidates
+  // s = # of candidates that were not pruned
   // and for i < m, j < k, r < s candidate_matrix_[i*k + j, r] = 1 iff
-  // candidate_map_.candidate_cohort_maps[r].cohort_hashes[i].bit_indices[g] =
+  // candidate_map_.candidate_cohort_maps[c].cohort_hashes[i].bit_indices[g] =
   //     k - j
-  // for at least one g < h where h = # of hashes.
+  // for at least one g < h where h = # of hashes and c =
+  // column_candidates_[r].
   //
   // In other words, if one of the hash functions for cohort i hashes candidate
   // r to bit j (indexed from the left) then we put a 1 in column r, row
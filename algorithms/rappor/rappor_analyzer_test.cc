@@ -15,12 +15,17 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "algorithms/rappor/candidate_hash_index.h"
+#include "algorithms/rappor/least_squares_refit.h"
 #include "algorithms/rappor/rappor_encoder.h"
 #include "algorithms/rappor/rappor_test_utils.h"
 #include "encoder/client_secret.h"
@@ -174,6 +179,24 @@ class RapporAnalyzerTest : public ::testing::Test {
         analyzer_->ExtractEstimatedBitCountRatios(est_bit_count_ratios).ok());
   }
 
+  // Invokes LeastSquaresRefit() on the candidate matrix and the observations
+  // added so far. This should be invoked after BuildCandidateMap.
+  bool RefitLeastSquares(Eigen::VectorXf* est_candidate_weights,
+                         std::vector<double>* std_errors) {
+    Eigen::VectorXf est_bit_count_ratios;
+    Eigen::VectorXf est_std_errors;
+    EXPECT_TRUE(analyzer_
+                    ->ExtractEstimatedBitCountRatios(&est_bit_count_ratios,
+                                                     &est_std_errors)
+                    .ok());
+    return LeastSquaresRefit(analyzer_->candidate_matrix_,
+                             est_bit_count_ratios, est_std_errors,
+                             analyzer_->bit_counter_.num_observations(),
+                             RapporSolverOptions().max_refit_candidates,
+                             est_candidate_weights, std_errors)
+        .ok();
+  }
+
   // Invokes the Analyze() method using the given parameters. Checks that
   // the algorithms converges and that the result vector has the correct length.
   // Doesn't check the result vector at all but uses LOG(ERROR) statments
@@ -417,6 +440,66 @@ TEST_F(RapporAnalyzerTest, BuildCandidateMapCompareWithEncoder) {
   }
 }
 
+// Tests the function BuildCandidateMap when a candidate index directory is
+// set. The first analysis should write an index file and the second should
+// read it, and both should build the same CandidateMap and sparse matrix as
+// an analysis that does not use an index.
+TEST_F(RapporAnalyzerTest, BuildCandidateMapWithIndex) {
+  static const uint32_t kNumCandidates = 50;
+  static const uint32_t kNumCohorts = 20;
+  static const uint32_t kNumHashes = 5;
+  static const uint32_t kNumBloomBits = 64;
+
+  char index_dir_template[] = "/tmp/rappor_analyzer_test_XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(index_dir_template));
+  const std::string index_dir(index_dir_template);
+
+  SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes);
+  BuildCandidateMap();
+  std::vector<std::string> expected_bit_strings;
+  for (size_t candidate = 0; candidate < kNumCandidates; candidate++) {
+    for (size_t cohort = 0; cohort < kNumCohorts; cohort++) {
+      expected_bit_strings.push_back(BuildBitString(candidate, cohort));
+    }
+  }
+  Eigen::SparseMatrix<float, Eigen::RowMajor> expected_matrix =
+      candidate_matrix();
+
+  CandidateHashIndex::Key key;
+  ASSERT_TRUE(CandidateHashIndex::MakeKey(kNumBloomBits, kNumHashes,
+                                          kNumCohorts, candidate_list_, &key));
+  const std::string index_path = CandidateHashIndex::PathForKey(index_dir, key);
+
+  for (int i = 0; i < 2; i++) {
+    SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes);
+    analyzer_->set_candidate_index_directory(index_dir);
+    BuildCandidateMap();
+    // After the first iteration the index file should exist.
+    EXPECT_EQ(0, access(index_path.c_str(), R_OK)) << "i=" << i;
+
+    size_t j = 0;
+    for (size_t candidate = 0; candidate < kNumCandidates; candidate++) {
+      for (size_t cohort = 0; cohort < kNumCohorts; cohort++) {
+        EXPECT_EQ(expected_bit_strings[j++], BuildBitString(candidate, cohort));
+      }
+    }
+    EXPECT_TRUE(expected_matrix.isApprox(candidate_matrix())) << "i=" << i;
+  }
+
+  // A different candidate list must not use the same index file.
+  SetAnalyzer(kNumCandidates + 1, kNumBloomBits, kNumCohorts, kNumHashes);
+  analyzer_->set_candidate_index_directory(index_dir);
+  BuildCandidateMap();
+  EXPECT_EQ(kNumCandidates + 1, candidate_matrix().cols());
+
+  EXPECT_EQ(0, std::remove(index_path.c_str()));
+  ASSERT_TRUE(CandidateHashIndex::MakeKey(kNumBloomBits, kNumHashes,
+                                          kNumCohorts, candidate_list_, &key));
+  EXPECT_EQ(0, std::remove(
+                   CandidateHashIndex::PathForKey(index_dir, key).c_str()));
+  EXPECT_EQ(0, rmdir(index_dir.c_str()));
+}
+
 // Tests the function ExtractEstimatedBitCountRatios(). We build one small
 // estimated bit count ratio vector and explicitly check its values. We
 // use no-randomness: p = 0, q = 1 so that the estimated bit counts are
@@ -513,5 +596,231 @@ TEST_F(RapporAnalyzerTest, ExperimentWithAnalyze) {
                           candidate_indices, true_candidate_counts);
 }
 
+// Tests the least squares refit that forms the second stage of Analyze().
+TEST_F(RapporAnalyzerTest, RefitLeastSquares) {
+  static const uint32_t kNumCandidates = 10;
+  static const uint32_t kNumCohorts = 5;
+  static const uint32_t kNumHashes = 2;
+  static const uint32_t kNumBloomBits = 64;
+
+  for (double prob_0_becomes_1 : {0.0, 0.1}) {
+    prob_0_becomes_1_ = prob_0_becomes_1;
+    prob_1_stays_1_ = 1.0 - prob_0_becomes_1;
+    SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes);
+    BuildCandidateMap();
+
+    // In every cohort 40% of the observations are of candidate 1 and 60% are
+    // of candidate 9. The observations contain the raw Bloom filters so that
+    // with p=0, q=1 the refit recovers the true fractions exactly.
+    for (uint32_t cohort = 0; cohort < kNumCohorts; cohort++) {
+      for (int i = 0; i < 10; i++) {
+        AddObservation(cohort, BuildBitString(i < 4 ? 1 : 9, cohort));
+      }
+    }
+
+    // A rough solution in which the other candidates have estimated counts
+    // below one half.
+    Eigen::VectorXf weights = Eigen::VectorXf::Constant(kNumCandidates, 0.001);
+    weights(1) = 0.3;
+    weights(9) = 0.5;
+    std::vector<double> std_errors;
+    ASSERT_TRUE(RefitLeastSquares(&weights, &std_errors));
+    ASSERT_EQ(kNumCandidates, std_errors.size());
+    for (size_t i = 0; i < kNumCandidates; i++) {
+      if (i == 1 || i == 9) {
+        continue;
+      }
+      EXPECT_EQ(0.0f, weights(i));
+      EXPECT_EQ(0.0, std_errors[i]);
+    }
+    if (prob_0_becomes_1 == 0.0) {
+      EXPECT_NEAR(0.4, weights(1), 1e-5);
+      EXPECT_NEAR(0.6, weights(9), 1e-5);
+      // There is no noise so there is no error.
+      EXPECT_EQ(0.0, std_errors[1]);
+      EXPECT_EQ(0.0, std_errors[9]);
+    } else {
+      EXPECT_GT(std_errors[1], 0.0);
+      EXPECT_GT(std_errors[9], 0.0);
+    }
+  }
+
+  // With 10 candidates and only 8 rows the refit of all of the candidates
+  // is singular.
+  prob_0_becomes_1_ = 0.0;
+  prob_1_stays_1_ = 1.0;
+  SetAnalyzer(kNumCandidates, 8, 1, kNumHashes);
+  BuildCandidateMap();
+  for (uint32_t candidate = 0; candidate < kNumCandidates; candidate++) {
+    AddObservation(0, BuildBitString(candidate, 0));
+  }
+  Eigen::VectorXf weights = Eigen::VectorXf::Constant(kNumCandidates, 0.1);
+  std::vector<double> std_errors;
+  EXPECT_FALSE(RefitLeastSquares(&weights, &std_errors));
+  EXPECT_EQ(Eigen::VectorXf::Constant(kNumCandidates, 0.1), weights);
+}
+
+// Tests Analyze() with the proximal gradient minimizer on one or more
+// threads.
+TEST_F(RapporAnalyzerTest, AnalyzeWithProximalGradient) {
+  static const uint32_t kNumCandidates = 10;
+  static const uint32_t kNumCohorts = 5;
+  static const uint32_t kNumHashes = 2;
+  static const uint32_t kNumBloomBits = 64;
+
+  for (int num_threads : {1, 2, 4, 8}) {
+    SCOPED_TRACE(num_threads);
+    SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes);
+    BuildCandidateMap();
+    // In every cohort 40% of the observations are of candidate 1 and 60% are
+    // of candidate 9. With p=0, q=1 the system Ax = b has an exact solution.
+    for (uint32_t cohort = 0; cohort < kNumCohorts; cohort++) {
+      for (int i = 0; i < 10; i++) {
+        AddObservation(cohort, BuildBitString(i < 4 ? 1 : 9, cohort));
+      }
+    }
+    RapporSolverOptions options;
+    options.minimizer = RapporSolverOptions::kProximalGradient;
+    options.num_threads = num_threads;
+    analyzer_->set_solver_options(options);
+
+    std::vector<CandidateResult> results;
+    ASSERT_EQ(grpc::OK, analyzer_->Analyze(&results).error_code());
+    EXPECT_TRUE(analyzer_->converged());
+    ASSERT_EQ(kNumCandidates, results.size());
+    for (size_t i = 0; i < kNumCandidates; i++) {
+      double expected = i == 1 ? 20 : (i == 9 ? 30 : 0);
+      EXPECT_NEAR(expected, results[i].count_estimate, 0.01);
+    }
+  }
+
+  // A single epoch is not enough to converge.
+  SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes);
+  BuildCandidateMap();
+  AddObservation(0, BuildBitString(3, 0));
+  RapporSolverOptions options;
+  options.minimizer = RapporSolverOptions::kProximalGradient;
+  options.num_threads = 2;
+  options.max_epochs = 1;
+  analyzer_->set_solver_options(options);
+  std::vector<CandidateResult> results;
+  EXPECT_EQ(grpc::INTERNAL, analyzer_->Analyze(&results).error_code());
+}
+
+// Tests that Analyze() prunes the candidates that do not occur.
+TEST_F(RapporAnalyzerTest, AnalyzeWithPruning) {
+  static const uint32_t kNumCandidates = 10;
+  static const uint32_t kNumCohorts = 5;
+  static const uint32_t kNumHashes = 2;
+  static const uint32_t kNumBloomBits = 64;
+
+  SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes);
+  BuildCandidateMap();
+  // Only candidates 1 and 9 occur.
+  for (uint32_t cohort = 0; cohort < kNumCohorts; cohort++) {
+    for (int i = 0; i < 10; i++) {
+      AddObservation(cohort, BuildBitString(i < 4 ? 1 : 9, cohort));
+    }
+  }
+  RapporSolverOptions options;
+  options.minimizer = RapporSolverOptions::kProximalGradient;
+  options.num_threads = 2;
+  options.prune_candidates = true;
+  analyzer_->set_solver_options(options);
+  // The initial weights are indexed by candidate, not by column.
+  std::vector<float> initial_weights(kNumCandidates, 0.0f);
+  initial_weights[1] = 0.5f;
+  initial_weights[9] = 0.5f;
+  analyzer_->set_initial_weights(initial_weights);
+
+  std::vector<CandidateResult> results;
+  ASSERT_EQ(grpc::OK, analyzer_->Analyze(&results).error_code());
+  EXPECT_EQ(8u, analyzer_->num_pruned_candidates());
+  EXPECT_EQ(2, candidate_matrix().cols());
+  ASSERT_EQ(kNumCandidates, results.size());
+  for (size_t i = 0; i < kNumCandidates; i++) {
+    double expected = i == 1 ? 20 : (i == 9 ? 30 : 0);
+    EXPECT_NEAR(expected, results[i].count_estimate, 0.01);
+  }
+
+  // With a minimum cohort fraction of zero nothing is pruned.
+  options.prune_min_cohort_fraction = 0.0;
+  analyzer_->set_solver_options(options);
+  ASSERT_EQ(grpc::OK, analyzer_->Analyze(&results).error_code());
+  EXPECT_EQ(0u, analyzer_->num_pruned_candidates());
+  EXPECT_EQ(kNumCandidates, candidate_matrix().cols());
+}
+
+// Tests the RapporSolverOptions and warm-starting Analyze() from the
+// estimates of a previous analysis.
+TEST_F(RapporAnalyzerTest, AnalyzeWithSolverOptions) {
+  static const uint32_t kNumCandidates = 10;
+  static const uint32_t kNumCohorts = 3;
+  static const uint32_t kNumHashes = 2;
+  static const uint32_t kNumBloomBits = 8;
+  static const int kNumObservations = 100;
+
+  SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes);
+  std::vector<RapporObservation> observations(kNumObservations);
+  for (int i = 0; i < kNumObservations; i++) {
+    RapporEncoder encoder(config_, ClientSecret::GenerateNewSecret());
+    ValuePart value_part;
+    value_part.set_string_value(CandidateString(i < 40 ? 1 : 9));
+    ASSERT_EQ(kOK, encoder.Encode(value_part, &observations[i]));
+  }
+  auto add_observations = [this, &observations]() {
+    for (const auto& observation : observations) {
+      EXPECT_TRUE(analyzer_->AddObservation(observation));
+    }
+  };
+
+  // A cold start with the default options converges.
+  add_observations();
+  std::vector<CandidateResult> results;
+  ASSERT_EQ(grpc::OK, analyzer_->Analyze(&results).error_code());
+  EXPECT_TRUE(analyzer_->converged());
+  ASSERT_EQ(kNumCandidates, results.size());
+
+  // A warm start from the previous estimates converges to the same solution.
+  std::vector<float> initial_weights(kNumCandidates);
+  for (size_t i = 0; i < kNumCandidates; i++) {
+    initial_weights[i] = results[i].count_estimate / kNumObservations;
+  }
+  SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes);
+  add_observations();
+  analyzer_->set_initial_weights(initial_weights);
+  std::vector<CandidateResult> warm_results;
+  ASSERT_EQ(grpc::OK, analyzer_->Analyze(&warm_results).error_code());
+  EXPECT_TRUE(analyzer_->converged());
+  ASSERT_EQ(kNumCandidates, warm_results.size());
+  for (size_t i = 0; i < kNumCandidates; i++) {
+    EXPECT_NEAR(results[i].count_estimate, warm_results[i].count_estimate,
+                1.0);
+  }
+
+  // Initial weights of the wrong size are ignored.
+  SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes);
+  add_observations();
+  analyzer_->set_initial_weights(std::vector<float>(kNumCandidates + 1, 0.1));
+  EXPECT_EQ(grpc::OK, analyzer_->Analyze(&warm_results).error_code());
+
+  // The minimizer cannot converge in a single epoch from a cold start.
+  RapporSolverOptions options;
+  options.max_epochs = 1;
+  SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes);
+  add_observations();
+  analyzer_->set_solver_options(options);
+  EXPECT_EQ(grpc::INTERNAL, analyzer_->Analyze(&warm_results).error_code());
+
+  // Unless we accept an unconverged solution.
+  options.accept_unconverged = true;
+  SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes);
+  add_observations();
+  analyzer_->set_solver_options(options);
+  ASSERT_EQ(grpc::OK, analyzer_->Analyze(&warm_results).error_code());
+  EXPECT_FALSE(analyzer_->converged());
+  EXPECT_EQ(kNumCandidates, warm_results.size());
+}
+
 }  // namespace rappor
 }  // namespace cobalt
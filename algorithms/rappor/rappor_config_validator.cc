@@ -85,7 +85,7 @@ bool ExtractCategories(const BasicRapporConfig& config,
     } break;
     case BasicRapporConfig::kIndexedCategories: {
       uint32_t num_categories = config.indexed_categories().num_categories();
-      if (num_categories >= 1024) {
+      if (num_categories <= 1 || num_categories >= 1024) {
         return false;
       }
       for (uint32_t i = 0; i < num_categories; i++) {
@@ -100,6 +100,18 @@ bool ExtractCategories(const BasicRapporConfig& config,
   return true;
 }
 
+// Returns the 64-bit FNV-1a hash of |str|. This is only used to place string
+// categories in RapporConfigValidator's in-memory hash table so it need not
+// be cryptographically strong.
+uint64_t HashCategory(const std::string& str) {
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : str) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
 }  // namespace
 
 uint32_t RapporConfigValidator::MinPower2Above(uint16_t x) {
@@ -173,17 +185,8 @@ RapporConfigValidator::RapporConfigValidator(const BasicRapporConfig& config)
     return;
   }
   num_bits_ = categories_.size();
-
-  // Insert all of the categories into the map.
-  size_t index = 0;
-  for (const auto& category : categories_) {
-    std::string serialized_value_part;
-    category.SerializeToString(&serialized_value_part);
-    auto result =
-        category_to_bit_index_.emplace(serialized_value_part, index++);
-    if (!result.second) {
-      return;
-    }
+  if (!BuildCategoryIndex()) {
+    return;
   }
 
   valid_ = true;
@@ -191,17 +194,92 @@ RapporConfigValidator::RapporConfigValidator(const BasicRapporConfig& config)
 
 RapporConfigValidator::~RapporConfigValidator() {}
 
+bool RapporConfigValidator::BuildCategoryIndex() {
+  // ExtractCategories() guarantees that there are at least two categories,
+  // all of the same type.
+  category_case_ = categories_[0].data_case();
+  switch (category_case_) {
+    case ValuePart::kIntValue:
+      first_int_category_ = categories_[0].int_value();
+      return true;
+    case ValuePart::kIndexValue:
+      first_int_category_ = 0;
+      return true;
+    case ValuePart::kStringValue:
+      break;
+    default:
+      return false;
+  }
+
+  // Keep the load factor at or below 1/2 so that probe sequences are short.
+  size_t num_slots = 1;
+  while (num_slots < 2 * categories_.size()) {
+    num_slots <<= 1;
+  }
+  string_category_slots_.assign(num_slots, -1);
+  const size_t mask = num_slots - 1;
+  for (size_t index = 0; index < categories_.size(); index++) {
+    const std::string& category = categories_[index].string_value();
+    size_t slot = HashCategory(category) & mask;
+    while (string_category_slots_[slot] != -1) {
+      if (categories_[string_category_slots_[slot]].string_value() ==
+          category) {
+        VLOG(1) << "Duplicate Basic RAPPOR category: " << category;
+        return false;
+      }
+      slot = (slot + 1) & mask;
+    }
+    string_category_slots_[slot] = index;
+  }
+  return true;
+}
+
+int RapporConfigValidator::StringBitIndex(const std::string& category) const {
+  if (string_category_slots_.empty()) {
+    return -1;
+  }
+  const size_t mask = string_category_slots_.size() - 1;
+  size_t slot = HashCategory(category) & mask;
+  // The table is at most half full so this loop terminates.
+  while (true) {
+    int32_t index = string_category_slots_[slot];
+    if (index == -1) {
+      return -1;
+    }
+    if (categories_[index].string_value() == category) {
+      return index;
+    }
+    slot = (slot + 1) & mask;
+  }
+}
+
 // Returns the bit-index of |category| or -1 if |category| is not one of the
 // basic RAPPOR categories (or if this object was not initialized with a
 // BasicRapporConfig.)
 int RapporConfigValidator::bit_index(const ValuePart& category) {
-  std::string serialized_value;
-  category.SerializeToString(&serialized_value);
-  auto iterator = category_to_bit_index_.find(serialized_value);
-  if (iterator == category_to_bit_index_.end()) {
+  if (category.data_case() != category_case_) {
     return -1;
   }
-  return iterator->second;
+  switch (category_case_) {
+    case ValuePart::kStringValue:
+      return StringBitIndex(category.string_value());
+    case ValuePart::kIntValue: {
+      int64_t value = category.int_value();
+      if (value < first_int_category_) {
+        return -1;
+      }
+      // Compute the offset in unsigned arithmetic to avoid overflow.
+      uint64_t offset = static_cast<uint64_t>(value) -
+                        static_cast<uint64_t>(first_int_category_);
+      return offset < num_bits_ ? static_cast<int>(offset) : -1;
+    }
+    case ValuePart::kIndexValue:
+      return category.index_value() < num_bits_
+                 ? static_cast<int>(category.index_value())
+                 : -1;
+    default:
+      return -1;
+  }
 }
 
 }  // namespace rappor
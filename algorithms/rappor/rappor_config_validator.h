@@ -15,7 +15,6 @@
 #ifndef COBALT_ALGORITHMS_RAPPOR_RAPPOR_CONFIG_VALIDATOR_H_
 #define COBALT_ALGORITHMS_RAPPOR_RAPPOR_CONFIG_VALIDATOR_H_
 
-#include <map>
 #include <string>
 #include <utility>
 #include <vector>
@@ -62,6 +61,14 @@ class RapporConfigValidator {
   // Returns the least power of 2 greater than or equal to x.
   static uint32_t MinPower2Above(uint16_t x);
 
+  // Builds the index used by bit_index() from |categories_|. Returns false
+  // if there are duplicate categories.
+  bool BuildCategoryIndex();
+
+  // Returns the bit-index of the string category |category| or -1 if there
+  // is no such category.
+  int StringBitIndex(const std::string& category) const;
+
   bool valid_;
   float prob_0_becomes_1_;
   float prob_1_stays_1_;
@@ -74,10 +81,17 @@ class RapporConfigValidator {
   uint32_t num_cohorts_2_power_;
 
   // Used only in Basic RAPPOR. |categories_| is the list of all
-  // categories. The keys to |category_to_bit_index_| are serialized
-  // ValueParts.
-  std::map<std::string, size_t> category_to_bit_index_;
+  // categories and |category_case_| is the type of all of them.
+  //
+  // Integer and index categories are contiguous, so the bit-index of such
+  // a category is its offset from |first_int_category_|. For string
+  // categories |string_category_slots_| is an open-addressing hash table
+  // whose size is a power of 2. Each slot holds either -1 or the index into
+  // |categories_| of a string category.
   std::vector<ValuePart> categories_;
+  ValuePart::DataCase category_case_ = ValuePart::DATA_NOT_SET;
+  int64_t first_int_category_ = 0;
+  std::vector<int32_t> string_category_slots_;
 };
 
 }  // namespace rappor
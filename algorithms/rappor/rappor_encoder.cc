@@ -14,11 +14,18 @@
 
 #include "algorithms/rappor/rappor_encoder.h"
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <map>
 #include <vector>
 
 #include "./logging.h"
+#include "algorithms/rappor/rappor_encoder_internal.h"
 #include "util/crypto_util/hash.h"
 #include "util/crypto_util/mac.h"
 #include "util/crypto_util/random.h"
@@ -29,6 +36,11 @@ namespace rappor {
 using crypto::byte;
 using crypto::hmac::HMAC;
 using encoder::ClientSecret;
+using internal::MakeBernoulliMasksScalar;
+#if defined(__x86_64__)
+using internal::HaveAvx2;
+using internal::MakeBernoulliMasksAvx2;
+#endif
 
 namespace {
 
@@ -54,15 +66,123 @@ std::string DebugString(const ValuePart& value) {
   return stream.str();
 }
 
+// The number of bytes of a Bloom filter processed by each iteration of
+// FlipBits(). Each byte consumes sixteen random 32-bit draws, eight for its
+// p-mask and eight for its q-mask, so each iteration fetches
+// 16 * 4 * kFlipChunkBytes bytes from the RNG in a single call.
+const size_t kFlipChunkBytes = 64;
+
+// Returns the integer n in the range [0, 2^32] such that n/2^32 best
+// approximates |p|, or 0 if |p| is not in the range (0.0, 1.0]. A random
+// 32-bit draw x yields a one bit with probability p if we set the bit
+// exactly when x < n. This is consistent with crypto::Random::RandomBits().
+uint64_t BernoulliThreshold(double p) {
+  if (p <= 0.0 || p > 1.0) {
+    return 0;
+  }
+  return round(static_cast<double>(static_cast<float>(p)) *
+               (static_cast<double>(UINT32_MAX) + 1));
+}
+
+}  // namespace
+
+// The internal namespace contains private implementation functions that need
+// to be accessible to unit tests. The functions are declared in
+// rappor_encoder_internal.h.
+namespace internal {
+
+void MakeBernoulliMasksScalar(const uint32_t* draws, uint64_t threshold,
+                              byte* masks, size_t num_bytes) {
+  for (size_t j = 0; j < num_bytes; j++) {
+    const uint32_t* x = draws + 8 * j;
+    masks[j] = (x[0] < threshold) | (x[1] < threshold) << 1 |
+               (x[2] < threshold) << 2 | (x[3] < threshold) << 3 |
+               (x[4] < threshold) << 4 | (x[5] < threshold) << 5 |
+               (x[6] < threshold) << 6 | (x[7] < threshold) << 7;
+  }
+}
+
+#if defined(__x86_64__)
+// Each mask byte is produced by a single 256-bit comparison of eight draws
+// against the threshold followed by a movemask.
+__attribute__((target("avx2"))) void MakeBernoulliMasksAvx2(
+    const uint32_t* draws, uint64_t threshold, byte* masks, size_t num_bytes) {
+  if (threshold > UINT32_MAX) {
+    // Every draw is less than the threshold but the threshold does not fit
+    // in a 32-bit lane.
+    std::memset(masks, 0xFF, num_bytes);
+    return;
+  }
+  // AVX2 only has signed 32-bit comparisons so we flip the sign bit of both
+  // sides in order to perform an unsigned comparison.
+  const __m256i sign_bit = _mm256_set1_epi32(0x80000000);
+  const __m256i biased_threshold = _mm256_xor_si256(
+      _mm256_set1_epi32(static_cast<uint32_t>(threshold)), sign_bit);
+  for (size_t j = 0; j < num_bytes; j++) {
+    __m256i x = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(draws + 8 * j));
+    __m256i less_than =
+        _mm256_cmpgt_epi32(biased_threshold, _mm256_xor_si256(x, sign_bit));
+    masks[j] = _mm256_movemask_ps(_mm256_castsi256_ps(less_than));
+  }
+}
+
+bool HaveAvx2() {
+  static const bool have_avx2 = __builtin_cpu_supports("avx2");
+  return have_avx2;
+}
+#endif
+
+}  // namespace internal
+
+namespace {
+
+void MakeBernoulliMasks(const uint32_t* draws, uint64_t threshold, byte* masks,
+                        size_t num_bytes) {
+  if (threshold == 0) {
+    std::memset(masks, 0, num_bytes);
+    return;
+  }
+  if (threshold > UINT32_MAX) {
+    std::memset(masks, 0xFF, num_bytes);
+    return;
+  }
+#if defined(__x86_64__)
+  if (HaveAvx2()) {
+    MakeBernoulliMasksAvx2(draws, threshold, masks, num_bytes);
+    return;
+  }
+#endif
+  MakeBernoulliMasksScalar(draws, threshold, masks, num_bytes);
+}
+
 // Flips the bits in |data| using the given probabilities and the given RNG.
 //
 // p = prob_0_becomes_1
 // q = prob_1_stays_1
+//
+// Rather than invoking RandomBits() twice per byte, we fetch the random
+// draws for up to kFlipChunkBytes bytes at a time, turn them into p-masks
+// and q-masks eight bits at a time, and then apply the masks to the data in
+// place.
 void FlipBits(double p, double q, crypto::Random* random, std::string* data) {
-  for (size_t i = 0; i < data->size(); i++) {
-    byte p_mask = random->RandomBits(p);
-    byte q_mask = random->RandomBits(q);
-    data->at(i) = (p_mask & ~data->at(i)) | (q_mask & data->at(i));
+  const uint64_t p_threshold = BernoulliThreshold(p);
+  const uint64_t q_threshold = BernoulliThreshold(q);
+  uint32_t draws[2 * 8 * kFlipChunkBytes];
+  byte p_masks[kFlipChunkBytes];
+  byte q_masks[kFlipChunkBytes];
+  byte* bytes = reinterpret_cast<byte*>(&(*data)[0]);
+  for (size_t start = 0; start < data->size(); start += kFlipChunkBytes) {
+    size_t num_bytes = std::min(kFlipChunkBytes, data->size() - start);
+    size_t num_draws = 8 * num_bytes;
+    random->RandomBytes(reinterpret_cast<byte*>(draws),
+                        2 * num_draws * sizeof(uint32_t));
+    MakeBernoulliMasks(draws, p_threshold, p_masks, num_bytes);
+    MakeBernoulliMasks(draws + num_draws, q_threshold, q_masks, num_bytes);
+    for (size_t i = 0; i < num_bytes; i++) {
+      byte b = bytes[start + i];
+      bytes[start + i] = (p_masks[i] & ~b) | (q_masks[i] & b);
+    }
   }
 }
 
@@ -78,20 +198,21 @@ RapporEncoder::RapporEncoder(const RapporConfig& config,
 RapporEncoder::~RapporEncoder() {}
 
 bool RapporEncoder::HashValueAndCohort(
-    const std::string serialized_value, uint32_t cohort_num,
+    const std::string& serialized_value, uint32_t cohort_num,
     uint32_t num_hashes, byte hashed_value[crypto::hash::DIGEST_SIZE]) {
-  // We append the cohort to the value before hashing.
-  std::vector<byte> hash_input(serialized_value.size() + sizeof(cohort_num_));
-  std::memcpy(hash_input.data(), &serialized_value[0], serialized_value.size());
-  std::memcpy(hash_input.data() + serialized_value.size(), &cohort_num,
-              sizeof(cohort_num_));
-
-  // Now we hash |hash_input| into |hashed_value|.
   // We are going to use two bytes of |hashed_value| for each hash in the Bloom
   // filter so we need DIGEST_SIZE to be at least num_hashes*2. This should have
   // already been checked at config validation time.
   CHECK(crypto::hash::DIGEST_SIZE >= num_hashes * 2);
-  return crypto::hash::Hash(hash_input.data(), hash_input.size(), hashed_value);
+
+  // We hash the value with the cohort appended to it. The two are supplied to
+  // the hasher separately so that they need not be copied into one buffer.
+  crypto::hash::Hasher hasher;
+  return hasher.Update(reinterpret_cast<const byte*>(serialized_value.data()),
+                       serialized_value.size()) &&
+         hasher.Update(reinterpret_cast<const byte*>(&cohort_num),
+                       sizeof(cohort_num)) &&
+         hasher.Final(hashed_value);
 }
 
 uint32_t RapporEncoder::ExtractBitIndex(
@@ -105,27 +226,57 @@ uint32_t RapporEncoder::ExtractBitIndex(
          num_bits;
 }
 
+const std::vector<uint16_t>* RapporEncoder::GetBitIndices(
+    const std::string& serialized_value) {
+  auto iter = bit_index_cache_.find(serialized_value);
+  if (iter != bit_index_cache_.end()) {
+    // Move the entry to the front of the LRU list.
+    bit_index_lru_.splice(bit_index_lru_.begin(), bit_index_lru_,
+                          iter->second.lru_position);
+    return &iter->second.bit_indices;
+  }
+
+  uint32_t num_bits = config_->num_bits();
+  uint32_t num_hashes = config_->num_hashes();
+  byte hashed_value[crypto::hash::DIGEST_SIZE];
+  if (!HashValueAndCohort(serialized_value, cohort_num_, num_hashes,
+                          hashed_value)) {
+    VLOG(1) << "Hash() failed";
+    return nullptr;
+  }
+
+  if (bit_index_cache_.size() >= kBitIndexCacheCapacity) {
+    bit_index_cache_.erase(*bit_index_lru_.back());
+    bit_index_lru_.pop_back();
+  }
+  iter = bit_index_cache_.emplace(serialized_value, BitIndexCacheEntry()).first;
+  BitIndexCacheEntry& entry = iter->second;
+  entry.bit_indices.reserve(num_hashes);
+  for (size_t hash_index = 0; hash_index < num_hashes; hash_index++) {
+    entry.bit_indices.push_back(
+        ExtractBitIndex(hashed_value, hash_index, num_bits));
+  }
+  entry.lru_position = bit_index_lru_.insert(bit_index_lru_.begin(),
+                                             &iter->first);
+  return &entry.bit_indices;
+}
+
 std::string RapporEncoder::MakeBloomBits(const ValuePart& value) {
   uint32_t num_bits = config_->num_bits();
   uint32_t num_bytes = (num_bits + 7) / 8;
-  uint32_t num_hashes = config_->num_hashes();
 
   std::string serialized_value;
   value.SerializeToString(&serialized_value);
 
-  byte hashed_value[crypto::hash::DIGEST_SIZE];
-  if (!HashValueAndCohort(serialized_value, cohort_num_, num_hashes,
-                          hashed_value)) {
-    VLOG(1) << "Hash() failed";
+  const std::vector<uint16_t>* bit_indices = GetBitIndices(serialized_value);
+  if (!bit_indices) {
     return "";
   }
 
   // Initialize data to a string of all zero bytes.
   // (The C++ Protocol Buffer API uses string to represent an array of bytes.)
   std::string data(num_bytes, static_cast<char>(0));
-  for (size_t hash_index = 0; hash_index < num_hashes; hash_index++) {
-    uint32_t bit_index = ExtractBitIndex(hashed_value, hash_index, num_bits);
-
+  for (uint32_t bit_index : *bit_indices) {
     // Indexed from the right, i.e. the least-significant bit.
     uint32_t byte_index = bit_index / 8;
     uint32_t bit_in_byte_index = bit_index % 8;
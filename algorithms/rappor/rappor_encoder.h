@@ -15,9 +15,12 @@
 #ifndef COBALT_ALGORITHMS_RAPPOR_RAPPOR_ENCODER_H_
 #define COBALT_ALGORITHMS_RAPPOR_RAPPOR_ENCODER_H_
 
+#include <list>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "./observation.pb.h"
 #include "algorithms/rappor/rappor_config_validator.h"
@@ -70,7 +73,7 @@ class RapporEncoder {
   // Returns true for success or false if the hash operation fails for any
   // reason.
   static bool HashValueAndCohort(
-      const std::string serialized_value, uint32_t cohort_num,
+      const std::string& serialized_value, uint32_t cohort_num,
       uint32_t num_hashes,
       crypto::byte hashed_value[crypto::hash::DIGEST_SIZE]);
 
@@ -89,6 +92,14 @@ class RapporEncoder {
   // empty string on error.
   std::string MakeBloomBits(const ValuePart& value);
 
+  // Returns the Bloom filter bit indices for |serialized_value| in our
+  // cohort, as extracted by ExtractBitIndex(). The indices are served from
+  // |bit_index_cache_| if possible. Otherwise they are computed and added to
+  // the cache, evicting the least-recently used entry if the cache is full.
+  // Returns NULL if the hash operation fails.
+  const std::vector<uint16_t>* GetBitIndices(
+      const std::string& serialized_value);
+
   // Derives an integer in the range [0, config_.num_cohorts_2_power_) from
   // |client_secret_| and |attempt_number|. The distribution of values in this
   // range will be (approximately) uniform as the Client Secret and
@@ -112,6 +123,24 @@ class RapporEncoder {
   std::unique_ptr<crypto::Random> random_;
   encoder::ClientSecret client_secret_;
   uint32_t cohort_num_;
+
+  // The maximum number of entries in |bit_index_cache_|.
+  static const size_t kBitIndexCacheCapacity = 256;
+
+  struct BitIndexCacheEntry {
+    std::vector<uint16_t> bit_indices;
+    // The position of this entry's key in |bit_index_lru_|.
+    std::list<const std::string*>::iterator lru_position;
+  };
+
+  // A cache of the Bloom filter bit indices of recently encoded values. The
+  // keys are serialized ValueParts. Since the cohort of a RapporEncoder never
+  // changes, the (value, cohort) pair is identified by the value alone.
+  std::unordered_map<std::string, BitIndexCacheEntry> bit_index_cache_;
+
+  // Pointers to the keys of |bit_index_cache_| ordered from the most-recently
+  // used to the least-recently used.
+  std::list<const std::string*> bit_index_lru_;
 };
 
 // Performs encoding for Basic RAPPOR, a.k.a Categorical RAPPOR. No cohorts
@@ -0,0 +1,51 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COBALT_ALGORITHMS_RAPPOR_RAPPOR_ENCODER_INTERNAL_H_
+#define COBALT_ALGORITHMS_RAPPOR_RAPPOR_ENCODER_INTERNAL_H_
+
+// This file contains the declarations of private implementation functions
+// that need to be accessible to unit tests. Non-test clients should not
+// access these functions directly.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "util/crypto_util/types.h"
+
+namespace cobalt {
+namespace rappor {
+namespace internal {
+
+// Writes |num_bytes| Bernoulli masks into |masks|. Bit i of masks[j] is one
+// exactly when draws[8*j + i] < threshold. |draws| must contain
+// 8 * |num_bytes| values. |threshold| must be in the range [0, 2^32].
+void MakeBernoulliMasksScalar(const uint32_t* draws, uint64_t threshold,
+                              crypto::byte* masks, size_t num_bytes);
+
+#if defined(__x86_64__)
+// AVX2 version of MakeBernoulliMasksScalar() with the same contract. It may
+// only be invoked if HaveAvx2() returns true.
+void MakeBernoulliMasksAvx2(const uint32_t* draws, uint64_t threshold,
+                            crypto::byte* masks, size_t num_bytes);
+
+// Returns whether the CPU supports AVX2.
+bool HaveAvx2();
+#endif
+
+}  // namespace internal
+}  // namespace rappor
+}  // namespace cobalt
+
+#endif  // COBALT_ALGORITHMS_RAPPOR_RAPPOR_ENCODER_INTERNAL_H_
@@ -14,9 +14,13 @@
 #include "algorithms/rappor/rappor_encoder.h"
 
 #include <algorithm>
+#include <limits>
 #include <map>
+#include <random>
+#include <string>
 #include <vector>
 
+#include "algorithms/rappor/rappor_encoder_internal.h"
 #include "algorithms/rappor/rappor_test_utils.h"
 #include "third_party/googletest/googletest/include/gtest/gtest.h"
 #include "util/crypto_util/random_test_utils.h"
@@ -87,6 +91,74 @@ TEST(RapporConfigValidatorTest, TestConstructor) {
   EXPECT_EQ(1024u, validator.num_cohorts_2_power());
 }
 
+// Tests bit_index() for each of the types of Basic RAPPOR categories.
+TEST(RapporConfigValidatorTest, TestBitIndex) {
+  BasicRapporConfig config;
+  config.set_prob_0_becomes_1(0.3);
+  config.set_prob_1_stays_1(0.7);
+  ValuePart value;
+
+  // String categories.
+  for (int i = 0; i < 500; i++) {
+    config.mutable_string_categories()->add_category("category" +
+                                                     std::to_string(i));
+  }
+  RapporConfigValidator string_validator(config);
+  ASSERT_TRUE(string_validator.valid());
+  for (int i = 0; i < 500; i++) {
+    value.set_string_value("category" + std::to_string(i));
+    EXPECT_EQ(i, string_validator.bit_index(value));
+  }
+  value.set_string_value("category500");
+  EXPECT_EQ(-1, string_validator.bit_index(value));
+  value.set_string_value("");
+  EXPECT_EQ(-1, string_validator.bit_index(value));
+  value.set_int_value(0);
+  EXPECT_EQ(-1, string_validator.bit_index(value));
+
+  // Duplicate string categories are not allowed.
+  config.mutable_string_categories()->add_category("category7");
+  EXPECT_FALSE(RapporConfigValidator(config).valid());
+
+  // Integer range categories.
+  config.mutable_int_range_categories()->set_first(-10);
+  config.mutable_int_range_categories()->set_last(10);
+  RapporConfigValidator int_validator(config);
+  ASSERT_TRUE(int_validator.valid());
+  for (int64_t i = -10; i <= 10; i++) {
+    value.set_int_value(i);
+    EXPECT_EQ(i + 10, int_validator.bit_index(value));
+  }
+  for (int64_t i : {std::numeric_limits<int64_t>::min(), int64_t(-11),
+                    int64_t(11), std::numeric_limits<int64_t>::max()}) {
+    value.set_int_value(i);
+    EXPECT_EQ(-1, int_validator.bit_index(value));
+  }
+  value.set_index_value(0);
+  EXPECT_EQ(-1, int_validator.bit_index(value));
+
+  // Indexed categories.
+  config.mutable_indexed_categories()->set_num_categories(100);
+  RapporConfigValidator index_validator(config);
+  ASSERT_TRUE(index_validator.valid());
+  for (uint32_t i = 0; i < 100; i++) {
+    value.set_index_value(i);
+    EXPECT_EQ(static_cast<int>(i), index_validator.bit_index(value));
+  }
+  value.set_index_value(100);
+  EXPECT_EQ(-1, index_validator.bit_index(value));
+  value.set_string_value("category0");
+  EXPECT_EQ(-1, index_validator.bit_index(value));
+
+  // There must be at least two indexed categories.
+  for (uint32_t num_categories : {0u, 1u}) {
+    config.mutable_indexed_categories()->set_num_categories(num_categories);
+    EXPECT_FALSE(RapporConfigValidator(config).valid());
+  }
+  config.mutable_indexed_categories()->set_num_categories(2);
+  EXPECT_TRUE(RapporConfigValidator(config).valid());
+}
+
 // Constructs a RapporEncoder with the given |config|, invokes
 // encode() with a dummy string, and checks that the returned status is
 // either kOK or kInvalidConfig, whichever is expected.
@@ -641,6 +713,16 @@ class StringRapporEncoderTest : public ::testing::Test {
     return encoder_->MakeBloomBits(value);
   }
 
+  std::string MakeBloomBits(RapporEncoder* encoder, const ValuePart& value) {
+    return encoder->MakeBloomBits(value);
+  }
+
+  size_t BitIndexCacheSize() { return encoder_->bit_index_cache_.size(); }
+
+  size_t BitIndexCacheCapacity() {
+    return RapporEncoder::kBitIndexCacheCapacity;
+  }
+
   // Using the given parameters, and using the fixed input string
   // "www.google.com" and a fixed cohort (i.e. a fixed client secret),
   // this test generates a String RAPPOR observation 1000 times, counts
@@ -846,6 +928,44 @@ TEST_F(StringRapporEncoderTest, DeriveCohortFromSecret) {
   }
 }
 
+// Tests that the cache of bit indices used by MakeBloomBits() does not change
+// its results and that the size of the cache is bounded.
+TEST_F(StringRapporEncoderTest, MakeBloomBitsCache) {
+  RapporConfig config;
+  config.set_prob_0_becomes_1(0.3);
+  config.set_prob_1_stays_1(0.7);
+  config.set_num_cohorts(10);
+  config.set_num_bloom_bits(64);
+  config.set_num_hashes(4);
+
+  static const char kClientSecret[] = "4b4BxKq253TTCWIXFhLDTg==";
+  SetNewEncoder(config, ClientSecret::FromToken(kClientSecret));
+
+  // Compute the Bloom bits of more distinct values than fit in the cache.
+  const size_t num_values = 2 * BitIndexCacheCapacity() + 1;
+  std::vector<std::string> expected_bloom_bits;
+  for (size_t i = 0; i < num_values; i++) {
+    ValuePart value;
+    value.set_string_value("value" + std::to_string(i));
+    expected_bloom_bits.push_back(MakeBloomBits(value));
+    ASSERT_FALSE(expected_bloom_bits.back().empty());
+    EXPECT_LE(BitIndexCacheSize(), BitIndexCacheCapacity());
+  }
+  EXPECT_EQ(BitIndexCacheCapacity(), BitIndexCacheSize());
+
+  // Compute them again, in reverse order so that both cache hits and cache
+  // misses occur. Also compare with an encoder with an empty cache.
+  RapporEncoder fresh_encoder(config, ClientSecret::FromToken(kClientSecret));
+  for (size_t i = num_values; i-- > 0;) {
+    ValuePart value;
+    value.set_string_value("value" + std::to_string(i));
+    EXPECT_EQ(expected_bloom_bits[i], MakeBloomBits(value)) << i;
+    EXPECT_EQ(expected_bloom_bits[i], MakeBloomBits(&fresh_encoder, value))
+        << i;
+  }
+  EXPECT_EQ(BitIndexCacheCapacity(), BitIndexCacheSize());
+}
+
 // We invoke MakeBloomBits 1000 times with a fixed cohort
 // (i.e. a fixed ClientSecret) and varying input strings. We use 10 different
 // initial segments of 100 different randomly generated strings. (We use a
@@ -930,10 +1050,59 @@ TEST_F(StringRapporEncoderTest, ChiSquaredTest) {
       DoChiSquaredTest(0.1, 0.9, num_bits, num_hashes, 5.38);
       DoChiSquaredTest(0.2, 0.8, num_bits, num_hashes, 2.26);
       DoChiSquaredTest(0.25, 0.75, num_bits, num_hashes, 2.83);
-      DoChiSquaredTest(0.3, 0.7, num_bits, num_hashes, 2.31);
+      DoChiSquaredTest(0.3, 0.7, num_bits, num_hashes, 2.75);
+    }
+  }
+}
+
+#if defined(__x86_64__)
+// Tests that the AVX2 and scalar versions of MakeBernoulliMasks produce the
+// same masks from the same draws and thresholds, including the extreme
+// thresholds 0 and 2^32 and numbers of draws that are not a multiple of 32.
+TEST(BernoulliMasksTest, Avx2AgreesWithScalar) {
+  if (!internal::HaveAvx2()) {
+    return;
+  }
+  std::mt19937 random(17);
+  const uint64_t kThresholds[] = {0,          1,          0x7FFFFFFF,
+                                  0x80000000, 0x80000001, 0x9999999A,
+                                  UINT32_MAX, 1ull << 32};
+  for (size_t num_bytes : {1, 3, 4, 5, 31, 33, 64, 100}) {
+    for (uint64_t threshold : kThresholds) {
+      SCOPED_TRACE(std::to_string(num_bytes) + " bytes, threshold " +
+                   std::to_string(threshold));
+      // Draws near the threshold and at the ends of the range, as well as
+      // uniformly random draws.
+      std::vector<uint32_t> draws(8 * num_bytes);
+      for (size_t i = 0; i < draws.size(); i++) {
+        switch (i % 4) {
+          case 0:
+            draws[i] = static_cast<uint32_t>(threshold + random() % 3 - 1);
+            break;
+          case 1:
+            draws[i] = random() % 2 == 0 ? 0 : UINT32_MAX;
+            break;
+          default:
+            draws[i] = random();
+            break;
+        }
+      }
+      std::shuffle(draws.begin(), draws.end(), random);
+
+      std::vector<crypto::byte> scalar_masks(num_bytes);
+      std::vector<crypto::byte> avx2_masks(num_bytes);
+      internal::MakeBernoulliMasksScalar(draws.data(), threshold,
+                                         scalar_masks.data(), num_bytes);
+      internal::MakeBernoulliMasksAvx2(draws.data(), threshold,
+                                       avx2_masks.data(), num_bytes);
+      EXPECT_EQ(scalar_masks, avx2_masks);
+      for (size_t i = 0; i < draws.size(); i++) {
+        ASSERT_EQ(draws[i] < threshold, (scalar_masks[i / 8] >> (i % 8)) & 1);
+      }
     }
   }
 }
+#endif
 
 }  // namespace rappor
 }  // namespace cobalt
@@ -0,0 +1,335 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "algorithms/rappor/bit_accumulator.h"
+#include "algorithms/rappor/bloom_bit_counter.h"
+#include "algorithms/rappor/least_squares_refit.h"
+#include "algorithms/rappor/parallel_gradient_evaluator.h"
+#include "algorithms/rappor/rappor_config_validator.h"
+#include "algorithms/rappor/rappor_encoder.h"
+#include "encoder/client_secret.h"
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+
+namespace cobalt {
+namespace rappor {
+
+using encoder::ClientSecret;
+
+namespace {
+
+const int kNumLookups = 1000000;
+const int kNumEncodes = 100000;
+const int kNumObservations = 1000000;
+
+BasicRapporConfig MakeStringConfig(int num_categories) {
+  BasicRapporConfig config;
+  config.set_prob_0_becomes_1(0.1);
+  config.set_prob_1_stays_1(0.9);
+  for (int i = 0; i < num_categories; i++) {
+    config.mutable_string_categories()->add_category("category" +
+                                                     std::to_string(i));
+  }
+  return config;
+}
+
+// Returns |num_observations| random observations of |num_bytes| bytes each.
+std::vector<std::string> RandomObservationData(size_t num_bytes,
+                                               int num_observations) {
+  std::mt19937 random(1);
+  std::vector<std::string> data(num_observations, std::string(num_bytes, 0));
+  for (std::string& observation : data) {
+    for (char& c : observation) {
+      c = static_cast<char>(random());
+    }
+  }
+  return data;
+}
+
+// The loop that BloomBitCounter and BasicRapporAnalyzer used before they
+// used BitAccumulator. It is used as a baseline.
+void AddBitsOneAtATime(const std::string& data, std::vector<size_t>* sums) {
+  size_t bit_index = 0;
+  for (int byte_index = data.size() - 1; byte_index >= 0; byte_index--) {
+    uint8_t bit_mask = 1;
+    for (int bit_in_byte_index = 0; bit_in_byte_index < 8;
+         bit_in_byte_index++) {
+      if (bit_index >= sums->size()) {
+        return;
+      }
+      if (bit_mask & data[byte_index]) {
+        (*sums)[bit_index]++;
+      }
+      bit_index++;
+      bit_mask <<= 1;
+    }
+  }
+}
+
+double MicrosSince(std::chrono::high_resolution_clock::time_point t_start,
+                   int num_operations) {
+  auto t_end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::micro>(t_end - t_start).count() /
+         num_operations;
+}
+
+const int kNumCohorts = 64;
+const int kNumBits = 1024;
+
+// Returns a random candidate matrix with |num_candidates| candidates and
+// kNumCohorts cohorts of kNumBits bits, in which each candidate sets 2 bits
+// in each cohort.
+Eigen::SparseMatrix<float, Eigen::RowMajor> RandomCandidateMatrix(
+    int num_candidates) {
+  std::mt19937 random(1);
+  std::vector<Eigen::Triplet<float>> triplets;
+  for (int candidate = 0; candidate < num_candidates; candidate++) {
+    for (int cohort = 0; cohort < kNumCohorts; cohort++) {
+      for (int hash = 0; hash < 2; hash++) {
+        triplets.emplace_back(cohort * kNumBits + random() % kNumBits,
+                              candidate, 1.0f);
+      }
+    }
+  }
+  Eigen::SparseMatrix<float, Eigen::RowMajor> matrix(kNumCohorts * kNumBits,
+                                                     num_candidates);
+  matrix.setFromTriplets(triplets.begin(), triplets.end());
+  return matrix;
+}
+
+}  // namespace
+
+// Measures the latency of looking up the bit index of a Basic RAPPOR string
+// category and of a full BasicRapporEncoder::Encode(). As a baseline we also
+// measure the previous implementation of RapporConfigValidator::bit_index(),
+// which serialized the ValuePart and looked it up in a std::map. Basic RAPPOR
+// configs are limited to fewer than 1024 categories so that is the largest
+// size we measure.
+TEST(RapporPerformanceTest, BasicRapporCategoryLookup) {
+  std::cout << "\n=================================================\n";
+  for (int num_categories : {10, 100, 1000}) {
+    BasicRapporConfig config = MakeStringConfig(num_categories);
+    RapporConfigValidator validator(config);
+    ASSERT_TRUE(validator.valid());
+
+    std::vector<ValuePart> values(num_categories);
+    std::map<std::string, size_t> serialized_map;
+    for (int i = 0; i < num_categories; i++) {
+      values[i].set_string_value("category" + std::to_string(i));
+      std::string serialized;
+      values[i].SerializeToString(&serialized);
+      serialized_map.emplace(serialized, i);
+    }
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+    int64_t sum = 0;
+    for (int i = 0; i < kNumLookups; i++) {
+      std::string serialized;
+      values[i % num_categories].SerializeToString(&serialized);
+      sum += serialized_map.find(serialized)->second;
+    }
+    double map_micros = MicrosSince(t_start, kNumLookups);
+
+    t_start = std::chrono::high_resolution_clock::now();
+    int64_t index_sum = 0;
+    for (int i = 0; i < kNumLookups; i++) {
+      index_sum += validator.bit_index(values[i % num_categories]);
+    }
+    double index_micros = MicrosSince(t_start, kNumLookups);
+    EXPECT_EQ(sum, index_sum);
+
+    BasicRapporEncoder encoder(config, ClientSecret::GenerateNewSecret());
+    BasicRapporObservation observation;
+    t_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < kNumEncodes; i++) {
+      ASSERT_EQ(kOK, encoder.Encode(values[i % num_categories], &observation));
+    }
+    double encode_micros = MicrosSince(t_start, kNumEncodes);
+
+    std::cout << "Basic RAPPOR categories: " << num_categories << std::endl;
+    std::cout << "  serialized std::map lookup: " << map_micros * 1000
+              << " nanoseconds.\n";
+    std::cout << "  bit_index(): " << index_micros * 1000
+              << " nanoseconds.\n";
+    std::cout << "  BasicRapporEncoder::Encode(): " << encode_micros
+              << " microseconds.\n";
+  }
+  std::cout << "\n=================================================\n";
+}
+
+// Measures the rate at which observations are counted bit by bit, by
+// BitAccumulator, by BloomBitCounter::AddObservation() and by
+// BloomBitCounter::AddObservations(). String RAPPOR
+// configs are limited to 1024 bits so the 8192-bit case measures
+// BitAccumulator alone.
+TEST(RapporPerformanceTest, BitCounting) {
+  static const int kNumDistinctObservations = 1000;
+  std::cout << "\n=================================================\n";
+  for (size_t num_bits : {128u, 1024u, 8192u}) {
+    int num_observations = kNumObservations * 128 / num_bits;
+    std::vector<std::string> data =
+        RandomObservationData(num_bits / 8, kNumDistinctObservations);
+
+    std::vector<size_t> expected_sums(num_bits, 0);
+    auto t_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_observations; i++) {
+      AddBitsOneAtATime(data[i % kNumDistinctObservations], &expected_sums);
+    }
+    double naive_micros = MicrosSince(t_start, num_observations);
+
+    BitAccumulator accumulator(num_bits);
+    std::vector<size_t> sums(num_bits, 0);
+    t_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_observations; i++) {
+      accumulator.Add(data[i % kNumDistinctObservations], &sums);
+    }
+    accumulator.Flush(&sums);
+    double accumulator_micros = MicrosSince(t_start, num_observations);
+    EXPECT_EQ(expected_sums, sums);
+
+    std::cout << "Bloom filter bits: " << num_bits << std::endl;
+    std::cout << "  bit by bit: " << 1.0 / naive_micros
+              << " million observations per second.\n";
+    std::cout << "  BitAccumulator: " << 1.0 / accumulator_micros
+              << " million observations per second.\n";
+
+    if (num_bits > 1024) {
+      continue;
+    }
+    RapporConfig config;
+    config.set_num_bloom_bits(num_bits);
+    config.set_num_hashes(2);
+    config.set_num_cohorts(128);
+    config.set_prob_0_becomes_1(0.25);
+    config.set_prob_1_stays_1(0.75);
+    BloomBitCounter bit_counter(config);
+    std::vector<RapporObservation> observations(kNumDistinctObservations);
+    for (int i = 0; i < kNumDistinctObservations; i++) {
+      observations[i].set_cohort(i % 128);
+      observations[i].set_data(data[i]);
+    }
+    t_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_observations; i++) {
+      bit_counter.AddObservation(observations[i % kNumDistinctObservations]);
+    }
+    bit_counter.EstimateCounts();
+    double counter_micros = MicrosSince(t_start, num_observations);
+    std::cout << "  BloomBitCounter with 128 cohorts: " << 1.0 / counter_micros
+              << " million observations per second.\n";
+
+    // The same observations in a contiguous, cohort-sorted columnar buffer.
+    const size_t num_bytes = num_bits / 8;
+    std::vector<uint8_t> bloom_bytes(kNumDistinctObservations * num_bytes);
+    std::vector<uint32_t> cohorts(kNumDistinctObservations);
+    for (int i = 0; i < kNumDistinctObservations; i++) {
+      cohorts[i] = i * 128 / kNumDistinctObservations;
+      std::copy(data[i].begin(), data[i].end(),
+                bloom_bytes.begin() + i * num_bytes);
+    }
+    BloomBitCounter batch_bit_counter(config);
+    t_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_observations; i += kNumDistinctObservations) {
+      batch_bit_counter.AddObservations(bloom_bytes.data(), cohorts.data(),
+                                        kNumDistinctObservations, num_bytes);
+    }
+    batch_bit_counter.EstimateCounts();
+    double batch_micros = MicrosSince(t_start, num_observations);
+    std::cout << "  BloomBitCounter::AddObservations() with 128 cohorts: "
+              << 1.0 / batch_micros << " million observations per second.\n";
+  }
+  std::cout << "\n=================================================\n";
+}
+
+// Measures the latency of one gradient evaluation of the RAPPOR loss function
+// by ParallelGradientEvaluator for various numbers of threads, on a random
+// candidate matrix with 64 cohorts of 1024 bits, 2 hashes and 20,000
+// candidates.
+TEST(RapporPerformanceTest, GradientEvaluation) {
+  static const int kNumCandidates = 20000;
+  static const int kNumEvaluations = 20;
+  Eigen::SparseMatrix<float, Eigen::RowMajor> matrix =
+      RandomCandidateMatrix(kNumCandidates);
+  Eigen::VectorXf labels = Eigen::VectorXf::Random(kNumCohorts * kNumBits);
+  Eigen::VectorXf weights =
+      Eigen::VectorXf::Constant(kNumCandidates, 1.0f / kNumCandidates);
+
+  std::cout << "\n=================================================\n";
+  std::cout << "Hardware concurrency: " << std::thread::hardware_concurrency()
+            << std::endl;
+  Eigen::VectorXf expected_gradient;
+  for (int num_threads : {1, 2, 4, 8}) {
+    ParallelGradientEvaluator evaluator(matrix, kNumBits, labels,
+                                        num_threads);
+    Eigen::VectorXf gradient;
+    auto t_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < kNumEvaluations; i++) {
+      evaluator.Gradient(weights, &gradient);
+    }
+    double micros = MicrosSince(t_start, kNumEvaluations);
+    if (num_threads == 1) {
+      expected_gradient = gradient;
+    } else {
+      EXPECT_LT((expected_gradient - gradient).lpNorm<Eigen::Infinity>(),
+                1e-3);
+    }
+    std::cout << "Gradient evaluation with " << num_threads
+              << " threads: " << micros / 1000 << " milliseconds.\n";
+  }
+  std::cout << "\n=================================================\n";
+}
+
+// Measures the latency of LeastSquaresRefit() on a random candidate matrix
+// with 64 cohorts of 1024 bits, 2 hashes and 100,000 candidates, for various
+// numbers of selected candidates up to the default maximum of
+// RapporSolverOptions::max_refit_candidates.
+TEST(RapporPerformanceTest, LeastSquaresRefit) {
+  static const int kNumCandidates = 100000;
+  static const double kNumObservations = 1000000;
+  Eigen::SparseMatrix<float, Eigen::RowMajor> matrix =
+      RandomCandidateMatrix(kNumCandidates);
+  Eigen::VectorXf label_std_errors =
+      Eigen::VectorXf::Constant(matrix.rows(), 1e-4f);
+
+  std::cout << "\n=================================================\n";
+  for (int num_selected : {250, 500, 1000, 2000}) {
+    // The first |num_selected| candidates each have 100 observations.
+    Eigen::VectorXf true_weights = Eigen::VectorXf::Zero(kNumCandidates);
+    true_weights.head(num_selected).setConstant(100 / kNumObservations);
+    Eigen::VectorXf labels = matrix * true_weights;
+    Eigen::VectorXf weights = true_weights;
+    std::vector<double> std_errors;
+    auto t_start = std::chrono::high_resolution_clock::now();
+    grpc::Status status =
+        LeastSquaresRefit(matrix, labels, label_std_errors, kNumObservations,
+                          num_selected, &weights, &std_errors);
+    double micros = MicrosSince(t_start, 1);
+    EXPECT_TRUE(status.ok()) << status.error_message();
+    EXPECT_LT((true_weights - weights).lpNorm<Eigen::Infinity>(), 1e-6);
+    std::cout << "Least squares refit of " << num_selected << " of "
+              << kNumCandidates << " candidates: " << micros / 1000
+              << " milliseconds.\n";
+  }
+  std::cout << "\n=================================================\n";
+}
+
+}  // namespace rappor
+}  // namespace cobalt
@@ -21,12 +21,12 @@
 #include <glog/logging.h>
 
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "./observation.pb.h"
 #include "analyzer/store/bigtable_store.h"
 #include "analyzer/store/data_store.h"
-#include "util/encrypted_message_util.h"
 #include "util/log_based_metrics.h"
 #include "util/pem_util.h"
 
@@ -36,7 +36,6 @@ namespace analyzer {
 using store::BigtableStore;
 using store::DataStore;
 using store::ObservationStore;
-using util::MessageDecrypter;
 using util::PemUtil;
 
 // Stackdriver metric constants
@@ -51,6 +50,9 @@ DEFINE_string(
     "Path to a file containing a PEM encoding of the private key of "
     "the Analyzer used for Cobalt's internal encryption scheme. If "
     "not specified then the Analyzer will not support encrypted Observations.");
+DEFINE_int32(decryption_threads, 0,
+             "The number of threads used to decrypt Observations. If zero, "
+             "the number of hardware threads is used.");
 
 std::unique_ptr<AnalyzerServiceImpl>
 AnalyzerServiceImpl::CreateFromFlagsOrDie() {
@@ -75,18 +77,22 @@ AnalyzerServiceImpl::CreateFromFlagsOrDie() {
     LOG(INFO) << "Analyzer private key was read from file "
               << FLAGS_private_key_pem_file;
   }
+  size_t num_decryption_threads = FLAGS_decryption_threads > 0
+                                      ? FLAGS_decryption_threads
+                                      : std::thread::hardware_concurrency();
   return std::unique_ptr<AnalyzerServiceImpl>(new AnalyzerServiceImpl(
-      observation_store, FLAGS_port, server_credentials, private_key_pem));
+      observation_store, FLAGS_port, server_credentials, private_key_pem,
+      num_decryption_threads));
 }
 
 AnalyzerServiceImpl::AnalyzerServiceImpl(
     std::shared_ptr<store::ObservationStore> observation_store, int port,
     std::shared_ptr<grpc::ServerCredentials> server_credentials,
-    const std::string& private_key_pem)
+    const std::string& private_key_pem, size_t num_decryption_threads)
     : observation_store_(observation_store),
       port_(port),
       server_credentials_(server_credentials),
-      message_decrypter_(private_key_pem) {}
+      batch_decrypter_(private_key_pem, num_decryption_threads) {}
 
 void AnalyzerServiceImpl::Start() {
   grpc::ServerBuilder builder;
@@ -110,15 +116,13 @@ grpc::Status AnalyzerServiceImpl::AddObservations(
           << " observations for metric (" << batch->meta_data().customer_id()
           << ", " << batch->meta_data().project_id() << ", "
           << batch->meta_data().metric_id() << ")";
-  std::vector<Observation> observations(batch->encrypted_observation_size());
-  size_t index = 0;
-  for (const EncryptedMessage& em : batch->encrypted_observation()) {
-    if (!message_decrypter_.DecryptMessage(em, &observations[index++])) {
-      std::string error_message = "Decryption of an Observation failed.";
-      LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationsFailure)
-          << error_message;
-      return grpc::Status(grpc::INVALID_ARGUMENT, error_message);
-    }
+  std::vector<Observation> observations;
+  if (!batch_decrypter_.DecryptBatch(batch->encrypted_observation(),
+                                     &observations)) {
+    std::string error_message = "Decryption of an Observation failed.";
+    LOG_STACKDRIVER_COUNT_METRIC(ERROR, kAddObservationsFailure)
+        << error_message;
+    return grpc::Status(grpc::INVALID_ARGUMENT, error_message);
   }
 
   auto add_status =
@@ -20,10 +20,10 @@
 #include <utility>
 
 #include "analyzer/analyzer_service/analyzer.grpc.pb.h"
+#include "analyzer/analyzer_service/batch_decrypter.h"
 #include "analyzer/store/data_store.h"
 #include "analyzer/store/observation_store.h"
 #include "grpc++/grpc++.h"
-#include "util/encrypted_message_util.h"
 
 namespace cobalt {
 namespace analyzer {
@@ -48,10 +48,13 @@ class AnalyzerServiceImpl final : public Analyzer::Service {
   // EncryptedMessages that uses the EncryptedMessage::NONE scheme, i.e.
   // Observations that are sent in plain text. This is useful for testing but
   // should never be done in a production Cobalt environment.
+  //
+  // The Observations in each batch are decrypted by a pool of
+  // |num_decryption_threads| threads. See BatchDecrypter.
   AnalyzerServiceImpl(
       std::shared_ptr<store::ObservationStore> observation_store, int port,
       std::shared_ptr<grpc::ServerCredentials> server_credentials,
-      const std::string& private_key_pem);
+      const std::string& private_key_pem, size_t num_decryption_threads);
 
   // Starts the analyzer service
   void Start();
@@ -73,7 +76,7 @@ class AnalyzerServiceImpl final : public Analyzer::Service {
   int port_;
   std::shared_ptr<grpc::ServerCredentials> server_credentials_;
   std::unique_ptr<grpc::Server> server_;
-  util::MessageDecrypter message_decrypter_;
+  BatchDecrypter batch_decrypter_;
 };
 
 }  // namespace analyzer
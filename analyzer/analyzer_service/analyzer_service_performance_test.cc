@@ -0,0 +1,141 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "analyzer/analyzer_service/analyzer_service.h"
+#include "analyzer/analyzer_service/batch_decrypter.h"
+#include "analyzer/store/memory_store.h"
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+#include "util/crypto_util/cipher.h"
+#include "util/encrypted_message_util.h"
+
+namespace cobalt {
+namespace analyzer {
+
+using crypto::HybridCipher;
+using store::MemoryStore;
+using store::ObservationStore;
+using util::EncryptedMessageMaker;
+
+namespace {
+
+const int kBatchSize = 2000;
+const int kAnalyzerPort = 8080;
+
+// Returns a batch of kBatchSize Observations encrypted with |public_key|.
+ObservationBatch MakeBatch(const std::string& public_key) {
+  ObservationBatch batch;
+  ObservationMetadata* meta_data = batch.mutable_meta_data();
+  meta_data->set_customer_id(1);
+  meta_data->set_project_id(1);
+  meta_data->set_metric_id(1);
+  meta_data->set_day_index(1);
+  EncryptedMessageMaker maker(public_key, EncryptedMessage::HYBRID_ECDH_V1);
+  for (int i = 0; i < kBatchSize; i++) {
+    Observation observation;
+    ObservationPart& part = (*observation.mutable_parts())["part"];
+    part.set_encoding_config_id(1);
+    part.mutable_forculus()->set_ciphertext("ciphertext" + std::to_string(i));
+    EXPECT_TRUE(maker.Encrypt(observation, batch.add_encrypted_observation()));
+  }
+  return batch;
+}
+
+// Returns the numbers of threads to measure.
+std::vector<size_t> ThreadCounts() {
+  size_t num_cores = std::max(std::thread::hardware_concurrency(), 1u);
+  std::vector<size_t> thread_counts = {1};
+  for (size_t num_threads = 2; num_threads < num_cores; num_threads *= 2) {
+    thread_counts.push_back(num_threads);
+  }
+  if (num_cores > 1) {
+    thread_counts.push_back(num_cores);
+  }
+  return thread_counts;
+}
+
+// Prints the throughput of decrypting kBatchSize observations in |seconds|
+// using |num_threads| threads.
+void PrintThroughput(size_t num_threads, double seconds) {
+  size_t num_cores = std::min<size_t>(
+      num_threads, std::max(std::thread::hardware_concurrency(), 1u));
+  double per_second = kBatchSize / seconds;
+  std::cout << num_threads << " threads: " << per_second
+            << " observations per second, " << per_second / num_cores
+            << " per second per core.\n";
+}
+
+}  // namespace
+
+// Measures the throughput of BatchDecrypter, in observations decrypted per
+// second and per second per core, for various numbers of threads.
+TEST(AnalyzerServicePerformanceTest, BatchDecrypter) {
+  std::string public_key, private_key;
+  ASSERT_TRUE(HybridCipher::GenerateKeyPairPEM(&public_key, &private_key));
+  ObservationBatch batch = MakeBatch(public_key);
+
+  std::cout << "\n=================================================\n";
+  std::cout << "Observations per batch: " << kBatchSize << std::endl;
+  std::cout << "Hardware threads: " << std::thread::hardware_concurrency()
+            << std::endl;
+  for (size_t num_threads : ThreadCounts()) {
+    BatchDecrypter decrypter(private_key, num_threads);
+    std::vector<Observation> observations;
+    auto t_start = std::chrono::high_resolution_clock::now();
+    EXPECT_TRUE(
+        decrypter.DecryptBatch(batch.encrypted_observation(), &observations));
+    auto t_end = std::chrono::high_resolution_clock::now();
+    PrintThroughput(num_threads,
+                    std::chrono::duration<double>(t_end - t_start).count());
+  }
+  std::cout << "\n=================================================\n";
+}
+
+// Measures the throughput of AnalyzerServiceImpl::AddObservations(),
+// including writing the observations to a MemoryStore, for various numbers
+// of decryption threads. The service is invoked directly rather than through
+// gRPC.
+TEST(AnalyzerServicePerformanceTest, AddObservations) {
+  std::string public_key, private_key;
+  ASSERT_TRUE(HybridCipher::GenerateKeyPairPEM(&public_key, &private_key));
+  ObservationBatch batch = MakeBatch(public_key);
+
+  std::cout << "\n=================================================\n";
+  std::cout << "Observations per batch: " << kBatchSize << std::endl;
+  for (size_t num_threads : ThreadCounts()) {
+    std::shared_ptr<MemoryStore> data_store(new MemoryStore());
+    std::shared_ptr<ObservationStore> observation_store(
+        new ObservationStore(data_store));
+    AnalyzerServiceImpl analyzer(observation_store, kAnalyzerPort,
+                                 grpc::InsecureServerCredentials(),
+                                 private_key, num_threads);
+    google::protobuf::Empty empty;
+    auto t_start = std::chrono::high_resolution_clock::now();
+    EXPECT_TRUE(analyzer.AddObservations(nullptr, &batch, &empty).ok());
+    auto t_end = std::chrono::high_resolution_clock::now();
+    PrintThroughput(num_threads,
+                    std::chrono::duration<double>(t_end - t_start).count());
+  }
+  std::cout << "\n=================================================\n";
+}
+
+}  // namespace analyzer
+}  // namespace cobalt
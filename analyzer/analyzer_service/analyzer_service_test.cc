@@ -47,7 +47,7 @@ class AnalyzerServiceTest : public ::testing::Test {
       : data_store_(new MemoryStore()),
         observation_store_(new ObservationStore(data_store_)),
         analyzer_(observation_store_, kAnalyzerPort,
-                  grpc::InsecureServerCredentials(), "") {}
+                  grpc::InsecureServerCredentials(), "", 2) {}
 
  protected:
   virtual void SetUp() {
@@ -0,0 +1,141 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "analyzer/analyzer_service/batch_decrypter.h"
+
+#include <algorithm>
+
+namespace cobalt {
+namespace analyzer {
+
+namespace {
+// The number of consecutive messages that a worker claims at a time. A
+// decryption takes on the order of 100 microseconds, so this is large enough
+// that the workers rarely contend for the mutex and small enough that a batch
+// of a few hundred messages is still spread over several workers.
+const size_t kChunkSize = 16;
+}  // namespace
+
+// The state of an invocation of DecryptBatch(). The counts and |failed| are
+// protected by |mutex_|. Each element of |observations| is written without
+// the mutex by the worker that claimed its chunk.
+struct BatchDecrypter::Batch {
+  const google::protobuf::RepeatedPtrField<EncryptedMessage>*
+      encrypted_messages;
+  std::vector<Observation>* observations;
+  size_t num_chunks;
+
+  // The number of chunks that have been claimed by, and completed by,
+  // workers.
+  size_t num_claimed = 0;
+  size_t num_completed = 0;
+
+  // Whether any message could not be decrypted. Once it is set the remaining
+  // chunks are skipped.
+  bool failed = false;
+};
+
+BatchDecrypter::BatchDecrypter(const std::string& private_key_pem,
+                               size_t num_threads) {
+  num_threads = std::max<size_t>(num_threads, 1);
+  for (size_t i = 0; i < num_threads; i++) {
+    decrypters_.emplace_back(new util::MessageDecrypter(private_key_pem));
+  }
+  for (size_t i = 0; i < num_threads; i++) {
+    workers_.emplace_back([this, i] { this->Run(i); });
+  }
+}
+
+BatchDecrypter::~BatchDecrypter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shut_down_ = true;
+    worker_notifier_.notify_all();
+  }
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+bool BatchDecrypter::DecryptBatch(
+    const google::protobuf::RepeatedPtrField<EncryptedMessage>&
+        encrypted_messages,
+    std::vector<Observation>* observations) {
+  observations->resize(encrypted_messages.size());
+  if (encrypted_messages.empty()) {
+    return true;
+  }
+
+  Batch batch;
+  batch.encrypted_messages = &encrypted_messages;
+  batch.observations = observations;
+  batch.num_chunks = (encrypted_messages.size() + kChunkSize - 1) / kChunkSize;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  work_queue_.push_back(&batch);
+  worker_notifier_.notify_all();
+  done_notifier_.wait(
+      lock, [&batch] { return batch.num_completed == batch.num_chunks; });
+  return !batch.failed;
+}
+
+void BatchDecrypter::Run(size_t worker_index) {
+  const util::MessageDecrypter& decrypter = *decrypters_[worker_index];
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    worker_notifier_.wait(
+        lock, [this] { return shut_down_ || !work_queue_.empty(); });
+    if (work_queue_.empty()) {
+      // shut_down_ is true and there is nothing left to do.
+      return;
+    }
+
+    // Claim the next chunk of the oldest batch.
+    Batch* batch = work_queue_.front();
+    size_t chunk_index = batch->num_claimed++;
+    if (batch->num_claimed == batch->num_chunks) {
+      work_queue_.pop_front();
+    }
+    bool skip = batch->failed;
+
+    lock.unlock();
+    bool success = skip || DecryptChunk(decrypter, batch, chunk_index);
+    lock.lock();
+
+    if (!success) {
+      batch->failed = true;
+    }
+    if (++batch->num_completed == batch->num_chunks) {
+      // |batch| may be destroyed as soon as the mutex is released.
+      done_notifier_.notify_all();
+    }
+  }
+}
+
+bool BatchDecrypter::DecryptChunk(const util::MessageDecrypter& decrypter,
+                                  Batch* batch, size_t chunk_index) {
+  size_t begin = chunk_index * kChunkSize;
+  size_t end = std::min<size_t>(begin + kChunkSize,
+                                batch->encrypted_messages->size());
+  for (size_t i = begin; i < end; i++) {
+    if (!decrypter.DecryptMessage(batch->encrypted_messages->Get(i),
+                                  &(*batch->observations)[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace analyzer
+}  // namespace cobalt
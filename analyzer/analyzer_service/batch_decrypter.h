@@ -0,0 +1,107 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COBALT_ANALYZER_ANALYZER_SERVICE_BATCH_DECRYPTER_H_
+#define COBALT_ANALYZER_ANALYZER_SERVICE_BATCH_DECRYPTER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./encrypted_message.pb.h"
+#include "./observation.pb.h"
+#include "google/protobuf/repeated_field.h"
+#include "util/encrypted_message_util.h"
+
+namespace cobalt {
+namespace analyzer {
+
+// A BatchDecrypter decrypts batches of EncryptedMessages containing
+// Observations using a pool of worker threads.
+//
+// Hybrid decryption of an Observation, which consists of an elliptic-curve
+// point multiplication, a key derivation and an AES-GCM decryption, is
+// expensive and each Observation in a batch is decrypted independently. A
+// batch is therefore divided into chunks of consecutive messages which the
+// workers claim one at a time, so that a large batch is spread over all of
+// the workers and several batches may be decrypted concurrently. Each worker
+// has its own MessageDecrypter, and so its own HybridCipher, so that no
+// cipher state is shared between threads.
+//
+// This class is thread-safe: DecryptBatch() may be invoked concurrently, for
+// example by several gRPC handler threads.
+class BatchDecrypter {
+ public:
+  // Constructs a BatchDecrypter that uses |num_threads| worker threads, or
+  // one if |num_threads| is zero, each of which decrypts with the private
+  // key |private_key_pem|. See MessageDecrypter.
+  BatchDecrypter(const std::string& private_key_pem, size_t num_threads);
+
+  // Stops the worker threads. There must be no concurrent invocation of
+  // DecryptBatch().
+  ~BatchDecrypter();
+
+  // Decrypts each of |encrypted_messages| into the Observation at the same
+  // index of |observations|, which is resized to the size of
+  // |encrypted_messages|. Blocks until the whole batch has been decrypted.
+  // Returns true for success or false if any of the messages could not be
+  // decrypted, in which case the contents of |observations| are undefined.
+  bool DecryptBatch(
+      const google::protobuf::RepeatedPtrField<EncryptedMessage>&
+          encrypted_messages,
+      std::vector<Observation>* observations);
+
+  size_t num_threads() const { return workers_.size(); }
+
+ private:
+  struct Batch;
+
+  // The main function of worker thread |worker_index|. Repeatedly claims a
+  // chunk of the batch at the front of |work_queue_| and decrypts it.
+  void Run(size_t worker_index);
+
+  // Decrypts chunk |chunk_index| of |batch| using |decrypter|. Returns false
+  // if any of its messages could not be decrypted.
+  static bool DecryptChunk(const util::MessageDecrypter& decrypter,
+                           Batch* batch, size_t chunk_index);
+
+  // One MessageDecrypter for each worker thread.
+  std::vector<std::unique_ptr<util::MessageDecrypter>> decrypters_;
+  std::vector<std::thread> workers_;
+
+  // Protects access to work_queue_ and shut_down_, and to the counts of
+  // claimed and completed chunks of the batches.
+  std::mutex mutex_;
+
+  // Notifies the sleeping workers when a batch has been enqueued or
+  // shut_down_ has been set true. Uses mutex_.
+  std::condition_variable worker_notifier_;
+
+  // Notifies threads waiting in DecryptBatch() when a chunk has been
+  // completed. Uses mutex_.
+  std::condition_variable done_notifier_;
+
+  // The batches that have chunks that have not yet been claimed by a worker.
+  std::deque<Batch*> work_queue_;
+  bool shut_down_ = false;
+};
+
+}  // namespace analyzer
+}  // namespace cobalt
+
+#endif  // COBALT_ANALYZER_ANALYZER_SERVICE_BATCH_DECRYPTER_H_
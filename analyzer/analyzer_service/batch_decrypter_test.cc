@@ -0,0 +1,137 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "analyzer/analyzer_service/batch_decrypter.h"
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+#include "util/crypto_util/cipher.h"
+
+namespace cobalt {
+namespace analyzer {
+
+using crypto::HybridCipher;
+using google::protobuf::RepeatedPtrField;
+using util::EncryptedMessageMaker;
+
+namespace {
+
+std::string PartName(int index) { return "part" + std::to_string(index); }
+
+// Returns |num_messages| EncryptedMessages whose Observations have the single
+// parts PartName(0), PartName(1), ...
+RepeatedPtrField<EncryptedMessage> MakeBatch(const std::string& public_key,
+                                             int num_messages) {
+  EncryptedMessageMaker maker(public_key, EncryptedMessage::HYBRID_ECDH_V1);
+  RepeatedPtrField<EncryptedMessage> batch;
+  for (int i = 0; i < num_messages; i++) {
+    Observation observation;
+    (*observation.mutable_parts())[PartName(i)] = ObservationPart();
+    EXPECT_TRUE(maker.Encrypt(observation, batch.Add()));
+  }
+  return batch;
+}
+
+// Checks that |observations| are the Observations of MakeBatch().
+void CheckObservations(int num_messages,
+                       const std::vector<Observation>& observations) {
+  ASSERT_EQ(static_cast<size_t>(num_messages), observations.size());
+  for (int i = 0; i < num_messages; i++) {
+    EXPECT_EQ(1u, observations[i].parts().count(PartName(i)));
+  }
+}
+
+class BatchDecrypterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(HybridCipher::GenerateKeyPairPEM(&public_key_, &private_key_));
+  }
+
+  std::string public_key_;
+  std::string private_key_;
+};
+
+}  // namespace
+
+// Tests that batches of various sizes are decrypted in order by various
+// numbers of threads.
+TEST_F(BatchDecrypterTest, DecryptBatch) {
+  for (size_t num_threads : {0, 1, 3, 8}) {
+    SCOPED_TRACE(num_threads);
+    BatchDecrypter decrypter(private_key_, num_threads);
+    EXPECT_EQ(std::max<size_t>(num_threads, 1), decrypter.num_threads());
+    for (int num_messages : {0, 1, 16, 17, 100}) {
+      SCOPED_TRACE(num_messages);
+      std::vector<Observation> observations;
+      EXPECT_TRUE(decrypter.DecryptBatch(MakeBatch(public_key_, num_messages),
+                                         &observations));
+      CheckObservations(num_messages, observations);
+    }
+  }
+}
+
+// Tests that a batch fails if any of its messages cannot be decrypted, and
+// that the decrypter may be used again afterwards.
+TEST_F(BatchDecrypterTest, Failure) {
+  BatchDecrypter decrypter(private_key_, 4);
+  RepeatedPtrField<EncryptedMessage> batch = MakeBatch(public_key_, 50);
+  batch.Mutable(37)->mutable_ciphertext()->assign("garbage");
+  std::vector<Observation> observations;
+  EXPECT_FALSE(decrypter.DecryptBatch(batch, &observations));
+
+  // A decrypter with the wrong key fails on every message.
+  std::string other_public_key, other_private_key;
+  ASSERT_TRUE(
+      HybridCipher::GenerateKeyPairPEM(&other_public_key, &other_private_key));
+  BatchDecrypter other_decrypter(other_private_key, 2);
+  EXPECT_FALSE(
+      other_decrypter.DecryptBatch(MakeBatch(public_key_, 5), &observations));
+
+  EXPECT_TRUE(decrypter.DecryptBatch(MakeBatch(public_key_, 20),
+                                     &observations));
+  CheckObservations(20, observations);
+}
+
+// Tests that several threads may decrypt batches concurrently.
+TEST_F(BatchDecrypterTest, ConcurrentBatches) {
+  BatchDecrypter decrypter(private_key_, 3);
+  static const int kNumCallers = 4;
+  std::vector<RepeatedPtrField<EncryptedMessage>> batches;
+  for (int i = 0; i < kNumCallers; i++) {
+    batches.push_back(MakeBatch(public_key_, 40 + i));
+  }
+  std::vector<std::vector<Observation>> observations(kNumCallers);
+  bool results[kNumCallers];
+  std::vector<std::thread> callers;
+  for (int i = 0; i < kNumCallers; i++) {
+    callers.emplace_back([&, i] {
+      results[i] = decrypter.DecryptBatch(batches[i], &observations[i]);
+    });
+  }
+  for (auto& caller : callers) {
+    caller.join();
+  }
+  for (int i = 0; i < kNumCallers; i++) {
+    SCOPED_TRACE(i);
+    EXPECT_TRUE(results[i]);
+    CheckObservations(40 + i, observations[i]);
+  }
+}
+
+}  // namespace analyzer
+}  // namespace cobalt
@@ -14,6 +14,7 @@
 
 #include "analyzer/report_master/histogram_analysis_engine.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <utility>
@@ -21,9 +22,11 @@
 
 #include "./observation.pb.h"
 #include "algorithms/forculus/forculus_analyzer.h"
+#include "algorithms/forculus/sharded_forculus_analyzer.h"
 #include "algorithms/rappor/basic_rappor_analyzer.h"
 #include "algorithms/rappor/rappor_analyzer.h"
 #include "config/buckets_config.h"
+#include "gflags/gflags.h"
 #include "glog/logging.h"
 #include "util/log_based_metrics.h"
 
@@ -32,11 +35,64 @@ namespace analyzer {
 
 using config::AnalyzerConfig;
 using forculus::ForculusAnalyzer;
+using forculus::ShardedForculusAnalyzer;
 using rappor::BasicRapporAnalyzer;
 using rappor::RapporAnalyzer;
 using store::ObservationStore;
 using store::ReportStore;
 
+DEFINE_string(rappor_candidate_index_dir, "",
+              "If not empty, a directory in which string RAPPOR analysis "
+              "keeps memory-mapped indices of the Bloom filter bits of its "
+              "candidates so that later reports over the same candidate list "
+              "need not recompute them.");
+DEFINE_int32(rappor_max_epochs, 10000,
+             "The maximum number of epochs that the minimizer used by string "
+             "RAPPOR analysis may run.");
+DEFINE_double(rappor_convergence_threshold, 0,
+              "If positive, overrides the default convergence threshold of "
+              "the minimizer used by string RAPPOR analysis.");
+DEFINE_bool(rappor_accept_unconverged, false,
+            "If true then string RAPPOR analysis reports the best solution "
+            "found when the minimizer does not converge within "
+            "--rappor_max_epochs epochs, rather than failing.");
+DEFINE_double(rappor_l1, 0,
+              "The weight given to the l1 norm of the solution by string "
+              "RAPPOR analysis. If positive the analysis performs a Lasso "
+              "regression.");
+DEFINE_bool(rappor_least_squares_refit, false,
+            "If true then string RAPPOR analysis refits the selected "
+            "candidates by least squares and reports their standard errors.");
+DEFINE_int32(rappor_max_refit_candidates, 2000,
+             "The maximum number of candidates that the least squares refit "
+             "of string RAPPOR analysis may select. If more are selected "
+             "the refit is skipped, since its cost is cubic in their number.");
+DEFINE_string(rappor_minimizer, "boosting",
+              "The minimizer used by string RAPPOR analysis: either "
+              "'boosting', lossmin's single-threaded parallel boosting with "
+              "momentum, or 'proximal_gradient', accelerated proximal "
+              "gradient descent on --rappor_num_threads threads.");
+DEFINE_int32(rappor_num_threads, 1,
+             "The number of threads with which the 'proximal_gradient' "
+             "minimizer of string RAPPOR analysis computes its matrix "
+             "products. Ignored by the 'boosting' minimizer.");
+DEFINE_bool(rappor_prune_candidates, false,
+            "If true then string RAPPOR analysis drops the candidates whose "
+            "Bloom filter bits are statistically absent in most cohorts "
+            "before it estimates the counts of the others.");
+DEFINE_int32(forculus_memory_budget_mb, 0,
+             "If positive, the approximate number of megabytes that Forculus "
+             "analysis may use for ciphertexts that have not yet reached the "
+             "threshold before it spills them to --forculus_spill_dir.");
+DEFINE_int32(forculus_num_shards, 1,
+             "If greater than one, Forculus analysis partitions the "
+             "observations by ciphertext among this many threads. This is "
+             "intended for large reports.");
+DEFINE_string(forculus_spill_dir, "/tmp",
+              "The directory to which Forculus analysis spills ciphertexts "
+              "that have not yet reached the threshold. See "
+              "--forculus_memory_budget_mb.");
+
 // Stackdriver metric constants
 namespace {
 const char kCheckConsistentEncodingFailure[] =
@@ -107,15 +163,36 @@ class ForculusAdapter : public DecoderAdapter {
  public:
   ForculusAdapter(const ReportId& report_id,
                   const cobalt::ForculusConfig& config)
-      : report_id_(report_id), analyzer_(new ForculusAnalyzer(config)) {}
+      : report_id_(report_id) {
+    size_t memory_budget =
+        static_cast<size_t>(std::max(FLAGS_forculus_memory_budget_mb, 0))
+        << 20;
+    if (FLAGS_forculus_num_shards > 1) {
+      sharded_analyzer_.reset(
+          new ShardedForculusAnalyzer(config, FLAGS_forculus_num_shards));
+      if (memory_budget > 0) {
+        sharded_analyzer_->set_memory_budget(memory_budget,
+                                             FLAGS_forculus_spill_dir);
+      }
+    } else {
+      analyzer_.reset(new ForculusAnalyzer(config));
+      if (memory_budget > 0) {
+        analyzer_->set_memory_budget(memory_budget, FLAGS_forculus_spill_dir);
+      }
+    }
+  }
 
   bool ProcessObservationPart(uint32_t day_index,
                               const ObservationPart& obs) override {
+    if (sharded_analyzer_) {
+      return sharded_analyzer_->AddObservation(day_index, obs.forculus());
+    }
     return analyzer_->AddObservation(day_index, obs.forculus());
   }
 
   grpc::Status PerformAnalysis(std::vector<ReportRow>* results) override {
-    auto result_map = analyzer_->TakeResults();
+    auto result_map = sharded_analyzer_ ? sharded_analyzer_->TakeResults()
+                                        : analyzer_->TakeResults();
     results->clear();
     for (const auto& pair : result_map) {
       ValuePart value_part;
@@ -140,7 +217,9 @@ class ForculusAdapter : public DecoderAdapter {
 
  private:
   ReportId report_id_;
+  // Exactly one of these is not NULL.
   std::unique_ptr<ForculusAnalyzer> analyzer_;
+  std::unique_ptr<ShardedForculusAnalyzer> sharded_analyzer_;
 };
 
 ////////////////////////////////////////////////////////////////////////////
@@ -157,7 +236,25 @@ class RapporAdapter : public DecoderAdapter {
                 const RapporCandidateList* candidates)
       : report_id_(report_id),
         analyzer_(new RapporAnalyzer(config, candidates)),
-        candidates_(candidates) {}
+        candidates_(candidates) {
+    analyzer_->set_candidate_index_directory(FLAGS_rappor_candidate_index_dir);
+    rappor::RapporSolverOptions solver_options;
+    solver_options.max_epochs = FLAGS_rappor_max_epochs;
+    solver_options.convergence_threshold = FLAGS_rappor_convergence_threshold;
+    solver_options.accept_unconverged = FLAGS_rappor_accept_unconverged;
+    solver_options.l1 = FLAGS_rappor_l1;
+    solver_options.least_squares_refit = FLAGS_rappor_least_squares_refit;
+    solver_options.max_refit_candidates = FLAGS_rappor_max_refit_candidates;
+    if (FLAGS_rappor_minimizer == "proximal_gradient") {
+      solver_options.minimizer = rappor::RapporSolverOptions::kProximalGradient;
+    } else if (FLAGS_rappor_minimizer != "boosting") {
+      LOG(ERROR) << "Unknown --rappor_minimizer=" << FLAGS_rappor_minimizer
+                 << ". Using 'boosting'.";
+    }
+    solver_options.num_threads = FLAGS_rappor_num_threads;
+    solver_options.prune_candidates = FLAGS_rappor_prune_candidates;
+    analyzer_->set_solver_options(solver_options);
+  }
 
   bool ProcessObservationPart(uint32_t day_index,
                               const ObservationPart& obs) override {
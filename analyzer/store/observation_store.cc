@@ -35,7 +35,7 @@ namespace store {
 
 using crypto::byte;
 using crypto::hash::DIGEST_SIZE;
-using crypto::hash::Hash;
+using crypto::hash::Hasher;
 using internal::DayIndexFromRowKey;
 using internal::GenerateNewRowKey;
 using internal::ParseEncryptedObservationPart;
@@ -122,15 +122,21 @@ std::string RowKey(uint32_t customer_id, uint32_t project_id,
 // Returns a 32-bit hash of (|observation|, |metadata|) appropriate for use as
 // the <hash> component of a row key. See comments on RowKey() above.
 uint32_t HashObservation(const Observation& observation,
-                         const ObservationMetadata metadata) {
-  std::string serialized_observation;
+                         const ObservationMetadata& metadata) {
+  // The two messages are serialized into per-thread buffers, whose capacity
+  // is reused by later invocations, and hashed one after the other rather
+  // than concatenated.
+  static thread_local std::string serialized_observation;
+  static thread_local std::string serialized_metadata;
   observation.SerializeToString(&serialized_observation);
-  std::string serialized_metadta;
-  metadata.SerializeToString(&serialized_metadta);
-  serialized_observation += serialized_metadta;
+  metadata.SerializeToString(&serialized_metadata);
+  Hasher hasher;
+  hasher.Update(reinterpret_cast<const byte*>(serialized_observation.data()),
+                serialized_observation.size());
+  hasher.Update(reinterpret_cast<const byte*>(serialized_metadata.data()),
+                serialized_metadata.size());
   byte hash_bytes[DIGEST_SIZE];
-  Hash(reinterpret_cast<const byte*>(serialized_observation.data()),
-       serialized_observation.size(), hash_bytes);
+  hasher.Final(hash_bytes);
   uint32_t return_value = 0;
   std::memcpy(&return_value, hash_bytes,
               std::min(DIGEST_SIZE, sizeof(return_value)));
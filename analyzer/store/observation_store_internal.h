@@ -34,7 +34,7 @@ std::string RowKey(uint32_t customer_id, uint32_t project_id,
 // Returns a 32-bit hash of (|observation|, |metadata|) appropriate for use as
 // the <hash> component of a row key.
 uint32_t HashObservation(const Observation& observation,
-                         const ObservationMetadata metadata);
+                         const ObservationMetadata& metadata);
 
 // Returns the day_index encoded by |row_key|.
 uint32_t DayIndexFromRowKey(const std::string& row_key);
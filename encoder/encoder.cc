@@ -54,6 +54,20 @@ std::string DataCaseToString(ValuePart::DataCase data_case) {
   return "UNKNOWN_TYPE";
 }
 
+// Returns the entry of |cache| with the given |key|, first inserting the
+// result of |make_encoder|() if there is no such entry.
+template <class T, class MakeEncoder>
+T* FindOrInsert(std::map<std::tuple<uint32_t, uint32_t, std::string>,
+                         std::unique_ptr<T>>* cache,
+                std::tuple<uint32_t, uint32_t, std::string> key,
+                MakeEncoder make_encoder) {
+  auto iter = cache->find(key);
+  if (iter == cache->end()) {
+    iter = cache->emplace(std::move(key), make_encoder()).first;
+  }
+  return iter->second.get();
+}
+
 }  // namespace
 
 Encoder::Encoder(std::shared_ptr<ProjectContext> project,
@@ -65,6 +79,43 @@ Encoder::Encoder(std::shared_ptr<ProjectContext> project,
       client_secret_(std::move(client_secret)),
       system_data_(system_data) {}
 
+Encoder::~Encoder() {}
+
+ForculusEncrypter* Encoder::GetForculusEncrypter(
+    uint32_t metric_id, uint32_t encoding_config_id,
+    const EncodingConfig* encoding_config, const std::string& part_name) {
+  return FindOrInsert(
+      &forculus_encrypters_,
+      AlgorithmEncoderKey(metric_id, encoding_config_id, part_name), [&]() {
+        return std::unique_ptr<ForculusEncrypter>(new ForculusEncrypter(
+            encoding_config->forculus(), customer_id_, project_id_, metric_id,
+            part_name, client_secret_));
+      });
+}
+
+RapporEncoder* Encoder::GetRapporEncoder(uint32_t metric_id,
+                                         uint32_t encoding_config_id,
+                                         const EncodingConfig* encoding_config,
+                                         const std::string& part_name) {
+  return FindOrInsert(
+      &rappor_encoders_,
+      AlgorithmEncoderKey(metric_id, encoding_config_id, part_name), [&]() {
+        return std::unique_ptr<RapporEncoder>(
+            new RapporEncoder(encoding_config->rappor(), client_secret_));
+      });
+}
+
+BasicRapporEncoder* Encoder::GetBasicRapporEncoder(
+    uint32_t metric_id, uint32_t encoding_config_id,
+    const EncodingConfig* encoding_config, const std::string& part_name) {
+  return FindOrInsert(
+      &basic_rappor_encoders_,
+      AlgorithmEncoderKey(metric_id, encoding_config_id, part_name), [&]() {
+        return std::unique_ptr<BasicRapporEncoder>(new BasicRapporEncoder(
+            encoding_config->basic_rappor(), client_secret_));
+      });
+}
+
 Encoder::Status Encoder::EncodeForculus(
     uint32_t metric_id, uint32_t encoding_config_id, const ValuePart& value,
     const EncodingConfig* encoding_config, const std::string& part_name,
@@ -83,12 +134,11 @@ Encoder::Status Encoder::EncodeForculus(
   }
   ForculusObservation* forculus_observation =
       observation_part->mutable_forculus();
-  ForculusEncrypter forculus_encrypter(encoding_config->forculus(),
-                                       customer_id_, project_id_, metric_id,
-                                       part_name, client_secret_);
+  ForculusEncrypter* forculus_encrypter = GetForculusEncrypter(
+      metric_id, encoding_config_id, encoding_config, part_name);
 
-  switch (
-      forculus_encrypter.EncryptValue(value, day_index, forculus_observation)) {
+  switch (forculus_encrypter->EncryptValue(value, day_index,
+                                           forculus_observation)) {
     case ForculusEncrypter::kOK:
       return kOK;
 
@@ -115,8 +165,9 @@ Encoder::Status Encoder::EncodeRappor(uint32_t metric_id,
     return kInvalidArguments;
   }
   RapporObservation* rappor_observation = observation_part->mutable_rappor();
-  RapporEncoder rappor_encoder(encoding_config->rappor(), client_secret_);
-  switch (rappor_encoder.Encode(value, rappor_observation)) {
+  RapporEncoder* rappor_encoder = GetRapporEncoder(
+      metric_id, encoding_config_id, encoding_config, part_name);
+  switch (rappor_encoder->Encode(value, rappor_observation)) {
     case rappor::kOK:
       return kOK;
 
@@ -150,9 +201,9 @@ Encoder::Status Encoder::EncodeBasicRappor(
   }
   BasicRapporObservation* basic_rappor_observation =
       observation_part->mutable_basic_rappor();
-  BasicRapporEncoder basic_rappor_encoder(encoding_config->basic_rappor(),
-                                          client_secret_);
-  switch (basic_rappor_encoder.Encode(value, basic_rappor_observation)) {
+  BasicRapporEncoder* basic_rappor_encoder = GetBasicRapporEncoder(
+      metric_id, encoding_config_id, encoding_config, part_name);
+  switch (basic_rappor_encoder->Encode(value, basic_rappor_observation)) {
     case rappor::kOK:
       return kOK;
 
@@ -178,18 +229,17 @@ Encoder::Status Encoder::EncodeNoOp(uint32_t metric_id, const ValuePart& value,
   return kOK;
 }
 
-// Check that the specified metric_part and value_part_data are compatible.
+// Check that the specified metric_part and value_part are compatible.
 // If they are not, return false and emit an error message.
 // Else, return true.
 // The part_name and metric_id are used to construct error messages.
 bool Encoder::CheckValidValuePart(
     uint32_t metric_id, const std::string& part_name,
-    const MetricPart& metric_part,
-    const Encoder::Value::ValuePartData& value_part_data) {
+    const MetricPart& metric_part, const ValuePart& value_part) {
   // Check that the data_type of the ValuePart matches the data_type of the
   // MetricPart.
   MetricPart::DataType value_data_type;
-  switch (value_part_data.value_part.data_case()) {
+  switch (value_part.data_case()) {
     case ValuePart::kStringValue:
       value_data_type = MetricPart::STRING;
       break;
@@ -220,15 +270,13 @@ bool Encoder::CheckValidValuePart(
   if (metric_part.data_type() != value_data_type) {
     LOG(ERROR) << "Metric part (" << customer_id_ << ", " << project_id_ << ", "
                << metric_id << ")-" << part_name << " is not of type "
-               << DataCaseToString(value_part_data.value_part.data_case())
-               << ".";
+               << DataCaseToString(value_part.data_case()) << ".";
     return false;
   }
 
   // Check that the int bucket distribution value is allowed and valid.
-  if (value_part_data.value_part.data_case() ==
-      ValuePart::kIntBucketDistribution) {
-    auto counts = value_part_data.value_part.int_bucket_distribution().counts();
+  if (value_part.data_case() == ValuePart::kIntBucketDistribution) {
+    auto counts = value_part.int_bucket_distribution().counts();
     if (!CheckIntBucketDistribution(metric_id, part_name, metric_part,
                                     counts)) {
       return false;
@@ -341,86 +389,130 @@ Encoder::Result Encoder::EncodeIntBucketDistribution(
   return Encode(metric_id, value);
 }
 
-Encoder::Result Encoder::Encode(uint32_t metric_id, const Value& value) {
-  Result result;
+Encoder::Status Encoder::EncodeValuePart(
+    uint32_t metric_id, uint32_t encoding_config_id, const ValuePart& value,
+    const EncodingConfig* encoding_config, const std::string& part_name,
+    uint32_t day_index, ObservationPart* observation_part) {
+  observation_part->set_encoding_config_id(encoding_config_id);
+  switch (encoding_config->config_case()) {
+    case EncodingConfig::kForculus:
+      return EncodeForculus(metric_id, encoding_config_id, value,
+                            encoding_config, part_name, day_index,
+                            observation_part);
 
-  // Get the Metric.
-  const Metric* metric = project_->Metric(metric_id);
-  if (!metric) {
-    // No such metric.
-    LOG(ERROR) << "No such metric: (" << customer_id_ << ", " << project_id_
-               << ", " << metric_id << ")";
-    result.status = kInvalidArguments;
-    return result;
-  }
+    case EncodingConfig::kRappor:
+      return EncodeRappor(metric_id, encoding_config_id, value,
+                          encoding_config, part_name, observation_part);
 
-  // Check that the number of values provided equals the number of metric
-  // parts.
-  if (metric->parts().size() != value.parts_.size()) {
-    LOG(ERROR) << "Metric (" << customer_id_ << ", " << project_id_ << ", "
-               << metric_id << ") does not have " << value.parts_.size()
-               << " part(s)";
-    result.status = kInvalidArguments;
-    return result;
+    case EncodingConfig::kBasicRappor:
+      return EncodeBasicRappor(metric_id, encoding_config_id, value,
+                               encoding_config, part_name, observation_part);
+
+    case EncodingConfig::kNoOpEncoding:
+      return EncodeNoOp(metric_id, value, part_name, observation_part);
+
+    default:
+      return kInvalidConfig;
   }
+}
 
-  // Compute the day_index.
+Encoder::Status Encoder::ComputeDayIndex(uint32_t metric_id,
+                                         const Metric& metric,
+                                         uint32_t* day_index) {
   time_t current_time = current_time_;
   if (current_time <= 0) {
     // Use the real clock if we have not been given a static value for
     // current_time.
     current_time = std::time(nullptr);
   }
-  uint32_t day_index = TimeToDayIndex(current_time, metric->time_zone_policy());
-  if (day_index == UINT32_MAX) {
+  *day_index = TimeToDayIndex(current_time, metric.time_zone_policy());
+  if (*day_index == UINT32_MAX) {
     // Invalid Metric: No time_zone_policy.
     LOG(ERROR) << "TimeZonePolicy unset for metric: (" << customer_id_ << ", "
                << project_id_ << ", " << metric_id << ")";
-    result.status = kInvalidConfig;
-    return result;
+    return kInvalidConfig;
   }
+  return kOK;
+}
 
-  // Create a new Observation and ObservationMetadata.
-  result.observation.reset(new Observation());
-
-  // Generate the random_id field. Currently we use 8 bytes but our
-  // infrastructure allows us to change that in the future if we wish to. The
-  // random_id is used by the Analyzer Service as part of a unique row key
-  // for the observation in the Observation Store.
-  static const size_t kNumRandomBytes = 8;
-  result.observation->set_allocated_random_id(
-      new std::string(kNumRandomBytes, 0));
-  random_.RandomString(result.observation->mutable_random_id());
-
-  result.metadata.reset(new ObservationMetadata());
-  result.metadata->set_customer_id(customer_id_);
-  result.metadata->set_project_id(project_id_);
-  result.metadata->set_metric_id(metric_id);
-  result.metadata->set_day_index(day_index);
+std::unique_ptr<ObservationMetadata> Encoder::MakeMetadata(
+    uint32_t metric_id, const Metric& metric, uint32_t day_index) {
+  std::unique_ptr<ObservationMetadata> metadata(new ObservationMetadata());
+  metadata->set_customer_id(customer_id_);
+  metadata->set_project_id(project_id_);
+  metadata->set_metric_id(metric_id);
+  metadata->set_day_index(day_index);
 
   if (system_data_) {
     // If we were provided a SystemProfile, add the subset of fields specified
     // in system_profile_field.
     const auto& profile = system_data_->system_profile();
-    for (const auto& metric : metric->system_profile_field()) {
-      switch (metric) {
+    for (const auto& field : metric.system_profile_field()) {
+      switch (field) {
         case SystemProfileField::OS:
-          result.metadata->mutable_system_profile()->set_os(profile.os());
+          metadata->mutable_system_profile()->set_os(profile.os());
           break;
         case SystemProfileField::ARCH:
-          result.metadata->mutable_system_profile()->set_arch(profile.arch());
+          metadata->mutable_system_profile()->set_arch(profile.arch());
           break;
         case SystemProfileField::BOARD_NAME:
-          result.metadata->mutable_system_profile()->set_board_name(
+          metadata->mutable_system_profile()->set_board_name(
               profile.board_name());
           break;
         case SystemProfileField::PRODUCT_NAME:
-          result.metadata->mutable_system_profile()->set_product_name(
+          metadata->mutable_system_profile()->set_product_name(
               profile.product_name());
           break;
       }
     }
   }
+  return metadata;
+}
+
+void Encoder::SetRandomId(Observation* observation) {
+  // Generate the random_id field. Currently we use 8 bytes but our
+  // infrastructure allows us to change that in the future if we wish to. The
+  // random_id is used by the Analyzer Service as part of a unique row key
+  // for the observation in the Observation Store.
+  static const size_t kNumRandomBytes = 8;
+  observation->mutable_random_id()->assign(kNumRandomBytes, 0);
+  random_.RandomString(observation->mutable_random_id());
+}
+
+Encoder::Result Encoder::Encode(uint32_t metric_id, const Value& value) {
+  Result result;
+
+  // Get the Metric.
+  const Metric* metric = project_->Metric(metric_id);
+  if (!metric) {
+    // No such metric.
+    LOG(ERROR) << "No such metric: (" << customer_id_ << ", " << project_id_
+               << ", " << metric_id << ")";
+    result.status = kInvalidArguments;
+    return result;
+  }
+
+  // Check that the number of values provided equals the number of metric
+  // parts.
+  if (metric->parts().size() != value.parts_.size()) {
+    LOG(ERROR) << "Metric (" << customer_id_ << ", " << project_id_ << ", "
+               << metric_id << ") does not have " << value.parts_.size()
+               << " part(s)";
+    result.status = kInvalidArguments;
+    return result;
+  }
+
+  // Compute the day_index.
+  uint32_t day_index;
+  result.status = ComputeDayIndex(metric_id, *metric, &day_index);
+  if (result.status != kOK) {
+    return result;
+  }
+
+  // Create a new Observation and ObservationMetadata.
+  result.observation.reset(new Observation());
+  SetRandomId(result.observation.get());
+  result.metadata = MakeMetadata(metric_id, *metric, day_index);
 
   // Iterate through the provided values.
   for (const auto& key_value : value.parts_) {
@@ -452,7 +544,7 @@ Encoder::Result Encoder::Encode(uint32_t metric_id, const Value& value) {
     // Check that the data type of the ValuePart is valid for the specified
     // MetricPart.
     if (!CheckValidValuePart(metric_id, part_name, metric_part,
-                             value_part_data)) {
+                             value_part_data.value_part)) {
       result.status = kInvalidArguments;
       return result;
     }
@@ -469,53 +561,79 @@ Encoder::Result Encoder::Encode(uint32_t metric_id, const Value& value) {
       return result;
     }
 
-    // Add an ObservationPart to the Observation with the part_name.
-    ObservationPart& observation_part =
-        (*result.observation->mutable_parts())[part_name];
-    observation_part.set_encoding_config_id(value_part_data.encoding_config_id);
-
-    // Perform the encoding.
-    Status status = kOK;
-    switch (encoding_config->config_case()) {
-      case EncodingConfig::kForculus: {
-        status = EncodeForculus(metric_id, value_part_data.encoding_config_id,
-                                value_part_data.value_part, encoding_config,
-                                part_name, day_index, &observation_part);
-        break;
-      }
+    // Add an ObservationPart to the Observation with the part_name and
+    // perform the encoding.
+    result.status = EncodeValuePart(
+        metric_id, value_part_data.encoding_config_id,
+        value_part_data.value_part, encoding_config, part_name, day_index,
+        &(*result.observation->mutable_parts())[part_name]);
+    if (result.status != kOK) {
+      return result;
+    }
+  }
+  result.status = kOK;
+  return result;
+}
 
-      case EncodingConfig::kRappor: {
-        status = EncodeRappor(metric_id, value_part_data.encoding_config_id,
-                              value_part_data.value_part, encoding_config,
-                              part_name, &observation_part);
-        break;
-      }
+Encoder::Status Encoder::EncodeBatch(uint32_t metric_id,
+                                     uint32_t encoding_config_id,
+                                     const std::vector<ValuePart>& values,
+                                     BatchResult* result) {
+  CHECK(result);
+  // Clear() retains the previously allocated Observations so that Add()
+  // below can reuse them.
+  result->observations.Clear();
 
-      case EncodingConfig::kBasicRappor: {
-        status =
-            EncodeBasicRappor(metric_id, value_part_data.encoding_config_id,
-                              value_part_data.value_part, encoding_config,
-                              part_name, &observation_part);
-        break;
-      }
+  // Get the Metric.
+  const Metric* metric = project_->Metric(metric_id);
+  if (!metric) {
+    // No such metric.
+    LOG(ERROR) << "No such metric: (" << customer_id_ << ", " << project_id_
+               << ", " << metric_id << ")";
+    return kInvalidArguments;
+  }
 
-      case EncodingConfig::kNoOpEncoding: {
-        status = EncodeNoOp(metric_id, value_part_data.value_part, part_name,
-                            &observation_part);
-        break;
-      }
+  // The batch API only supports metrics with a single part.
+  if (metric->parts().size() != 1) {
+    LOG(ERROR) << "Metric (" << customer_id_ << ", " << project_id_ << ", "
+               << metric_id << ") does not have 1 part";
+    return kInvalidArguments;
+  }
+  const std::string& part_name = metric->parts().begin()->first;
+  const MetricPart& metric_part = metric->parts().begin()->second;
+
+  // Get the EncodingConfig
+  const EncodingConfig* encoding_config =
+      project_->EncodingConfig(encoding_config_id);
+  if (!encoding_config) {
+    // No such encoding config.
+    LOG(ERROR) << "No such encoding config: (" << customer_id_ << ", "
+               << project_id_ << ", " << encoding_config_id << ")";
+    return kInvalidArguments;
+  }
 
-      default:
-        status = kInvalidConfig;
-        break;
+  uint32_t day_index;
+  Status status = ComputeDayIndex(metric_id, *metric, &day_index);
+  if (status != kOK) {
+    return status;
+  }
+  result->metadata = MakeMetadata(metric_id, *metric, day_index);
+
+  result->observations.Reserve(values.size());
+  for (const ValuePart& value : values) {
+    if (!CheckValidValuePart(metric_id, part_name, metric_part, value)) {
+      return kInvalidArguments;
     }
+    Observation* observation = result->observations.Add();
+    SetRandomId(observation);
+    status = EncodeValuePart(metric_id, encoding_config_id, value,
+                             encoding_config, part_name, day_index,
+                             &(*observation->mutable_parts())[part_name]);
     if (status != kOK) {
-      result.status = status;
-      return result;
+      return status;
     }
   }
-  result.status = kOK;
-  return result;
+  return kOK;
 }
 
 ValuePart& Encoder::Value::AddPart(uint32_t encoding_config_id,
@@ -18,6 +18,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include "./observation.pb.h"
@@ -27,6 +28,16 @@
 #include "util/crypto_util/random.h"
 
 namespace cobalt {
+
+namespace forculus {
+class ForculusEncrypter;
+}  // namespace forculus
+
+namespace rappor {
+class BasicRapporEncoder;
+class RapporEncoder;
+}  // namespace rappor
+
 namespace encoder {
 
 // An Encoder is used for encoding raw values into Observations. An Observation
@@ -70,6 +81,13 @@ namespace encoder {
 // (c) Floating point numbers are only compatible with the NoOp encoding.
 // (d) Indexes are compatible with Basic RAPPOR and NoOp only.
 // (e) Blobs are compatible with Forculus and NoOp only.
+//
+// The per-algorithm encoders (RapporEncoder, BasicRapporEncoder and
+// ForculusEncrypter) that an Encoder uses are constructed lazily, the first
+// time a given (metric, encoding config, metric part) triple is encoded, and
+// are then cached and reused for the lifetime of the Encoder. This avoids
+// repeating per-config set-up work, such as deriving the RAPPOR cohort or
+// indexing the Basic RAPPOR categories, on every call.
 class Encoder {
  public:
   // Constructs an Encoder for the given project.
@@ -91,6 +109,8 @@ class Encoder {
   Encoder(std::shared_ptr<ProjectContext> project, ClientSecret client_secret,
           const SystemDataInterface* system_data = nullptr);
 
+  ~Encoder();
+
   enum Status {
     kOK = 0,
 
@@ -267,6 +287,38 @@ class Encoder {
   // result contains an error status.
   Result Encode(uint32_t metric_id, const Value& value);
 
+  /////////////////////////////////////////////////////////////////////////////
+  //                            The batch API
+  //
+  // This API may be used when a client has many values to log for the same
+  // single-part metric at once. The metric lookup, the encoding config lookup,
+  // the day index and the SystemProfile filtering are performed once per batch
+  // rather than once per value, and all of the Observations in the batch share
+  // a single ObservationMetadata.
+  ////////////////////////////////////////////////////////////////////////////
+
+  // The output of EncodeBatch(). An instance may be passed to EncodeBatch()
+  // repeatedly so that the memory allocated for the Observations of one batch
+  // is reused for the next.
+  struct BatchResult {
+    // The metadata shared by all of the Observations in |observations|.
+    std::unique_ptr<ObservationMetadata> metadata;
+
+    // One Observation for each of the values passed to EncodeBatch(), in the
+    // same order. Each Observation is assigned its own |random_id|.
+    google::protobuf::RepeatedPtrField<Observation> observations;
+  };
+
+  // Encodes each of the |values| using the specified encoding for the
+  // specified metric, which must have only a single part. The type of each
+  // value must correspond to the type of the metric's sole part. On success
+  // returns kOK and overwrites the contents of |*result|. Otherwise returns
+  // an error status, in which case the contents of |*result| are
+  // unspecified. Encoding an empty batch succeeds and yields no Observations.
+  Status EncodeBatch(uint32_t metric_id, uint32_t encoding_config_id,
+                     const std::vector<ValuePart>& values,
+                     BatchResult* result);
+
   // Sets a static value to use for the current time when computing the
   // day index. By default an Encoder uses the real system clock to determine
   // the current time. But this function may be invoked to override that
@@ -305,21 +357,68 @@ class Encoder {
                     const std::string& part_name,
                     ObservationPart* observation_part);
 
+  // Helper function that dispatches on the type of |encoding_config| in order
+  // to encode |value| and writes the result into |observation_part|.
+  Status EncodeValuePart(uint32_t metric_id, uint32_t encoding_config_id,
+                         const ValuePart& value,
+                         const EncodingConfig* encoding_config,
+                         const std::string& part_name, uint32_t day_index,
+                         ObservationPart* observation_part);
+
+  // Computes the day index for the current time according to the
+  // time_zone_policy of |metric|. Returns kInvalidConfig if the metric does
+  // not specify a time_zone_policy.
+  Status ComputeDayIndex(uint32_t metric_id, const Metric& metric,
+                         uint32_t* day_index);
+
+  // Returns a new ObservationMetadata for |metric| on |day_index|, including
+  // the subset of the SystemProfile fields requested by the metric.
+  std::unique_ptr<ObservationMetadata> MakeMetadata(uint32_t metric_id,
+                                                    const Metric& metric,
+                                                    uint32_t day_index);
+
+  // Sets |observation|'s random_id to a new, quasi-unique random value.
+  void SetRandomId(Observation* observation);
+
   bool CheckValidValuePart(uint32_t metric_id, const std::string& part_name,
                            const MetricPart& metric_part,
-                           const Value::ValuePartData& value_part_data);
+                           const ValuePart& value_part);
 
   bool CheckIntBucketDistribution(
       uint32_t metric_id, const std::string& part_name,
       const MetricPart& metric_part,
       const google::protobuf::Map<uint32_t, uint64_t>& counts);
 
+  // The key into the caches of per-algorithm encoders below:
+  // (metric_id, encoding_config_id, part_name).
+  typedef std::tuple<uint32_t, uint32_t, std::string> AlgorithmEncoderKey;
+
+  // Returns the cached encoder for the given key, first constructing it from
+  // |encoding_config| if necessary. The Encoder retains ownership.
+  forculus::ForculusEncrypter* GetForculusEncrypter(
+      uint32_t metric_id, uint32_t encoding_config_id,
+      const EncodingConfig* encoding_config, const std::string& part_name);
+  rappor::RapporEncoder* GetRapporEncoder(uint32_t metric_id,
+                                          uint32_t encoding_config_id,
+                                          const EncodingConfig* encoding_config,
+                                          const std::string& part_name);
+  rappor::BasicRapporEncoder* GetBasicRapporEncoder(
+      uint32_t metric_id, uint32_t encoding_config_id,
+      const EncodingConfig* encoding_config, const std::string& part_name);
+
   uint32_t customer_id_, project_id_;
   std::shared_ptr<ProjectContext> project_;
   ClientSecret client_secret_;
   const SystemDataInterface* system_data_;  // not owned
   time_t current_time_ = 0;
   crypto::Random random_;
+
+  std::map<AlgorithmEncoderKey, std::unique_ptr<forculus::ForculusEncrypter>>
+      forculus_encrypters_;
+  std::map<AlgorithmEncoderKey, std::unique_ptr<rappor::RapporEncoder>>
+      rappor_encoders_;
+  std::map<AlgorithmEncoderKey, std::unique_ptr<rappor::BasicRapporEncoder>>
+      basic_rappor_encoders_;
 };
 
 }  // namespace encoder
@@ -0,0 +1,177 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "algorithms/rappor/rappor_encoder.h"
+#include "config/client_config.h"
+#include "config/cobalt_config.pb.h"
+#include "encoder/client_secret.h"
+#include "encoder/encoder.h"
+#include "encoder/project_context.h"
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+
+namespace cobalt {
+namespace encoder {
+
+using config::ClientConfig;
+using rappor::BasicRapporEncoder;
+
+namespace {
+
+const uint32_t kCustomerId = 1;
+const uint32_t kProjectId = 1;
+const uint32_t kMetricId = 1;
+const uint32_t kEncodingConfigId = 1;
+const int kNumCategories = 500;
+const int kNumEncodes = 10000;
+
+std::string CategoryName(int index) {
+  std::ostringstream stream;
+  stream << "category" << index;
+  return stream.str();
+}
+
+// Returns a ProjectContext containing a single metric with a single STRING
+// part and a single Basic RAPPOR encoding with kNumCategories categories.
+std::shared_ptr<ProjectContext> GetTestProject() {
+  CobaltConfig cobalt_config;
+  Metric* metric = cobalt_config.add_metric_configs();
+  metric->set_customer_id(kCustomerId);
+  metric->set_project_id(kProjectId);
+  metric->set_id(kMetricId);
+  metric->set_time_zone_policy(Metric::UTC);
+  (*metric->mutable_parts())["Part1"].set_data_type(MetricPart::STRING);
+
+  EncodingConfig* encoding = cobalt_config.add_encoding_configs();
+  encoding->set_customer_id(kCustomerId);
+  encoding->set_project_id(kProjectId);
+  encoding->set_id(kEncodingConfigId);
+  BasicRapporConfig* basic_rappor = encoding->mutable_basic_rappor();
+  basic_rappor->set_prob_0_becomes_1(0.1);
+  basic_rappor->set_prob_1_stays_1(0.9);
+  for (int i = 0; i < kNumCategories; i++) {
+    basic_rappor->mutable_string_categories()->add_category(CategoryName(i));
+  }
+
+  std::unique_ptr<ClientConfig> client_config =
+      ClientConfig::CreateFromCobaltConfig(&cobalt_config);
+  EXPECT_NE(nullptr, client_config);
+  return std::shared_ptr<ProjectContext>(new ProjectContext(
+      kCustomerId, kProjectId,
+      std::shared_ptr<ClientConfig>(client_config.release())));
+}
+
+}  // namespace
+
+// Measures the per-call latency of encoding a Basic RAPPOR value for a metric
+// with kNumCategories categories. We compare constructing a new
+// BasicRapporEncoder for every value, which is what the Encoder used to do,
+// against Encoder::EncodeString(), which reuses a cached BasicRapporEncoder.
+TEST(EncoderPerformanceTest, BasicRapporWithManyCategories) {
+  std::shared_ptr<ProjectContext> project = GetTestProject();
+  ClientSecret client_secret = ClientSecret::GenerateNewSecret();
+  const BasicRapporConfig& basic_rappor_config =
+      project->EncodingConfig(kEncodingConfigId)->basic_rappor();
+
+  auto t_start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < kNumEncodes; i++) {
+    BasicRapporEncoder basic_rappor_encoder(basic_rappor_config,
+                                            client_secret);
+    ValuePart value;
+    value.set_string_value(CategoryName(i % kNumCategories));
+    BasicRapporObservation observation;
+    EXPECT_EQ(rappor::kOK, basic_rappor_encoder.Encode(value, &observation));
+  }
+  auto t_end = std::chrono::high_resolution_clock::now();
+  double uncached_micros =
+      std::chrono::duration<double, std::micro>(t_end - t_start).count() /
+      kNumEncodes;
+
+  Encoder encoder(project, std::move(client_secret));
+  t_start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < kNumEncodes; i++) {
+    Encoder::Result result = encoder.EncodeString(
+        kMetricId, kEncodingConfigId, CategoryName(i % kNumCategories));
+    EXPECT_EQ(Encoder::kOK, result.status);
+  }
+  t_end = std::chrono::high_resolution_clock::now();
+  double cached_micros =
+      std::chrono::duration<double, std::micro>(t_end - t_start).count() /
+      kNumEncodes;
+
+  std::cout << "\n=================================================\n";
+  std::cout << "Basic RAPPOR categories: " << kNumCategories << std::endl;
+  std::cout << "Values encoded: " << kNumEncodes << std::endl;
+  std::cout << "New BasicRapporEncoder per value: " << uncached_micros
+            << " microseconds per value.\n";
+  std::cout << "Encoder::EncodeString() with cached encoder: "
+            << cached_micros << " microseconds per value.\n";
+  std::cout << "\n=================================================\n";
+}
+
+// Measures the per-value latency of encoding bursts of kBurstSize values for
+// the same metric. We compare invoking Encoder::EncodeString() once per value
+// against invoking Encoder::EncodeBatch() once per burst, reusing a single
+// BatchResult.
+TEST(EncoderPerformanceTest, EncodeStringVersusEncodeBatch) {
+  static const int kBurstSize = 100;
+  std::shared_ptr<ProjectContext> project = GetTestProject();
+  Encoder encoder(project, ClientSecret::GenerateNewSecret());
+
+  std::vector<ValuePart> values(kBurstSize);
+  for (int i = 0; i < kBurstSize; i++) {
+    values[i].set_string_value(CategoryName(i % kNumCategories));
+  }
+
+  auto t_start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < kNumEncodes; i++) {
+    Encoder::Result result = encoder.EncodeString(
+        kMetricId, kEncodingConfigId, values[i % kBurstSize].string_value());
+    EXPECT_EQ(Encoder::kOK, result.status);
+  }
+  auto t_end = std::chrono::high_resolution_clock::now();
+  double single_micros =
+      std::chrono::duration<double, std::micro>(t_end - t_start).count() /
+      kNumEncodes;
+
+  Encoder::BatchResult batch;
+  t_start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < kNumEncodes / kBurstSize; i++) {
+    EXPECT_EQ(Encoder::kOK, encoder.EncodeBatch(kMetricId, kEncodingConfigId,
+                                                values, &batch));
+  }
+  t_end = std::chrono::high_resolution_clock::now();
+  double batch_micros =
+      std::chrono::duration<double, std::micro>(t_end - t_start).count() /
+      kNumEncodes;
+
+  std::cout << "\n=================================================\n";
+  std::cout << "Burst size: " << kBurstSize << std::endl;
+  std::cout << "Values encoded: " << kNumEncodes << std::endl;
+  std::cout << "Encoder::EncodeString(): " << single_micros
+            << " microseconds per value.\n";
+  std::cout << "Encoder::EncodeBatch(): " << batch_micros
+            << " microseconds per value.\n";
+  std::cout << "\n=================================================\n";
+}
+
+}  // namespace encoder
+}  // namespace cobalt
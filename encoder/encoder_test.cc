@@ -4,7 +4,10 @@
 
 #include "encoder/encoder.h"
 
+#include <set>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "./gtest.h"
 #include "./logging.h"
@@ -443,6 +446,180 @@ TEST(EncoderTest, EncodeIntBasicRappor) {
   DoEncodeIntTest(125, 2, 4, true, ObservationPart::kBasicRappor);
 }
 
+// Tests that an Encoder may be used repeatedly for the same metric and
+// encodings. The Encoder caches the per-algorithm encoders between calls so
+// this checks that the cached encoders continue to produce valid output.
+TEST(EncoderTest, RepeatedEncodings) {
+  std::shared_ptr<ProjectContext> project = GetTestProject();
+  Encoder encoder(project, ClientSecret::GenerateNewSecret());
+  encoder.set_current_time(kSomeTimestamp);
+
+  uint32_t cohort = 0;
+  std::string forculus_ciphertext;
+  for (int i = 0; i < 3; i++) {
+    // EncodingConfig 1 is Forculus. The ciphertext is a deterministic function
+    // of the value so it should be the same every time.
+    auto result = encoder.EncodeString(1, 1, "some value");
+    CheckSinglePartResult(result, 1, 1, false, ObservationPart::kForculus);
+    const auto& ciphertext =
+        result.observation->parts().at("Part1").forculus().ciphertext();
+    if (i == 0) {
+      forculus_ciphertext = ciphertext;
+    }
+    EXPECT_EQ(forculus_ciphertext, ciphertext);
+
+    // EncodingConfig 2 is String RAPPOR. The cohort is derived from the
+    // client secret so it should be the same every time.
+    result = encoder.EncodeString(1, 2, "some value");
+    CheckSinglePartResult(result, 1, 2, false, ObservationPart::kRappor);
+    uint32_t this_cohort =
+        result.observation->parts().at("Part1").rappor().cohort();
+    if (i == 0) {
+      cohort = this_cohort;
+    }
+    EXPECT_EQ(cohort, this_cohort);
+
+    // EncodingConfig 3 is Basic RAPPOR with string values.
+    result = encoder.EncodeString(1, 3, "Apple");
+    CheckSinglePartResult(result, 1, 3, false, ObservationPart::kBasicRappor);
+
+    // An invalid value should still be rejected by the cached encoder.
+    result = encoder.EncodeString(1, 3, "Not a category");
+    EXPECT_EQ(Encoder::kInvalidArguments, result.status);
+  }
+}
+
+// Checks that |batch| contains |expected_num_observations| valid single-part
+// Observations by checking each of them using CheckSinglePartResult().
+void CheckBatchResult(const Encoder::BatchResult& batch,
+                      int expected_num_observations,
+                      uint32_t expected_metric_id,
+                      uint32_t expected_encoding_config_id, bool expect_utc,
+                      const ObservationPart::ValueCase& expected_encoding) {
+  ASSERT_NE(nullptr, batch.metadata);
+  ASSERT_EQ(expected_num_observations, batch.observations.size());
+  std::set<std::string> random_ids;
+  for (const Observation& observation : batch.observations) {
+    Encoder::Result result;
+    result.status = Encoder::kOK;
+    result.observation.reset(new Observation(observation));
+    result.metadata.reset(new ObservationMetadata(*batch.metadata));
+    CheckSinglePartResult(result, expected_metric_id,
+                          expected_encoding_config_id, expect_utc,
+                          expected_encoding);
+    EXPECT_EQ(8u, observation.random_id().size());
+    random_ids.insert(observation.random_id());
+  }
+  // Each Observation gets its own random_id.
+  EXPECT_EQ(static_cast<size_t>(expected_num_observations), random_ids.size());
+}
+
+// Tests the EncodeBatch() method with valid inputs, reusing a single
+// BatchResult across several batches.
+TEST(EncoderTest, EncodeBatch) {
+  std::shared_ptr<ProjectContext> project = GetTestProject();
+  FakeSystemData system_data;
+  Encoder encoder(project, ClientSecret::GenerateNewSecret(), &system_data);
+  encoder.set_current_time(kSomeTimestamp);
+
+  Encoder::BatchResult batch;
+  std::vector<ValuePart> values(3);
+  values[0].set_string_value("Apple");
+  values[1].set_string_value("Banana");
+  values[2].set_string_value("Apple");
+
+  // Metric 1 has a single string part.
+  // EncodingConfig 1 is Forculus.
+  ASSERT_EQ(Encoder::kOK, encoder.EncodeBatch(1, 1, values, &batch));
+  CheckBatchResult(batch, 3, 1, 1, false, ObservationPart::kForculus);
+  // Forculus is deterministic so equal values yield equal ciphertexts.
+  EXPECT_EQ(
+      batch.observations.Get(0).parts().at("Part1").forculus().ciphertext(),
+      batch.observations.Get(2).parts().at("Part1").forculus().ciphertext());
+
+  // EncodingConfig 2 is String RAPPOR.
+  ASSERT_EQ(Encoder::kOK, encoder.EncodeBatch(1, 2, values, &batch));
+  CheckBatchResult(batch, 3, 1, 2, false, ObservationPart::kRappor);
+
+  // EncodingConfig 3 is Basic RAPPOR with string values.
+  ASSERT_EQ(Encoder::kOK, encoder.EncodeBatch(1, 3, values, &batch));
+  CheckBatchResult(batch, 3, 1, 3, false, ObservationPart::kBasicRappor);
+
+  // A smaller batch replaces the contents of the previous one.
+  values.resize(1);
+  // EncodingConfig 7 is NoOp.
+  ASSERT_EQ(Encoder::kOK, encoder.EncodeBatch(1, 7, values, &batch));
+  CheckBatchResult(batch, 1, 1, 7, false, ObservationPart::kUnencoded);
+  EXPECT_EQ("Apple", batch.observations.Get(0)
+                         .parts()
+                         .at("Part1")
+                         .unencoded()
+                         .unencoded_value()
+                         .string_value());
+
+  // Metric 2 has a single integer part and UTC time_zone_policy.
+  // EncodingConfig 4 is Basic RAPPOR with int values.
+  values.resize(2);
+  values[0].set_int_value(123);
+  values[1].set_int_value(125);
+  ASSERT_EQ(Encoder::kOK, encoder.EncodeBatch(2, 4, values, &batch));
+  CheckBatchResult(batch, 2, 2, 4, true, ObservationPart::kBasicRappor);
+
+  // Metric 11 has a single string part with three system_profile_fields.
+  values.resize(1);
+  values[0].set_string_value("Grapefruit");
+  ASSERT_EQ(Encoder::kOK, encoder.EncodeBatch(11, 1, values, &batch));
+  CheckBatchResult(batch, 1, 11, 1, false, ObservationPart::kForculus);
+  Encoder::Result result;
+  result.status = Encoder::kOK;
+  result.metadata = std::move(batch.metadata);
+  CheckSystemProfileValid(result, project->Metric(11));
+
+  // An empty batch yields no Observations.
+  values.clear();
+  ASSERT_EQ(Encoder::kOK, encoder.EncodeBatch(1, 1, values, &batch));
+  EXPECT_EQ(0, batch.observations.size());
+}
+
+// Tests the EncodeBatch() method with invalid inputs.
+TEST(EncoderTest, EncodeBatchWithErrors) {
+  std::shared_ptr<ProjectContext> project = GetTestProject();
+  Encoder encoder(project, ClientSecret::GenerateNewSecret());
+
+  Encoder::BatchResult batch;
+  std::vector<ValuePart> values(2);
+  values[0].set_string_value("Apple");
+  values[1].set_string_value("Banana");
+
+  // There is no metric 99.
+  EXPECT_EQ(Encoder::kInvalidArguments,
+            encoder.EncodeBatch(99, 1, values, &batch));
+
+  // Metric 4 has two parts.
+  EXPECT_EQ(Encoder::kInvalidArguments,
+            encoder.EncodeBatch(4, 1, values, &batch));
+
+  // There is no encoding_config 99.
+  EXPECT_EQ(Encoder::kInvalidArguments,
+            encoder.EncodeBatch(1, 99, values, &batch));
+
+  // Metric 5 is missing a time_zone_policy.
+  EXPECT_EQ(Encoder::kInvalidConfig, encoder.EncodeBatch(5, 1, values, &batch));
+
+  // EncodingConfig 5 is an invalid Forculus config.
+  EXPECT_EQ(Encoder::kInvalidConfig, encoder.EncodeBatch(1, 5, values, &batch));
+
+  // Basic RAPPOR requires every value to be one of the categories.
+  values[1].set_string_value("San Francisco");
+  EXPECT_EQ(Encoder::kInvalidArguments,
+            encoder.EncodeBatch(1, 3, values, &batch));
+
+  // Metric 1 has a string part so every value must be a string.
+  values[1].set_int_value(42);
+  EXPECT_EQ(Encoder::kInvalidArguments,
+            encoder.EncodeBatch(1, 7, values, &batch));
+}
+
 // Tests the EncodeIndex() method with both valid and invalid inputs.
 TEST(EncoderTest, EncodeIndex) {
   // Metric 6 has a single part of type INDEX.
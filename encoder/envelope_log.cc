@@ -0,0 +1,425 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "encoder/envelope_log.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include "./logging.h"
+#include "util/crypto_util/hash.h"
+
+namespace cobalt {
+namespace encoder {
+
+namespace {
+
+// The file names of segments are this prefix followed by the sequence number
+// of the segment, padded with zeros so that they sort in sequence order.
+const char kSegmentPrefix[] = "segment-";
+
+// The start of every segment.
+struct SegmentHeader {
+  uint64_t magic;
+  uint64_t sequence_number;
+};
+const uint64_t kSegmentMagic = 0x31304c4556454f43;  // "COEVEL01"
+
+// The start of every record. It is followed by |payload_size| bytes of
+// serialized Envelope and then padding to a multiple of 8 bytes.
+struct RecordHeader {
+  // One of the states below. The area after the last record of a segment is
+  // zero, which is not a valid state.
+  uint32_t state;
+  uint32_t payload_size;
+  uint64_t record_id;
+  uint64_t envelope_size;
+  uint64_t checksum;
+};
+const uint32_t kCommitted = 0x54494d43;  // "CMIT"
+const uint32_t kReclaimed = 0x4d4c4352;  // "RCLM"
+
+size_t RecordSize(size_t payload_size) {
+  return (sizeof(RecordHeader) + payload_size + 7) & ~static_cast<size_t>(7);
+}
+
+RecordHeader ReadRecordHeader(const char* data, size_t offset) {
+  RecordHeader header;
+  std::memcpy(&header, data + offset, sizeof(header));
+  return header;
+}
+
+uint64_t Checksum(const void* data, size_t size) {
+  crypto::byte digest[crypto::hash::DIGEST_SIZE];
+  crypto::hash::Hash(static_cast<const crypto::byte*>(data), size, digest);
+  uint64_t checksum;
+  std::memcpy(&checksum, digest, sizeof(checksum));
+  return checksum;
+}
+
+// Writes the |length| bytes at |offset| in the mapping at |data| to disk.
+bool Sync(char* data, size_t offset, size_t length) {
+  static const size_t kPageSize = sysconf(_SC_PAGESIZE);
+  size_t begin = offset & ~(kPageSize - 1);
+  return msync(data + begin, offset + length - begin, MS_SYNC) == 0;
+}
+
+// Overwrites the state of the record at |offset| in the mapping at |data|
+// and writes it to disk.
+bool WriteRecordState(char* data, size_t offset, uint32_t state) {
+  std::memcpy(data + offset + offsetof(RecordHeader, state), &state,
+              sizeof(state));
+  return Sync(data, offset, sizeof(RecordHeader));
+}
+
+std::string SegmentFileName(uint64_t sequence_number) {
+  char file_name[sizeof(kSegmentPrefix) + 20];
+  std::snprintf(file_name, sizeof(file_name), "%s%020llu", kSegmentPrefix,
+                static_cast<unsigned long long>(sequence_number));
+  return file_name;
+}
+
+}  // namespace
+
+struct EnvelopeLog::Segment {
+  uint64_t sequence_number = 0;
+  std::string path;
+  char* data = nullptr;
+  size_t size = 0;
+
+  // The offset at which the next record would be written.
+  size_t end = sizeof(SegmentHeader);
+
+  // The number of records in |records_| that are in this segment and the sum
+  // of their RecordSize()s.
+  size_t num_records = 0;
+  size_t record_bytes = 0;
+};
+
+const size_t EnvelopeLog::kDefaultSegmentSize;
+
+EnvelopeLog::EnvelopeLog(const std::string& directory, size_t segment_size)
+    : directory_(directory), segment_size_(segment_size) {}
+
+EnvelopeLog::~EnvelopeLog() {
+  for (auto& entry : segments_) {
+    munmap(entry.second->data, entry.second->size);
+  }
+}
+
+std::unique_ptr<EnvelopeLog> EnvelopeLog::Open(const std::string& directory,
+                                               size_t segment_size) {
+  DIR* dir = opendir(directory.c_str());
+  if (!dir) {
+    LOG(ERROR) << "EnvelopeLog: Unable to open the directory " << directory;
+    return nullptr;
+  }
+  std::vector<std::string> file_names;
+  while (struct dirent* entry = readdir(dir)) {
+    if (std::strncmp(entry->d_name, kSegmentPrefix,
+                     sizeof(kSegmentPrefix) - 1) == 0) {
+      file_names.push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+
+  // Replay the segments in the order in which they were created.
+  std::sort(file_names.begin(), file_names.end());
+  std::unique_ptr<EnvelopeLog> log(new EnvelopeLog(directory, segment_size));
+  for (const std::string& file_name : file_names) {
+    if (!log->ReplaySegment(file_name)) {
+      return nullptr;
+    }
+  }
+  VLOG(3) << "EnvelopeLog: Replayed " << log->num_records()
+          << " Envelopes from " << log->num_segments() << " segments in "
+          << directory;
+  return log;
+}
+
+bool EnvelopeLog::ReplaySegment(const std::string& file_name) {
+  std::string path = directory_ + "/" + file_name;
+  int fd = open(path.c_str(), O_RDWR);
+  struct stat file_stat;
+  if (fd < 0 || fstat(fd, &file_stat) != 0) {
+    LOG(ERROR) << "EnvelopeLog: Unable to read " << path;
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  size_t size = file_stat.st_size;
+  if (size < sizeof(SegmentHeader)) {
+    // The process crashed while creating the segment.
+    close(fd);
+    unlink(path.c_str());
+    return true;
+  }
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "EnvelopeLog: Unable to map " << path;
+    return false;
+  }
+
+  std::unique_ptr<Segment> segment(new Segment());
+  segment->path = path;
+  segment->data = static_cast<char*>(data);
+  segment->size = size;
+  SegmentHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (header.magic != kSegmentMagic ||
+      segments_.count(header.sequence_number)) {
+    // The process crashed before the header was written.
+    munmap(data, size);
+    unlink(path.c_str());
+    return true;
+  }
+  segment->sequence_number = header.sequence_number;
+  next_sequence_number_ =
+      std::max(next_sequence_number_, header.sequence_number + 1);
+  Segment* raw_segment = segment.get();
+  segments_.emplace(header.sequence_number, std::move(segment));
+
+  // Index the committed records. The first record that is neither committed
+  // nor reclaimed, or that is damaged, ends the segment.
+  size_t offset = sizeof(SegmentHeader);
+  while (size - offset >= sizeof(RecordHeader)) {
+    RecordHeader record = ReadRecordHeader(raw_segment->data, offset);
+    size_t record_size = RecordSize(record.payload_size);
+    if ((record.state != kCommitted && record.state != kReclaimed) ||
+        record_size > size - offset) {
+      break;
+    }
+    if (record.state == kCommitted) {
+      const char* payload = raw_segment->data + offset + sizeof(RecordHeader);
+      if (Checksum(payload, record.payload_size) != record.checksum) {
+        LOG(ERROR) << "EnvelopeLog: Damaged record in " << path;
+        break;
+      }
+      if (records_.count(record.record_id)) {
+        // Compact() copied the record but the process crashed before the
+        // original was deleted. Keep the original.
+        WriteRecordState(raw_segment->data, offset, kReclaimed);
+      } else {
+        Index(record.record_id, raw_segment, offset, record.payload_size,
+              record.envelope_size);
+      }
+    }
+    next_record_id_ = std::max(next_record_id_, record.record_id + 1);
+    offset += record_size;
+  }
+  raw_segment->end = offset;
+  if (raw_segment->num_records == 0) {
+    DeleteSegment(raw_segment);
+  }
+  return true;
+}
+
+bool EnvelopeLog::Append(const Envelope& envelope, size_t envelope_size,
+                         uint64_t* record_id) {
+  std::string serialized_envelope;
+  envelope.SerializeToString(&serialized_envelope);
+  if (!WriteRecord(next_record_id_, serialized_envelope.data(),
+                   serialized_envelope.size(), envelope_size)) {
+    return false;
+  }
+  *record_id = next_record_id_++;
+  return true;
+}
+
+std::vector<EnvelopeLog::RecordInfo> EnvelopeLog::Records() const {
+  std::vector<RecordInfo> records;
+  records.reserve(records_.size());
+  for (const auto& entry : records_) {
+    records.push_back({entry.first, entry.second.envelope_size});
+  }
+  return records;
+}
+
+bool EnvelopeLog::Read(uint64_t record_id, Envelope* envelope) const {
+  auto iter = records_.find(record_id);
+  if (iter == records_.end()) {
+    return false;
+  }
+  const Location& location = iter->second;
+  RecordHeader header =
+      ReadRecordHeader(location.segment->data, location.offset);
+  return envelope->ParseFromArray(
+      location.segment->data + location.offset + sizeof(RecordHeader),
+      header.payload_size);
+}
+
+bool EnvelopeLog::Reclaim(uint64_t record_id) {
+  auto iter = records_.find(record_id);
+  if (iter == records_.end()) {
+    return false;
+  }
+  Segment* segment = iter->second.segment;
+  if (!WriteRecordState(segment->data, iter->second.offset, kReclaimed)) {
+    // The Envelope will be replayed, and so sent again, if the process
+    // restarts before the segment is deleted.
+    VLOG(1) << "EnvelopeLog: Unable to sync " << segment->path;
+  }
+  Forget(iter);
+  if (segment->num_records == 0 && segment != current_segment_) {
+    DeleteSegment(segment);
+  }
+  return true;
+}
+
+void EnvelopeLog::Compact() {
+  std::vector<Segment*> sparse_segments;
+  for (const auto& entry : segments_) {
+    Segment* segment = entry.second.get();
+    if (segment != current_segment_ &&
+        2 * segment->record_bytes < segment->size - sizeof(SegmentHeader)) {
+      sparse_segments.push_back(segment);
+    }
+  }
+
+  for (Segment* segment : sparse_segments) {
+    std::vector<uint64_t> record_ids;
+    for (const auto& entry : records_) {
+      if (entry.second.segment == segment) {
+        record_ids.push_back(entry.first);
+      }
+    }
+    for (uint64_t record_id : record_ids) {
+      auto iter = records_.find(record_id);
+      Location location = iter->second;
+      RecordHeader header = ReadRecordHeader(segment->data, location.offset);
+      Forget(iter);
+      if (!WriteRecord(record_id,
+                       segment->data + location.offset + sizeof(RecordHeader),
+                       header.payload_size, location.envelope_size)) {
+        Index(record_id, segment, location.offset, header.payload_size,
+              location.envelope_size);
+        return;
+      }
+    }
+    DeleteSegment(segment);
+  }
+}
+
+bool EnvelopeLog::WriteRecord(uint64_t record_id, const void* payload,
+                              size_t payload_size, size_t envelope_size) {
+  if (payload_size > UINT32_MAX) {
+    return false;
+  }
+  size_t record_size = RecordSize(payload_size);
+  if (!current_segment_ ||
+      current_segment_->size - current_segment_->end < record_size) {
+    if (!StartSegment(sizeof(SegmentHeader) + record_size)) {
+      return false;
+    }
+  }
+  Segment* segment = current_segment_;
+  size_t offset = segment->end;
+
+  // Write the record without a state, then commit it.
+  RecordHeader header;
+  header.state = 0;
+  header.payload_size = payload_size;
+  header.record_id = record_id;
+  header.envelope_size = envelope_size;
+  header.checksum = Checksum(payload, payload_size);
+  std::memcpy(segment->data + offset, &header, sizeof(header));
+  std::memcpy(segment->data + offset + sizeof(header), payload, payload_size);
+  if (!Sync(segment->data, offset, record_size) ||
+      !WriteRecordState(segment->data, offset, kCommitted)) {
+    // Replaying stops at an uncommitted record, so no more records may be
+    // appended to this segment.
+    LOG(ERROR) << "EnvelopeLog: Unable to sync " << segment->path;
+    current_segment_ = nullptr;
+    if (segment->num_records == 0) {
+      DeleteSegment(segment);
+    }
+    return false;
+  }
+  segment->end = offset + record_size;
+  Index(record_id, segment, offset, payload_size, envelope_size);
+  return true;
+}
+
+bool EnvelopeLog::StartSegment(size_t min_size) {
+  if (current_segment_ && current_segment_->num_records == 0) {
+    DeleteSegment(current_segment_);
+  }
+  current_segment_ = nullptr;
+
+  size_t size = std::max(segment_size_, min_size);
+  uint64_t sequence_number = next_sequence_number_++;
+  std::string path = directory_ + "/" + SegmentFileName(sequence_number);
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    LOG(ERROR) << "EnvelopeLog: Unable to create " << path;
+    return false;
+  }
+  void* data = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "EnvelopeLog: Unable to map " << path;
+    unlink(path.c_str());
+    return false;
+  }
+
+  std::unique_ptr<Segment> segment(new Segment());
+  segment->sequence_number = sequence_number;
+  segment->path = path;
+  segment->data = static_cast<char*>(data);
+  segment->size = size;
+  SegmentHeader header = {kSegmentMagic, sequence_number};
+  std::memcpy(segment->data, &header, sizeof(header));
+  if (!Sync(segment->data, 0, sizeof(header))) {
+    LOG(ERROR) << "EnvelopeLog: Unable to sync " << path;
+    munmap(data, size);
+    unlink(path.c_str());
+    return false;
+  }
+  current_segment_ = segment.get();
+  segments_.emplace(sequence_number, std::move(segment));
+  return true;
+}
+
+void EnvelopeLog::Index(uint64_t record_id, Segment* segment, size_t offset,
+                        size_t payload_size, size_t envelope_size) {
+  records_[record_id] = {segment, offset, envelope_size};
+  segment->num_records++;
+  segment->record_bytes += RecordSize(payload_size);
+  total_envelope_size_ += envelope_size;
+}
+
+void EnvelopeLog::Forget(std::map<uint64_t, Location>::iterator record_iter) {
+  const Location& location = record_iter->second;
+  RecordHeader header =
+      ReadRecordHeader(location.segment->data, location.offset);
+  location.segment->num_records--;
+  location.segment->record_bytes -= RecordSize(header.payload_size);
+  total_envelope_size_ -= location.envelope_size;
+  records_.erase(record_iter);
+}
+
+void EnvelopeLog::DeleteSegment(Segment* segment) {
+  if (segment == current_segment_) {
+    current_segment_ = nullptr;
+  }
+  munmap(segment->data, segment->size);
+  unlink(segment->path.c_str());
+  segments_.erase(segment->sequence_number);
+}
+
+}  // namespace encoder
+}  // namespace cobalt
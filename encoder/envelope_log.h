@@ -0,0 +1,150 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_ENCODER_ENVELOPE_LOG_H_
+#define COBALT_ENCODER_ENVELOPE_LOG_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "./encrypted_message.pb.h"
+#include "./observation.pb.h"
+
+namespace cobalt {
+namespace encoder {
+
+// An EnvelopeLog is a persistent queue of Envelopes. ShippingManager uses one
+// to keep the Envelopes that it has not yet sent to the Shuffler so that they
+// survive both long periods in which the Shuffler is unreachable and
+// restarts of the process. The Observations in the Envelopes have already
+// been encrypted to the Analyzer.
+//
+// The log is a sequence of segment files in a directory. A segment is a file
+// of fixed size that is memory-mapped and appended to until it is full, after
+// which a new segment is started. Each Envelope is a record consisting of a
+// header and the serialized Envelope. A record is committed by first writing
+// and syncing the header and the Envelope and then writing and syncing a
+// commit marker in the header, so that a record that was being written when
+// the process crashed is never replayed. Appends are never made to a segment
+// that was left by an earlier process.
+//
+// Once an Envelope has been sent its record is reclaimed by overwriting its
+// commit marker. A segment all of whose records have been reclaimed is
+// deleted. Compact() copies the remaining records of segments that are
+// mostly reclaimed into the current segment and deletes them.
+//
+// This class is not thread-safe.
+class EnvelopeLog {
+ public:
+  static const size_t kDefaultSegmentSize = 1 << 20;
+
+  // Opens the log in |directory|, which must exist, and replays the segments
+  // left there by an earlier EnvelopeLog. New segments are created with
+  // |segment_size| bytes, or more if necessary to hold a single large
+  // record. Returns NULL if the directory or one of the segments in it can
+  // not be read.
+  static std::unique_ptr<EnvelopeLog> Open(
+      const std::string& directory, size_t segment_size = kDefaultSegmentSize);
+
+  ~EnvelopeLog();
+
+  // Information about a record in the log.
+  struct RecordInfo {
+    uint64_t record_id;
+
+    // The value of EnvelopeMaker::size() for the Envelope.
+    size_t envelope_size;
+  };
+
+  // Appends |envelope|, the Envelope of an EnvelopeMaker whose size() is
+  // |envelope_size|, to the log and writes its id to |*record_id|. Returns
+  // true once the record has been committed, or false if it could not be
+  // written.
+  bool Append(const Envelope& envelope, size_t envelope_size,
+              uint64_t* record_id);
+
+  // Returns the records that have not been reclaimed, in the order in which
+  // they were appended.
+  std::vector<RecordInfo> Records() const;
+
+  // Reads the Envelope in the record |record_id| into |*envelope|. Returns
+  // false if there is no such record or if the Envelope can not be parsed.
+  bool Read(uint64_t record_id, Envelope* envelope) const;
+
+  // Reclaims the record |record_id|, deleting its segment if this was its
+  // last record. Returns false if there is no such record.
+  bool Reclaim(uint64_t record_id);
+
+  // Copies the records of each segment, other than the current one, that is
+  // less than half full of records that have not been reclaimed into the
+  // current segment and then deletes the segment.
+  void Compact();
+
+  // The number of records that have not been reclaimed and the sum of their
+  // envelope sizes.
+  size_t num_records() const { return records_.size(); }
+  size_t total_envelope_size() const { return total_envelope_size_; }
+
+  size_t num_segments() const { return segments_.size(); }
+
+ private:
+  struct Segment;
+
+  // The location of a record that has not been reclaimed.
+  struct Location {
+    Segment* segment;
+    size_t offset;
+    size_t envelope_size;
+  };
+
+  EnvelopeLog(const std::string& directory, size_t segment_size);
+
+  // Maps the segment file |file_name| and indexes its committed records.
+  // Segments that are invalid or have no committed records are deleted.
+  // Returns false if the file can not be read.
+  bool ReplaySegment(const std::string& file_name);
+
+  // Writes and commits a record with the given id containing |payload_size|
+  // bytes at |payload|, starting a new segment if necessary.
+  bool WriteRecord(uint64_t record_id, const void* payload,
+                   size_t payload_size, size_t envelope_size);
+
+  // Creates, maps and makes current a new segment of at least |min_size|
+  // bytes.
+  bool StartSegment(size_t min_size);
+
+  // Adds the record at |offset| in |segment| to |records_| and to the
+  // segment's counts.
+  void Index(uint64_t record_id, Segment* segment, size_t offset,
+             size_t payload_size, size_t envelope_size);
+
+  // Removes the record at |record_iter| from |records_| and from its
+  // segment's counts, without modifying the segment.
+  void Forget(std::map<uint64_t, Location>::iterator record_iter);
+
+  // Unmaps and deletes |segment|, which must have no records in |records_|.
+  void DeleteSegment(Segment* segment);
+
+  const std::string directory_;
+  const size_t segment_size_;
+
+  // The segments, keyed by sequence number, and the segment that is being
+  // appended to, if any.
+  std::map<uint64_t, std::unique_ptr<Segment>> segments_;
+  Segment* current_segment_ = nullptr;
+  uint64_t next_sequence_number_ = 0;
+
+  // The records that have not been reclaimed, keyed by record id. Record ids
+  // increase in the order of appending, and are preserved by Compact().
+  std::map<uint64_t, Location> records_;
+  uint64_t next_record_id_ = 0;
+  size_t total_envelope_size_ = 0;
+};
+
+}  // namespace encoder
+}  // namespace cobalt
+
+#endif  // COBALT_ENCODER_ENVELOPE_LOG_H_
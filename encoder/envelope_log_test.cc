@@ -0,0 +1,263 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "encoder/envelope_log.h"
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "./gtest.h"
+
+namespace cobalt {
+namespace encoder {
+
+namespace {
+
+// The sizes of the headers in the segment files. These must match
+// envelope_log.cc.
+const size_t kSegmentHeaderSize = 16;
+const size_t kRecordHeaderSize = 32;
+
+// Returns an Envelope with one batch for |metric_id| containing one
+// EncryptedMessage whose ciphertext is |ciphertext|.
+Envelope MakeEnvelope(uint32_t metric_id, const std::string& ciphertext) {
+  Envelope envelope;
+  ObservationBatch* batch = envelope.add_batch();
+  batch->mutable_meta_data()->set_metric_id(metric_id);
+  batch->add_encrypted_observation()->set_ciphertext(ciphertext);
+  return envelope;
+}
+
+// Checks that the record |record_id| in |log| contains
+// MakeEnvelope(metric_id, ciphertext).
+void CheckRecord(const EnvelopeLog& log, uint64_t record_id,
+                 uint32_t metric_id, const std::string& ciphertext) {
+  Envelope envelope;
+  ASSERT_TRUE(log.Read(record_id, &envelope));
+  ASSERT_EQ(1, envelope.batch_size());
+  EXPECT_EQ(metric_id, envelope.batch(0).meta_data().metric_id());
+  ASSERT_EQ(1, envelope.batch(0).encrypted_observation_size());
+  EXPECT_EQ(ciphertext,
+            envelope.batch(0).encrypted_observation(0).ciphertext());
+}
+
+}  // namespace
+
+class EnvelopeLogTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char dir_template[] = "/tmp/envelope_log_test_XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(dir_template));
+    directory_ = dir_template;
+  }
+
+  void TearDown() override {
+    for (const std::string& file_name : FileNames()) {
+      std::remove((directory_ + "/" + file_name).c_str());
+    }
+    rmdir(directory_.c_str());
+  }
+
+  // Returns the names of the files in directory_, in sorted order.
+  std::vector<std::string> FileNames() {
+    std::vector<std::string> file_names;
+    DIR* dir = opendir(directory_.c_str());
+    while (struct dirent* entry = readdir(dir)) {
+      if (entry->d_name[0] != '.') {
+        file_names.push_back(entry->d_name);
+      }
+    }
+    closedir(dir);
+    std::sort(file_names.begin(), file_names.end());
+    return file_names;
+  }
+
+  // Overwrites |data| at |offset| in the file |file_name|.
+  void Overwrite(const std::string& file_name, size_t offset,
+                 const std::string& data) {
+    std::fstream file(directory_ + "/" + file_name,
+                      std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(offset);
+    file.write(data.data(), data.size());
+  }
+
+  std::string directory_;
+};
+
+// Tests appending, reading and reclaiming records.
+TEST_F(EnvelopeLogTest, AppendReadReclaim) {
+  auto log = EnvelopeLog::Open(directory_);
+  ASSERT_NE(nullptr, log);
+  EXPECT_EQ(0u, log->num_records());
+  EXPECT_EQ(0u, log->num_segments());
+
+  uint64_t record_ids[3];
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(log->Append(MakeEnvelope(i, "ciphertext" + std::to_string(i)),
+                            10 * (i + 1), &record_ids[i]));
+  }
+  EXPECT_LT(record_ids[0], record_ids[1]);
+  EXPECT_LT(record_ids[1], record_ids[2]);
+  EXPECT_EQ(3u, log->num_records());
+  EXPECT_EQ(60u, log->total_envelope_size());
+  EXPECT_EQ(1u, log->num_segments());
+
+  auto records = log->Records();
+  ASSERT_EQ(3u, records.size());
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(record_ids[i], records[i].record_id);
+    EXPECT_EQ(10u * (i + 1), records[i].envelope_size);
+    CheckRecord(*log, record_ids[i], i, "ciphertext" + std::to_string(i));
+  }
+
+  EXPECT_TRUE(log->Reclaim(record_ids[1]));
+  EXPECT_FALSE(log->Reclaim(record_ids[1]));
+  Envelope envelope;
+  EXPECT_FALSE(log->Read(record_ids[1], &envelope));
+  EXPECT_EQ(2u, log->num_records());
+  EXPECT_EQ(40u, log->total_envelope_size());
+
+  // The current segment is kept even when all of its records are reclaimed.
+  EXPECT_TRUE(log->Reclaim(record_ids[0]));
+  EXPECT_TRUE(log->Reclaim(record_ids[2]));
+  EXPECT_EQ(0u, log->num_records());
+  EXPECT_EQ(0u, log->total_envelope_size());
+  EXPECT_EQ(1u, log->num_segments());
+}
+
+// Tests that the records that have not been reclaimed are replayed by a new
+// EnvelopeLog, which continues numbering records after them.
+TEST_F(EnvelopeLogTest, Replay) {
+  uint64_t record_ids[3];
+  {
+    auto log = EnvelopeLog::Open(directory_);
+    ASSERT_NE(nullptr, log);
+    for (int i = 0; i < 3; i++) {
+      ASSERT_TRUE(log->Append(MakeEnvelope(i, "ciphertext" + std::to_string(i)),
+                              10, &record_ids[i]));
+    }
+    EXPECT_TRUE(log->Reclaim(record_ids[0]));
+  }
+
+  auto log = EnvelopeLog::Open(directory_);
+  ASSERT_NE(nullptr, log);
+  EXPECT_EQ(2u, log->num_records());
+  EXPECT_EQ(20u, log->total_envelope_size());
+  auto records = log->Records();
+  ASSERT_EQ(2u, records.size());
+  EXPECT_EQ(record_ids[1], records[0].record_id);
+  EXPECT_EQ(record_ids[2], records[1].record_id);
+  CheckRecord(*log, record_ids[1], 1, "ciphertext1");
+  CheckRecord(*log, record_ids[2], 2, "ciphertext2");
+
+  uint64_t record_id;
+  ASSERT_TRUE(log->Append(MakeEnvelope(3, "ciphertext3"), 10, &record_id));
+  EXPECT_GT(record_id, record_ids[2]);
+  EXPECT_EQ(2u, log->num_segments());
+
+  // Once all of its records are reclaimed the old segment is deleted.
+  EXPECT_TRUE(log->Reclaim(record_ids[1]));
+  EXPECT_TRUE(log->Reclaim(record_ids[2]));
+  EXPECT_EQ(1u, log->num_segments());
+  EXPECT_EQ(1u, FileNames().size());
+}
+
+// Tests that replaying stops at a record that was not committed or that is
+// damaged, and that a segment without committed records is deleted.
+TEST_F(EnvelopeLogTest, TornRecords) {
+  const std::string kCiphertext = "ciphertext";
+  size_t payload_size = MakeEnvelope(0, kCiphertext).ByteSizeLong();
+  size_t record_size = (kRecordHeaderSize + payload_size + 7) / 8 * 8;
+  {
+    auto log = EnvelopeLog::Open(directory_);
+    ASSERT_NE(nullptr, log);
+    uint64_t record_id;
+    for (int i = 0; i < 4; i++) {
+      ASSERT_TRUE(log->Append(MakeEnvelope(0, kCiphertext), 10, &record_id));
+    }
+  }
+  ASSERT_EQ(1u, FileNames().size());
+  std::string file_name = FileNames()[0];
+
+  // Damage the payload of the fourth record.
+  Overwrite(file_name,
+            kSegmentHeaderSize + 3 * record_size + kRecordHeaderSize, "X");
+  {
+    auto log = EnvelopeLog::Open(directory_);
+    ASSERT_NE(nullptr, log);
+    EXPECT_EQ(3u, log->num_records());
+  }
+
+  // Clear the commit marker of the second record. The third record is
+  // ignored too because replaying stops at the second.
+  Overwrite(file_name, kSegmentHeaderSize + record_size, std::string(4, '\0'));
+  {
+    auto log = EnvelopeLog::Open(directory_);
+    ASSERT_NE(nullptr, log);
+    EXPECT_EQ(1u, log->num_records());
+  }
+
+  Overwrite(file_name, kSegmentHeaderSize, std::string(4, '\0'));
+  {
+    auto log = EnvelopeLog::Open(directory_);
+    ASSERT_NE(nullptr, log);
+    EXPECT_EQ(0u, log->num_records());
+    EXPECT_EQ(0u, log->num_segments());
+  }
+  EXPECT_TRUE(FileNames().empty());
+}
+
+// Tests that Compact() moves the records of sparse segments into the current
+// segment, preserving their ids, and deletes the sparse segments.
+TEST_F(EnvelopeLogTest, Compact) {
+  const size_t kSegmentSize = 1024;
+  std::vector<uint64_t> record_ids;
+  {
+    auto log = EnvelopeLog::Open(directory_, kSegmentSize);
+    ASSERT_NE(nullptr, log);
+    for (int i = 0; i < 40; i++) {
+      uint64_t record_id;
+      ASSERT_TRUE(log->Append(MakeEnvelope(i, "ciphertext" + std::to_string(i)),
+                              10, &record_id));
+      record_ids.push_back(record_id);
+    }
+    size_t num_segments = log->num_segments();
+    EXPECT_LT(2u, num_segments);
+
+    // Reclaim all but every tenth record.
+    for (int i = 0; i < 40; i++) {
+      if (i % 10 != 0) {
+        EXPECT_TRUE(log->Reclaim(record_ids[i]));
+      }
+    }
+    EXPECT_EQ(4u, log->num_records());
+    log->Compact();
+    EXPECT_EQ(4u, log->num_records());
+    EXPECT_EQ(40u, log->total_envelope_size());
+    EXPECT_EQ(1u, log->num_segments());
+    EXPECT_EQ(1u, FileNames().size());
+    for (int i = 0; i < 40; i += 10) {
+      CheckRecord(*log, record_ids[i], i, "ciphertext" + std::to_string(i));
+    }
+  }
+
+  auto log = EnvelopeLog::Open(directory_, kSegmentSize);
+  ASSERT_NE(nullptr, log);
+  auto records = log->Records();
+  ASSERT_EQ(4u, records.size());
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(record_ids[10 * i], records[i].record_id);
+    CheckRecord(*log, record_ids[10 * i], 10 * i,
+                "ciphertext" + std::to_string(10 * i));
+  }
+}
+
+}  // namespace encoder
+}  // namespace cobalt
@@ -15,6 +15,7 @@
 #include "encoder/envelope_maker.h"
 
 #include <utility>
+#include <vector>
 
 #include "./logging.h"
 
@@ -32,39 +33,109 @@ EnvelopeMaker::EnvelopeMaker(const std::string& analyzer_public_key_pem,
       max_bytes_each_observation_(max_bytes_each_observation),
       max_num_bytes_(max_num_bytes) {}
 
+EnvelopeMaker::AddStatus EnvelopeMaker::EncryptObservation(
+    const Observation& observation, EncryptedMessage* encrypted_message,
+    size_t* obs_size) {
+  if (!encrypt_to_analyzer_.Encrypt(observation, encrypted_message)) {
+    VLOG(1)
+        << "ERROR: Encryption of Observations failed! Observation not added "
+           "to batch.";
+    return kEncryptionFailed;
+  }
+  *obs_size = ObservationSize(*encrypted_message);
+  if (*obs_size > max_bytes_each_observation_) {
+    VLOG(1) << "WARNING: An Observation was rejected by "
+               "EnvelopeMaker::AddObservation() because it was too big: "
+            << *obs_size;
+    return kObservationTooBig;
+  }
+  return kOk;
+}
+
+size_t EnvelopeMaker::ObservationSize(
+    const EncryptedMessage& encrypted_message) {
+  // "+1" below is for the |scheme| field of EncryptedMessage.
+  return encrypted_message.ciphertext().size() +
+         encrypted_message.public_key_fingerprint().size() + 1;
+}
+
 EnvelopeMaker::AddStatus EnvelopeMaker::AddObservation(
     const Observation& observation,
     std::unique_ptr<ObservationMetadata> metadata) {
   EncryptedMessage encrypted_message;
-  if (encrypt_to_analyzer_.Encrypt(observation, &encrypted_message)) {
-    // "+1" below is for the |scheme| field of EncryptedMessage.
-    size_t obs_size = encrypted_message.ciphertext().size() +
-                      encrypted_message.public_key_fingerprint().size() + 1;
-    if (obs_size > max_bytes_each_observation_) {
-      VLOG(1) << "WARNING: An Observation was rejected by "
-                 "EnvelopeMaker::AddObservation() because it was too big: "
-              << obs_size;
-      return kObservationTooBig;
-    }
+  size_t obs_size;
+  AddStatus status =
+      EncryptObservation(observation, &encrypted_message, &obs_size);
+  if (status != kOk) {
+    return status;
+  }
+
+  size_t new_num_bytes = num_bytes_ + obs_size;
+  if (new_num_bytes > max_num_bytes_) {
+    VLOG(4) << "Envelope full.";
+    return kEnvelopeFull;
+  }
 
-    size_t new_num_bytes = num_bytes_ + obs_size;
-    if (new_num_bytes > max_num_bytes_) {
-      VLOG(4) << "Envelope full.";
-      return kEnvelopeFull;
+  num_bytes_ = new_num_bytes;
+  // Put the encrypted observation into the appropriate ObservationBatch.
+  GetBatch(std::move(metadata))
+      ->add_encrypted_observation()
+      ->Swap(&encrypted_message);
+  return kOk;
+}
+
+EnvelopeMaker::AddStatus EnvelopeMaker::AddObservationBatch(
+    const google::protobuf::RepeatedPtrField<Observation>& observations,
+    std::unique_ptr<ObservationMetadata> metadata) {
+  if (observations.empty()) {
+    return kOk;
+  }
+  // Encrypt all of the Observations before adding any of them so that we
+  // can add either all or none.
+  std::vector<EncryptedMessage> encrypted_messages(observations.size());
+  size_t batch_num_bytes = 0;
+  for (int i = 0; i < observations.size(); i++) {
+    size_t obs_size;
+    AddStatus status =
+        EncryptObservation(observations.Get(i), &encrypted_messages[i],
+                           &obs_size);
+    if (status != kOk) {
+      return status;
     }
+    batch_num_bytes += obs_size;
+  }
+  return AddEncryptedObservations(&encrypted_messages, batch_num_bytes,
+                                  std::move(metadata));
+}
 
-    num_bytes_ = new_num_bytes;
-    // Put the encrypted observation into the appropriate ObservationBatch.
-    GetBatch(std::move(metadata))
-        ->add_encrypted_observation()
-        ->Swap(&encrypted_message);
+EnvelopeMaker::AddStatus EnvelopeMaker::AddEncryptedObservations(
+    std::vector<EncryptedMessage>* encrypted_observations, size_t num_bytes,
+    std::unique_ptr<ObservationMetadata> metadata) {
+  if (encrypted_observations->empty()) {
     return kOk;
-  } else {
-    VLOG(1)
-        << "ERROR: Encryption of Observations failed! Observation not added "
-           "to batch.";
-    return kEncryptionFailed;
   }
+  if (num_bytes > max_num_bytes_) {
+    VLOG(1) << "WARNING: A batch of " << encrypted_observations->size()
+            << " Observations was rejected by EnvelopeMaker because it was "
+               "too big: "
+            << num_bytes;
+    return kObservationTooBig;
+  }
+  size_t new_num_bytes = num_bytes_ + num_bytes;
+  if (new_num_bytes > max_num_bytes_) {
+    VLOG(4) << "Envelope full.";
+    return kEnvelopeFull;
+  }
+
+  num_bytes_ = new_num_bytes;
+  auto* batch_observations =
+      GetBatch(std::move(metadata))->mutable_encrypted_observation();
+  batch_observations->Reserve(batch_observations->size() +
+                              encrypted_observations->size());
+  for (auto& encrypted_message : *encrypted_observations) {
+    batch_observations->Add()->Swap(&encrypted_message);
+  }
+  return kOk;
 }
 
 ObservationBatch* EnvelopeMaker::GetBatch(
@@ -123,5 +194,24 @@ void EnvelopeMaker::MergeOutOf(EnvelopeMaker* other) {
   other->Clear();
 }
 
+void EnvelopeMaker::MergeOutOf(Envelope* envelope, size_t num_bytes) {
+  CHECK(envelope);
+  for (auto& other_batch : *envelope->mutable_batch()) {
+    std::unique_ptr<ObservationMetadata> metadata(
+        other_batch.release_meta_data());
+    if (!metadata) {
+      metadata.reset(new ObservationMetadata());
+    }
+    auto* other_messages = other_batch.mutable_encrypted_observation();
+    auto* this_messages =
+        GetBatch(std::move(metadata))->mutable_encrypted_observation();
+    while (!other_messages->empty()) {
+      this_messages->AddAllocated(other_messages->ReleaseLast());
+    }
+  }
+  num_bytes_ += num_bytes;
+  envelope->Clear();
+}
+
 }  // namespace encoder
 }  // namespace cobalt
@@ -18,6 +18,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "./encrypted_message.pb.h"
 #include "./observation.pb.h"
@@ -104,6 +105,35 @@ class EnvelopeMaker {
   AddStatus AddObservation(const Observation& observation,
                            std::unique_ptr<ObservationMetadata> metadata);
 
+  // Adds all of the |observations|, which share the same |metadata|. This is
+  // equivalent to invoking AddObservation() once for each Observation except
+  // that the ObservationBatch for |metadata| is looked up only once, and that
+  // either all of the Observations are added or none of them are. Returns
+  // kObservationTooBig if any single Observation is too big, or if the sum of
+  // the sizes of the Observations is greater than |max_num_bytes| so that
+  // they could never be added together. Returns kEnvelopeFull if the
+  // Observations would fit into an empty Envelope but not into this one.
+  AddStatus AddObservationBatch(
+      const google::protobuf::RepeatedPtrField<Observation>& observations,
+      std::unique_ptr<ObservationMetadata> metadata);
+
+  // Adds Observations that have already been encrypted to the Analyzer, all
+  // of which share the same |metadata|. |num_bytes| is the amount by which
+  // they increase size(). It is usually the sum of the ObservationSize()s of
+  // |*encrypted_observations|, but may be smaller if the caller accounts for
+  // the compression of the Envelope. The elements of
+  // |*encrypted_observations| are left empty on success. The return value is
+  // as for AddObservationBatch(). This allows the expensive encryption to be
+  // performed by the caller, outside of any lock that protects this
+  // EnvelopeMaker.
+  AddStatus AddEncryptedObservations(
+      std::vector<EncryptedMessage>* encrypted_observations, size_t num_bytes,
+      std::unique_ptr<ObservationMetadata> metadata);
+
+  // Returns the size that the Observation encrypted into |encrypted_message|
+  // contributes to the size() of an Envelope.
+  static size_t ObservationSize(const EncryptedMessage& encrypted_message);
+
   // Populates |*encrypted_message| with the encryption of the current
   // value of the Envelope. Returns true for success or false for failure.
   bool MakeEncryptedEnvelope(EncryptedMessage* encrypted_message) const;
@@ -125,6 +155,11 @@ class EnvelopeMaker {
   // Leaves |*other| empty.
   void MergeOutOf(EnvelopeMaker* other);
 
+  // Moves the Observations out of |*envelope|, which was produced by an
+  // EnvelopeMaker whose size() was |num_bytes|, and merges them into |*this|.
+  // Leaves |*envelope| empty.
+  void MergeOutOf(Envelope* envelope, size_t num_bytes);
+
   // Returns an approximation to the size of the Envelope in bytes. This value
   // is the sum of the sizes of the serialized, encrypted Observations contained
   // in the Envelope. But the size of the EncryptedMessage produced by the
@@ -140,6 +175,13 @@ class EnvelopeMaker {
   // new ObservationBatch is created.
   ObservationBatch* GetBatch(std::unique_ptr<ObservationMetadata> metadata);
 
+  // Encrypts |observation| into |*encrypted_message| and checks it against
+  // max_bytes_each_observation_. On success writes the size that the
+  // Observation will contribute to the Envelope into |*obs_size|.
+  AddStatus EncryptObservation(const Observation& observation,
+                               EncryptedMessage* encrypted_message,
+                               size_t* obs_size);
+
   Envelope envelope_;
   util::EncryptedMessageMaker encrypt_to_analyzer_;
   util::EncryptedMessageMaker encrypt_to_shuffler_;
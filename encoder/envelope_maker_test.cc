@@ -5,6 +5,7 @@
 #include "encoder/envelope_maker.h"
 
 #include <utility>
+#include <vector>
 
 #include "./gtest.h"
 #include "./logging.h"
@@ -499,5 +500,73 @@ TEST_F(EnvelopeMakerTest, EnvelopeFull) {
       expected_observation_num_bytes, EnvelopeMaker::kEnvelopeFull);
 }
 
+// Tests AddObservationBatch() with the output of Encoder::EncodeBatch().
+TEST_F(EnvelopeMakerTest, AddObservationBatch) {
+  static const uint32_t kEncodingConfigId = 3;  // NoOp encoding.
+
+  // Set max_bytes_each_observation = 100, max_num_bytes=1800.
+  ResetEnvelopeMaker(100, 1800);
+
+  // Build 10 values of length 20 bytes.
+  std::vector<ValuePart> values(10);
+  for (auto& value : values) {
+    value.set_string_value(std::string(20, 'x'));
+  }
+  Encoder::BatchResult batch;
+
+  // Add the same batch twice to metric 1 and once to metric 2.
+  for (uint32_t metric_id : {1, 1, 2}) {
+    ASSERT_EQ(Encoder::kOK,
+              encoder_.EncodeBatch(metric_id, kEncodingConfigId, values,
+                                   &batch));
+    EXPECT_EQ(EnvelopeMaker::kOk,
+              envelope_maker_->AddObservationBatch(batch.observations,
+                                                   std::move(batch.metadata)));
+  }
+  EXPECT_EQ(1500u, envelope_maker_->size());
+
+  // The Observations for each metric were added to a single batch.
+  ASSERT_EQ(2, envelope_maker_->envelope().batch_size());
+  EXPECT_EQ(1u, envelope_maker_->envelope().batch(0).meta_data().metric_id());
+  EXPECT_EQ(20,
+            envelope_maker_->envelope().batch(0).encrypted_observation_size());
+  EXPECT_EQ(2u, envelope_maker_->envelope().batch(1).meta_data().metric_id());
+  EXPECT_EQ(10,
+            envelope_maker_->envelope().batch(1).encrypted_observation_size());
+
+  // Another 10 Observations would fit into an empty Envelope, but not into
+  // this one. None of them should be added.
+  ASSERT_EQ(Encoder::kOK,
+            encoder_.EncodeBatch(3, kEncodingConfigId, values, &batch));
+  EXPECT_EQ(EnvelopeMaker::kEnvelopeFull,
+            envelope_maker_->AddObservationBatch(batch.observations,
+                                                 std::move(batch.metadata)));
+  EXPECT_EQ(1500u, envelope_maker_->size());
+  EXPECT_EQ(2, envelope_maker_->envelope().batch_size());
+
+  // A batch containing a single Observation that is too big is rejected.
+  ResetEnvelopeMaker(100, 1800);
+  values[5].set_string_value(std::string(101, 'x'));
+  ASSERT_EQ(Encoder::kOK,
+            encoder_.EncodeBatch(1, kEncodingConfigId, values, &batch));
+  EXPECT_EQ(EnvelopeMaker::kObservationTooBig,
+            envelope_maker_->AddObservationBatch(batch.observations,
+                                                 std::move(batch.metadata)));
+  EXPECT_TRUE(envelope_maker_->Empty());
+
+  // A batch whose total size is bigger than max_num_bytes could never be
+  // added and so is also rejected as too big.
+  values.resize(37);
+  for (auto& value : values) {
+    value.set_string_value(std::string(20, 'x'));
+  }
+  ASSERT_EQ(Encoder::kOK,
+            encoder_.EncodeBatch(1, kEncodingConfigId, values, &batch));
+  EXPECT_EQ(EnvelopeMaker::kObservationTooBig,
+            envelope_maker_->AddObservationBatch(batch.observations,
+                                                 std::move(batch.metadata)));
+  EXPECT_TRUE(envelope_maker_->Empty());
+}
+
 }  // namespace encoder
 }  // namespace cobalt
@@ -0,0 +1,71 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "encoder/observation_ring.h"
+
+#include <utility>
+
+namespace cobalt {
+namespace encoder {
+
+namespace {
+size_t RoundUpToPowerOfTwo(size_t n) {
+  size_t power = 1;
+  while (power < n) {
+    power *= 2;
+  }
+  return power;
+}
+}  // namespace
+
+ObservationRing::ObservationRing(size_t capacity)
+    : slots_(new Slot[RoundUpToPowerOfTwo(capacity)]),
+      mask_(RoundUpToPowerOfTwo(capacity) - 1),
+      tail_(0) {
+  for (size_t i = 0; i <= mask_; i++) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool ObservationRing::Push(Entry* entry) {
+  size_t position = tail_.load(std::memory_order_relaxed);
+  Slot* slot;
+  while (true) {
+    slot = &slots_[position & mask_];
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      // The slot is free. Claim it unless another producer does first, in
+      // which case |position| is updated to the current tail.
+      if (tail_.compare_exchange_weak(position, position + 1,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < position) {
+      // The slot still holds the entry pushed one lap ago.
+      return false;
+    } else {
+      // Another producer claimed |position|.
+      position = tail_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->entry = std::move(*entry);
+  slot->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+bool ObservationRing::Pop(Entry* entry) {
+  Slot* slot = &slots_[head_ & mask_];
+  if (slot->sequence.load(std::memory_order_acquire) != head_ + 1) {
+    return false;
+  }
+  *entry = std::move(slot->entry);
+  slot->entry = Entry();
+  // Make the slot free for the producer that claims it on the next lap.
+  slot->sequence.store(head_ + mask_ + 1, std::memory_order_release);
+  head_++;
+  return true;
+}
+
+}  // namespace encoder
+}  // namespace cobalt
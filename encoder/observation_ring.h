@@ -0,0 +1,73 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_ENCODER_OBSERVATION_RING_H_
+#define COBALT_ENCODER_OBSERVATION_RING_H_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "./encrypted_message.pb.h"
+#include "./observation.pb.h"
+
+namespace cobalt {
+namespace encoder {
+
+// An ObservationRing is a bounded, lock-free, multi-producer single-consumer
+// queue of encrypted Observations. ShippingManager uses one so that the
+// threads that add Observations do not contend for its mutex: they encrypt
+// their Observations and push them here, and the thread that holds the
+// mutex pops them into the active EnvelopeMaker.
+//
+// Push() may be invoked concurrently by any number of threads. Pop() must
+// only be invoked by one thread at a time.
+class ObservationRing {
+ public:
+  // One or more encrypted Observations that share the same metadata.
+  struct Entry {
+    std::unique_ptr<ObservationMetadata> metadata;
+    std::vector<EncryptedMessage> encrypted_observations;
+
+    // The amount by which |encrypted_observations| increase the size() of
+    // the EnvelopeMaker they are added to.
+    size_t num_bytes = 0;
+  };
+
+  // Constructs a ring that holds |capacity| entries, rounded up to a power
+  // of two.
+  explicit ObservationRing(size_t capacity);
+
+  // Moves |*entry| into the ring. Returns false, leaving |*entry| unchanged,
+  // if the ring is full.
+  bool Push(Entry* entry);
+
+  // Moves the oldest entry out of the ring into |*entry|. Returns false if
+  // the ring is empty, or if the oldest entry is still being pushed.
+  bool Pop(Entry* entry);
+
+ private:
+  // Each slot has a sequence number which tells producers and the consumer
+  // whose turn it is: a slot at position p in the ring is free for the
+  // producer that claims p when its sequence number is p, and holds an entry
+  // for the consumer when it is p + 1.
+  struct Slot {
+    std::atomic<size_t> sequence;
+    Entry entry;
+  };
+
+  std::unique_ptr<Slot[]> slots_;
+  const size_t mask_;
+
+  // The next position to be claimed by a producer.
+  std::atomic<size_t> tail_;
+
+  // The next position to be popped. Accessed only by the consumer.
+  size_t head_ = 0;
+};
+
+}  // namespace encoder
+}  // namespace cobalt
+
+#endif  // COBALT_ENCODER_OBSERVATION_RING_H_
@@ -0,0 +1,103 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "encoder/observation_ring.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./gtest.h"
+
+namespace cobalt {
+namespace encoder {
+
+namespace {
+
+// Returns an Entry with a single encrypted Observation whose ciphertext is
+// |ciphertext| and with the given |num_bytes|.
+ObservationRing::Entry MakeEntry(const std::string& ciphertext,
+                                 size_t num_bytes) {
+  ObservationRing::Entry entry;
+  entry.metadata.reset(new ObservationMetadata());
+  entry.encrypted_observations.resize(1);
+  entry.encrypted_observations[0].set_ciphertext(ciphertext);
+  entry.num_bytes = num_bytes;
+  return entry;
+}
+
+}  // namespace
+
+// Tests pushing and popping entries on a single thread, including when the
+// ring is full or empty.
+TEST(ObservationRingTest, PushAndPop) {
+  // The capacity is rounded up to 4.
+  ObservationRing ring(3);
+  ObservationRing::Entry entry;
+  EXPECT_FALSE(ring.Pop(&entry));
+
+  for (int lap = 0; lap < 3; lap++) {
+    for (int i = 0; i < 4; i++) {
+      entry = MakeEntry(std::to_string(i), i);
+      EXPECT_TRUE(ring.Push(&entry));
+    }
+    entry = MakeEntry("extra", 1);
+    EXPECT_FALSE(ring.Push(&entry));
+    // A failed push leaves the entry unchanged.
+    EXPECT_EQ("extra", entry.encrypted_observations[0].ciphertext());
+
+    for (int i = 0; i < 4; i++) {
+      ASSERT_TRUE(ring.Pop(&entry));
+      EXPECT_NE(nullptr, entry.metadata);
+      ASSERT_EQ(1u, entry.encrypted_observations.size());
+      EXPECT_EQ(std::to_string(i),
+                entry.encrypted_observations[0].ciphertext());
+      EXPECT_EQ(static_cast<size_t>(i), entry.num_bytes);
+    }
+    EXPECT_FALSE(ring.Pop(&entry));
+  }
+}
+
+// Tests that entries pushed concurrently by several producers are all popped
+// exactly once by a concurrent consumer, in order for each producer.
+TEST(ObservationRingTest, ConcurrentProducers) {
+  static const int kNumProducers = 4;
+  static const int kNumEntriesPerProducer = 2000;
+  ObservationRing ring(16);
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kNumProducers; p++) {
+    producers.emplace_back([&ring, p] {
+      for (int i = 0; i < kNumEntriesPerProducer; i++) {
+        ObservationRing::Entry entry = MakeEntry(std::to_string(p), i);
+        while (!ring.Push(&entry)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  std::vector<size_t> next_index(kNumProducers, 0);
+  int num_popped = 0;
+  while (num_popped < kNumProducers * kNumEntriesPerProducer) {
+    ObservationRing::Entry entry;
+    if (!ring.Pop(&entry)) {
+      std::this_thread::yield();
+      continue;
+    }
+    int p = std::stoi(entry.encrypted_observations[0].ciphertext());
+    ASSERT_LE(0, p);
+    ASSERT_GT(kNumProducers, p);
+    EXPECT_EQ(next_index[p]++, entry.num_bytes);
+    num_popped++;
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  ObservationRing::Entry entry;
+  EXPECT_FALSE(ring.Pop(&entry));
+}
+
+}  // namespace encoder
+}  // namespace cobalt
@@ -4,9 +4,11 @@
 
 #include <chrono>
 #include <cmath>
+#include <functional>
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "encoder/send_retryer.h"
 
@@ -52,6 +54,11 @@ void CancelHandle::TryCancel() {
   }
 }
 
+int CancelHandle::num_attempts() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_attempts_;
+}
+
 SendRetryer::SendRetryer(ShufflerClientInterface* shuffler_client)
     : shuffler_client_(shuffler_client), clock_(new SystemClock()) {
   CHECK(shuffler_client);
@@ -61,6 +68,28 @@ grpc::Status SendRetryer::SendToShuffler(
     std::chrono::seconds initial_rpc_deadline,
     std::chrono::seconds overall_deadline, CancelHandle* cancel_handle,
     const EncryptedMessage& encrypted_message) {
+  return Retry(initial_rpc_deadline, overall_deadline, cancel_handle,
+               [this, &encrypted_message](grpc::ClientContext* context) {
+                 return shuffler_client_->SendToShuffler(encrypted_message,
+                                                         context);
+               });
+}
+
+grpc::Status SendRetryer::SendStreamToShuffler(
+    std::chrono::seconds initial_rpc_deadline,
+    std::chrono::seconds overall_deadline, CancelHandle* cancel_handle,
+    const std::vector<EncryptedMessage>& encrypted_messages) {
+  return Retry(initial_rpc_deadline, overall_deadline, cancel_handle,
+               [this, &encrypted_messages](grpc::ClientContext* context) {
+                 return shuffler_client_->SendStreamToShuffler(
+                     encrypted_messages, context);
+               });
+}
+
+grpc::Status SendRetryer::Retry(
+    std::chrono::seconds initial_rpc_deadline,
+    std::chrono::seconds overall_deadline, CancelHandle* cancel_handle,
+    const std::function<grpc::Status(grpc::ClientContext*)>& rpc) {
   CHECK(initial_rpc_deadline > std::chrono::seconds::zero());
   CHECK(overall_deadline >= initial_rpc_deadline);
 
@@ -79,6 +108,10 @@ grpc::Status SendRetryer::SendToShuffler(
     local_cancel_handle.reset(new CancelHandle());
     cancel_handle = local_cancel_handle.get();
   }
+  {
+    std::lock_guard<std::mutex> lock(cancel_handle->mutex_);
+    cancel_handle->num_attempts_ = 0;
+  }
 
   // Initialize rpc_deadline to min(initial_rpc_deadline, kMaxRpcDeadline).
   std::chrono::seconds rpc_deadline = initial_rpc_deadline;
@@ -103,14 +136,14 @@ grpc::Status SendRetryer::SendToShuffler(
       // We need a new ClientContext for every request.
       cancel_handle->context_.reset(new grpc::ClientContext());
       client_context = cancel_handle->context_.get();
+      cancel_handle->num_attempts_++;
     }
 
     // Attempt the RPC.
     client_context->set_deadline(clock_->now() + rpc_deadline);
     VLOG(4) << "Sending an RPC to the Shuffler with a deadline of "
             << rpc_deadline.count() << " seconds.";
-    auto status =
-        shuffler_client_->SendToShuffler(encrypted_message, client_context);
+    auto status = rpc(client_context);
     VLOG(4) << "Response received from Shuffler: (" << status.error_code()
             << ") " << status.error_message();
 
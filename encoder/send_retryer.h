@@ -5,7 +5,9 @@
 #ifndef COBALT_ENCODER_SEND_RETRYER_H_
 #define COBALT_ENCODER_SEND_RETRYER_H_
 
+#include <functional>
 #include <memory>
+#include <vector>
 
 #include "encoder/shuffler_client.h"
 #include "util/clock.h"
@@ -29,6 +31,12 @@ class SendRetryerInterface {
       std::chrono::seconds overerall_deadline,
       send_retryer::CancelHandle* cancel_handle,
       const EncryptedMessage& encrypted_message) = 0;
+
+  virtual grpc::Status SendStreamToShuffler(
+      std::chrono::seconds initial_rpc_deadline,
+      std::chrono::seconds overerall_deadline,
+      send_retryer::CancelHandle* cancel_handle,
+      const std::vector<EncryptedMessage>& encrypted_messages) = 0;
 };
 
 // This class wraps a ShufflerClient with retry logic. We categorize
@@ -86,9 +94,32 @@ class SendRetryer : public SendRetryerInterface {
       send_retryer::CancelHandle* cancel_handle,
       const EncryptedMessage& encrypted_message) override;
 
+  // The stream-aware version of SendToShuffler(). Uses the wrapped
+  // ShufflerClient to send all of the given |encrypted_messages| to the
+  // Shuffler on a single stream. The parameters and the return value are as
+  // for SendToShuffler() except that the RPC deadlines apply to the stream as
+  // a whole. The Shuffler saves the Envelopes of a stream all or nothing when
+  // the stream is closed, so if the stream fails with a retryable error then
+  // none of them has been saved and all of them are sent again on a new
+  // stream.
+  grpc::Status SendStreamToShuffler(
+      std::chrono::seconds initial_rpc_deadline,
+      std::chrono::seconds overerall_deadline,
+      send_retryer::CancelHandle* cancel_handle,
+      const std::vector<EncryptedMessage>& encrypted_messages) override;
+
  private:
   friend class SendRetryerTest;
 
+  // Does the work of SendToShuffler() and SendStreamToShuffler(). Each
+  // attempt invokes |rpc| with a new ClientContext whose deadline has been
+  // set.
+  grpc::Status Retry(
+      std::chrono::seconds initial_rpc_deadline,
+      std::chrono::seconds overerall_deadline,
+      send_retryer::CancelHandle* cancel_handle,
+      const std::function<grpc::Status(grpc::ClientContext*)>& rpc);
+
   ShufflerClientInterface* shuffler_client_;  // not owned
 
   // The value with which we will initialize sleep_between_attempts. This
@@ -108,12 +139,17 @@ class CancelHandle {
   // an attempt will be made to cancel it but this may not succeed.
   void TryCancel();
 
+  // Returns the number of RPCs to the Shuffler made by the current or most
+  // recent invocation of SendToShuffler() that used this CancelHandle.
+  int num_attempts();
+
  private:
   friend class SendRetryer;
   friend class SendRetryerTest;
 
   std::mutex mutex_;
   bool cancelled_ = false;
+  int num_attempts_ = 0;
   std::condition_variable cancel_notifier_;
   std::unique_ptr<grpc::ClientContext> context_;
 
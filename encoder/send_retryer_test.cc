@@ -61,10 +61,20 @@ class FakeShufflerClient : public ShufflerClientInterface {
     return statuses_to_return[call_count - 1];
   }
 
+  // Each stream is treated as a single call to SendToShuffler(). The number
+  // of messages in each stream is recorded in |stream_sizes|.
+  grpc::Status SendStreamToShuffler(
+      const std::vector<EncryptedMessage>& encrypted_messages,
+      grpc::ClientContext* context = nullptr) override {
+    stream_sizes.push_back(encrypted_messages.size());
+    return SendToShuffler(EncryptedMessage(), context);
+  }
+
   IncrementingClock* incrementing_clock;  // not owned.
   std::vector<grpc::Status> statuses_to_return = {grpc::Status::OK};
   size_t call_count = 0;
   std::vector<int64_t> deadlines;
+  std::vector<size_t> stream_sizes;
   size_t cancel_on_this_call_count = -1;
   CancelHandle* cancel_handle;
 };
@@ -104,6 +114,8 @@ class SendRetryerTest : public ::testing::Test {
                     std::vector<int> expected_deadline_seconds) {
     EXPECT_EQ(expected_code, status.error_code());
     EXPECT_EQ(expected_call_count, shuffler_client_->call_count);
+    EXPECT_EQ(static_cast<int>(expected_call_count),
+              cancel_handle_->num_attempts());
     ASSERT_EQ(expected_call_count, shuffler_client_->deadlines.size());
     ASSERT_EQ(expected_call_count, expected_deadline_seconds.size());
     for (size_t i = 0; i < expected_call_count; i++) {
@@ -280,6 +292,23 @@ TEST_F(SendRetryerTest, TestCancel) {
   CheckResults(status, grpc::CANCELLED, 2u, {10u, 15u});
 }
 
+// Tests that when the ShufflerClient returns UNAVAILABLE for a stream the
+// first time and OK the second time then the Retryer sends the whole stream
+// a total of 2 times and returns OK.
+TEST_F(SendRetryerTest, StreamReturnsUnavailableThenOk) {
+  shuffler_client_->statuses_to_return = {
+      grpc::Status(grpc::UNAVAILABLE, "UNAVAILABLE"), grpc::Status::OK};
+  std::vector<EncryptedMessage> encrypted_messages(3);
+  auto status = retryer_->SendStreamToShuffler(
+      std::chrono::seconds(10), std::chrono::seconds::max(),
+      cancel_handle_.get(), encrypted_messages);
+
+  // Expect 2 streams of 3 messages with deadlines seconds {10, 10} to
+  // return OK.
+  CheckResults(status, grpc::OK, 2u, {10u, 10u});
+  EXPECT_EQ(std::vector<size_t>({3u, 3u}), shuffler_client_->stream_sizes);
+}
+
 }  // namespace send_retryer
 }  // namespace encoder
 }  // namespace cobalt
@@ -2,6 +2,8 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <algorithm>
+#include <cmath>
 #include <mutex>
 #include <utility>
 
@@ -32,13 +34,19 @@ ShippingManager::ShippingManager(
     : size_params_(size_params),
       envelope_send_threshold_size_(
           size_t(0.6 * size_params.max_bytes_per_envelope_)),
+      max_bytes_total_(size_params.max_bytes_total_),
       total_bytes_send_threshold_(size_t(0.6 * size_params.max_bytes_total_)),
       schedule_params_(schedule_params),
       envelope_maker_params_(envelope_maker_params),
       send_retryer_params_(send_retryer_params),
       send_retryer_(send_retryer),
+      encrypt_to_analyzer_(envelope_maker_params.analyzer_public_key_pem_,
+                           envelope_maker_params.analyzer_scheme_),
+      intake_ring_(kIntakeRingCapacity),
       next_scheduled_send_time_(std::chrono::system_clock::now() +
-                                schedule_params_.schedule_interval_) {
+                                schedule_params_.schedule_interval_),
+      cancel_handles_(new send_retryer::CancelHandle
+                          [send_retryer_params.max_concurrent_sends_]) {
   CHECK(send_retryer);
   _mutex_protected_fields_do_not_access_directly_.active_envelope_maker.reset(
       new EnvelopeMaker(envelope_maker_params.analyzer_public_key_pem_,
@@ -58,14 +66,34 @@ ShippingManager::~ShippingManager() {
   worker_thread_.join();
 }
 
+bool ShippingManager::EnablePersistence(const std::string& directory,
+                                        size_t max_bytes_total) {
+  CHECK(!worker_thread_.joinable());
+  CHECK_LE(size_params_.max_bytes_per_envelope_, max_bytes_total);
+  envelope_log_ = EnvelopeLog::Open(directory);
+  if (!envelope_log_) {
+    LOG(ERROR) << "ShippingManager: Unable to open the EnvelopeLog in "
+               << directory << ". Observations will be kept in memory.";
+    return false;
+  }
+  max_bytes_total_ = max_bytes_total;
+  total_bytes_send_threshold_ = size_t(0.6 * max_bytes_total);
+
+  // Any Envelopes left in the log by an earlier ShippingManager will be sent
+  // at the next scheduled send.
+  envelopes_to_send_total_bytes_ = envelope_log_->total_envelope_size();
+  temporarily_full_ = envelopes_to_send_total_bytes_ >= max_bytes_total_;
+  return true;
+}
+
 void ShippingManager::Start() {
   {
     // We set idle and waiting_for_schedule to false since we are about to
     // start the worker thread. The worker thread will set these variables
     // to true at the appropriate times.
     auto locked = lock();
-    locked->fields->idle = false;
-    locked->fields->waiting_for_schedule = false;
+    locked.fields->idle = false;
+    locked.fields->waiting_for_schedule = false;
   }
 
   std::thread t([this] { this->Run(); });
@@ -75,63 +103,138 @@ void ShippingManager::Start() {
 ShippingManager::Status ShippingManager::AddObservation(
     const Observation& observation,
     std::unique_ptr<ObservationMetadata> metadata) {
-  auto locked = lock();
-  if (locked->fields->shut_down) {
+  if (shutting_down_) {
     return kShutDown;
   }
-  if (locked->fields->temporarily_full) {
+  if (temporarily_full_) {
     // Not just the current EnvelopeMaker, but the ShippingManager in
     // general is full. This should be very rare. Unless there is a problem
     // with sending Observations to the server we should never be full.
-    // The dynamics of when this might happen will be different once we
-    // implement local persistence of Observations.
     return kFull;
   }
-  switch (locked->fields->active_envelope_maker->AddObservation(
-      observation, std::move(metadata))) {
-    case EnvelopeMaker::kOk:
-      VLOG(4) << "ShippingManager::AddObservation: OK";
-      // Set idle_ false because any thread that invokes WaitUntilIdle() after
-      // this should wait until the Observatoin just added has been sent.
-      locked->fields->idle = false;
-      break;
+  ObservationRing::Entry entry;
+  entry.encrypted_observations.resize(1);
+  Status status = EncryptObservation(
+      observation, &entry.encrypted_observations[0], &entry.num_bytes);
+  if (status != kOk) {
+    return status;
+  }
+  entry.metadata = std::move(metadata);
+  return AddToIntake(&entry);
+}
+
+ShippingManager::Status ShippingManager::AddObservationBatch(
+    const google::protobuf::RepeatedPtrField<Observation>& observations,
+    std::unique_ptr<ObservationMetadata> metadata) {
+  if (shutting_down_) {
+    return kShutDown;
+  }
+  if (temporarily_full_) {
+    return kFull;
+  }
+  if (observations.empty()) {
+    return kOk;
+  }
+  // Encrypt all of the Observations before adding any of them so that we
+  // can add either all or none.
+  ObservationRing::Entry entry;
+  entry.encrypted_observations.resize(observations.size());
+  for (int i = 0; i < observations.size(); i++) {
+    size_t obs_size;
+    Status status = EncryptObservation(
+        observations.Get(i), &entry.encrypted_observations[i], &obs_size);
+    if (status != kOk) {
+      return status;
+    }
+    entry.num_bytes += obs_size;
+  }
+  if (entry.num_bytes > size_params_.max_bytes_per_envelope_) {
+    VLOG(1) << "WARNING: A batch of " << observations.size()
+            << " Observations was rejected by "
+               "ShippingManager::AddObservationBatch() because it was too "
+               "big: "
+            << entry.num_bytes;
+    return kObservationTooBig;
+  }
+  entry.metadata = std::move(metadata);
+  return AddToIntake(&entry);
+}
 
-    case EnvelopeMaker::kObservationTooBig:
-      return kObservationTooBig;
+ShippingManager::Status ShippingManager::EncryptObservation(
+    const Observation& observation, EncryptedMessage* encrypted_message,
+    size_t* obs_size) {
+  if (!encrypt_to_analyzer_.Encrypt(observation, encrypted_message)) {
+    VLOG(1) << "ERROR: Encryption of Observation failed!";
+    return kEncryptionFailed;
+  }
+  // Round up so that every Observation occupies at least one byte.
+  *obs_size = static_cast<size_t>(
+      std::ceil(EnvelopeMaker::ObservationSize(*encrypted_message) *
+                compression_ratio_.load(std::memory_order_relaxed)));
+  if (*obs_size > size_params_.max_bytes_per_observation_) {
+    VLOG(1) << "WARNING: An Observation was rejected by "
+               "ShippingManager::AddObservation() because it was too big: "
+            << *obs_size;
+    return kObservationTooBig;
+  }
+  return kOk;
+}
 
-    case EnvelopeMaker::kEnvelopeFull:
+ShippingManager::Status ShippingManager::AddToIntake(
+    ObservationRing::Entry* entry) {
+  // Reserve room in the active EnvelopeMaker.
+  size_t num_bytes = entry->num_bytes;
+  size_t old_intake_bytes = intake_bytes_.load();
+  do {
+    if (old_intake_bytes + num_bytes > size_params_.max_bytes_per_envelope_) {
       // This should be very rare because of the fact that we invoke
-      // RequestSendSoon() below when size() >= envelope_send_threshold_size_.
-      // This should prevent us from getting to the point that the active
-      // EnvelopeMaker is ever full.
-      RequestSendSoonLockHeld(locked->fields);
+      // RequestSendSoon() below when the intake reaches
+      // envelope_send_threshold_size_. This should prevent us from getting
+      // to the point that the active EnvelopeMaker is ever full.
+      RequestSendSoon();
       return kFull;
+    }
+  } while (!intake_bytes_.compare_exchange_weak(old_intake_bytes,
+                                                old_intake_bytes + num_bytes));
+  size_t new_intake_bytes = old_intake_bytes + num_bytes;
 
-    case EnvelopeMaker::kEncryptionFailed:
-      return kEncryptionFailed;
-  }
-  if (locked->fields->active_envelope_maker->size() >=
-      envelope_send_threshold_size_) {
-    // The active EnvelopeMaker is starting to get too large. Initiate
-    // a send.
-    RequestSendSoonLockHeld(locked->fields);
+  if (!intake_ring_.Push(entry)) {
+    // The ring is full because the worker thread has not drained it
+    // recently. Drain it here and add the Observations directly.
+    auto locked = lock();
+    DrainIntakeLockHeld(locked.fields);
+    CHECK_EQ(EnvelopeMaker::kOk,
+             locked.fields->active_envelope_maker->AddEncryptedObservations(
+                 &entry->encrypted_observations, num_bytes,
+                 std::move(entry->metadata)));
   }
+  VLOG(4) << "ShippingManager::AddObservation: OK";
 
-  size_t new_total_bytes = locked->fields->envelopes_to_send_total_bytes +
-                           locked->fields->active_envelope_maker->size();
-
+  // If the active EnvelopeMaker is starting to get too large, initiate a
+  // send.
+  bool request_send = new_intake_bytes >= envelope_send_threshold_size_;
+  size_t new_total_bytes = envelopes_to_send_total_bytes_ + new_intake_bytes;
   if (new_total_bytes > total_bytes_send_threshold_) {
-    RequestSendSoonLockHeld(locked->fields);
-    if (new_total_bytes > size_params_.max_bytes_total_) {
+    request_send = true;
+    if (new_total_bytes > max_bytes_total_) {
       // Not just the current EnvelopeMaker, but the ShippingManager in general
       // is now temporarily full. This should be very rare. Unless there is
       // a problem with sending Observations to the server we should never
       // be full.
-      locked->fields->temporarily_full = true;
+      temporarily_full_ = true;
     }
   }
 
-  locked->fields->add_observation_notifier.notify_all();
+  // The worker thread only waits for an Observation to arrive while
+  // |intake_bytes_| is zero, so it only needs to be woken by the thread that
+  // makes it non-zero.
+  if (request_send || old_intake_bytes == 0) {
+    auto locked = lock();
+    if (request_send) {
+      RequestSendSoonLockHeld(locked.fields);
+    }
+    locked.fields->add_observation_notifier.notify_all();
+  }
   return kOk;
 }
 
@@ -152,70 +255,88 @@ void ShippingManager::RequestSendSoon() { RequestSendSoon(SendCallback()); }
 void ShippingManager::RequestSendSoon(SendCallback send_callback) {
   VLOG(4) << "ShippingManager: Expedited send requested.";
   auto locked = lock();
-  RequestSendSoonLockHeld(locked->fields);
+  RequestSendSoonLockHeld(locked.fields);
 
   // If we were given a SendCallback then do one of three things...
   if (send_callback) {
-    if (locked->fields->active_envelope_maker->size() > 0) {
+    if (intake_bytes_ > 0) {
       // If the active EnvelopeMaker is not empty put the SendCallback
       // onto the on-deck queue so that it gets invoked after the next
       // send that includes the active EnvelopeMaker.
-      locked->fields->on_deck_send_callback_queue.push_back(send_callback);
-    } else if (locked->fields->envelopes_to_send_total_bytes > 0) {
+      locked.fields->on_deck_send_callback_queue.push_back(send_callback);
+    } else if (envelopes_to_send_total_bytes_ > 0) {
       // If the active EnvelopeMaker is empty but the worker thread has
       // some EnvelopeMakers it is currently dealing with then put the
       // SendCallback directly onto the current queue so that it gets invoked
       // after the next send attempt.
-      locked->fields->current_send_callback_queue.push_back(send_callback);
+      locked.fields->current_send_callback_queue.push_back(send_callback);
     } else {
       // Otherwise the ShippingManager has no Observations so invoke the
       // SendCallback immediately and clear expedited_send_requested.
-      locked->fields->expedited_send_requested = false;
+      locked.fields->expedited_send_requested = false;
       send_callback(true);
     }
   }
 }
 
-bool ShippingManager::shut_down() { return lock()->fields->shut_down; }
+bool ShippingManager::shut_down() { return lock().fields->shut_down; }
 
 void ShippingManager::ShutDown() {
   {
     auto locked = lock();
-    cancel_handle_.TryCancel();
-    locked->fields->shut_down = true;
-    locked->fields->shutdown_notifier.notify_all();
-    locked->fields->add_observation_notifier.notify_all();
-    locked->fields->expedited_send_notifier.notify_all();
-    locked->fields->idle_notifier.notify_all();
-    locked->fields->waiting_for_schedule_notifier.notify_all();
+    for (size_t i = 0; i < send_retryer_params_.max_concurrent_sends_; i++) {
+      cancel_handles_[i].TryCancel();
+    }
+    locked.fields->shut_down = true;
+    shutting_down_ = true;
+    locked.fields->shutdown_notifier.notify_all();
+    locked.fields->add_observation_notifier.notify_all();
+    locked.fields->expedited_send_notifier.notify_all();
+    locked.fields->idle_notifier.notify_all();
+    locked.fields->waiting_for_schedule_notifier.notify_all();
   }
   VLOG(4) << "ShippingManager: shut-down requested.";
 }
 
 std::unique_ptr<EnvelopeMaker> ShippingManager::TakeActiveEnvelopeMaker() {
   auto locked = lock();
-  return TakeActiveEnvelopeMakerLockHeld(locked->fields);
+  return TakeActiveEnvelopeMakerLockHeld(locked.fields);
 }
 
 size_t ShippingManager::num_send_attempts() {
   auto locked = lock();
-  return locked->fields->num_send_attempts;
+  return locked.fields->num_send_attempts;
 }
 
 size_t ShippingManager::num_failed_attempts() {
   auto locked = lock();
-  return locked->fields->num_failed_attempts;
+  return locked.fields->num_failed_attempts;
 }
 
 grpc::Status ShippingManager::last_send_status() {
   auto locked = lock();
-  return locked->fields->last_send_status;
+  return locked.fields->last_send_status;
+}
+
+size_t ShippingManager::num_retries() {
+  auto locked = lock();
+  return locked.fields->num_retries;
+}
+
+size_t ShippingManager::num_bytes_sent() {
+  auto locked = lock();
+  return locked.fields->num_bytes_sent;
+}
+
+std::chrono::milliseconds ShippingManager::last_send_latency() {
+  auto locked = lock();
+  return locked.fields->last_send_latency;
 }
 
 void ShippingManager::Run() {
   while (true) {
     auto locked = lock();
-    if (locked->fields->shut_down) {
+    if (locked.fields->shut_down) {
       return;
     }
 
@@ -227,55 +348,58 @@ void ShippingManager::Run() {
     // Sleep for schedule_params_.min_interval or until shut_down_.
     VLOG(4) << "ShippingManager worker: sleeping for "
             << schedule_params_.min_interval_.count() << " seconds.";
-    locked->fields->shutdown_notifier.wait_for(
-        locked->lock, schedule_params_.min_interval_,
-        [&locked] { return (locked->fields->shut_down); });
+    locked.fields->shutdown_notifier.wait_for(
+        locked.lock, schedule_params_.min_interval_,
+        [&locked] { return (locked.fields->shut_down); });
     VLOG(4) << "ShippingManager worker: waking up from sleep. shut_down_="
-            << locked->fields->shut_down;
-    if (locked->fields->shut_down) {
+            << locked.fields->shut_down;
+    if (locked.fields->shut_down) {
       return;
     }
 
-    if (locked->fields->active_envelope_maker->Empty() &&
-        locked->fields->envelopes_to_send_total_bytes == 0) {
+    // Move the Observations that have arrived into the active EnvelopeMaker
+    // so that |intake_ring_| does not fill up between sends.
+    DrainIntakeLockHeld(locked.fields);
+
+    if (intake_bytes_ == 0 && envelopes_to_send_total_bytes_ == 0) {
       // There are no Observations at all in the ShippingManager. Wait
       // forever until notified that one arrived or shut down.
       VLOG(4) << "ShippingManager worker: waiting for an Observation to "
                  "arrive.";
-      locked->fields->idle = true;
-      locked->fields->idle_notifier.notify_all();
-      locked->fields->add_observation_notifier.wait(locked->lock, [&locked] {
-        return (locked->fields->shut_down ||
-                !locked->fields->active_envelope_maker->Empty());
-      });
-      locked->fields->idle = false;
+      locked.fields->idle = true;
+      locked.fields->idle_notifier.notify_all();
+      locked.fields->add_observation_notifier.wait(
+          locked.lock, [this, &locked] {
+            return (locked.fields->shut_down || intake_bytes_ > 0);
+          });
+      locked.fields->idle = false;
     } else {
       auto now = std::chrono::system_clock::now();
       VLOG(4) << "now: " << ToString(now) << " next_scheduled_send_time_: "
               << ToString(next_scheduled_send_time_);
       if (next_scheduled_send_time_ <= now ||
-          locked->fields->expedited_send_requested) {
+          locked.fields->expedited_send_requested) {
         VLOG(4) << "ShippingManager worker: time to send now.";
-        PrepareForSendLockHeld(locked->fields);
-        locked->lock.unlock();
+        PrepareForSendLockHeld(locked.fields);
+        locked.lock.unlock();
         SendAllEnvelopes();
         next_scheduled_send_time_ = std::chrono::system_clock::now() +
                                     schedule_params_.schedule_interval_;
-        locked->lock.lock();
+        locked.lock.lock();
       } else {
         // Wait until the next scheduled send time or until notified of
         // a new request for an expedited send or we are shut down.
         VLOG(4) << "ShippingManager worker: waiting "
                 << schedule_params_.schedule_interval_.count()
                 << " seconds for next scheduled send.";
-        locked->fields->waiting_for_schedule = true;
-        locked->fields->waiting_for_schedule_notifier.notify_all();
-        locked->fields->expedited_send_notifier.wait_until(
-            locked->lock, next_scheduled_send_time_, [&locked] {
-              return (locked->fields->shut_down ||
-                      locked->fields->expedited_send_requested);
+        locked.fields->waiting_for_schedule = true;
+        locked.fields->waiting_for_schedule_notifier.notify_all();
+        locked.fields->expedited_send_notifier.wait_until(
+            locked.lock, next_scheduled_send_time_, [&locked] {
+              return (locked.fields->shut_down ||
+                      locked.fields->expedited_send_requested);
             });
-        locked->fields->waiting_for_schedule = false;
+        locked.fields->waiting_for_schedule = false;
       }
     }
   }
@@ -284,22 +408,30 @@ void ShippingManager::Run() {
 // A lock on mutex_ should be held by the caller.
 std::unique_ptr<EnvelopeMaker> ShippingManager::TakeActiveEnvelopeMakerLockHeld(
     MutexProtectedFields* fields) {
-  std::unique_ptr<EnvelopeMaker> latest_envelope_maker(
-      new EnvelopeMaker(envelope_maker_params_.analyzer_public_key_pem_,
-                        envelope_maker_params_.analyzer_scheme_,
-                        envelope_maker_params_.shuffler_public_key_pem_,
-                        envelope_maker_params_.shuffler_scheme_,
-                        size_params_.max_bytes_per_observation_,
-                        size_params_.max_bytes_per_envelope_));
+  DrainIntakeLockHeld(fields);
+  std::unique_ptr<EnvelopeMaker> latest_envelope_maker = NewEnvelopeMaker();
   fields->active_envelope_maker.swap(latest_envelope_maker);
+  intake_bytes_ -= latest_envelope_maker->size();
   return latest_envelope_maker;
 }
 
+// A lock on mutex_ should be held by the caller.
+void ShippingManager::DrainIntakeLockHeld(MutexProtectedFields* fields) {
+  ObservationRing::Entry entry;
+  while (intake_ring_.Pop(&entry)) {
+    // Room for the entry was reserved in |intake_bytes_| so it must fit.
+    CHECK_EQ(EnvelopeMaker::kOk,
+             fields->active_envelope_maker->AddEncryptedObservations(
+                 &entry.encrypted_observations, entry.num_bytes,
+                 std::move(entry.metadata)));
+  }
+}
+
 // A lock on mutex_ should be held by the caller.
 void ShippingManager::PrepareForSendLockHeld(MutexProtectedFields* fields) {
   fields->expedited_send_requested = false;
   auto latest_envelope_maker = TakeActiveEnvelopeMakerLockHeld(fields);
-  fields->envelopes_to_send_total_bytes += latest_envelope_maker->size();
+  envelopes_to_send_total_bytes_ += latest_envelope_maker->size();
   envelopes_to_send_.emplace_front(std::move(latest_envelope_maker));
   // Copy on_deck_send_callback_queue onto the end of
   // current_send_callback_queue and then clear current_send_callback_queue.
@@ -310,14 +442,32 @@ void ShippingManager::PrepareForSendLockHeld(MutexProtectedFields* fields) {
   fields->on_deck_send_callback_queue.clear();
 }
 
+std::unique_ptr<EnvelopeMaker> ShippingManager::NewEnvelopeMaker() {
+  return std::unique_ptr<EnvelopeMaker>(
+      new EnvelopeMaker(envelope_maker_params_.analyzer_public_key_pem_,
+                        envelope_maker_params_.analyzer_scheme_,
+                        envelope_maker_params_.shuffler_public_key_pem_,
+                        envelope_maker_params_.shuffler_scheme_,
+                        size_params_.max_bytes_per_observation_,
+                        size_params_.max_bytes_per_envelope_));
+}
+
 void ShippingManager::SendAllEnvelopes() {
+  bool success = true;
+  size_t envelopes_to_send_total_bytes = 0;
+  if (envelope_log_) {
+    success = SendAllEnvelopesFromLog();
+    envelopes_to_send_total_bytes = envelope_log_->total_envelope_size();
+  }
+  // Without persistence all Envelopes are sent from memory. With persistence
+  // only those that could not be written to the log are.
   std::deque<std::unique_ptr<EnvelopeMaker>> envelopes_that_failed;
   while (!envelopes_to_send_.empty()) {
     SendOneEnvelope(&envelopes_that_failed);
   }
-  bool success = envelopes_that_failed.empty();
+  FinishAllSends(&envelopes_that_failed);
+  success = success && envelopes_that_failed.empty();
   envelopes_to_send_ = std::move(envelopes_that_failed);
-  size_t envelopes_to_send_total_bytes = 0;
   for (const auto& env : envelopes_to_send_) {
     envelopes_to_send_total_bytes += env->size();
   }
@@ -327,14 +477,11 @@ void ShippingManager::SendAllEnvelopes() {
   std::vector<SendCallback> callbacks_to_invoke;
   {
     auto locked = lock();
-    locked->fields->envelopes_to_send_total_bytes =
-        envelopes_to_send_total_bytes;
-    if (envelopes_to_send_total_bytes +
-            locked->fields->active_envelope_maker->size() <
-        size_params_.max_bytes_total_) {
-      locked->fields->temporarily_full = false;
+    envelopes_to_send_total_bytes_ = envelopes_to_send_total_bytes;
+    if (envelopes_to_send_total_bytes + intake_bytes_ < max_bytes_total_) {
+      temporarily_full_ = false;
     }
-    callbacks_to_invoke.swap(locked->fields->current_send_callback_queue);
+    callbacks_to_invoke.swap(locked.fields->current_send_callback_queue);
   }
   for (SendCallback& callback : callbacks_to_invoke) {
     callback(success);
@@ -368,51 +515,253 @@ void ShippingManager::SendOneEnvelope(
     // Drop on floor.
     return;
   }
+  UpdateCompressionRatio(envelope_to_send->envelope(), encrypted_envelope);
+
+  QueueSend(std::move(encrypted_envelope), envelope_to_send_size,
+            std::move(envelope_to_send), std::vector<uint64_t>(),
+            envelopes_that_failed);
+}
+
+bool ShippingManager::SendAllEnvelopesFromLog() {
+  // Move the Envelopes into the log, oldest first. Any that can not be
+  // written are left in |envelopes_to_send_| to be sent from memory.
+  std::deque<std::unique_ptr<EnvelopeMaker>> envelopes_not_logged;
+  while (!envelopes_to_send_.empty()) {
+    std::unique_ptr<EnvelopeMaker> envelope_maker =
+        std::move(envelopes_to_send_.back());
+    envelopes_to_send_.pop_back();
+    if (envelope_maker->Empty()) {
+      continue;
+    }
+    uint64_t record_id;
+    if (!envelope_log_->Append(envelope_maker->envelope(),
+                               envelope_maker->size(), &record_id)) {
+      envelopes_not_logged.emplace_front(std::move(envelope_maker));
+    }
+  }
+  envelopes_to_send_ = std::move(envelopes_not_logged);
+
+  // Combine the records into Envelopes of an efficient size as
+  // SendOneEnvelope() does, send them and reclaim those that were sent.
+  // Failed sends leave their records in the log, so |envelopes_that_failed|
+  // stays empty.
+  bool success = true;
+  std::deque<std::unique_ptr<EnvelopeMaker>> envelopes_that_failed;
+  std::vector<EnvelopeLog::RecordInfo> records = envelope_log_->Records();
+  size_t next_record = 0;
+  while (next_record < records.size()) {
+    std::unique_ptr<EnvelopeMaker> envelope_to_send = NewEnvelopeMaker();
+    std::vector<uint64_t> record_ids;
+    while (next_record < records.size() &&
+           envelope_to_send->size() < size_params_.min_envelope_send_size_ &&
+           (record_ids.empty() ||
+            envelope_to_send->size() + records[next_record].envelope_size <=
+                size_params_.max_bytes_per_envelope_)) {
+      const EnvelopeLog::RecordInfo& record = records[next_record++];
+      Envelope envelope;
+      if (!envelope_log_->Read(record.record_id, &envelope)) {
+        LOG(ERROR) << "ShippingManager: Unable to read an Envelope from the "
+                      "EnvelopeLog. Its Observations have been dropped.";
+        envelope_log_->Reclaim(record.record_id);
+        continue;
+      }
+      envelope_to_send->MergeOutOf(&envelope, record.envelope_size);
+      record_ids.push_back(record.record_id);
+    }
+    if (record_ids.empty()) {
+      continue;
+    }
+
+    EncryptedMessage encrypted_envelope;
+    if (!envelope_to_send->MakeEncryptedEnvelope(&encrypted_envelope)) {
+      // Drop on floor, as SendOneEnvelope() does.
+      LOG(ERROR) << "ShippingManager: Unable to encrypt an Envelope. Its "
+                    "Observations have been dropped.";
+      for (uint64_t record_id : record_ids) {
+        envelope_log_->Reclaim(record_id);
+      }
+      continue;
+    }
+    UpdateCompressionRatio(envelope_to_send->envelope(), encrypted_envelope);
+    success = QueueSend(std::move(encrypted_envelope),
+                        envelope_to_send->size(), nullptr,
+                        std::move(record_ids), &envelopes_that_failed) &&
+              success;
+  }
+  success = FinishAllSends(&envelopes_that_failed) && success;
+
+  envelope_log_->Compact();
+  return success;
+}
 
-  VLOG(5) << "ShippingManager worker: Sending Envelope of size "
-          << envelope_to_send->size() << " bytes.";
-  auto status = send_retryer_->SendToShuffler(
-      send_retryer_params_.initial_rpc_deadline_,
-      send_retryer_params_.deadline_per_send_attempt_, &cancel_handle_,
-      encrypted_envelope);
+void ShippingManager::UpdateCompressionRatio(
+    const Envelope& envelope, const EncryptedMessage& encrypted_envelope) {
+  if (envelope_maker_params_.shuffler_scheme_ !=
+      EncryptedMessage::HYBRID_ECDH_V1_DEFLATE) {
+    return;
+  }
+  size_t uncompressed_size = 0;
+  for (const auto& batch : envelope.batch()) {
+    for (const auto& observation : batch.encrypted_observation()) {
+      uncompressed_size += EnvelopeMaker::ObservationSize(observation);
+    }
+  }
+  if (uncompressed_size == 0) {
+    return;
+  }
+  // The ciphertext includes the fixed overhead of the encryption, so small
+  // Envelopes may appear not to compress at all. That only makes our
+  // estimate conservative.
+  double ratio = static_cast<double>(encrypted_envelope.ciphertext().size()) /
+                 uncompressed_size;
+  compression_ratio_.store(std::min(ratio, 1.0), std::memory_order_relaxed);
+  VLOG(5) << "ShippingManager: compression ratio=" << compression_ratio_;
+}
+
+bool ShippingManager::QueueSend(
+    EncryptedMessage encrypted_envelope, size_t envelope_size,
+    std::unique_ptr<EnvelopeMaker> envelope_maker,
+    std::vector<uint64_t> record_ids,
+    std::deque<std::unique_ptr<EnvelopeMaker>>* envelopes_that_failed) {
+  pending_encrypted_envelopes_.push_back(std::move(encrypted_envelope));
+  pending_send_.envelope_size += envelope_size;
+  if (envelope_maker) {
+    pending_send_.envelope_makers.push_back(std::move(envelope_maker));
+  }
+  pending_send_.record_ids.insert(pending_send_.record_ids.end(),
+                                  record_ids.begin(), record_ids.end());
+  if (pending_encrypted_envelopes_.size() <
+      send_retryer_params_.max_envelopes_per_stream_) {
+    return true;
+  }
+  return StartPendingSend(envelopes_that_failed);
+}
+
+bool ShippingManager::StartPendingSend(
+    std::deque<std::unique_ptr<EnvelopeMaker>>* envelopes_that_failed) {
+  if (pending_encrypted_envelopes_.empty()) {
+    return true;
+  }
+  bool success = true;
+  if (in_flight_sends_.size() >= send_retryer_params_.max_concurrent_sends_) {
+    success = FinishOldestSend(envelopes_that_failed);
+  }
+  InFlightSend send = std::move(pending_send_);
+  pending_send_ = InFlightSend();
+  std::vector<EncryptedMessage> encrypted_envelopes;
+  encrypted_envelopes.swap(pending_encrypted_envelopes_);
+  VLOG(5) << "ShippingManager worker: Sending " << encrypted_envelopes.size()
+          << " Envelope(s) of total size " << send.envelope_size << " bytes.";
+  send_retryer::CancelHandle* cancel_handle =
+      &cancel_handles_[num_sends_started_++ %
+                       send_retryer_params_.max_concurrent_sends_];
+  send.result = std::async(
+      std::launch::async, [this, cancel_handle,
+                           encrypted_envelopes =
+                               std::move(encrypted_envelopes)] {
+        auto start_time = std::chrono::steady_clock::now();
+        SendResult result;
+        if (encrypted_envelopes.size() == 1) {
+          result.status = send_retryer_->SendToShuffler(
+              send_retryer_params_.initial_rpc_deadline_,
+              send_retryer_params_.deadline_per_send_attempt_, cancel_handle,
+              encrypted_envelopes[0]);
+        } else {
+          result.status = send_retryer_->SendStreamToShuffler(
+              send_retryer_params_.initial_rpc_deadline_,
+              send_retryer_params_.deadline_per_send_attempt_, cancel_handle,
+              encrypted_envelopes);
+        }
+        result.latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start_time);
+        result.num_retries = std::max(cancel_handle->num_attempts() - 1, 0);
+        return result;
+      });
+  in_flight_sends_.push_back(std::move(send));
+  return success;
+}
+
+bool ShippingManager::FinishOldestSend(
+    std::deque<std::unique_ptr<EnvelopeMaker>>* envelopes_that_failed) {
+  CHECK(!in_flight_sends_.empty());
+  InFlightSend send = std::move(in_flight_sends_.front());
+  in_flight_sends_.pop_front();
+  SendResult result = send.result.get();
   {
     auto locked = lock();
-    locked->fields->num_send_attempts++;
-    if (!status.ok()) {
-      locked->fields->num_failed_attempts++;
+    locked.fields->num_send_attempts++;
+    locked.fields->num_retries += result.num_retries;
+    locked.fields->last_send_latency = result.latency;
+    if (result.status.ok()) {
+      locked.fields->num_bytes_sent += send.envelope_size;
+    } else {
+      locked.fields->num_failed_attempts++;
     }
-    locked->fields->last_send_status = status;
+    locked.fields->last_send_status = result.status;
   }
-  if (status.ok()) {
-    VLOG(4) << "ShippingManager::SendOneEnvelope: OK";
-    return;
+
+  if (result.status.ok()) {
+    VLOG(4) << "ShippingManager: Envelope of size " << send.envelope_size
+            << " bytes sent in " << result.latency.count() << " ms.";
+    for (uint64_t record_id : send.record_ids) {
+      envelope_log_->Reclaim(record_id);
+    }
+    return true;
   }
 
-  VLOG(1) << "Cobalt send to Shuffler failed: (" << status.error_code() << ") "
-          << status.error_message()
-          << ". Observations have been re-enqueued for later.";
-  envelopes_that_failed->emplace_back(std::move(envelope_to_send));
+  VLOG(1) << "Cobalt send to Shuffler failed: (" << result.status.error_code()
+          << ") " << result.status.error_message()
+          << ". Observations have been kept for later.";
+  // The Shuffler stores the Envelopes of a stream only if it accepts all of
+  // them, so every Envelope of a failed send is sent again. Re-enqueue the
+  // Envelopes that were sent from memory, combining each with the previous
+  // failure as SendOneEnvelope() would if they were sent again.
+  for (auto& envelope_maker : send.envelope_makers) {
+    if (!envelopes_that_failed->empty() &&
+        envelopes_that_failed->back()->size() <
+            size_params_.min_envelope_send_size_ &&
+        envelopes_that_failed->back()->size() + envelope_maker->size() <=
+            size_params_.max_bytes_per_envelope_) {
+      envelopes_that_failed->back()->MergeOutOf(envelope_maker.get());
+    } else {
+      envelopes_that_failed->emplace_back(std::move(envelope_maker));
+    }
+  }
+  return false;
+}
+
+bool ShippingManager::FinishAllSends(
+    std::deque<std::unique_ptr<EnvelopeMaker>>* envelopes_that_failed) {
+  bool success = StartPendingSend(envelopes_that_failed);
+  while (!in_flight_sends_.empty()) {
+    success = FinishOldestSend(envelopes_that_failed) && success;
+  }
+  return success;
 }
 
 void ShippingManager::WaitUntilIdle(std::chrono::seconds max_wait) {
+  // Observations may have been added without the mutex since the worker
+  // thread became idle, in which case it is about to be woken.
   auto locked = lock();
-  if (locked->fields->shut_down || locked->fields->idle) {
+  auto is_idle = [this, &locked] {
+    return (locked.fields->shut_down ||
+            (locked.fields->idle && intake_bytes_ == 0));
+  };
+  if (is_idle()) {
     return;
   }
-  locked->fields->idle_notifier.wait_for(locked->lock, max_wait, [&locked] {
-    return (locked->fields->shut_down || locked->fields->idle);
-  });
+  locked.fields->idle_notifier.wait_for(locked.lock, max_wait, is_idle);
 }
 
 void ShippingManager::WaitUntilWorkerWaiting(std::chrono::seconds max_wait) {
   auto locked = lock();
-  if (locked->fields->shut_down || locked->fields->waiting_for_schedule) {
+  if (locked.fields->shut_down || locked.fields->waiting_for_schedule) {
     return;
   }
-  locked->fields->waiting_for_schedule_notifier.wait_for(
-      locked->lock, max_wait, [&locked] {
-        return (locked->fields->shut_down ||
-                locked->fields->waiting_for_schedule);
+  locked.fields->waiting_for_schedule_notifier.wait_for(
+      locked.lock, max_wait, [&locked] {
+        return (locked.fields->shut_down ||
+                locked.fields->waiting_for_schedule);
       });
 }
 
@@ -9,6 +9,8 @@
 #include <chrono>
 #include <condition_variable>
 #include <deque>
+#include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -16,7 +18,9 @@
 #include <vector>
 
 #include "./logging.h"
+#include "encoder/envelope_log.h"
 #include "encoder/envelope_maker.h"
+#include "encoder/observation_ring.h"
 #include "encoder/send_retryer.h"
 #include "encoder/shuffler_client.h"
 
@@ -41,12 +45,25 @@ using send_retryer::SendRetryerInterface;
 // the collection of Observations it controls into one or more Envelopes
 // in order to try to achieve an efficient size Envelope to send.
 //
+// By default the unsent Observations are held only in memory. If
+// EnablePersistence() is invoked they are instead written to an EnvelopeLog
+// on disk before each send, and removed from it once they have been sent, so
+// that they survive restarts of the process and a much larger backlog may be
+// accumulated while the Shuffler is unreachable.
+//
 // Usage: Construct a ShippingManager, invoke Start() once, and repeatedly
 // invoke AddObservation(). After Start() has been invoked calls to
 // AddObservation() are thread safe: It may be invoked concurrently
 // by multiple threads. Optionally invoke RequestSendSoon() to expedite a send
 // operation.
 //
+// AddObservation() encrypts the Observation on the calling thread without
+// holding any lock and hands it to the worker thread through a lock-free
+// ObservationRing, so that many threads may add Observations concurrently
+// without being serialized behind each other's encryption. The mutex is
+// acquired by AddObservation() only to wake the worker thread or to
+// request an expedited send.
+//
 // Usually a single ShippingManager will be constructed for an entire
 // client device and all applications running on that device that wish to use
 // Cobalt to collect metrics will make use of this single instance.
@@ -78,6 +95,12 @@ class ShippingManager {
     // with sizes smaller than this value (in bytes) into Envelopes whose size
     // exceeds this value prior to sending to the Shuffler.
     //
+    // If the Envelopes are encrypted to the Shuffler using the
+    // HYBRID_ECDH_V1_DEFLATE scheme then all of these sizes are measured in
+    // compressed bytes: The size of each Observation is scaled by the
+    // compression ratio achieved by the most recently sent Envelope, so that
+    // each Envelope holds more Observations.
+    //
     // REQUIRED:
     // 0 <= max_bytes_per_observation <= max_bytes_per_envelope <=
     // max_bytes_total
@@ -161,17 +184,41 @@ class ShippingManager {
   // Parameters passed to the ShippingManager constructor that will be passed
   // to the method SendRetryer::SendToShuffler(). See the documentation of
   // that method.
+  //
+  // max_concurrent_sends: The maximum number of sends the worker thread
+  // will have in flight to the Shuffler at once. Each is performed by its own
+  // invocation of the SendRetryer, which retries it independently. The
+  // results are accounted for in the order in which the sends were started.
+  //
+  // max_envelopes_per_stream: The maximum number of Envelopes in each send.
+  // If this is more than 1 then the Envelopes are sent together using
+  // SendRetryer::SendStreamToShuffler(), which saves the per-RPC overhead
+  // of sending them one at a time. A send containing a single Envelope
+  // always uses SendRetryer::SendToShuffler().
+  //
+  // REQUIRED:
+  // max_concurrent_sends >= 1
+  // max_envelopes_per_stream >= 1
   class SendRetryerParams {
    public:
     SendRetryerParams(std::chrono::seconds initial_rpc_deadline,
-                      std::chrono::seconds deadline_per_send_attempt)
+                      std::chrono::seconds deadline_per_send_attempt,
+                      size_t max_concurrent_sends = 1,
+                      size_t max_envelopes_per_stream = 1)
         : initial_rpc_deadline_(initial_rpc_deadline),
-          deadline_per_send_attempt_(deadline_per_send_attempt) {}
+          deadline_per_send_attempt_(deadline_per_send_attempt),
+          max_concurrent_sends_(max_concurrent_sends),
+          max_envelopes_per_stream_(max_envelopes_per_stream) {
+      CHECK_GE(max_concurrent_sends_, 1u);
+      CHECK_GE(max_envelopes_per_stream_, 1u);
+    }
 
    private:
     friend class ShippingManager;
     std::chrono::seconds initial_rpc_deadline_;
     std::chrono::seconds deadline_per_send_attempt_;
+    size_t max_concurrent_sends_;
+    size_t max_envelopes_per_stream_;
   };
 
   // Constructor
@@ -201,6 +248,16 @@ class ShippingManager {
   // before exiting.
   ~ShippingManager();
 
+  // Makes the ShippingManager keep its unsent Observations in an EnvelopeLog
+  // in |directory|, which must exist and be used by no other ShippingManager.
+  // Observations left there by an earlier ShippingManager will be sent. The
+  // size of the accumulated, unsent Observation data is limited by
+  // |max_bytes_total| rather than by the max_bytes_total of the SizeParams.
+  // Returns false if the EnvelopeLog could not be opened, in which case the
+  // Observations will be kept in memory. This method must be invoked before
+  // Start().
+  bool EnablePersistence(const std::string& directory, size_t max_bytes_total);
+
   // Starts the worker thread. Destruct this object to stop the worker thread.
   // This method must be invoked exactly once.
   void Start();
@@ -215,10 +272,10 @@ class ShippingManager {
 
     // The Observation was not added to the Envelope because the Shipping
     // manager has too large of a backlog of Observations that have not yet
-    // been sent. In the current version we use a pure in-memory cache not
-    // backed by a persistent cache and so we return this error if the in-memory
-    // backlog gets too large. In later versions we will have a persistent
-    // cache and so the threshold for returning this error will be much higher.
+    // been sent. Unless EnablePersistence() has been invoked the backlog is
+    // kept in memory and the threshold for returning this error is the
+    // max_bytes_total of the SizeParams. With persistence the threshold is
+    // the much higher limit passed to EnablePersistence().
     kFull,
 
     // The ShippingManager is shutting down. No more Observations will be
@@ -237,6 +294,17 @@ class ShippingManager {
   Status AddObservation(const Observation& observation,
                         std::unique_ptr<ObservationMetadata> metadata);
 
+  // Adds all of the |observations|, which share the same |metadata|, to the
+  // collection of Observations controlled by this ShippingManager. This is
+  // intended to be used with the output of Encoder::EncodeBatch(). The batch
+  // is handed to the worker thread as a single unit, and either all of the
+  // Observations are added or none of them are. kObservationTooBig is
+  // returned if the batch as a whole is bigger than |max_bytes_per_envelope|;
+  // such a batch must be split by the caller.
+  Status AddObservationBatch(
+      const google::protobuf::RepeatedPtrField<Observation>& observations,
+      std::unique_ptr<ObservationMetadata> metadata);
+
   // Register a request with the ShippingManager for an expedited send.
   // The ShippingManager's worker thread will use the |SendRetryer| to send
   // all of the accumulated, unsent Observations as soon as possible but not
@@ -283,6 +351,15 @@ class ShippingManager {
   size_t num_failed_attempts();
   grpc::Status last_send_status();
 
+  // Per-send metrics. num_retries() is the total number of RPCs that were
+  // retried by the SendRetryer, num_bytes_sent() is the total size of the
+  // Observations in the Envelopes that were sent successfully and
+  // last_send_latency() is the time taken by the most recently completed
+  // send attempt, including its retries.
+  size_t num_retries();
+  size_t num_bytes_sent();
+  std::chrono::milliseconds last_send_latency();
+
  private:
   // Has the ShippingManager been shut down?
   bool shut_down();
@@ -297,6 +374,20 @@ class ShippingManager {
   // exits when ShutDown() is invoked.
   void Run();
 
+  // Encrypts |observation| into |*encrypted_message| and writes its
+  // EnvelopeMaker::ObservationSize(), scaled by |compression_ratio_|, to
+  // |*obs_size|. Does not acquire the mutex_ lock.
+  Status EncryptObservation(const Observation& observation,
+                            EncryptedMessage* encrypted_message,
+                            size_t* obs_size);
+
+  // Does the work of AddObservation() and AddObservationBatch() once the
+  // Observations in |*entry| have been encrypted. Reserves room for them in
+  // the active EnvelopeMaker and pushes them into |intake_ring_|. Acquires
+  // the mutex_ lock only if the worker thread must be woken, a send must be
+  // requested or the ring is full.
+  Status AddToIntake(ObservationRing::Entry* entry);
+
   // Helper method used by Run(). Does not assume mutex_ lock is held.
   void SendAllEnvelopes();
 
@@ -304,6 +395,79 @@ class ShippingManager {
   void SendOneEnvelope(
       std::deque<std::unique_ptr<EnvelopeMaker>>* envelopes_that_failed);
 
+  // Helper method used by SendAllEnvelopes() when persistence is enabled.
+  // Appends |envelopes_to_send_| to |envelope_log_| and then sends and
+  // reclaims the records in the log. Returns true if all of them were sent.
+  // Does not assume mutex_ lock is held.
+  bool SendAllEnvelopesFromLog();
+
+  // The result of one invocation of SendRetryer::SendToShuffler().
+  struct SendResult {
+    grpc::Status status;
+    std::chrono::milliseconds latency;
+    size_t num_retries;
+  };
+
+  // A send of one or more Envelopes that has been started by
+  // StartPendingSend() but not yet accounted for by FinishOldestSend().
+  struct InFlightSend {
+    std::future<SendResult> result;
+
+    // The number of bytes of Observations in the Envelopes being sent.
+    size_t envelope_size = 0;
+
+    // The EnvelopeMakers of those Envelopes that are being sent from memory.
+    // They are re-enqueued if the send fails.
+    std::vector<std::unique_ptr<EnvelopeMaker>> envelope_makers;
+
+    // The records from which those Envelopes that are being sent from
+    // |envelope_log_| were made. They are reclaimed if the send succeeds.
+    std::vector<uint64_t> record_ids;
+  };
+
+  // Adds |encrypted_envelope|, whose Envelope has |envelope_size| bytes of
+  // Observations, to |pending_send_| along with its |envelope_maker| or its
+  // |record_ids|. Once |pending_send_| holds max_envelopes_per_stream
+  // Envelopes, invokes StartPendingSend(envelopes_that_failed) and returns
+  // its result. Otherwise returns true. Does not assume mutex_ lock is held.
+  bool QueueSend(
+      EncryptedMessage encrypted_envelope, size_t envelope_size,
+      std::unique_ptr<EnvelopeMaker> envelope_maker,
+      std::vector<uint64_t> record_ids,
+      std::deque<std::unique_ptr<EnvelopeMaker>>* envelopes_that_failed);
+
+  // Starts sending the Envelopes in |pending_send_|, if there are any, on
+  // another thread using the SendRetryer and moves |pending_send_| to
+  // |in_flight_sends_|. If max_concurrent_sends sends are already in flight,
+  // first waits for the oldest of them by invoking
+  // FinishOldestSend(envelopes_that_failed), and returns false if that send
+  // failed. Does not assume mutex_ lock is held.
+  bool StartPendingSend(
+      std::deque<std::unique_ptr<EnvelopeMaker>>* envelopes_that_failed);
+
+  // Waits for the oldest send in |in_flight_sends_| to complete and accounts
+  // for it: updates the diagnostic stats, reclaims its records from
+  // |envelope_log_| if it succeeded and otherwise appends its EnvelopeMakers
+  // to |envelopes_that_failed|. Returns whether it succeeded. Does not assume
+  // mutex_ lock is held.
+  bool FinishOldestSend(
+      std::deque<std::unique_ptr<EnvelopeMaker>>* envelopes_that_failed);
+
+  // Invokes StartPendingSend() and then FinishOldestSend() until no sends
+  // are in flight. Returns true if all of them succeeded.
+  bool FinishAllSends(
+      std::deque<std::unique_ptr<EnvelopeMaker>>* envelopes_that_failed);
+
+  // Returns a new, empty EnvelopeMaker.
+  std::unique_ptr<EnvelopeMaker> NewEnvelopeMaker();
+
+  // If Envelopes are compressed, sets |compression_ratio_| to the ratio of
+  // the size of |encrypted_envelope| to the sum of the uncompressed sizes of
+  // the Observations in |envelope|, from which it was made. Invoked only by
+  // the worker thread.
+  void UpdateCompressionRatio(const Envelope& envelope,
+                              const EncryptedMessage& encrypted_envelope);
+
   const SizeParams size_params_;
 
   // When the active EnvelopeMaker surpasses this size (in bytes) we invoke
@@ -312,11 +476,19 @@ class ShippingManager {
   // active Envelope is full.
   const size_t envelope_send_threshold_size_;
 
+  // The number of entries in |intake_ring_|.
+  static const size_t kIntakeRingCapacity = 1024;
+
+  // When the total amount of Observation data reaches this size we return
+  // kFull. This is size_params_.max_bytes_total_ unless EnablePersistence()
+  // has been invoked.
+  size_t max_bytes_total_;
+
   // When the total amount of Observation data surpasses this size
   // we invoke RequestSendSoon(). This value is set to 0.6 * max_bytes_total_
   // so that it is unlikely that we ever need to return kFull because the
   // the total amount of Observation data is too great.
-  const size_t total_bytes_send_threshold_;
+  size_t total_bytes_send_threshold_;
 
   const ScheduleParams schedule_params_;
   const EnvelopeMakerParams envelope_maker_params_;
@@ -324,12 +496,73 @@ class ShippingManager {
 
   SendRetryerInterface* send_retryer_;  // not owned
 
+  // Used by the threads that add Observations to encrypt them to the
+  // Analyzer. It may be used concurrently.
+  const util::EncryptedMessageMaker encrypt_to_analyzer_;
+
+  // Encrypted Observations that have been added but not yet moved into the
+  // active EnvelopeMaker. Any thread may push. Only the holder of the mutex
+  // pops.
+  ObservationRing intake_ring_;
+
+  // The following are read by AddObservation() without holding the mutex.
+  // Except for |intake_bytes_| and |compression_ratio_| they are only written
+  // while holding it.
+
+  // Set to true in order to stop accepting Observations. It mirrors
+  // MutexProtectedFields::shut_down.
+  std::atomic<bool> shutting_down_{false};
+
+  // Setting this to true indicates that the total size of all Observations
+  // currently stored in the ShippingManager is too large. We will stop
+  // accepting any more Observations until this is set to false again.
+  std::atomic<bool> temporarily_full_{false};
+
+  // Keeps track of the sum of the sizes of all Envelopes in
+  // |envelopes_to_send_| and |envelope_log_|.
+  std::atomic<size_t> envelopes_to_send_total_bytes_{0};
+
+  // The sum of the sizes of the Observations in the active EnvelopeMaker and
+  // in |intake_ring_|, including those for which AddObservation() has
+  // reserved room but which it has not yet pushed. AddObservation() never
+  // lets this exceed max_bytes_per_envelope, so the entries in the ring
+  // always fit into the active EnvelopeMaker.
+  std::atomic<size_t> intake_bytes_{0};
+
+  // The factor by which the sizes of Observations are multiplied to estimate
+  // the number of bytes they will occupy in a compressed Envelope. It is 1
+  // unless Envelopes are compressed, and never more than 1. It is written
+  // only by the worker thread.
+  std::atomic<double> compression_ratio_{1.0};
+
   // Variables accessed only by the worker thread. These are not
   // protected by a mutex.
   std::chrono::system_clock::time_point next_scheduled_send_time_;
 
   std::deque<std::unique_ptr<EnvelopeMaker>> envelopes_to_send_;
-  send_retryer::CancelHandle cancel_handle_;
+
+  // The Envelopes that have been queued by QueueSend() but not yet started
+  // by StartPendingSend(). |pending_send_| does not yet have a result.
+  std::vector<EncryptedMessage> pending_encrypted_envelopes_;
+  InFlightSend pending_send_;
+
+  // The sends that have been started but not yet accounted for, oldest
+  // first.
+  std::deque<InFlightSend> in_flight_sends_;
+
+  // The number of sends that have been started. The send with sequence
+  // number n uses |cancel_handles_[n % max_concurrent_sends]|, which is free
+  // because sends are accounted for in the order in which they were started.
+  size_t num_sends_started_ = 0;
+
+  // One CancelHandle for each of the max_concurrent_sends possible in-flight
+  // sends. ShutDown() cancels all of them.
+  std::unique_ptr<send_retryer::CancelHandle[]> cancel_handles_;
+
+  // If persistence is enabled, the log into which the worker thread moves
+  // |envelopes_to_send_| before each send. It is set before the worker thread
+  // is started.
+  std::unique_ptr<EnvelopeLog> envelope_log_;
 
   // The background worker thread that runs the method "Run()."
   std::thread worker_thread_;
@@ -363,18 +596,9 @@ class ShippingManager {
     // envelopes_to_send_total_bytes != 0.
     std::vector<SendCallback> current_send_callback_queue;
 
-    // Keeps track of the sum of the sizes of all Envelopes in
-    // |envelopes_to_send_|.
-    size_t envelopes_to_send_total_bytes = 0;
-
     // Set shut_down to true in order to stop "Run()".
     bool shut_down = false;
 
-    // Setting this to true indicates that the total size of all Observations
-    // currently stored in the ShippingManager is too large. We will stop
-    // accepting any more Observations until this is set to false again.
-    bool temporarily_full = false;
-
     // We initialize idle_ and waiting_for_schedule_ to true because initially
     // the worker thread isn't even started so WaitUntilIdle() and
     // WaitUntilWorkerWaiting() should return immediately if invoked. We will
@@ -387,6 +611,9 @@ class ShippingManager {
     size_t num_send_attempts = 0;
     size_t num_failed_attempts = 0;
     grpc::Status last_send_status;
+    size_t num_retries = 0;
+    size_t num_bytes_sent = 0;
+    std::chrono::milliseconds last_send_latency{0};
 
     std::condition_variable add_observation_notifier;
     std::condition_variable expedited_send_notifier;
@@ -396,7 +623,8 @@ class ShippingManager {
   };
 
   // Constructing a LockedFields object constructs a std::unique_lock and
-  // therefore locks the mutex in |fields|.
+  // therefore locks the mutex in |fields|. It is movable so that lock() may
+  // return it by value without allocating.
   struct LockedFields {
     explicit LockedFields(MutexProtectedFields* fields)
         : lock(fields->mutex), fields(fields) {}
@@ -406,22 +634,26 @@ class ShippingManager {
 
   // All of the fields that are accessed by multiple threads and therefore
   // need to be protected by a mutex. Do not access this variable directly.
-  // Instead invoke the method lock() which returns a smart pointer to a
-  // |LockedFields| that wraps this field. All access to this field should
-  // be via the following idiom:
+  // Instead invoke the method lock() which returns a |LockedFields| that
+  // wraps this field. All access to this field should be via the following
+  // idiom:
   //
   // auto locked = lock();
-  // locked->fields->[field_name].
+  // locked.fields->[field_name].
   MutexProtectedFields _mutex_protected_fields_do_not_access_directly_;
 
   // Provides access to the fields that are protected by a mutex while
-  // acquiring a lock on the mutex. Destroy the returned std::unique_ptr to
+  // acquiring a lock on the mutex. Destroy the returned LockedFields to
   // release the mutex.
-  std::unique_ptr<LockedFields> lock() {
-    return std::unique_ptr<LockedFields>(
-        new LockedFields(&_mutex_protected_fields_do_not_access_directly_));
+  LockedFields lock() {
+    return LockedFields(&_mutex_protected_fields_do_not_access_directly_);
   }
 
+  // Moves the entries in |intake_ring_| into the active EnvelopeMaker.
+  // Holding the fields->mutex lock makes the caller the single consumer of
+  // the ring.
+  void DrainIntakeLockHeld(MutexProtectedFields* fields);
+
   // Does the work of TakeActiveEnvelopeMaker() and assumes that the
   // fields->mutex lock is held.
   std::unique_ptr<EnvelopeMaker> TakeActiveEnvelopeMakerLockHeld(
@@ -0,0 +1,141 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/shipping_manager.h"
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+#include "util/crypto_util/cipher.h"
+
+namespace cobalt {
+namespace encoder {
+
+using crypto::HybridCipher;
+
+namespace {
+
+const int kNumObservations = 6400;
+const std::chrono::seconds kMaxSeconds = ShippingManager::kMaxSeconds;
+
+// A SendRetryer that accepts every Envelope without sending it anywhere.
+class NoOpSendRetryer : public SendRetryerInterface {
+ public:
+  grpc::Status SendToShuffler(
+      std::chrono::seconds initial_rpc_deadline,
+      std::chrono::seconds overerall_deadline,
+      send_retryer::CancelHandle* cancel_handle,
+      const EncryptedMessage& encrypted_message) override {
+    return grpc::Status::OK;
+  }
+
+  grpc::Status SendStreamToShuffler(
+      std::chrono::seconds initial_rpc_deadline,
+      std::chrono::seconds overerall_deadline,
+      send_retryer::CancelHandle* cancel_handle,
+      const std::vector<EncryptedMessage>& encrypted_messages) override {
+    return grpc::Status::OK;
+  }
+};
+
+Observation MakeObservation(int index) {
+  Observation observation;
+  ObservationPart& part = (*observation.mutable_parts())["part"];
+  part.set_encoding_config_id(1);
+  part.mutable_forculus()->set_ciphertext("ciphertext" +
+                                          std::to_string(index));
+  return observation;
+}
+
+std::unique_ptr<ObservationMetadata> MakeMetadata() {
+  std::unique_ptr<ObservationMetadata> metadata(new ObservationMetadata());
+  metadata->set_customer_id(1);
+  metadata->set_project_id(1);
+  metadata->set_metric_id(1);
+  metadata->set_day_index(1);
+  return metadata;
+}
+
+// Adds kNumObservations Observations, encrypted to the Analyzer with a real
+// key, to a ShippingManager from |num_threads| threads concurrently and
+// returns the number of seconds taken.
+double TimeConcurrentAdds(const std::string& analyzer_public_key,
+                          int num_threads) {
+  NoOpSendRetryer send_retryer;
+  ShippingManager shipping_manager(
+      ShippingManager::SizeParams(1024, 1024 * 1024, 16 * 1024 * 1024,
+                                  64 * 1024),
+      ShippingManager::ScheduleParams(kMaxSeconds,
+                                      std::chrono::seconds::zero()),
+      ShippingManager::EnvelopeMakerParams(analyzer_public_key,
+                                           EncryptedMessage::HYBRID_ECDH_V1,
+                                           "", EncryptedMessage::NONE),
+      ShippingManager::SendRetryerParams(std::chrono::seconds(10),
+                                         std::chrono::seconds(60)),
+      &send_retryer);
+  shipping_manager.Start();
+
+  int num_per_thread = kNumObservations / num_threads;
+  auto t_start = std::chrono::high_resolution_clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&shipping_manager, num_per_thread, t] {
+      for (int i = 0; i < num_per_thread; i++) {
+        Observation observation = MakeObservation(t * num_per_thread + i);
+        ShippingManager::Status status;
+        // kFull is returned while the worker thread catches up.
+        while ((status = shipping_manager.AddObservation(
+                    observation, MakeMetadata())) == ShippingManager::kFull) {
+          std::this_thread::yield();
+        }
+        EXPECT_EQ(ShippingManager::kOk, status);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto t_end = std::chrono::high_resolution_clock::now();
+  shipping_manager.RequestSendSoon();
+  shipping_manager.WaitUntilIdle(kMaxSeconds);
+  return std::chrono::duration<double>(t_end - t_start).count();
+}
+
+}  // namespace
+
+// Measures the throughput of ShippingManager::AddObservation(), including the
+// encryption of each Observation to the Analyzer, when it is invoked
+// concurrently by 1, 8 and 64 threads.
+TEST(ShippingManagerPerformanceTest, ConcurrentAddObservation) {
+  std::string public_key, private_key;
+  ASSERT_TRUE(HybridCipher::GenerateKeyPairPEM(&public_key, &private_key));
+
+  std::cout << "\n=================================================\n";
+  std::cout << "Observations added: " << kNumObservations << std::endl;
+  std::cout << "Hardware threads: " << std::thread::hardware_concurrency()
+            << std::endl;
+  for (int num_threads : {1, 8, 64}) {
+    double seconds = TimeConcurrentAdds(public_key, num_threads);
+    std::cout << num_threads << " threads: " << seconds << " seconds, "
+              << kNumObservations / seconds << " observations per second.\n";
+  }
+  std::cout << "\n=================================================\n";
+}
+
+}  // namespace encoder
+}  // namespace cobalt
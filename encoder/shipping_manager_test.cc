@@ -4,7 +4,12 @@
 
 #include "encoder/shipping_manager.h"
 
+#include <dirent.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
 #include <memory>
 #include <string>
 #include <utility>
@@ -19,6 +24,7 @@
 // Generated from shipping_manager_test_config.yaml
 #include "encoder/shipping_manager_test_config.h"
 #include "third_party/gflags/include/gflags/gflags.h"
+#include "util/crypto_util/cipher.h"
 
 namespace cobalt {
 namespace encoder {
@@ -47,6 +53,7 @@ const size_t kMaxBytesTotal = 1000;
 // 40 bytes, the worker thread will attempt to send Envelopes that contain
 // exactly 5, 40-byte Observations. (4 * 40 < 170 and 6 * 40 > 200 ).
 const size_t kMinEnvelopeSendSize = 170;
+const size_t kMaxBytesTotalPersistent = 2000;
 const std::chrono::seconds kInitialRpcDeadline(10);
 const std::chrono::seconds kDeadlinePerSendAttempt(60);
 const std::chrono::seconds kMaxSeconds = ShippingManager::kMaxSeconds;
@@ -97,9 +104,57 @@ struct FakeSendRetryer : public SendRetryerInterface {
       std::chrono::seconds overerall_deadline,
       send_retryer::CancelHandle* cancel_handle,
       const EncryptedMessage& encrypted_message) override {
-    // Decrypt encrypted_message. (No actual decryption is involved since
-    // we used the NONE encryption scheme.)
-    util::MessageDecrypter decrypter("");
+    int num_observations = 0;
+    grpc::Status status = Receive(encrypted_message, &num_observations);
+    if (status.ok()) {
+      std::unique_lock<std::mutex> lock(mutex);
+      accepted_observation_count += num_observations;
+    }
+    return status;
+  }
+
+  // Each Envelope in the stream is treated as a call to SendToShuffler().
+  // As on the Shuffler, the Observations of a stream are accepted only if
+  // every Envelope in it is.
+  grpc::Status SendStreamToShuffler(
+      std::chrono::seconds initial_rpc_deadline,
+      std::chrono::seconds overerall_deadline,
+      send_retryer::CancelHandle* cancel_handle,
+      const std::vector<EncryptedMessage>& encrypted_messages) override {
+    int fail_at;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      stream_call_count++;
+      fail_at = fail_stream_at_envelope;
+      fail_stream_at_envelope = -1;
+    }
+    int num_observations = 0;
+    for (size_t i = 0; i < encrypted_messages.size(); i++) {
+      int num_envelope_observations = 0;
+      grpc::Status status =
+          Receive(encrypted_messages[i], &num_envelope_observations);
+      if (status.ok() && static_cast<int>(i) == fail_at) {
+        status = grpc::Status(grpc::INVALID_ARGUMENT, "Failed by the test.");
+      }
+      if (!status.ok()) {
+        return status;
+      }
+      num_observations += num_envelope_observations;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    accepted_observation_count += num_observations;
+    return grpc::Status::OK;
+  }
+
+  // Checks and counts the Envelope in |encrypted_message|, sets
+  // |*num_observations| to the number of Observations in it and returns
+  // |status_to_return|, blocking first if |should_block| is set.
+  grpc::Status Receive(const EncryptedMessage& encrypted_message,
+                       int* num_observations) {
+    // Decrypt encrypted_message. (No actual decryption is involved unless
+    // the test has set |private_key_pem|. Otherwise we used the NONE
+    // encryption scheme.)
+    util::MessageDecrypter decrypter(private_key_pem);
     Envelope recovered_envelope;
     EXPECT_TRUE(
         decrypter.DecryptMessage(encrypted_message, &recovered_envelope));
@@ -107,24 +162,30 @@ struct FakeSendRetryer : public SendRetryerInterface {
     EXPECT_EQ(kMetricId, recovered_envelope.batch(0).meta_data().metric_id());
     FakeSystemData::CheckSystemProfile(recovered_envelope);
 
+    *num_observations =
+        recovered_envelope.batch(0).encrypted_observation_size();
+
     std::unique_lock<std::mutex> lock(mutex);
     send_call_count++;
-    observation_count +=
-        recovered_envelope.batch(0).encrypted_observation_size();
+    observation_count += *num_observations;
     // We grab the return value before we block. This allows the test
     // thread to wait for us to block, then change the value of
     // status_to_return for the *next* send without changing it for
     // the currently blocking send.
     grpc::Status status = status_to_return;
+    num_in_flight++;
+    max_num_in_flight = std::max(max_num_in_flight, num_in_flight);
     if (should_block) {
       is_blocking = true;
       send_is_blocking_notifier.notify_all();
       send_can_exit_notifier.wait(lock, [this] { return !should_block; });
       is_blocking = false;
     }
+    num_in_flight--;
     return status;
   }
 
+  std::string private_key_pem;
   std::mutex mutex;
   bool should_block = false;
   std::condition_variable send_can_exit_notifier;
@@ -132,7 +193,14 @@ struct FakeSendRetryer : public SendRetryerInterface {
   std::condition_variable send_is_blocking_notifier;
   grpc::Status status_to_return = grpc::Status::OK;
   int send_call_count = 0;
+  int stream_call_count = 0;
   int observation_count = 0;
+  // The number of Observations in the sends that succeeded.
+  int accepted_observation_count = 0;
+  // If non-negative, the next stream fails at the Envelope with this index.
+  int fail_stream_at_envelope = -1;
+  int num_in_flight = 0;
+  int max_num_in_flight = 0;
 };
 
 }  // namespace
@@ -144,8 +212,30 @@ class ShippingManagerTest : public ::testing::Test {
         encoder_(project_, ClientSecret::GenerateNewSecret(), &system_data_) {}
 
  protected:
+  void TearDown() override {
+    if (persistence_directory_.empty()) {
+      return;
+    }
+    shipping_manager_.reset();
+    DIR* dir = opendir(persistence_directory_.c_str());
+    while (struct dirent* entry = readdir(dir)) {
+      if (entry->d_name[0] != '.') {
+        std::remove((persistence_directory_ + "/" + entry->d_name).c_str());
+      }
+    }
+    closedir(dir);
+    rmdir(persistence_directory_.c_str());
+  }
+
+  // If |persistent| is true the ShippingManager keeps its unsent Observations
+  // in a temporary directory, which is the same for every invocation of
+  // Init() within a test.
   void Init(std::chrono::seconds schedule_interval,
-            std::chrono::seconds min_interval) {
+            std::chrono::seconds min_interval, bool persistent = false,
+            size_t max_concurrent_sends = 1,
+            size_t max_envelopes_per_stream = 1) {
+    // Destroy any earlier ShippingManager before its SendRetryer.
+    shipping_manager_.reset();
     send_retryer_.reset(new FakeSendRetryer());
     shipping_manager_.reset(new ShippingManager(
         ShippingManager::SizeParams(kMaxBytesPerObservation,
@@ -155,8 +245,19 @@ class ShippingManagerTest : public ::testing::Test {
         ShippingManager::EnvelopeMakerParams("", EncryptedMessage::NONE, "",
                                              EncryptedMessage::NONE),
         ShippingManager::SendRetryerParams(kInitialRpcDeadline,
-                                           kDeadlinePerSendAttempt),
+                                           kDeadlinePerSendAttempt,
+                                           max_concurrent_sends,
+                                           max_envelopes_per_stream),
         send_retryer_.get()));
+    if (persistent) {
+      if (persistence_directory_.empty()) {
+        char dir_template[] = "/tmp/shipping_manager_test_XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(dir_template));
+        persistence_directory_ = dir_template;
+      }
+      ASSERT_TRUE(shipping_manager_->EnablePersistence(
+          persistence_directory_, kMaxBytesTotalPersistent));
+    }
     shipping_manager_->Start();
   }
 
@@ -169,6 +270,21 @@ class ShippingManagerTest : public ::testing::Test {
                                              std::move(result.metadata));
   }
 
+  ShippingManager::Status AddObservationBatch(size_t num_observations,
+                                              size_t num_bytes) {
+    CHECK(num_bytes > kNoOpEncodingByteOverhead) << " num_bytes=" << num_bytes;
+    std::vector<ValuePart> values(num_observations);
+    for (auto& value : values) {
+      value.set_string_value(
+          std::string(num_bytes - kNoOpEncodingByteOverhead, 'x'));
+    }
+    Encoder::BatchResult batch;
+    CHECK_EQ(Encoder::kOK, encoder_.EncodeBatch(kMetricId, kEncodingConfigId,
+                                                values, &batch));
+    return shipping_manager_->AddObservationBatch(batch.observations,
+                                                  std::move(batch.metadata));
+  }
+
   void CheckCallCount(int expected_call_count, int expected_observation_count) {
     std::unique_lock<std::mutex> lock(send_retryer_->mutex);
     EXPECT_EQ(expected_call_count, send_retryer_->send_call_count);
@@ -180,6 +296,7 @@ class ShippingManagerTest : public ::testing::Test {
   std::unique_ptr<ShippingManager> shipping_manager_;
   std::shared_ptr<ProjectContext> project_;
   Encoder encoder_;
+  std::string persistence_directory_;
 };
 
 // We construct a ShippingManager and destruct it without calling any methods.
@@ -224,6 +341,34 @@ TEST_F(ShippingManagerTest, SendOne) {
   CheckCallCount(1, 1);
 }
 
+// We add a batch of two Observations, confirm that they are not immediately
+// sent, invoke RequestSendSoon, wait for the Observations to be sent, confirm
+// that they were sent together in a single Envelope.
+TEST_F(ShippingManagerTest, SendBatch) {
+  // Init with a very long time for the regular schedule interval but
+  // zero for the minimum interval so the test doesn't have to wait.
+  Init(kMaxSeconds, std::chrono::seconds::zero());
+  EXPECT_EQ(ShippingManager::kOk, AddObservationBatch(2, 40));
+
+  // Confirm they have not been sent yet.
+  CheckCallCount(0, 0);
+
+  // Invoke RequestSendSoon.
+  shipping_manager_->RequestSendSoon();
+
+  // Wait for them to be sent.
+  shipping_manager_->WaitUntilIdle(kMaxSeconds);
+
+  // Confirm they have been sent together.
+  EXPECT_EQ(1u, shipping_manager_->num_send_attempts());
+  EXPECT_EQ(0u, shipping_manager_->num_failed_attempts());
+  CheckCallCount(1, 2);
+
+  // A batch that is bigger than max_bytes_per_envelope can never be sent
+  // in a single Envelope and so is rejected.
+  EXPECT_EQ(ShippingManager::kObservationTooBig, AddObservationBatch(6, 40));
+}
+
 // We add two Observations, confirm that they are not immediately sent,
 // invoke RequestSendSoon, wait for the Observations to be sent, confirm
 // that they were sent together in a single Envelope.
@@ -675,5 +820,247 @@ TEST_F(ShippingManagerTest,
   EXPECT_FALSE(success2);
 }
 
+// Tests that with max_concurrent_sends > 1 several Envelopes are in flight
+// at once and that their results are all accounted for.
+TEST_F(ShippingManagerTest, ConcurrentSends) {
+  Init(kMaxSeconds, std::chrono::seconds::zero(), false, 3);
+  {
+    std::unique_lock<std::mutex> lock(send_retryer_->mutex);
+    send_retryer_->status_to_return = grpc::Status::CANCELLED;
+  }
+
+  // Accumulate three Envelopes of five Observations each that failed to be
+  // sent. See the test ExceedMaxBytesTotal for the pattern of sends.
+  for (int i = 0; i < 15; i++) {
+    EXPECT_EQ(ShippingManager::kOk, AddObservation(40));
+    shipping_manager_->RequestSendSoon();
+    shipping_manager_->WaitUntilWorkerWaiting(kMaxSeconds);
+  }
+  EXPECT_EQ(0u, shipping_manager_->num_bytes_sent());
+
+  // Now let the sends succeed but block them until all three are in flight.
+  {
+    std::unique_lock<std::mutex> lock(send_retryer_->mutex);
+    send_retryer_->send_call_count = 0;
+    send_retryer_->observation_count = 0;
+    send_retryer_->max_num_in_flight = 0;
+    send_retryer_->status_to_return = grpc::Status::OK;
+    send_retryer_->should_block = true;
+  }
+  size_t num_send_attempts = shipping_manager_->num_send_attempts();
+  shipping_manager_->RequestSendSoon();
+  {
+    std::unique_lock<std::mutex> lock(send_retryer_->mutex);
+    EXPECT_TRUE(send_retryer_->send_is_blocking_notifier.wait_for(
+        lock, std::chrono::seconds(10),
+        [this] { return send_retryer_->num_in_flight == 3; }));
+    send_retryer_->should_block = false;
+    send_retryer_->send_can_exit_notifier.notify_all();
+  }
+  shipping_manager_->WaitUntilIdle(kMaxSeconds);
+
+  CheckCallCount(3, 15);
+  EXPECT_EQ(3, send_retryer_->max_num_in_flight);
+  EXPECT_EQ(num_send_attempts + 3, shipping_manager_->num_send_attempts());
+  EXPECT_EQ(grpc::OK, shipping_manager_->last_send_status().error_code());
+  EXPECT_EQ(15u * 40u, shipping_manager_->num_bytes_sent());
+  EXPECT_EQ(0u, shipping_manager_->num_retries());
+}
+
+// Tests that with max_envelopes_per_stream > 1 several Envelopes are sent
+// together on one stream.
+TEST_F(ShippingManagerTest, StreamedSends) {
+  Init(kMaxSeconds, std::chrono::seconds::zero(), false, 1, 3);
+  {
+    std::unique_lock<std::mutex> lock(send_retryer_->mutex);
+    send_retryer_->status_to_return = grpc::Status::CANCELLED;
+  }
+
+  // Accumulate three Envelopes of five Observations each that failed to be
+  // sent, as in the test ConcurrentSends.
+  for (int i = 0; i < 15; i++) {
+    EXPECT_EQ(ShippingManager::kOk, AddObservation(40));
+    shipping_manager_->RequestSendSoon();
+    shipping_manager_->WaitUntilWorkerWaiting(kMaxSeconds);
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(send_retryer_->mutex);
+    send_retryer_->send_call_count = 0;
+    send_retryer_->stream_call_count = 0;
+    send_retryer_->observation_count = 0;
+    send_retryer_->status_to_return = grpc::Status::OK;
+  }
+  size_t num_send_attempts = shipping_manager_->num_send_attempts();
+  bool success = false;
+  shipping_manager_->RequestSendSoon([&success](bool s) { success = s; });
+  shipping_manager_->WaitUntilIdle(kMaxSeconds);
+  EXPECT_TRUE(success);
+
+  // All three Envelopes are sent by a single send attempt on one stream.
+  CheckCallCount(3, 15);
+  EXPECT_EQ(1, send_retryer_->stream_call_count);
+  EXPECT_EQ(num_send_attempts + 1, shipping_manager_->num_send_attempts());
+  EXPECT_EQ(15u * 40u, shipping_manager_->num_bytes_sent());
+}
+
+// Tests that when a stream fails on its second Envelope all of the Envelopes
+// of the stream are sent again, and that because the Shuffler accepts a
+// stream all or nothing no Observation is accepted twice.
+TEST_F(ShippingManagerTest, StreamFailsOnSecondEnvelope) {
+  Init(kMaxSeconds, std::chrono::seconds::zero(), false, 1, 3);
+  {
+    std::unique_lock<std::mutex> lock(send_retryer_->mutex);
+    send_retryer_->status_to_return = grpc::Status::CANCELLED;
+  }
+
+  // Accumulate three Envelopes of five Observations each that failed to be
+  // sent, as in the test StreamedSends.
+  for (int i = 0; i < 15; i++) {
+    EXPECT_EQ(ShippingManager::kOk, AddObservation(40));
+    shipping_manager_->RequestSendSoon();
+    shipping_manager_->WaitUntilWorkerWaiting(kMaxSeconds);
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(send_retryer_->mutex);
+    send_retryer_->send_call_count = 0;
+    send_retryer_->stream_call_count = 0;
+    send_retryer_->observation_count = 0;
+    send_retryer_->accepted_observation_count = 0;
+    send_retryer_->status_to_return = grpc::Status::OK;
+    send_retryer_->fail_stream_at_envelope = 1;
+  }
+  bool success = true;
+  shipping_manager_->RequestSendSoon([&success](bool s) { success = s; });
+  shipping_manager_->WaitUntilWorkerWaiting(kMaxSeconds);
+  EXPECT_FALSE(success);
+
+  // The stream stopped at its second Envelope and nothing was accepted.
+  CheckCallCount(2, 10);
+  EXPECT_EQ(1, send_retryer_->stream_call_count);
+  EXPECT_EQ(0, send_retryer_->accepted_observation_count);
+  EXPECT_EQ(grpc::INVALID_ARGUMENT,
+            shipping_manager_->last_send_status().error_code());
+
+  // The next send attempt sends all three Envelopes again on a new stream.
+  shipping_manager_->RequestSendSoon([&success](bool s) { success = s; });
+  shipping_manager_->WaitUntilIdle(kMaxSeconds);
+  EXPECT_TRUE(success);
+  CheckCallCount(5, 25);
+  EXPECT_EQ(2, send_retryer_->stream_call_count);
+  EXPECT_EQ(15, send_retryer_->accepted_observation_count);
+}
+
+// Tests that with persistence enabled, Observations that could not be sent
+// are sent by a later ShippingManager using the same directory.
+TEST_F(ShippingManagerTest, PersistAcrossRestarts) {
+  Init(kMaxSeconds, std::chrono::seconds::zero(), true);
+  {
+    std::unique_lock<std::mutex> lock(send_retryer_->mutex);
+    send_retryer_->status_to_return = grpc::Status::CANCELLED;
+  }
+
+  // Each send attempt combines all of the Observations added so far into a
+  // single Envelope.
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(ShippingManager::kOk, AddObservation(40));
+    shipping_manager_->RequestSendSoon();
+    shipping_manager_->WaitUntilWorkerWaiting(kMaxSeconds);
+  }
+  CheckCallCount(3, 6);
+  EXPECT_EQ(3u, shipping_manager_->num_failed_attempts());
+
+  // A new ShippingManager sends the three Observations without any being
+  // added to it.
+  Init(kMaxSeconds, std::chrono::seconds::zero(), true);
+  bool success = false;
+  shipping_manager_->RequestSendSoon([&success](bool s) { success = s; });
+  shipping_manager_->WaitUntilIdle(kMaxSeconds);
+  EXPECT_TRUE(success);
+  CheckCallCount(1, 3);
+  EXPECT_EQ(0u, shipping_manager_->num_failed_attempts());
+
+  // They are not sent again by a third ShippingManager.
+  Init(kMaxSeconds, std::chrono::seconds::zero(), true);
+  shipping_manager_->RequestSendSoon();
+  shipping_manager_->WaitUntilIdle(kMaxSeconds);
+  CheckCallCount(0, 0);
+}
+
+// Tests that with persistence enabled the ShippingManager accepts
+// Observations up to the limit given to EnablePersistence() rather than
+// max_bytes_total, and that they are then sent in Envelopes of the usual
+// size.
+TEST_F(ShippingManagerTest, PersistentMaxBytesTotal) {
+  Init(kMaxSeconds, std::chrono::seconds::zero(), true);
+  {
+    std::unique_lock<std::mutex> lock(send_retryer_->mutex);
+    send_retryer_->status_to_return = grpc::Status::CANCELLED;
+  }
+
+  // kMaxBytesTotalPersistent = 2000 = 40 * 50, so as in ExceedMaxBytesTotal
+  // the 51st Observation is accepted and the 52nd is not.
+  for (int i = 0; i < 51; i++) {
+    ASSERT_EQ(ShippingManager::kOk, AddObservation(40)) << i;
+    shipping_manager_->RequestSendSoon();
+    shipping_manager_->WaitUntilWorkerWaiting(kMaxSeconds);
+  }
+  EXPECT_EQ(ShippingManager::kFull, AddObservation(40));
+
+  {
+    std::unique_lock<std::mutex> lock(send_retryer_->mutex);
+    send_retryer_->status_to_return = grpc::Status::OK;
+    send_retryer_->send_call_count = 0;
+    send_retryer_->observation_count = 0;
+  }
+  shipping_manager_->RequestSendSoon();
+  shipping_manager_->WaitUntilIdle(kMaxSeconds);
+
+  // The 51 Observations are sent in Envelopes of 5 Observations each.
+  CheckCallCount(11, 51);
+  EXPECT_EQ(ShippingManager::kOk, AddObservation(40));
+}
+
+// Tests that when Envelopes are compressed the sizes of Observations are
+// scaled by the compression ratio of the previously sent Envelope, so that
+// more Observations fit into an Envelope.
+TEST_F(ShippingManagerTest, CompressedEnvelopes) {
+  std::string public_key, private_key;
+  ASSERT_TRUE(
+      crypto::HybridCipher::GenerateKeyPairPEM(&public_key, &private_key));
+  send_retryer_.reset(new FakeSendRetryer());
+  send_retryer_->private_key_pem = private_key;
+  // We use larger sizes than the other tests so that the fixed overhead of
+  // the encryption is small in comparison.
+  shipping_manager_.reset(new ShippingManager(
+      ShippingManager::SizeParams(1000, 2000, 10000, 1000),
+      ShippingManager::ScheduleParams(kMaxSeconds,
+                                      std::chrono::seconds::zero()),
+      ShippingManager::EnvelopeMakerParams(
+          "", EncryptedMessage::NONE, public_key,
+          EncryptedMessage::HYBRID_ECDH_V1_DEFLATE),
+      ShippingManager::SendRetryerParams(kInitialRpcDeadline,
+                                         kDeadlinePerSendAttempt),
+      send_retryer_.get()));
+  shipping_manager_->Start();
+
+  // Before any Envelope has been sent the sizes are not scaled, so ten
+  // 500-byte Observations are too big for one Envelope.
+  EXPECT_EQ(ShippingManager::kObservationTooBig,
+            AddObservationBatch(10, 500));
+  EXPECT_EQ(ShippingManager::kOk, AddObservationBatch(3, 500));
+  shipping_manager_->RequestSendSoon();
+  shipping_manager_->WaitUntilIdle(kMaxSeconds);
+  CheckCallCount(1, 3);
+
+  // The Observations consist mostly of repeated characters so they compress
+  // well. Now the ten of them fit into one Envelope.
+  EXPECT_EQ(ShippingManager::kOk, AddObservationBatch(10, 500));
+  shipping_manager_->RequestSendSoon();
+  shipping_manager_->WaitUntilIdle(kMaxSeconds);
+  CheckCallCount(2, 13);
+}
+
 }  // namespace encoder
 }  // namespace cobalt
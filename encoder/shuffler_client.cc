@@ -16,6 +16,7 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "encoder/shuffler_client.h"
 
@@ -59,5 +60,27 @@ grpc::Status ShufflerClient::SendToShuffler(
   return shuffler_stub_->Process(context, encrypted_message, &resp);
 }
 
+grpc::Status ShufflerClient::SendStreamToShuffler(
+    const std::vector<EncryptedMessage>& encrypted_messages,
+    grpc::ClientContext* context) {
+  std::unique_ptr<grpc::ClientContext> temp_context;
+  if (context == nullptr) {
+    temp_context.reset(new grpc::ClientContext());
+    context = temp_context.get();
+  }
+  shuffler::ShufflerResponse resp;
+  std::unique_ptr<grpc::ClientWriter<EncryptedMessage>> writer(
+      shuffler_stub_->ProcessStream(context, &resp));
+  for (const EncryptedMessage& encrypted_message : encrypted_messages) {
+    // Write() fails only if the stream has been broken, in which case
+    // Finish() returns the reason.
+    if (!writer->Write(encrypted_message)) {
+      break;
+    }
+  }
+  writer->WritesDone();
+  return writer->Finish();
+}
+
 }  // namespace encoder
 }  // namespace cobalt
@@ -17,6 +17,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "grpc++/grpc++.h"
 #include "shuffler/shuffler.grpc.pb.h"
@@ -38,6 +39,17 @@ class ShufflerClientInterface {
   virtual grpc::Status SendToShuffler(
       const EncryptedMessage& encrypted_message,
       grpc::ClientContext* context = nullptr) = 0;
+
+  // Send all of the given |encrypted_messages| to the Shuffler on a single
+  // stream. Each should be an encrypted Envelope as given by the output of
+  // EnvelopeMaker::MakeEncryptedEnvelope(). If the returned status is not OK
+  // then some of them may nevertheless have been received by the Shuffler.
+  //
+  // context. As for SendToShuffler(). The deadline applies to the stream as
+  // a whole.
+  virtual grpc::Status SendStreamToShuffler(
+      const std::vector<EncryptedMessage>& encrypted_messages,
+      grpc::ClientContext* context = nullptr) = 0;
 };
 
 // This class provides a thin wrapper around the gRPC client to the Shuffler,
@@ -72,6 +84,12 @@ class ShufflerClient : public ShufflerClientInterface {
   grpc::Status SendToShuffler(const EncryptedMessage& encrypted_message,
                               grpc::ClientContext* context = nullptr) override;
 
+  // Send all of the given |encrypted_messages| to the Shuffler using a single
+  // ProcessStream RPC. See ShufflerClientInterface.
+  grpc::Status SendStreamToShuffler(
+      const std::vector<EncryptedMessage>& encrypted_messages,
+      grpc::ClientContext* context = nullptr) override;
+
  private:
   std::unique_ptr<shuffler::Shuffler::Stub> shuffler_stub_;
 };
@@ -13,9 +13,9 @@
 // limitations under the License.
 
 /*
-Package implementing a simple gRPC server that performs unary RPC to
-implement shuffler service whose definition can be found in
-shuffler/shuffler.proto.
+Package implementing a simple gRPC server that performs unary and
+client-streaming RPCs to implement shuffler service whose definition can be
+found in shuffler/shuffler.proto.
 
 A shuffler listens to incoming requests from Encoders (end users),
 strips the user metadata like IP-address, timestamps etc before buffering
@@ -26,6 +26,7 @@ package receiver
 
 import (
 	"fmt"
+	"io"
 	"net"
 	"time"
 
@@ -73,6 +74,9 @@ type ServerConfig struct {
 	// TODO(rudominer) Support key rotation: Rather than a single private key
 	// this should be a set of (public-key-hash, private-key) pairs.
 	PrivateKeyPem string
+	// The maximum size in bytes of a decompressed Envelope. If not positive
+	// then util.DefaultMaxDecompressedSize is used.
+	MaxEnvelopeSize int64
 }
 
 // Process processes the incoming encoder requests and persists them locally in
@@ -81,13 +85,10 @@ type ServerConfig struct {
 func (s *ShufflerServer) Process(ctx context.Context,
 	encryptedMessage *cobalt.EncryptedMessage) (*shuffler.ShufflerResponse, error) {
 	glog.V(4).Infoln("Process() is invoked.")
-	envelope, err := s.decryptEnvelope(encryptedMessage)
+	batches, err := s.extractBatches(encryptedMessage)
 	if err != nil {
 		return nil, err
 	}
-	if len(envelope.GetBatch()) == 0 {
-		return nil, grpc.Errorf(codes.InvalidArgument, "Empty envelope.")
-	}
 
 	// TODO(ukode): Some notes here for future development:
 	// Check the recipient first. If the request is intended for another Shuffler
@@ -97,10 +98,62 @@ func (s *ShufflerServer) Process(ctx context.Context,
 	// a channel that the forwarder can consume and dispatch to the next
 	// Shuffler |envelope.RecipientUrl|.
 
-	// Extract the Observation from the sealed envelope, save it in Shuffler
-	// data store for dispatcher to consume and forward to Analyzer based on
-	// some dispatch criteria. The data store shuffles the order of the
-	// Observation before persisting.
+	// Save the Observations in Shuffler data store for dispatcher to consume
+	// and forward to Analyzer based on some dispatch criteria. The data store
+	// shuffles the order of the Observation before persisting.
+	if err := s.store.AddAllObservations(batches, storage.GetDayIndexUtc(time.Now())); err != nil {
+		return nil, err
+	}
+
+	glog.V(4).Infoln("Process() done, returning OK.")
+	return &shuffler.ShufflerResponse{}, nil
+}
+
+// ProcessStream processes the EncryptedMessages received on |stream| as
+// Process() does, but all or nothing: each message is decrypted and validated
+// as it is received and the Observations of all of them are saved together
+// once the encoder has closed the stream. If any of the messages can not be
+// processed it returns the error without reading the rest of the stream and
+// saves none of them, so that the encoder may send all of them again without
+// duplicating Observations.
+func (s *ShufflerServer) ProcessStream(stream shuffler.Shuffler_ProcessStreamServer) error {
+	glog.V(4).Infoln("ProcessStream() is invoked.")
+	var batches []*cobalt.ObservationBatch
+	numEnvelopes := 0
+	for {
+		encryptedMessage, err := stream.Recv()
+		if err == io.EOF {
+			break
+		}
+		if err != nil {
+			return err
+		}
+		envelopeBatches, err := s.extractBatches(encryptedMessage)
+		if err != nil {
+			return err
+		}
+		batches = append(batches, envelopeBatches...)
+		numEnvelopes++
+	}
+	if err := s.store.AddAllObservations(batches, storage.GetDayIndexUtc(time.Now())); err != nil {
+		return err
+	}
+	glog.V(4).Infof("ProcessStream() done after %d envelopes, returning OK.", numEnvelopes)
+	return stream.SendAndClose(&shuffler.ShufflerResponse{})
+}
+
+// extractBatches decrypts the Envelope in |encryptedMessage|, checks that it is
+// not empty and returns its ObservationBatches, each of whose MetaData
+// includes the Envelope's SystemProfile.
+func (s *ShufflerServer) extractBatches(encryptedMessage *cobalt.EncryptedMessage) ([]*cobalt.ObservationBatch, error) {
+	envelope, err := s.decryptEnvelope(encryptedMessage)
+	if err != nil {
+		return nil, err
+	}
+	if len(envelope.GetBatch()) == 0 {
+		return nil, grpc.Errorf(codes.InvalidArgument, "Empty envelope.")
+	}
+
 	batches := envelope.GetBatch()
 	systemProfile := envelope.GetSystemProfile()
 	if systemProfile != nil {
@@ -118,12 +171,7 @@ func (s *ShufflerServer) Process(ctx context.Context,
 			}
 		}
 	}
-	if err := s.store.AddAllObservations(batches, storage.GetDayIndexUtc(time.Now())); err != nil {
-		return nil, err
-	}
-
-	glog.V(4).Infoln("Process() done, returning OK.")
-	return &shuffler.ShufflerResponse{}, nil
+	return batches, nil
 }
 
 // Run serves incoming encoder requests and blocks forever unless a fatal error
@@ -144,12 +192,22 @@ func Run(dataStore storage.Store, config *ServerConfig) {
 	}
 
 	// Start shuffler service
-	shufflerServerSingleton = &ShufflerServer{
+	shufflerServerSingleton = newShufflerServer(dataStore, config)
+	shufflerServerSingleton.startServer()
+}
+
+// newShufflerServer returns a ShufflerServer that saves Observations in
+// |dataStore| and is configured by |config|, without starting it.
+func newShufflerServer(dataStore storage.Store, config *ServerConfig) *ShufflerServer {
+	decrypter := util.NewMessageDecrypter(config.PrivateKeyPem)
+	if config.MaxEnvelopeSize > 0 {
+		decrypter.SetMaxDecompressedSize(config.MaxEnvelopeSize)
+	}
+	return &ShufflerServer{
 		store:     dataStore,
 		config:    *config,
-		decrypter: util.NewMessageDecrypter(config.PrivateKeyPem),
+		decrypter: decrypter,
 	}
-	shufflerServerSingleton.startServer()
 }
 
 // startServer sets up and starts the grpc server using configuration from
@@ -25,6 +25,7 @@ import (
 	"shuffler"
 	"shuffler_config"
 	"storage"
+	"util"
 	"util/stackdriver"
 
 	"github.com/golang/glog"
@@ -44,6 +45,9 @@ var (
 		"Path to a file containing a PEM encoding of the private key of "+
 			"the Shuffler used for Cobalt's internal encryption scheme. If "+
 			"not specified then the Shuffler will not support encrypted Envelopes.")
+	maxEnvelopeSize = flag.Int64("max_envelope_size", util.DefaultMaxDecompressedSize,
+		"The maximum size in bytes of a decompressed Envelope. Compressed "+
+			"Envelopes that expand beyond this size are rejected.")
 
 	// shuffler client configuration flags to connect to analyzer
 	caFile      = flag.String("ca_file", "", "The file containing the CA root certificate")
@@ -145,10 +149,11 @@ func main() {
 
 	// Start listening on receiver for incoming requests from Encoder
 	receiver.Run(store, &receiver.ServerConfig{
-		EnableTLS:     *tls,
-		CertFile:      *certFile,
-		KeyFile:       *keyFile,
-		Port:          *port,
-		PrivateKeyPem: privateKeyPem,
+		EnableTLS:       *tls,
+		CertFile:        *certFile,
+		KeyFile:         *keyFile,
+		Port:            *port,
+		PrivateKeyPem:   privateKeyPem,
+		MaxEnvelopeSize: *maxEnvelopeSize,
 	})
 }
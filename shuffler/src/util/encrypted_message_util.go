@@ -15,6 +15,11 @@
 package util
 
 import (
+	"bytes"
+	"compress/zlib"
+	"io"
+	"io/ioutil"
+
 	"github.com/golang/glog"
 	"github.com/golang/protobuf/proto"
 	"google.golang.org/grpc"
@@ -29,6 +34,11 @@ const (
 	newMessageDecrypterFailed      = "encrypted-message-util-new-message-decrypter-failed"
 )
 
+// DefaultMaxDecompressedSize is the default limit on the number of bytes that a
+// MessageDecrypter will recover from an EncryptedMessage that uses the
+// HYBRID_ECDH_V1_DEFLATE scheme.
+const DefaultMaxDecompressedSize = 16 * 1024 * 1024
+
 // This file contains two types for working with EncryptedMessages.
 //
 // EncryptedMessageMaker is not currently used on the Shuffler. It is included for
@@ -49,7 +59,7 @@ type EncryptedMessageMaker struct {
 // parsed.
 //
 // |scheme| specifies which encryption scheme should be used. As of this
-// writing there are two schemes:
+// writing there are three schemes:
 //   (i) EncryptedMessage_NONE means that messages will not be
 //   encrypted: they will be sent in plain text. This scheme must
 //   never be used in production Cobalt.
@@ -58,14 +68,18 @@ type EncryptedMessageMaker struct {
 //   Cobalt's Elliptic-Curve Diffie-Hellman-based hybrid
 //   public-key/private-key encryption scheme should be used.
 //
+//   (iii) EncryptedMessage_HYBRID_ECDH_V1_DEFLATE indicates that messages
+//   should be compressed with DEFLATE and then encrypted as with
+//   HYBRID_ECDH_V1.
+//
 // |publicKeyPem| must be appropriate to |scheme|. If |scheme| is
-// EncryptedMessage_NONE then |publicKeyPem| is ignored. If |scheme| is
-// EncryptedMessage_HYBRID_ECDH_V1 then |publicKeyPem| must be a PEM
-// encoding of a public key appropriate for that scheme.
+// EncryptedMessage_NONE then |publicKeyPem| is ignored. Otherwise
+// |publicKeyPem| must be a PEM encoding of a public key appropriate for
+// HYBRID_ECDH_V1.
 func NewEncryptedMessageMaker(publicKeyPem string,
 	scheme cobalt.EncryptedMessage_EncryptionScheme) *EncryptedMessageMaker {
 	var cipher *HybridCipher
-	if scheme == cobalt.EncryptedMessage_HYBRID_ECDH_V1 {
+	if scheme == cobalt.EncryptedMessage_HYBRID_ECDH_V1 || scheme == cobalt.EncryptedMessage_HYBRID_ECDH_V1_DEFLATE {
 		publicKey, err := ParseECPublicKeyPem(publicKeyPem)
 		if err != nil {
 			stackdriver.LogCountMetricf(newEncryptedMessageMakerFailed, "Failed to decode public key PEM: %v.", err)
@@ -105,14 +119,26 @@ func (m *EncryptedMessageMaker) Encrypt(message proto.Message) (*cobalt.Encrypte
 		return &encryptedMessage, nil
 	}
 
-	if m.encryptionScheme != cobalt.EncryptedMessage_HYBRID_ECDH_V1 {
-		// HYBRID_ECDH_V1 is the only other scheme we know about.
+	if m.encryptionScheme != cobalt.EncryptedMessage_HYBRID_ECDH_V1 && m.encryptionScheme != cobalt.EncryptedMessage_HYBRID_ECDH_V1_DEFLATE {
+		// HYBRID_ECDH_V1 and HYBRID_ECDH_V1_DEFLATE are the only other schemes we know about.
 		return nil, grpc.Errorf(codes.Internal, "Unexpected encryption scheme: %v", m.encryptionScheme)
 	}
 
 	if m.hybridCipher == nil {
 		return nil, grpc.Errorf(codes.Internal, "m.hybridCipher is nil")
 	}
+
+	if m.encryptionScheme == cobalt.EncryptedMessage_HYBRID_ECDH_V1_DEFLATE {
+		var compressedMessage bytes.Buffer
+		writer := zlib.NewWriter(&compressedMessage)
+		if _, err := writer.Write(serializedMessage); err != nil {
+			return nil, grpc.Errorf(codes.Internal, "message could not be compressed: %v", err)
+		}
+		if err := writer.Close(); err != nil {
+			return nil, grpc.Errorf(codes.Internal, "message could not be compressed: %v", err)
+		}
+		serializedMessage = compressedMessage.Bytes()
+	}
 	ciphertext, err := m.hybridCipher.Encrypt(serializedMessage)
 	if err != nil {
 		return nil, err
@@ -124,13 +150,14 @@ func (m *EncryptedMessageMaker) Encrypt(message proto.Message) (*cobalt.Encrypte
 }
 
 type MessageDecrypter struct {
-	hybridCipher *HybridCipher
+	hybridCipher        *HybridCipher
+	maxDecompressedSize int64
 }
 
 // Constructs a new MessageDecrypter. If |privateKeyPem| is a valid PEM
 // encoding of a private key for Cobalt's hybrid encryption scheme, then the
 // resulting MessageDecrypter will be able to decrypt messages that use the
-// HYBRID_ECDH_V1 scheme. Otherwise the resulting MessageDecrypter will only
+// HYBRID_ECDH_V1 and HYBRID_ECDH_V1_DEFLATE schemes. Otherwise the resulting MessageDecrypter will only
 // be able to decrypt EncryptedMessages that use the NONE scheme.
 //
 // TODO(rudominer) For key-rotation support this constructor
@@ -153,10 +180,19 @@ func NewMessageDecrypter(privateKeyPem string) *MessageDecrypter {
 		}
 	}
 	return &MessageDecrypter{
-		hybridCipher: hybridCipher,
+		hybridCipher:        hybridCipher,
+		maxDecompressedSize: DefaultMaxDecompressedSize,
 	}
 }
 
+// SetMaxDecompressedSize sets the maximum number of bytes that DecryptMessage
+// will recover from an EncryptedMessage that uses the HYBRID_ECDH_V1_DEFLATE
+// scheme. Decryption of a message that decompresses to more than |size| bytes
+// fails with InvalidArgument.
+func (m *MessageDecrypter) SetMaxDecompressedSize(size int64) {
+	m.maxDecompressedSize = size
+}
+
 // Decrypts |encryptedMessage| and deserializes the result into the provided |outMessage|. Return a non-nil error if and only if this fails.
 func (m *MessageDecrypter) DecryptMessage(encryptedMessage *cobalt.EncryptedMessage, outMessage proto.Message) error {
 	if m == nil {
@@ -175,8 +211,8 @@ func (m *MessageDecrypter) DecryptMessage(encryptedMessage *cobalt.EncryptedMess
 		}
 		return grpc.Errorf(codes.InvalidArgument, "Unable to unmarshal encryptedMessage. Ciphertext: %v", err)
 	}
-	if encryptedMessage.Scheme != cobalt.EncryptedMessage_HYBRID_ECDH_V1 {
-		// HYBRID_ECDH_V1 is the only other scheme we know about.
+	if encryptedMessage.Scheme != cobalt.EncryptedMessage_HYBRID_ECDH_V1 && encryptedMessage.Scheme != cobalt.EncryptedMessage_HYBRID_ECDH_V1_DEFLATE {
+		// HYBRID_ECDH_V1 and HYBRID_ECDH_V1_DEFLATE are the only other schemes we know about.
 		return grpc.Errorf(codes.InvalidArgument, "Unrecognized encryption scheme specified in EncryptedMessage: %v", encryptedMessage.Scheme)
 	}
 	if m.hybridCipher == nil {
@@ -186,6 +222,21 @@ func (m *MessageDecrypter) DecryptMessage(encryptedMessage *cobalt.EncryptedMess
 	if err != nil {
 		return grpc.Errorf(codes.InvalidArgument, "Decryption error: %v", err)
 	}
+	if encryptedMessage.Scheme == cobalt.EncryptedMessage_HYBRID_ECDH_V1_DEFLATE {
+		reader, err := zlib.NewReader(bytes.NewReader(recoveredText))
+		if err != nil {
+			return grpc.Errorf(codes.InvalidArgument, "Decompression error: %v", err)
+		}
+		// Read at most one byte more than the limit so that we can tell
+		// whether the limit was exceeded without inflating the whole message.
+		recoveredText, err = ioutil.ReadAll(io.LimitReader(reader, m.maxDecompressedSize+1))
+		if err != nil {
+			return grpc.Errorf(codes.InvalidArgument, "Decompression error: %v", err)
+		}
+		if int64(len(recoveredText)) > m.maxDecompressedSize {
+			return grpc.Errorf(codes.InvalidArgument, "Decompressed message exceeds %v bytes", m.maxDecompressedSize)
+		}
+	}
 	if err = proto.Unmarshal(recoveredText, outMessage); err != nil {
 		return grpc.Errorf(codes.InvalidArgument, "Unable to unmarshal decrypted text: %v", err)
 	}
@@ -18,6 +18,9 @@ import (
 	"reflect"
 	"testing"
 
+	"google.golang.org/grpc"
+	"google.golang.org/grpc/codes"
+
 	"cobalt"
 )
 
@@ -120,6 +123,87 @@ func TestHybridEncryption(t *testing.T) {
 	}
 }
 
+// Tests that a MessageDecrypter that is constructed with a valid private key
+// can decrypt messages that use the HYBRID_ECDH_V1_DEFLATE scheme.
+func TestHybridEncryptionWithDeflate(t *testing.T) {
+	// Make an EncryptedMessageMaker
+	encryptedMessageMaker := NewEncryptedMessageMaker(publicKeyPem, cobalt.EncryptedMessage_HYBRID_ECDH_V1_DEFLATE)
+	if encryptedMessageMaker == nil {
+		t.Fatal("Failed to create EncryptedMessageMaker")
+	}
+
+	// Make an Envelope with some non-default values so we can recognize it.
+	envelope1 := MakeTestEnvelope()
+
+	// Encrypt the Envelope
+	encryptedMessage, err := encryptedMessageMaker.Encrypt(&envelope1)
+	if err != nil {
+		t.Fatalf("%v", err)
+	}
+	if encryptedMessage.Scheme != cobalt.EncryptedMessage_HYBRID_ECDH_V1_DEFLATE {
+		t.Errorf("Unexpected scheme: %v", encryptedMessage.Scheme)
+	}
+
+	// Make a MessageDecrypter
+	messageDecrypter := NewMessageDecrypter(privateKeyPem)
+
+	// Decrypt the Envelope
+	envelope2 := cobalt.Envelope{}
+	err = messageDecrypter.DecryptMessage(encryptedMessage, &envelope2)
+	if err != nil {
+		t.Errorf("%v", err)
+	}
+
+	// Compare the recovered envelope with the plaintext envelope
+	if !reflect.DeepEqual(&envelope1, &envelope2) {
+		t.Errorf("%v != %v", envelope1, envelope2)
+	}
+}
+
+// Tests that a compressed message that decompresses to more than the maximum
+// size fails to decrypt.
+func TestHybridEncryptionWithDeflateTooBig(t *testing.T) {
+	// Make an EncryptedMessageMaker
+	encryptedMessageMaker := NewEncryptedMessageMaker(publicKeyPem, cobalt.EncryptedMessage_HYBRID_ECDH_V1_DEFLATE)
+	if encryptedMessageMaker == nil {
+		t.Fatal("Failed to create EncryptedMessageMaker")
+	}
+
+	// Make an Envelope of more than 1 MB that compresses to a few KB.
+	envelope1 := MakeTestEnvelope()
+	envelope1.Batch[0].EncryptedObservation = []*cobalt.EncryptedMessage{
+		&cobalt.EncryptedMessage{Ciphertext: make([]byte, 1024*1024)},
+	}
+
+	// Encrypt the Envelope
+	encryptedMessage, err := encryptedMessageMaker.Encrypt(&envelope1)
+	if err != nil {
+		t.Fatalf("%v", err)
+	}
+	if len(encryptedMessage.Ciphertext) > 16*1024 {
+		t.Errorf("Unexpected ciphertext size: %v", len(encryptedMessage.Ciphertext))
+	}
+
+	// A MessageDecrypter with a limit of 1 MB must reject the Envelope.
+	messageDecrypter := NewMessageDecrypter(privateKeyPem)
+	messageDecrypter.SetMaxDecompressedSize(1024 * 1024)
+	envelope2 := cobalt.Envelope{}
+	err = messageDecrypter.DecryptMessage(encryptedMessage, &envelope2)
+	if grpc.Code(err) != codes.InvalidArgument {
+		t.Errorf("Expected InvalidArgument, got: %v", err)
+	}
+
+	// With the default limit the Envelope is recovered.
+	messageDecrypter = NewMessageDecrypter(privateKeyPem)
+	envelope2 = cobalt.Envelope{}
+	if err = messageDecrypter.DecryptMessage(encryptedMessage, &envelope2); err != nil {
+		t.Errorf("%v", err)
+	}
+	if !reflect.DeepEqual(&envelope1, &envelope2) {
+		t.Error("The recovered Envelope differs from the original")
+	}
+}
+
 // Tests that a MessageDecrypter that is constructed with an invalid private key
 // can fail gracefully.
 func TestFailedHybridEncryption(t *testing.T) {
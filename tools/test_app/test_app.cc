@@ -92,6 +92,9 @@ DEFINE_string(shuffler_pk_pem_file, "",
               "Path to a file containing a PEM encoding of the public key of "
               "the Shuffler used for Cobalt's internal encryption scheme. If "
               "not specified then no encryption will be used.");
+DEFINE_bool(compress_envelopes, false,
+            "Should Envelopes be compressed before they are encrypted to the "
+            "Shuffler? Only used if -shuffler_pk_pem_file is specified.");
 DEFINE_bool(
     use_tls, false,
     "Should tls be used for the connection to the shuffler or the analyzer?");
@@ -99,6 +102,12 @@ DEFINE_string(root_certs_pem_file, "",
               "Full path to a file containing a PEM encoding of the TLS root "
               "certificates to be used by the gRPC client.");
 DEFINE_uint32(deadline_seconds, 10, "RPC deadline.");
+DEFINE_uint32(max_concurrent_sends, 1,
+              "The maximum number of Envelopes to have in flight to the "
+              "Shuffler at once.");
+DEFINE_uint32(max_envelopes_per_stream, 1,
+              "The maximum number of Envelopes to send to the Shuffler on a "
+              "single stream.");
 DEFINE_string(config_bin_proto_path, "",
               "Path to the serialized CobaltConfig proto from which the "
               "configuration is to be read. (Optional)");
@@ -507,7 +516,9 @@ std::unique_ptr<TestApp> TestApp::CreateFromFlagsOrDie(int argc, char* argv[]) {
                "used. Pass the flag -shuffler_pk_pem_file";
   } else if (ReadPublicKeyPem(FLAGS_shuffler_pk_pem_file,
                               &shuffler_public_key_pem)) {
-    shuffler_encryption_scheme = EncryptedMessage::HYBRID_ECDH_V1;
+    shuffler_encryption_scheme =
+        FLAGS_compress_envelopes ? EncryptedMessage::HYBRID_ECDH_V1_DEFLATE
+                                 : EncryptedMessage::HYBRID_ECDH_V1;
   }
 
   std::unique_ptr<SystemData> system_data(new SystemData("test_app"));
@@ -558,7 +569,9 @@ TestApp::TestApp(
               analyzer_public_key_pem, analyzer_scheme, shuffler_public_key_pem,
               shuffler_scheme),
           ShippingManager::SendRetryerParams(kInitialRpcDeadline,
-                                             kDeadlinePerSendAttempt),
+                                             kDeadlinePerSendAttempt,
+                                             FLAGS_max_concurrent_sends,
+                                             FLAGS_max_envelopes_per_stream),
           send_retryer_.get())),
       ostream_(ostream) {
   shipping_manager_->Start();
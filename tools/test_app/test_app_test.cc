@@ -236,6 +236,15 @@ class FakeShufflerClient : public ShufflerClientInterface {
     EXPECT_TRUE(decrypter_.DecryptMessage(encrypted_message, &envelope));
     return grpc::Status::OK;
   }
+
+  grpc::Status SendStreamToShuffler(
+      const std::vector<EncryptedMessage>& encrypted_messages,
+      grpc::ClientContext* context = nullptr) override {
+    for (const auto& encrypted_message : encrypted_messages) {
+      SendToShuffler(encrypted_message, context);
+    }
+    return grpc::Status::OK;
+  }
   Envelope envelope;
 
  private:
@@ -429,14 +429,17 @@ bool HybridCipher::EncryptInternal(const byte* ptext, size_t ptext_len,
     return false;
   }
 
-  // Do symmetric encryption with hkdf_derived_key
-  if (!symm_cipher_->set_key(hkdf_derived_key)) {
+  // Do symmetric encryption with hkdf_derived_key. A local SymmetricCipher
+  // is used, rather than symm_cipher_, so that Encrypt() may be invoked
+  // concurrently.
+  SymmetricCipher symm_cipher;
+  if (!symm_cipher.set_key(hkdf_derived_key)) {
     return false;
   }
   // For hybrid mode, we can fix the nonce to all zeroes without losing
   // security. See: https://goto.google.com/aes-gcm-zero-nonce-security
-  if (!symm_cipher_->Encrypt(kAllZeroNonce, ptext, ptext_len,
-                             symmetric_ctext_out)) {
+  if (!symm_cipher.Encrypt(kAllZeroNonce, ptext, ptext_len,
+                           symmetric_ctext_out)) {
     return false;
   }
 
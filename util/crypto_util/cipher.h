@@ -194,6 +194,9 @@ class HybridCipher {
   //
   // Returns true for success or false for failure. Use the functions
   // in errors.h to obtain error information upon failure.
+  //
+  // Once the public key has been set this method may be invoked
+  // concurrently by multiple threads.
   bool Encrypt(const byte* ptext, size_t ptext_len,
                std::vector<byte>* hybrid_ctext);
 
@@ -14,8 +14,6 @@
 
 #include "util/crypto_util/hash.h"
 
-#include <openssl/sha.h>
-
 namespace cobalt {
 
 namespace crypto {
@@ -26,6 +24,18 @@ bool Hash(const byte *data, const size_t data_len, byte out[DIGEST_SIZE]) {
   return nullptr != SHA256((uint8_t *)data, data_len, (uint8_t *)out);
 }
 
+bool Hasher::Init() {
+  return SHA256_Init(&ctx_);
+}
+
+bool Hasher::Update(const byte *data, const size_t data_len) {
+  return SHA256_Update(&ctx_, data, data_len);
+}
+
+bool Hasher::Final(byte out[DIGEST_SIZE]) {
+  return SHA256_Final(out, &ctx_);
+}
+
 }  // namespace hash
 
 }  // namespace crypto
@@ -15,6 +15,8 @@
 #ifndef COBALT_UTIL_CRYPTO_UTIL_HASH_H_
 #define COBALT_UTIL_CRYPTO_UTIL_HASH_H_
 
+#include <openssl/sha.h>
+
 #include <cstddef>
 
 #include "util/crypto_util/types.h"
@@ -37,6 +39,30 @@ static const size_t DIGEST_SIZE = 32;  // SHA-256 outputs 32 bytes.
 // Returns true for success or false for failure.
 bool Hash(const byte *data, const size_t data_len, byte out[DIGEST_SIZE]);
 
+// A Hasher computes the same SHA-256 digest as Hash() of data that is
+// supplied in several pieces, so that callers need not copy the pieces into
+// one buffer. Its state is held inline and so it does not allocate.
+//
+// Usage: Init(), then Update() any number of times, then Final(). An instance
+// may be reused by invoking Init() again.
+class Hasher {
+ public:
+  Hasher() { Init(); }
+
+  // Discards any data supplied so far.
+  bool Init();
+
+  // Appends |data_len| bytes at |data| to the data to be hashed.
+  bool Update(const byte *data, const size_t data_len);
+
+  // Writes the digest of the data supplied since Init() to |out|. Init() must
+  // be invoked before the instance is used again.
+  bool Final(byte out[DIGEST_SIZE]);
+
+ private:
+  SHA256_CTX ctx_;
+};
+
 }  // namespace hash
 
 }  // namespace crypto
@@ -14,6 +14,8 @@
 
 #include "util/crypto_util/hash.h"
 
+#include <algorithm>
+#include <cstring>
 #include <string>
 
 #include "third_party/googletest/googletest/include/gtest/gtest.h"
@@ -50,6 +52,31 @@ TEST(HashTest, TestHash) {
       stream.str());
 }
 
+// Tests that a Hasher computes the same digest as Hash() when the data is
+// supplied in pieces of various sizes, and that it may be reused.
+TEST(HashTest, TestHasher) {
+  std::string data(1000, 0);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<char>(i * 7);
+  }
+  const byte* bytes = reinterpret_cast<const byte*>(data.data());
+  byte expected_digest[DIGEST_SIZE];
+  EXPECT_TRUE(Hash(bytes, data.size(), expected_digest));
+
+  Hasher hasher;
+  for (size_t piece_size : {1, 3, 64, 100, 1000}) {
+    SCOPED_TRACE(piece_size);
+    EXPECT_TRUE(hasher.Init());
+    for (size_t offset = 0; offset < data.size(); offset += piece_size) {
+      EXPECT_TRUE(hasher.Update(bytes + offset,
+                                std::min(piece_size, data.size() - offset)));
+    }
+    byte digest[DIGEST_SIZE];
+    EXPECT_TRUE(hasher.Final(digest));
+    EXPECT_EQ(0, std::memcmp(expected_digest, digest, DIGEST_SIZE));
+  }
+}
+
 }  // namespace hash
 
 }  // namespace crypto
@@ -17,6 +17,10 @@
 #include <openssl/digest.h>
 #include <openssl/hmac.h>
 
+#include <cstring>
+
+#include "util/crypto_util/hash.h"
+
 namespace cobalt {
 
 namespace crypto {
@@ -30,6 +34,60 @@ bool HMAC(const byte *key , const size_t key_len, const byte *data,
       &out_len_unused);
 }
 
+bool HmacContext::SetKey(const byte *key, const size_t key_len) {
+  // See RFC 2104: a key longer than the block size is first hashed, and the
+  // key is then padded with zeros to the block size.
+  byte key_block[SHA256_CBLOCK] = {0};
+  if (key_len > SHA256_CBLOCK) {
+    if (!hash::Hash(key, key_len, key_block)) {
+      return false;
+    }
+  } else if (key_len > 0) {
+    std::memcpy(key_block, key, key_len);
+  }
+
+  byte pad[SHA256_CBLOCK];
+  for (size_t i = 0; i < SHA256_CBLOCK; i++) {
+    pad[i] = key_block[i] ^ 0x36;
+  }
+  if (!SHA256_Init(&inner_key_state_) ||
+      !SHA256_Update(&inner_key_state_, pad, SHA256_CBLOCK)) {
+    return false;
+  }
+  for (size_t i = 0; i < SHA256_CBLOCK; i++) {
+    pad[i] = key_block[i] ^ 0x5c;
+  }
+  if (!SHA256_Init(&outer_key_state_) ||
+      !SHA256_Update(&outer_key_state_, pad, SHA256_CBLOCK)) {
+    return false;
+  }
+  return Init();
+}
+
+bool HmacContext::Init() {
+  inner_ = inner_key_state_;
+  return true;
+}
+
+bool HmacContext::Update(const byte *data, const size_t data_len) {
+  return SHA256_Update(&inner_, data, data_len);
+}
+
+bool HmacContext::Final(byte tag[TAG_SIZE]) {
+  byte inner_digest[SHA256_DIGEST_LENGTH];
+  if (!SHA256_Final(inner_digest, &inner_)) {
+    return false;
+  }
+  SHA256_CTX outer = outer_key_state_;
+  return SHA256_Update(&outer, inner_digest, sizeof(inner_digest)) &&
+         SHA256_Final(tag, &outer);
+}
+
+bool HmacContext::Compute(const byte *data, const size_t data_len,
+                          byte tag[TAG_SIZE]) {
+  return Init() && Update(data, data_len) && Final(tag);
+}
+
 }  // namespace hmac
 
 }  // namespace crypto
@@ -15,6 +15,8 @@
 #ifndef COBALT_UTIL_CRYPTO_UTIL_MAC_H_
 #define COBALT_UTIL_CRYPTO_UTIL_MAC_H_
 
+#include <openssl/sha.h>
+
 #include <cstddef>
 
 #include "util/crypto_util/types.h"
@@ -35,6 +37,44 @@ static const size_t TAG_SIZE = 32;  // SHA-256 outputs 32 bytes.
 bool HMAC(const byte *key , const size_t key_len, const byte *data,
     const size_t data_len, byte tag[TAG_SIZE]);
 
+// An HmacContext computes the same HMAC-SHA256 tags as HMAC() for a key that
+// is fixed in advance, over data that may be supplied in several pieces.
+//
+// SetKey() precomputes the SHA-256 states that result from absorbing the
+// padded key into the inner and outer hashes, so that computing each tag
+// costs two fewer SHA-256 blocks than HMAC() and never reprocesses the key.
+// The state is held inline and so an HmacContext does not allocate.
+//
+// Usage: SetKey(), then for each tag Init(), Update() any number of times and
+// Final(). Compute() does all three for data in one buffer.
+class HmacContext {
+ public:
+  HmacContext() {}
+
+  // Sets the key used for subsequent tags and invokes Init().
+  bool SetKey(const byte *key, const size_t key_len);
+
+  // Discards any data supplied since the last Init().
+  bool Init();
+
+  // Appends |data_len| bytes at |data| to the data to be authenticated.
+  bool Update(const byte *data, const size_t data_len);
+
+  // Writes the tag of the data supplied since Init() to |tag|. Init() must be
+  // invoked before the next tag is computed.
+  bool Final(byte tag[TAG_SIZE]);
+
+  // Writes the tag of |data_len| bytes at |data| to |tag|.
+  bool Compute(const byte *data, const size_t data_len, byte tag[TAG_SIZE]);
+
+ private:
+  // The states of the inner and outer hashes after absorbing the padded key,
+  // and the state of the inner hash of the tag in progress.
+  SHA256_CTX inner_key_state_;
+  SHA256_CTX outer_key_state_;
+  SHA256_CTX inner_;
+};
+
 }  // namespace hmac
 
 }  // namespace crypto
@@ -15,6 +15,7 @@
 #include "util/crypto_util/mac.h"
 
 #include <limits.h>
+#include <string.h>
 #include <string>
 #include <vector>
 
@@ -78,6 +79,36 @@ TEST(HmacTest, EqualAndNotEqual) {
   checkEqualHmacs(key1, key2, data1, data1, false);
 }
 
+// Tests that an HmacContext computes the same tags as HMAC() for keys that
+// are shorter than, as long as and longer than the SHA-256 block size, with
+// the data supplied at once or in two pieces.
+TEST(HmacTest, HmacContext) {
+  byte key[100], data[100];
+  Random rand;
+  rand.RandomBytes(key, 100);
+  rand.RandomBytes(data, 100);
+  HmacContext context;
+  for (size_t key_len : {0, 1, 32, 64, 65, 100}) {
+    SCOPED_TRACE(key_len);
+    EXPECT_TRUE(context.SetKey(key, key_len));
+    for (size_t data_len : {0, 1, 55, 64, 100}) {
+      SCOPED_TRACE(data_len);
+      byte expected_tag[TAG_SIZE], tag[TAG_SIZE];
+      EXPECT_TRUE(HMAC(key, key_len, data, data_len, expected_tag));
+
+      EXPECT_TRUE(context.Compute(data, data_len, tag));
+      EXPECT_EQ(0, memcmp(expected_tag, tag, TAG_SIZE));
+
+      EXPECT_TRUE(context.Init());
+      EXPECT_TRUE(context.Update(data, data_len / 2));
+      EXPECT_TRUE(context.Update(data + data_len / 2,
+                                 data_len - data_len / 2));
+      EXPECT_TRUE(context.Final(tag));
+      EXPECT_EQ(0, memcmp(expected_tag, tag, TAG_SIZE));
+    }
+  }
+}
+
 }  // namespace hmac
 
 }  // namespace crypto
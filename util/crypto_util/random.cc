@@ -12,16 +12,98 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <openssl/chacha.h>
 #include <openssl/rand.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 
 #include "util/crypto_util/random.h"
 
 namespace cobalt {
 namespace crypto {
 
-void Random::RandomBytes(byte* buf, std::size_t num) { RAND_bytes(buf, num); }
+namespace {
+
+// A ChaCha20-based generator that is keyed from RAND_bytes() and which
+// produces its output kBufferSize bytes at a time.
+//
+// Each refill runs ChaCha20 over kKeySize + kBufferSize bytes. The first
+// kKeySize bytes of the keystream become the key for the next refill and
+// the remaining bytes are handed out to callers, being zeroed as they are
+// consumed. This "fast key erasure" construction means that the state of the
+// generator reveals nothing about output it has already produced.
+class BufferedChaChaEngine {
+ public:
+  BufferedChaChaEngine()
+      : pos_(sizeof(block_)), refills_since_reseed_(0), seeded_pid_(0) {}
+
+  ~BufferedChaChaEngine() {
+    memset(key_, 0, sizeof(key_));
+    memset(block_, 0, sizeof(block_));
+  }
+
+  void Generate(byte* buf, std::size_t num) {
+    while (num > 0) {
+      if (pos_ == sizeof(block_)) {
+        Refill();
+      }
+      std::size_t n = std::min(num, sizeof(block_) - pos_);
+      memcpy(buf, block_ + pos_, n);
+      memset(block_ + pos_, 0, n);
+      pos_ += n;
+      buf += n;
+      num -= n;
+    }
+  }
+
+ private:
+  static const std::size_t kKeySize = 32;
+  static const std::size_t kBufferSize = 4096;
+
+  // The number of refills after which we obtain a new key from RAND_bytes().
+  static const std::size_t kRefillsPerReseed = 256;
+
+  void Refill() {
+    // We also re-key if we discover that we are in a child process that was
+    // forked after we were seeded, so that parent and child do not produce
+    // the same stream.
+    pid_t pid = getpid();
+    if (refills_since_reseed_ == 0 || pid != seeded_pid_) {
+      RAND_bytes(key_, sizeof(key_));
+      seeded_pid_ = pid;
+      refills_since_reseed_ = kRefillsPerReseed;
+    }
+    refills_since_reseed_--;
+
+    // Since the key is never used twice we may use a fixed nonce.
+    static const uint8_t kZeroNonce[12] = {};
+    memset(block_, 0, sizeof(block_));
+    CRYPTO_chacha_20(block_, block_, sizeof(block_), key_, kZeroNonce, 0);
+    memcpy(key_, block_, kKeySize);
+    memset(block_, 0, kKeySize);
+    pos_ = kKeySize;
+  }
+
+  uint8_t key_[kKeySize];
+  byte block_[kKeySize + kBufferSize];
+  std::size_t pos_;
+  std::size_t refills_since_reseed_;
+  pid_t seeded_pid_;
+};
+
+BufferedChaChaEngine* ThreadLocalEngine() {
+  static thread_local BufferedChaChaEngine engine;
+  return &engine;
+}
+
+}  // namespace
+
+void Random::RandomBytes(byte* buf, std::size_t num) {
+  ThreadLocalEngine()->Generate(buf, num);
+}
 
 void Random::RandomString(std::string* buf) {
   RandomBytes(reinterpret_cast<byte*>(&((*buf)[0])), buf->size());
@@ -26,12 +26,23 @@ namespace crypto {
 
 // An instance of Random provides some utility functions for retrieving
 // randomness.
+//
+// The default implementation of RandomBytes() does not invoke the BoringSSL
+// RNG on every call. Instead each thread owns a ChaCha20-based generator that
+// is keyed from RAND_bytes() and that hands out bytes from a refillable
+// buffer. After every refill the generator replaces its own key with fresh
+// output so that earlier output cannot be reconstructed from its state, and it
+// is periodically re-keyed from RAND_bytes(). Because the generator state is
+// thread-local, instances of Random may be freely shared between threads.
 class Random {
  public:
   virtual ~Random() {}
 
   // Writes |num| bytes of random data from a uniform distribution to buf.
   // The caller must ensure that |buf| has enough space.
+  //
+  // All of the other methods of this class obtain their randomness through
+  // this method so that subclasses may override it.
   virtual void RandomBytes(byte *buf, std::size_t num);
 
   // Writes |buf->size()| bytes of random data from a uniform distribution
@@ -0,0 +1,93 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/crypto_util/random.h"
+
+#include <openssl/rand.h>
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+
+namespace cobalt {
+namespace crypto {
+
+namespace {
+
+// The number of calls to RandomBits() made by each measurement. This
+// corresponds to encoding 1024 RAPPOR observations with 1024-bit Bloom
+// filters, each of which requires two calls to RandomBits() per byte.
+static const size_t kNumCalls = 1024 * 128 * 2;
+
+// This is the implementation of Random::RandomBits() prior to the
+// introduction of the buffered engine: eight calls to RAND_bytes() for each
+// byte of output.
+byte UnbufferedRandomBits(float p) {
+  if (p <= 0.0 || p > 1.0) {
+    return 0;
+  }
+  byte ret_val = 0;
+  uint64_t threshold =
+      round(static_cast<double>(p) * (static_cast<double>(UINT32_MAX) + 1));
+  for (int i = 0; i < 8; i++) {
+    uint32_t x;
+    RAND_bytes(reinterpret_cast<byte*>(&x), sizeof(x));
+    uint8_t random_bit = (x < threshold);
+    ret_val |= random_bit << i;
+  }
+  return ret_val;
+}
+
+// Invokes |random_bits| kNumCalls times and returns the number of output
+// bits produced per second of wall time.
+template <class F>
+double MeasureBitsPerSecond(F random_bits) {
+  // Accumulate the output so that the compiler cannot discard the calls.
+  byte accumulator = 0;
+  auto t_start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < kNumCalls; i++) {
+    accumulator ^= random_bits(0.25);
+  }
+  auto t_end = std::chrono::high_resolution_clock::now();
+  double seconds = std::chrono::duration<double>(t_end - t_start).count();
+  EXPECT_NE(-1, accumulator);
+  return (kNumCalls * 8) / seconds;
+}
+
+}  // namespace
+
+// Compares the throughput of Random::RandomBits() against the previous
+// unbuffered implementation and prints the results.
+TEST(RandomPerformanceTest, RandomBits) {
+  double unbuffered_rate = MeasureBitsPerSecond(UnbufferedRandomBits);
+  Random rand;
+  double buffered_rate =
+      MeasureBitsPerSecond([&rand](float p) { return rand.RandomBits(p); });
+
+  std::cout << "\n=================================================\n";
+  std::cout << "Calls to RandomBits() per measurement: " << kNumCalls
+            << std::endl;
+  std::cout << "Unbuffered RAND_bytes() bits/sec: " << unbuffered_rate
+            << std::endl;
+  std::cout << "Buffered ChaCha20 engine bits/sec: " << buffered_rate
+            << std::endl;
+  std::cout << "Speedup: " << buffered_rate / unbuffered_rate << "x"
+            << std::endl;
+  std::cout << "\n=================================================\n";
+}
+
+}  // namespace crypto
+}  // namespace cobalt
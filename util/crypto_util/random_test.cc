@@ -15,7 +15,9 @@
 
 #include <bitset>
 #include <cmath>
+#include <cstring>
 #include <memory>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -122,6 +124,39 @@ TEST(RandomTest, TestRandomBits) {
   }
 }
 
+// Tests that RandomBytes() keeps producing fresh output across many refills
+// of the per-thread buffer and that different threads obtain different
+// output.
+TEST(RandomTest, TestRandomBytesAcrossRefillsAndThreads) {
+  static const size_t kChunkSize = 1000;
+  static const size_t kNumChunks = 100;
+  Random rand;
+  std::vector<byte> bytes(kChunkSize * kNumChunks);
+  rand.RandomBytes(bytes.data(), bytes.size());
+
+  // No two chunks should be equal and no chunk should be all zero.
+  std::vector<byte> zeros(kChunkSize, 0);
+  for (size_t i = 0; i < kNumChunks; i++) {
+    const byte* chunk_i = bytes.data() + i * kChunkSize;
+    EXPECT_NE(0, memcmp(chunk_i, zeros.data(), kChunkSize));
+    for (size_t j = i + 1; j < kNumChunks; j++) {
+      EXPECT_NE(0, memcmp(chunk_i, bytes.data() + j * kChunkSize, kChunkSize));
+    }
+  }
+
+  // A second thread, sharing the same instance of Random, should not see the
+  // same stream as the first.
+  std::vector<byte> first_thread(kChunkSize);
+  std::vector<byte> second_thread(kChunkSize);
+  rand.RandomBytes(first_thread.data(), kChunkSize);
+  std::thread t(
+      [&rand, &second_thread]() {
+        rand.RandomBytes(second_thread.data(), kChunkSize);
+      });
+  t.join();
+  EXPECT_NE(first_thread, second_thread);
+}
+
 }  // namespace crypto
 
 }  // namespace cobalt
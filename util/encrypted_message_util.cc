@@ -14,6 +14,8 @@
 
 #include "util/encrypted_message_util.h"
 
+#include <zlib.h>
+
 #include <vector>
 
 #include "./encrypted_message.pb.h"
@@ -27,6 +29,54 @@ namespace util {
 using ::cobalt::crypto::byte;
 using ::cobalt::crypto::HybridCipher;
 
+namespace {
+
+// Compresses |data| with DEFLATE in the zlib format into |*compressed|.
+bool Deflate(const std::string& data, std::string* compressed) {
+  uLongf compressed_size = compressBound(data.size());
+  compressed->resize(compressed_size);
+  if (compress2(reinterpret_cast<Bytef*>(&(*compressed)[0]), &compressed_size,
+                reinterpret_cast<const Bytef*>(data.data()), data.size(),
+                Z_DEFAULT_COMPRESSION) != Z_OK) {
+    return false;
+  }
+  compressed->resize(compressed_size);
+  return true;
+}
+
+// Decompresses the output of Deflate(), |compressed_size| bytes at
+// |compressed|, into |*data|. Fails without decompressing the rest of the
+// input as soon as |*data| would exceed |max_size| bytes.
+bool Inflate(const byte* compressed, size_t compressed_size, size_t max_size,
+             std::string* data) {
+  z_stream stream = {};
+  if (inflateInit(&stream) != Z_OK) {
+    return false;
+  }
+  stream.next_in = const_cast<Bytef*>(compressed);
+  stream.avail_in = compressed_size;
+  data->clear();
+  int status = Z_OK;
+  char buffer[16384];
+  while (status == Z_OK) {
+    stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    stream.avail_out = sizeof(buffer);
+    status = inflate(&stream, Z_NO_FLUSH);
+    size_t num_bytes = sizeof(buffer) - stream.avail_out;
+    if (data->size() + num_bytes > max_size) {
+      VLOG(1) << "ERROR: Decompressed message exceeds " << max_size
+              << " bytes.";
+      inflateEnd(&stream);
+      return false;
+    }
+    data->append(buffer, num_bytes);
+  }
+  inflateEnd(&stream);
+  return status == Z_STREAM_END;
+}
+
+}  // namespace
+
 EncryptedMessageMaker::EncryptedMessageMaker(
     const std::string& public_key_pem,
     EncryptedMessage::EncryptionScheme scheme)
@@ -54,8 +104,10 @@ bool EncryptedMessageMaker::Encrypt(
     return true;
   }
 
-  if (encryption_scheme_ != EncryptedMessage::HYBRID_ECDH_V1) {
-    // HYBRID_ECDH_V1 is the only other scheme we know about.
+  if (encryption_scheme_ != EncryptedMessage::HYBRID_ECDH_V1 &&
+      encryption_scheme_ != EncryptedMessage::HYBRID_ECDH_V1_DEFLATE) {
+    // HYBRID_ECDH_V1 and HYBRID_ECDH_V1_DEFLATE are the only other schemes
+    // we know about.
     return false;
   }
 
@@ -63,6 +115,15 @@ bool EncryptedMessageMaker::Encrypt(
     return false;
   }
 
+  if (encryption_scheme_ == EncryptedMessage::HYBRID_ECDH_V1_DEFLATE) {
+    std::string compressed_message;
+    if (!Deflate(serialized_message, &compressed_message)) {
+      VLOG(1) << "ERROR: Compression of message failed!";
+      return false;
+    }
+    serialized_message.swap(compressed_message);
+  }
+
   std::vector<byte> ciphertext;
   if (!cipher_->Encrypt((const byte*)serialized_message.data(),
                         serialized_message.size(), &ciphertext)) {
@@ -70,7 +131,7 @@ bool EncryptedMessageMaker::Encrypt(
   }
   encrypted_message->set_allocated_ciphertext(
       new std::string((const char*)ciphertext.data(), ciphertext.size()));
-  encrypted_message->set_scheme(EncryptedMessage::HYBRID_ECDH_V1);
+  encrypted_message->set_scheme(encryption_scheme_);
   byte fingerprint[HybridCipher::PUBLIC_KEY_FINGERPRINT_SIZE];
   VLOG(5) << "Using encryption.";
   if (!cipher_->public_key_fingerprint(fingerprint)) {
@@ -81,8 +142,12 @@ bool EncryptedMessageMaker::Encrypt(
   return true;
 }
 
-MessageDecrypter::MessageDecrypter(const std::string& private_key_pem)
-    : cipher_(new HybridCipher()) {
+const size_t MessageDecrypter::kDefaultMaxDecompressedSize;
+
+MessageDecrypter::MessageDecrypter(const std::string& private_key_pem,
+                                   size_t max_decompressed_size)
+    : cipher_(new HybridCipher()),
+      max_decompressed_size_(max_decompressed_size) {
   if (!cipher_->set_private_key_pem(private_key_pem)) {
     cipher_.reset();
     return;
@@ -104,8 +169,10 @@ bool MessageDecrypter::DecryptMessage(
     return true;
   }
 
-  if (encrypted_message.scheme() != EncryptedMessage::HYBRID_ECDH_V1) {
-    // HYBRID_ECDH_V1 is the only other scheme we know about.
+  if (encrypted_message.scheme() != EncryptedMessage::HYBRID_ECDH_V1 &&
+      encrypted_message.scheme() != EncryptedMessage::HYBRID_ECDH_V1_DEFLATE) {
+    // HYBRID_ECDH_V1 and HYBRID_ECDH_V1_DEFLATE are the only other schemes
+    // we know about.
     return false;
   }
 
@@ -118,7 +185,16 @@ bool MessageDecrypter::DecryptMessage(
                         encrypted_message.ciphertext().size(), &ptext)) {
     return false;
   }
-  std::string serialized_observation((const char*)ptext.data(), ptext.size());
+  std::string serialized_observation;
+  if (encrypted_message.scheme() == EncryptedMessage::HYBRID_ECDH_V1_DEFLATE) {
+    if (!Inflate(ptext.data(), ptext.size(), max_decompressed_size_,
+                 &serialized_observation)) {
+      VLOG(1) << "ERROR: Decompression of message failed!";
+      return false;
+    }
+  } else {
+    serialized_observation.assign((const char*)ptext.data(), ptext.size());
+  }
   if (!recovered_message->ParseFromString(serialized_observation)) {
     return false;
   }
@@ -46,7 +46,7 @@ class EncryptedMessageMaker {
   // Constructs an EncryptedMessageMaker.
   //
   // |scheme| specifies which encryption scheme should be used. As of this
-  // writing there are two schemes:
+  // writing there are three schemes:
   //   (i) EncryptedMessage::NONE means that messages will not be
   //   encrypted: they will be sent in plain text. This scheme must
   //   never be used in production Cobalt.
@@ -55,15 +55,20 @@ class EncryptedMessageMaker {
   //   Cobalt's Elliptic-Curve Diffie-Hellman-based hybrid
   //   public-key/private-key encryption scheme should be used.
   //
+  //   (iii) EncryptedMessage::HYBRID_ECDH_V1_DEFLATE indicates that messages
+  //   should be compressed with DEFLATE and then encrypted as with
+  //   HYBRID_ECDH_V1.
+  //
   // |public_key_pem| must be appropriate to |scheme|. If |scheme| is
-  // EncryptedMessage::NONE then |public_key_pem| is ignored. If |scheme| is
-  // EncryptedMessage::HYBRID_ECDH_V1 then |public_key_pem| must be a PEM
-  // encoding of a public key appropriate for that scheme.
+  // EncryptedMessage::NONE then |public_key_pem| is ignored. Otherwise
+  // |public_key_pem| must be a PEM encoding of a public key appropriate for
+  // HYBRID_ECDH_V1.
   EncryptedMessageMaker(const std::string& public_key_pem,
                         EncryptedMessage::EncryptionScheme scheme);
 
   // Encrypts a protocol buffer |message| and populates |encrypted_message|
-  // with the result. Returns true for success or false on failure.
+  // with the result. Returns true for success or false on failure. This
+  // method may be invoked concurrently by multiple threads.
   bool Encrypt(const google::protobuf::MessageLite& message,
                EncryptedMessage* encrypted_message) const;
 
@@ -78,13 +83,24 @@ class MessageDecrypter {
   // should accept multiple (public, private) key pairs and use the
   // fingerprint field of EncryptedMessage to select the appropriate private
   // key.
-  explicit MessageDecrypter(const std::string& private_key_pem);
+  //
+  // |max_decompressed_size| limits the size of the serialized message that
+  // is recovered from an EncryptedMessage that uses the
+  // HYBRID_ECDH_V1_DEFLATE scheme. Decryption of a message that would
+  // decompress to more than this many bytes fails.
+  explicit MessageDecrypter(
+      const std::string& private_key_pem,
+      size_t max_decompressed_size = kDefaultMaxDecompressedSize);
+
+  // The default value of |max_decompressed_size|.
+  static const size_t kDefaultMaxDecompressedSize = 16 * 1024 * 1024;
 
   bool DecryptMessage(const EncryptedMessage& encrypted_message,
                       google::protobuf::MessageLite* recovered_message) const;
 
  private:
   std::unique_ptr<crypto::HybridCipher> cipher_;
+  size_t max_decompressed_size_;
 };
 
 }  // namespace util
@@ -93,6 +93,81 @@ TEST(EncryptedMessageUtilTest, HybridEncryption) {
   EXPECT_FALSE(bad_decrypter.DecryptMessage(encrypted_message, &observation));
 }
 
+// Tests the use of the hybrid cipher with compression option.
+TEST(EncryptedMessageUtilTest, HybridEncryptionWithDeflate) {
+  std::string public_key;
+  std::string private_key;
+  EXPECT_TRUE(HybridCipher::GenerateKeyPairPEM(&public_key, &private_key));
+
+  // Make an Observation with many similar parts so that it compresses well.
+  Observation observation;
+  for (int i = 0; i < 100; i++) {
+    (*observation.mutable_parts())["part" + std::to_string(i)]
+        .mutable_basic_rappor()
+        ->set_data("\x01\x02\x03\x04");
+  }
+
+  EncryptedMessageMaker maker(public_key, EncryptedMessage::HYBRID_ECDH_V1);
+  EncryptedMessage encrypted_message;
+  ASSERT_TRUE(maker.Encrypt(observation, &encrypted_message));
+
+  EncryptedMessageMaker deflate_maker(public_key,
+                                      EncryptedMessage::HYBRID_ECDH_V1_DEFLATE);
+  EncryptedMessage compressed_message;
+  ASSERT_TRUE(deflate_maker.Encrypt(observation, &compressed_message));
+  EXPECT_EQ(EncryptedMessage::HYBRID_ECDH_V1_DEFLATE,
+            compressed_message.scheme());
+  EXPECT_EQ(32u, compressed_message.public_key_fingerprint().size());
+  EXPECT_LT(compressed_message.ciphertext().size(),
+            encrypted_message.ciphertext().size() / 2);
+
+  // Decrypt and check.
+  MessageDecrypter decrypter(private_key);
+  Observation recovered_observation;
+  ASSERT_TRUE(
+      decrypter.DecryptMessage(compressed_message, &recovered_observation));
+  EXPECT_EQ(100u, recovered_observation.parts().size());
+  EXPECT_EQ("\x01\x02\x03\x04",
+            recovered_observation.parts().at("part42").basic_rappor().data());
+
+  // A message whose scheme claims compression but which is not compressed
+  // fails to decrypt, but doesn't cause a crash.
+  encrypted_message.set_scheme(EncryptedMessage::HYBRID_ECDH_V1_DEFLATE);
+  EXPECT_FALSE(
+      decrypter.DecryptMessage(encrypted_message, &recovered_observation));
+}
+
+// Tests that a compressed message that decompresses to more than the
+// maximum size fails to decrypt.
+TEST(EncryptedMessageUtilTest, HybridEncryptionWithDeflateTooBig) {
+  std::string public_key;
+  std::string private_key;
+  EXPECT_TRUE(HybridCipher::GenerateKeyPairPEM(&public_key, &private_key));
+
+  // An Observation of more than 1 MB that compresses to a few KB.
+  Observation observation;
+  (*observation.mutable_parts())["part"].mutable_basic_rappor()->set_data(
+      std::string(1024 * 1024, '\0'));
+
+  EncryptedMessageMaker maker(public_key,
+                              EncryptedMessage::HYBRID_ECDH_V1_DEFLATE);
+  EncryptedMessage encrypted_message;
+  ASSERT_TRUE(maker.Encrypt(observation, &encrypted_message));
+  EXPECT_GT(16u * 1024, encrypted_message.ciphertext().size());
+
+  Observation recovered_observation;
+  MessageDecrypter small_decrypter(private_key, 1024 * 1024);
+  EXPECT_FALSE(small_decrypter.DecryptMessage(encrypted_message,
+                                              &recovered_observation));
+
+  MessageDecrypter decrypter(private_key);
+  ASSERT_TRUE(
+      decrypter.DecryptMessage(encrypted_message, &recovered_observation));
+  EXPECT_EQ(
+      1024u * 1024,
+      recovered_observation.parts().at("part").basic_rappor().data().size());
+}
+
 // Tests that using encryption incorrectly fails but doesn't cause any crashes.
 TEST(EncryptedMessageUtilTest, Crazy) {
   std::string public_key;